@@ -0,0 +1,615 @@
+/*
+  Expression Evaluator Library (NS-EEL) v2
+
+  asm-nseel-x64-sse2.c: scalar SSE2 operator/function templates for x86-64
+  (System V and Win64 calling conventions, gcc/clang syntax)
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+*/
+
+/*
+  These follow the same register contract as the x87 templates:
+    rax = pointer to the last result (and the last parameter)
+    rdi = first parameter of 2 parameter functions, second of 3 parameter functions
+    rcx = first parameter of 3 parameter functions
+    rsi = worktable pointer, advanced by 8 for each temporary result
+
+  Every template is a global label pair (nseel_asm_x, nseel_asm_x_end) at file
+  scope so there is no compiler prologue/epilogue to skip, and GLUE_realAddress()
+  can just use the distance between them. Immediates are filled in by
+  EEL_GLUE_set_immediate(), so each one must be a movabsq of all 1s.
+
+  rsp is kept 16 byte aligned inside generated code (win64_callcode sets it up,
+  GLUE_PUSH_EAX pushes twice, and sub-block calls are preceded by a sub $8).
+  Only xmm0-xmm2 are used, so nothing needs saving for Win64's xmm6-xmm15.
+  rsi (and rdi, where needed) is saved in r15 (r14) across calls to C code.
+*/
+
+#if EEL_F_SIZE != 8
+#error asm-nseel-x64-sse2.c only supports EEL_F_SIZE=8
+#endif
+
+#ifdef __APPLE__
+#define EEL_SSE2_SYM(x) "_" #x
+#else
+#define EEL_SSE2_SYM(x) #x
+#endif
+
+#define EEL_SSE2_FUNC(x) ".globl " EEL_SSE2_SYM(x) "\n" EEL_SSE2_SYM(x) ":\n"
+#define EEL_SSE2_IMM(reg) "movabsq $0xFFFFFFFFFFFFFFFF, %" reg "\n"
+
+// xmm0 = fabs(*reg), clobbers rdx
+#define EEL_SSE2_LOADABS(reg) \
+    "movq (%" reg "), %rdx\n" \
+    "btrq $63, %rdx\n" \
+    "movq %rdx, %xmm0\n"
+
+// compare xmm0 against [g_closefact], CF set if below (or unordered, like x87's C0)
+#define EEL_SSE2_CMP_CLOSEFACT \
+    EEL_SSE2_IMM("rdx") \
+    "ucomisd (%rdx), %xmm0\n"
+
+// store edx (0 or 1) as a double in the next temp, return it
+#define EEL_SSE2_RET_EDX_AS_DOUBLE \
+    "cvtsi2sdl %edx, %xmm0\n" \
+    "movsd %xmm0, (%rsi)\n" \
+    "movq %rsi, %rax\n" \
+    "addq $8, %rsi\n"
+
+#define EEL_SSE2_RET_XMM0 \
+    "movsd %xmm0, (%rsi)\n" \
+    "movq %rsi, %rax\n" \
+    "addq $8, %rsi\n"
+
+#define EEL_SSE2_CALL_C(reg) \
+    "subq $128, %rsp\n" \
+    "call *%" reg "\n" \
+    "addq $128, %rsp\n"
+
+__asm__(".text\n");
+
+//---------------------------------------------------------------------------------------------------------------
+// calls to C functions
+
+__asm__(
+  EEL_SSE2_FUNC(nseel_asm_1pdd)
+    "movsd (%rax), %xmm0\n"
+    "movq %rsi, %r15\n"
+    EEL_SSE2_IMM("rax")
+    EEL_SSE2_CALL_C("rax")
+    "movq %r15, %rsi\n"
+    EEL_SSE2_RET_XMM0
+  EEL_SSE2_FUNC(nseel_asm_1pdd_end)
+);
+
+__asm__(
+  EEL_SSE2_FUNC(nseel_asm_2pdd)
+    "movsd (%rdi), %xmm0\n"
+    "movsd (%rax), %xmm1\n"
+    "movq %rsi, %r15\n"
+    EEL_SSE2_IMM("rax")
+    EEL_SSE2_CALL_C("rax")
+    "movq %r15, %rsi\n"
+    EEL_SSE2_RET_XMM0
+  EEL_SSE2_FUNC(nseel_asm_2pdd_end)
+);
+
+__asm__(
+  EEL_SSE2_FUNC(nseel_asm_2pdds)
+    "movsd (%rdi), %xmm0\n"
+    "movsd (%rax), %xmm1\n"
+    "movq %rsi, %r15\n"
+    "movq %rdi, %r14\n"
+    EEL_SSE2_IMM("rax")
+    EEL_SSE2_CALL_C("rax")
+    "movq %r15, %rsi\n"
+    "movsd %xmm0, (%r14)\n"
+    "movq %r14, %rax\n"
+  EEL_SSE2_FUNC(nseel_asm_2pdds_end)
+);
+
+__asm__(
+  EEL_SSE2_FUNC(nseel_asm_2pp)
+    "movq %rsi, %r15\n"
+#ifdef _WIN64
+    "movq %rdi, %rcx\n"
+    "movq %rax, %rdx\n"
+#else
+    "movq %rax, %rsi\n"
+#endif
+    EEL_SSE2_IMM("rax")
+    EEL_SSE2_CALL_C("rax")
+    "movq %r15, %rsi\n"
+    EEL_SSE2_RET_XMM0
+  EEL_SSE2_FUNC(nseel_asm_2pp_end)
+);
+
+__asm__(
+  EEL_SSE2_FUNC(nseel_asm_1pp)
+    "movq %rsi, %r15\n"
+#ifdef _WIN64
+    "movq %rax, %rcx\n"
+#else
+    "movq %rax, %rdi\n"
+#endif
+    EEL_SSE2_IMM("rax")
+    EEL_SSE2_CALL_C("rax")
+    "movq %r15, %rsi\n"
+    EEL_SSE2_RET_XMM0
+  EEL_SSE2_FUNC(nseel_asm_1pp_end)
+);
+
+//---------------------------------------------------------------------------------------------------------------
+
+// do nothing, eh
+__asm__(
+  EEL_SSE2_FUNC(nseel_asm_exec2)
+  EEL_SSE2_FUNC(nseel_asm_exec2_end)
+  EEL_SSE2_FUNC(nseel_asm_uplus)
+  EEL_SSE2_FUNC(nseel_asm_uplus_end)
+);
+
+// x87 version's single-precision trick, with the same newton step
+__asm__(
+  EEL_SSE2_FUNC(nseel_asm_invsqrt)
+    "movsd (%rax), %xmm0\n"
+    "cvtsd2ss %xmm0, %xmm1\n"
+    "movd %xmm1, %edx\n"
+    "sarl $1, %edx\n"
+    "movl $0x5f3759df, %ecx\n"
+    "subl %edx, %ecx\n"
+    "movd %ecx, %xmm1\n"
+    "cvtss2sd %xmm1, %xmm1\n"
+    EEL_SSE2_IMM("rdx")
+    "mulsd (%rdx), %xmm0\n" // [negativezeropointfive]
+    "mulsd %xmm1, %xmm0\n"
+    "mulsd %xmm1, %xmm0\n"
+    EEL_SSE2_IMM("rdx")
+    "addsd (%rdx), %xmm0\n" // [onepointfive]
+    "mulsd %xmm1, %xmm0\n"
+    EEL_SSE2_RET_XMM0
+  EEL_SSE2_FUNC(nseel_asm_invsqrt_end)
+);
+
+__asm__(
+  EEL_SSE2_FUNC(nseel_asm_sqr)
+    "movsd (%rax), %xmm0\n"
+    "mulsd %xmm0, %xmm0\n"
+    EEL_SSE2_RET_XMM0
+  EEL_SSE2_FUNC(nseel_asm_sqr_end)
+);
+
+__asm__(
+  EEL_SSE2_FUNC(nseel_asm_sqrt)
+    EEL_SSE2_LOADABS("rax")
+    "sqrtsd %xmm0, %xmm0\n"
+    EEL_SSE2_RET_XMM0
+  EEL_SSE2_FUNC(nseel_asm_sqrt_end)
+);
+
+__asm__(
+  EEL_SSE2_FUNC(nseel_asm_abs)
+    "movq (%rax), %rdx\n"
+    "btrq $63, %rdx\n"
+    "movq %rsi, %rax\n"
+    "movq %rdx, (%rsi)\n"
+    "addq $8, %rsi\n"
+  EEL_SSE2_FUNC(nseel_asm_abs_end)
+);
+
+__asm__(
+  EEL_SSE2_FUNC(nseel_asm_uminus)
+    "movq (%rax), %rdx\n"
+    "btcq $63, %rdx\n"
+    "movq %rsi, %rax\n"
+    "movq %rdx, (%rsi)\n"
+    "addq $8, %rsi\n"
+  EEL_SSE2_FUNC(nseel_asm_uminus_end)
+);
+
+//---------------------------------------------------------------------------------------------------------------
+// denormals and inf/nan are stored as 0, same as the x87 version
+__asm__(
+  EEL_SSE2_FUNC(nseel_asm_assign)
+    "movq (%rax), %rcx\n"
+    "movq %rcx, %rdx\n"
+    "shrq $52, %rdx\n"
+    "andl $0x7ff, %edx\n"
+    "jz 1f\n"
+    "cmpl $0x7ff, %edx\n"
+    "jne 0f\n"
+    "1:\n"
+    "xorl %ecx, %ecx\n"
+    "0:\n"
+    "movq %rcx, (%rdi)\n"
+  EEL_SSE2_FUNC(nseel_asm_assign_end)
+);
+
+#define EEL_SSE2_BINOP(name, op) \
+__asm__( \
+  EEL_SSE2_FUNC(nseel_asm_##name) \
+    "movsd (%rdi), %xmm0\n" \
+    op " (%rax), %xmm0\n" \
+    EEL_SSE2_RET_XMM0 \
+  EEL_SSE2_FUNC(nseel_asm_##name##_end) \
+); \
+__asm__( \
+  EEL_SSE2_FUNC(nseel_asm_##name##_op) \
+    "movsd (%rdi), %xmm0\n" \
+    op " (%rax), %xmm0\n" \
+    "movsd %xmm0, (%rdi)\n" \
+    "movq %rdi, %rax\n" \
+  EEL_SSE2_FUNC(nseel_asm_##name##_op_end) \
+);
+
+EEL_SSE2_BINOP(add, "addsd")
+EEL_SSE2_BINOP(sub, "subsd")
+EEL_SSE2_BINOP(mul, "mulsd")
+EEL_SSE2_BINOP(div, "divsd")
+
+//---------------------------------------------------------------------------------------------------------------
+// (int)fabs(a) % (int)fabs(b), 0 if the divisor truncates to 0
+#define EEL_SSE2_MOD_BODY \
+    "movq (%rdi), %rdx\n" \
+    "btrq $63, %rdx\n" \
+    "movq %rdx, %xmm0\n" \
+    "movq (%rax), %rdx\n" \
+    "btrq $63, %rdx\n" \
+    "movq %rdx, %xmm1\n" \
+    "cvttsd2si %xmm0, %eax\n" \
+    "cvttsd2si %xmm1, %ecx\n" \
+    "xorl %edx, %edx\n" \
+    "testl %ecx, %ecx\n" \
+    "jz 0f\n" \
+    "divl %ecx\n" \
+    "0:\n" \
+    "cvtsi2sdl %edx, %xmm0\n"
+
+__asm__(
+  EEL_SSE2_FUNC(nseel_asm_mod)
+    EEL_SSE2_MOD_BODY
+    EEL_SSE2_RET_XMM0
+  EEL_SSE2_FUNC(nseel_asm_mod_end)
+);
+
+__asm__(
+  EEL_SSE2_FUNC(nseel_asm_mod_op)
+    EEL_SSE2_MOD_BODY
+    "movsd %xmm0, (%rdi)\n"
+    "movq %rdi, %rax\n"
+  EEL_SSE2_FUNC(nseel_asm_mod_op_end)
+);
+
+// 64 bit integer or/and, like fistpll
+#define EEL_SSE2_BITOP(name, op) \
+__asm__( \
+  EEL_SSE2_FUNC(nseel_asm_##name) \
+    "cvttsd2si (%rdi), %rcx\n" \
+    "cvttsd2si (%rax), %rdx\n" \
+    op " %rdx, %rcx\n" \
+    "cvtsi2sdq %rcx, %xmm0\n" \
+    EEL_SSE2_RET_XMM0 \
+  EEL_SSE2_FUNC(nseel_asm_##name##_end) \
+); \
+__asm__( \
+  EEL_SSE2_FUNC(nseel_asm_##name##_op) \
+    "cvttsd2si (%rdi), %rcx\n" \
+    "cvttsd2si (%rax), %rdx\n" \
+    op " %rdx, %rcx\n" \
+    "cvtsi2sdq %rcx, %xmm0\n" \
+    "movsd %xmm0, (%rdi)\n" \
+    "movq %rdi, %rax\n" \
+  EEL_SSE2_FUNC(nseel_asm_##name##_op_end) \
+);
+
+EEL_SSE2_BITOP(or, "orq")
+EEL_SSE2_BITOP(and, "andq")
+
+//---------------------------------------------------------------------------------------------------------------
+// returns one of g_signs[], or the parameter itself if it is +/-0
+__asm__(
+  EEL_SSE2_FUNC(nseel_asm_sign)
+    EEL_SSE2_IMM("rdi")
+    "movq (%rax), %rcx\n"
+    "movq %rcx, %rdx\n"
+    "addq %rdx, %rdx\n" // drop the sign bit
+    "jz 1f\n"
+    "shrq $63, %rcx\n"
+    "movq (%rdi,%rcx,8), %rdx\n"
+    "movq %rsi, %rax\n"
+    "movq %rdx, (%rsi)\n"
+    "addq $8, %rsi\n"
+    "1:\n"
+  EEL_SSE2_FUNC(nseel_asm_sign_end)
+);
+
+__asm__(
+  EEL_SSE2_FUNC(nseel_asm_bnot)
+    EEL_SSE2_LOADABS("rax")
+    EEL_SSE2_CMP_CLOSEFACT
+    "setb %dl\n"
+    "movzbl %dl, %edx\n"
+    EEL_SSE2_RET_EDX_AS_DOUBLE
+  EEL_SSE2_FUNC(nseel_asm_bnot_end)
+);
+
+//---------------------------------------------------------------------------------------------------------------
+// control flow: the branches are separate blocks ending in a ret
+
+__asm__(
+  EEL_SSE2_FUNC(nseel_asm_if)
+    EEL_SSE2_LOADABS("rax")
+    EEL_SSE2_CMP_CLOSEFACT
+    EEL_SSE2_IMM("rax") // true block
+    EEL_SSE2_IMM("rdx") // false block
+    "cmovbq %rdx, %rax\n"
+    "subq $8, %rsp\n"
+    "call *%rax\n"
+    "addq $8, %rsp\n"
+  EEL_SSE2_FUNC(nseel_asm_if_end)
+);
+
+__asm__(
+  EEL_SSE2_FUNC(nseel_asm_repeat)
+    "cvttsd2si (%rax), %ecx\n"
+    "cmpl $1, %ecx\n"
+    "jl 1f\n"
+    "cmpl $" NSEEL_LOOPFUNC_SUPPORT_MAXLEN_STR ", %ecx\n"
+    "jl 0f\n"
+    "movl $" NSEEL_LOOPFUNC_SUPPORT_MAXLEN_STR ", %ecx\n"
+    "0:\n"
+      EEL_SSE2_IMM("rdx")
+      "subq $8, %rsp\n"
+      "pushq %rsi\n" // revert back to last temp workspace
+      "pushq %rcx\n"
+      "call *%rdx\n"
+      "popq %rcx\n"
+      "popq %rsi\n"
+      "addq $8, %rsp\n"
+    "decl %ecx\n"
+    "jnz 0b\n"
+    "1:\n"
+  EEL_SSE2_FUNC(nseel_asm_repeat_end)
+);
+
+__asm__(
+  EEL_SSE2_FUNC(nseel_asm_repeatwhile)
+    "movl $" NSEEL_LOOPFUNC_SUPPORT_MAXLEN_STR ", %ecx\n"
+    "0:\n"
+      EEL_SSE2_IMM("rdx")
+      "subq $8, %rsp\n"
+      "pushq %rsi\n" // revert back to last temp workspace
+      "pushq %rcx\n"
+      "call *%rdx\n"
+      "popq %rcx\n"
+      "popq %rsi\n"
+      "addq $8, %rsp\n"
+      EEL_SSE2_LOADABS("rax")
+      EEL_SSE2_CMP_CLOSEFACT
+      "jb 1f\n"
+    "decl %ecx\n"
+    "jnz 0b\n"
+    "1:\n"
+    "movq %rsi, %rax\n"
+  EEL_SSE2_FUNC(nseel_asm_repeatwhile_end)
+);
+
+__asm__(
+  EEL_SSE2_FUNC(nseel_asm_band)
+    EEL_SSE2_LOADABS("rax")
+    EEL_SSE2_CMP_CLOSEFACT
+    "jb 0f\n"
+      EEL_SSE2_IMM("rcx")
+      "subq $8, %rsp\n"
+      "call *%rcx\n"
+      "addq $8, %rsp\n"
+      EEL_SSE2_LOADABS("rax")
+      EEL_SSE2_CMP_CLOSEFACT
+      "jb 0f\n"
+    "movl $1, %edx\n"
+    "jmp 1f\n"
+    "0:\n"
+    "xorl %edx, %edx\n"
+    "1:\n"
+    EEL_SSE2_RET_EDX_AS_DOUBLE
+  EEL_SSE2_FUNC(nseel_asm_band_end)
+);
+
+__asm__(
+  EEL_SSE2_FUNC(nseel_asm_bor)
+    EEL_SSE2_LOADABS("rax")
+    EEL_SSE2_CMP_CLOSEFACT
+    "jae 0f\n"
+      EEL_SSE2_IMM("rcx")
+      "subq $8, %rsp\n"
+      "call *%rcx\n"
+      "addq $8, %rsp\n"
+      EEL_SSE2_LOADABS("rax")
+      EEL_SSE2_CMP_CLOSEFACT
+      "jae 0f\n"
+    "xorl %edx, %edx\n"
+    "jmp 1f\n"
+    "0:\n"
+    "movl $1, %edx\n"
+    "1:\n"
+    EEL_SSE2_RET_EDX_AS_DOUBLE
+  EEL_SSE2_FUNC(nseel_asm_bor_end)
+);
+
+//---------------------------------------------------------------------------------------------------------------
+// comparisons. unordered compares come out the same as the x87 C0 tests
+
+__asm__(
+  EEL_SSE2_FUNC(nseel_asm_equal)
+    "movsd (%rax), %xmm0\n"
+    "subsd (%rdi), %xmm0\n"
+    "movq %xmm0, %rdx\n"
+    "btrq $63, %rdx\n"
+    "movq %rdx, %xmm0\n"
+    EEL_SSE2_CMP_CLOSEFACT
+    "setb %dl\n"
+    "movzbl %dl, %edx\n"
+    EEL_SSE2_RET_EDX_AS_DOUBLE
+  EEL_SSE2_FUNC(nseel_asm_equal_end)
+);
+
+__asm__(
+  EEL_SSE2_FUNC(nseel_asm_notequal)
+    "movsd (%rax), %xmm0\n"
+    "subsd (%rdi), %xmm0\n"
+    "movq %xmm0, %rdx\n"
+    "btrq $63, %rdx\n"
+    "movq %rdx, %xmm0\n"
+    EEL_SSE2_CMP_CLOSEFACT
+    "setae %dl\n"
+    "movzbl %dl, %edx\n"
+    EEL_SSE2_RET_EDX_AS_DOUBLE
+  EEL_SSE2_FUNC(nseel_asm_notequal_end)
+);
+
+#define EEL_SSE2_CMPOP(name, lhs, rhs, setcc) \
+__asm__( \
+  EEL_SSE2_FUNC(nseel_asm_##name) \
+    "movsd (%" lhs "), %xmm0\n" \
+    "ucomisd (%" rhs "), %xmm0\n" \
+    setcc " %dl\n" \
+    "movzbl %dl, %edx\n" \
+    EEL_SSE2_RET_EDX_AS_DOUBLE \
+  EEL_SSE2_FUNC(nseel_asm_##name##_end) \
+);
+
+EEL_SSE2_CMPOP(below, "rdi", "rax", "setb")
+EEL_SSE2_CMPOP(beloweq, "rax", "rdi", "setae")
+EEL_SSE2_CMPOP(above, "rax", "rdi", "setb")
+EEL_SSE2_CMPOP(aboveeq, "rdi", "rax", "setae")
+
+__asm__(
+  EEL_SSE2_FUNC(nseel_asm_min)
+    "movsd (%rdi), %xmm0\n"
+    "ucomisd (%rax), %xmm0\n"
+    "cmovbq %rdi, %rax\n"
+  EEL_SSE2_FUNC(nseel_asm_min_end)
+);
+
+__asm__(
+  EEL_SSE2_FUNC(nseel_asm_max)
+    "movsd (%rdi), %xmm0\n"
+    "ucomisd (%rax), %xmm0\n"
+    "cmovaeq %rdi, %rax\n"
+  EEL_SSE2_FUNC(nseel_asm_max_end)
+);
+
+
+//---------------------------------------------------------------------------------------------------------------
+// just generic functions left, yay. first immediate is the context, second the function
+
+#ifdef _WIN64
+  #define EEL_SSE2_GENERIC_ARGS1 "movq %rax, %rdx\n"  EEL_SSE2_IMM("rcx")
+  #define EEL_SSE2_GENERIC_ARGS2 "movq %rdi, %rdx\n" "movq %rax, %r8\n" EEL_SSE2_IMM("rcx")
+  #define EEL_SSE2_GENERIC_ARGS3 "movq %rcx, %rdx\n" "movq %rdi, %r8\n" "movq %rax, %r9\n" EEL_SSE2_IMM("rcx")
+#else
+  #define EEL_SSE2_GENERIC_ARGS1 "movq %rax, %rsi\n" EEL_SSE2_IMM("rdi")
+  #define EEL_SSE2_GENERIC_ARGS2 "movq %rdi, %rsi\n" "movq %rax, %rdx\n" EEL_SSE2_IMM("rdi")
+  #define EEL_SSE2_GENERIC_ARGS3 "movq %rcx, %rsi\n" "movq %rdi, %rdx\n" "movq %rax, %rcx\n" EEL_SSE2_IMM("rdi")
+#endif
+
+#define EEL_SSE2_GENERIC(name, args) \
+__asm__( \
+  EEL_SSE2_FUNC(_asm_##name) \
+    "movq %rsi, %r15\n" \
+    args \
+    EEL_SSE2_IMM("rax") \
+    EEL_SSE2_CALL_C("rax") \
+    "movq %r15, %rsi\n" \
+  EEL_SSE2_FUNC(_asm_##name##_end) \
+); \
+__asm__( \
+  EEL_SSE2_FUNC(_asm_##name##_retd) \
+    "movq %rsi, %r15\n" \
+    args \
+    EEL_SSE2_IMM("rax") \
+    EEL_SSE2_CALL_C("rax") \
+    "movq %r15, %rsi\n" \
+    EEL_SSE2_RET_XMM0 \
+  EEL_SSE2_FUNC(_asm_##name##_retd_end) \
+);
+
+EEL_SSE2_GENERIC(generic1parm, EEL_SSE2_GENERIC_ARGS1)
+EEL_SSE2_GENERIC(generic2parm, EEL_SSE2_GENERIC_ARGS2)
+EEL_SSE2_GENERIC(generic3parm, EEL_SSE2_GENERIC_ARGS3)
+
+
+// this gets its own stub because it's pretty crucial for performance :/
+__asm__(
+  EEL_SSE2_FUNC(_asm_megabuf)
+    "movq %rsi, %r15\n"
+    "movsd (%rax), %xmm0\n"
+#ifdef _WIN64
+    EEL_SSE2_IMM("rcx") // first parameter = context pointer
+    EEL_SSE2_IMM("rdx")
+    "addsd (%rdx), %xmm0\n" // [g_closefact]
+    "cvttsd2si %xmm0, %edx\n"
+#else
+    EEL_SSE2_IMM("rdi") // first parameter = context pointer
+    EEL_SSE2_IMM("rdx")
+    "addsd (%rdx), %xmm0\n" // [g_closefact]
+    "cvttsd2si %xmm0, %esi\n"
+#endif
+    EEL_SSE2_IMM("rax")
+    EEL_SSE2_CALL_C("rax")
+    "movq %r15, %rsi\n"
+    "testq %rax, %rax\n"
+    "jnz 0f\n"
+    "movq %rsi, %rax\n"
+    "movq $0, (%rsi)\n"
+    "addq $8, %rsi\n"
+    "0:\n"
+  EEL_SSE2_FUNC(_asm_megabuf_end)
+);
+
+
+//---------------------------------------------------------------------------------------------------------------
+// entry point from GLUE_CALL_CODE. pushes an even number of registers so that
+// rsp is 16 byte aligned once the generated code is running.
+__asm__(
+  EEL_SSE2_FUNC(win64_callcode)
+    "pushq %rbx\n"
+    "pushq %rbp\n"
+#ifdef _WIN64
+    "pushq %rdi\n"
+    "pushq %rsi\n"
+    "movq %rcx, %rax\n"
+#else
+    "movq %rdi, %rax\n"
+#endif
+    "pushq %r12\n"
+    "pushq %r13\n"
+    "pushq %r14\n"
+    "pushq %r15\n"
+    "call *%rax\n"
+    "popq %r15\n"
+    "popq %r14\n"
+    "popq %r13\n"
+    "popq %r12\n"
+#ifdef _WIN64
+    "popq %rsi\n"
+    "popq %rdi\n"
+#endif
+    "popq %rbp\n"
+    "popq %rbx\n"
+    "ret\n"
+);
@@ -26,8 +26,27 @@
 
 #ifdef _WIN32
 #include <windows.h>
-#else
+#elif defined(EEL_USE_WDLTYPES)
 #include "../wdltypes.h"
+#else
+// minimal stand-ins for the WDL types, so the evaluator builds on its own
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+typedef intptr_t INT_PTR;
+#ifndef ARRAYSIZE
+#define ARRAYSIZE(x) (sizeof(x)/sizeof((x)[0]))
+#endif
+#define _snprintf snprintf
+#define _strdup strdup
+#endif
+
+// x86-64 gcc/clang builds get the scalar SSE2 templates (asm-nseel-x64-sse2.c),
+// which support both the System V and Win64 calling conventions.
+// define EEL_NO_X64_SSE2 to fall back to whatever the platform provided before.
+#if !defined(EEL_TARGET_X64_SSE2) && !defined(EEL_NO_X64_SSE2) && \
+    defined(__GNUC__) && (defined(__x86_64__) || defined(__amd64__))
+#define EEL_TARGET_X64_SSE2
 #endif
 
 #include "ns-eel.h"
@@ -55,6 +74,24 @@ extern "C" {
 
 #define NSEEL_CLOSEFACTOR 0.00001
 
+#define OPCODETYPE_DIRECTVALUE 0
+#define OPCODETYPE_VARPTR      1
+#define OPCODETYPE_FUNC1       2
+#define OPCODETYPE_FUNC2       3
+#define OPCODETYPE_FUNC3       4
+
+// parse tree node, built by the nseel_createCompiled*() calls from the parser
+typedef struct _opcodeRec opcodeRec;
+struct _opcodeRec
+{
+  int opcodeType; // OPCODETYPE_*
+  int fntype;     // MATH_SIMPLE or MATH_FN (FUNCx only)
+  INT_PTR fn;     // FN_* or function table index (FUNCx only)
+  EEL_F directValue;
+  EEL_F *valuePtr; // OPCODETYPE_VARPTR
+  opcodeRec *parms[3];
+};
+
 typedef struct
 {
 	int srcByteCount;
@@ -100,6 +137,16 @@ typedef struct _compileContext
   void *gram_blocks;
 
   void *caller_this;
+
+  int interpreted; // NSEEL_VM_SetInterpreted()
+  int unoptimized; // NSEEL_VM_SetOptimize()
+  void *interp_state; // nseel-interp.c, only valid during compilation
+
+  EEL_F **uniformVars; // NSEEL_VM_SetUniformVars()
+  int uniformVars_size;
+
+  EEL_F **batchVars; // NSEEL_VM_SetBatchVars()
+  int batchVars_size;
 }
 compileContext;
 
@@ -116,6 +163,21 @@ typedef struct {
 
 
 extern functionType *nseel_getFunctionFromTable(int idx);
+void *nseel_getPProcValue(compileContext *ctx, NSEEL_PPPROC pProc);
+
+// nseel-interp.c: bytecode backend (no executable memory needed)
+int nseel_interp_compileStatement(compileContext *ctx, opcodeRec *op); // returns 0 on failure
+int nseel_interp_finish(compileContext *ctx, void *buf); // buf=NULL returns the size needed, otherwise writes code to buf
+void nseel_interp_free(compileContext *ctx);
+void nseel_interp_execute(void *code, EEL_F *workTable);
+int nseel_interp_evalConstant(compileContext *ctx, opcodeRec *op, EEL_F *out); // returns 0 on failure
+
+// nseel-interp.c: batched execution, see NSEEL_code_execute_batch()
+void *nseel_batch_compile(compileContext *ctx, opcodeRec **statements, int nstatements); // returns NULL if the code can't be batched
+int nseel_batch_finish(void *state, void *buf); // like nseel_interp_finish(), frees state when writing
+void nseel_batch_free(void *state);
+int nseel_batch_clone(const void *code, void *buf); // buf=NULL returns the size needed
+void nseel_batch_execute(void *code, EEL_F **data, int nitems);
 
 INT_PTR nseel_createCompiledValue(compileContext *ctx, EEL_F value, EEL_F *addrValue);
 INT_PTR nseel_createCompiledFunction1(compileContext *ctx, int fntype, INT_PTR fn, INT_PTR code);
@@ -192,9 +254,9 @@ EEL_F * NSEEL_CGEN_CALL __NSEEL_RAM_MemCpy(EEL_F ***blocks,EEL_F *dest, EEL_F *s
 
   #define EEL_F2int(x) ((int)(x))
 
-#elif defined (_WIN64)
+#elif defined (_WIN64) || defined(EEL_TARGET_X64_SSE2)
 
-  // todo: AMD64 version?
+  // SSE2 truncates (cvttsd2si), matching the _RC_CHOP x87 code
   #define EEL_F2int(x) ((int)(x))
 
 #elif defined(_MSC_VER)
@@ -70,7 +70,8 @@ void NSEEL_addfunctionex2(const char *name, int nparms, char *code_startaddr, in
 
 void NSEEL_quit();
 
-int *NSEEL_getstats(); // returns a pointer to 5 ints... source bytes, static code bytes, call code bytes, data bytes, number of code handles
+int *NSEEL_getstats(); // returns a pointer to 9 ints... source bytes, static code bytes, call code bytes, data bytes, number of code handles,
+                       // compile-time arena bytes and blocks used by the last compile, memory blocks allocated so far, free blocks pooled
 EEL_F *NSEEL_getglobalregs();
 
 typedef void *NSEEL_VMCTX;
@@ -98,6 +99,25 @@ void NSEEL_VM_SetGRAM(NSEEL_VMCTX ctx, void **gram);
 void NSEEL_VM_FreeGRAM(void **ufd); // frees a gmem context.
 void NSEEL_VM_SetCustomFuncThis(NSEEL_VMCTX ctx, void *thisptr);
 
+// if nonzero, code compiled with this VM runs on the bytecode interpreter rather than as native code.
+// slower, but does not need writable+executable memory. must be set before compilation.
+void NSEEL_VM_SetInterpreted(NSEEL_VMCTX ctx, int interpreted);
+
+// if zero, code compiled with this VM is generated as parsed: no constant folding, dead store removal or
+// hoisting of uniform subexpressions (the prologue is empty). for checking the optimizer against. default 1.
+void NSEEL_VM_SetOptimize(NSEEL_VMCTX ctx, int optimize);
+
+// declares variables that the host only changes between batches of executions (i.e. once per frame).
+// subexpressions that depend only on these (if the code never writes them) are moved to a prologue,
+// which NSEEL_code_execute_prologue() runs. must be set before compilation, cleared by NSEEL_VM_resetvars().
+void NSEEL_VM_SetUniformVars(NSEEL_VMCTX ctx, EEL_F **vars, int nvars);
+
+// declares variables that the host sets before each execution and reads back after it. code that only
+// depends on these (and variables it doesn't write, or assigns before reading) can also be compiled for
+// NSEEL_code_execute_batch(), which runs many executions at once. must be set before compilation,
+// cleared by NSEEL_VM_resetvars().
+void NSEEL_VM_SetBatchVars(NSEEL_VMCTX ctx, EEL_F **vars, int nvars);
+
 
   // note that you shouldnt pass a C string directly, since it may need to 
   // fudge with the string during the compilation (it will always restore it to the 
@@ -110,8 +130,30 @@ NSEEL_CODEHANDLE NSEEL_code_compile(NSEEL_VMCTX _ctx, char *_expression, int lin
 
 char *NSEEL_code_getcodeerror(NSEEL_VMCTX ctx);
 void NSEEL_code_execute(NSEEL_CODEHANDLE code);
+void NSEEL_code_execute_prologue(NSEEL_CODEHANDLE code); // call after changing uniform vars, before NSEEL_code_execute()
+// runs code nitems times, batch var k of item i being data[k][i] (in and out). other variables the code
+// writes are left as the last item set them. returns 0 (doing nothing) if the code can't be batched.
+int NSEEL_code_execute_batch(NSEEL_CODEHANDLE code, EEL_F **data, int nitems);
+// copy of the batch code of code (NULL if it can't be batched), with its own working storage, so that
+// another thread can call NSEEL_code_execute_batch() on it while code runs. it shares code's variables,
+// but leaves all of them except the batch vars alone, so code itself should run the last items.
+// free with NSEEL_code_free(), before code's VM.
+NSEEL_CODEHANDLE NSEEL_code_clone_batch(NSEEL_CODEHANDLE code);
+// bit k is set if the batch code might read the incoming value of batch var k (bit 31: of any var past
+// the 31st). 0 means every item of a batch gets the same results, if the batch vars it does read start
+// out the same. -1 if the code can't be batched.
+int NSEEL_code_getbatchreads(NSEEL_CODEHANDLE code);
 void NSEEL_code_free(NSEEL_CODEHANDLE code);
 int *NSEEL_code_getstats(NSEEL_CODEHANDLE code); // 4 ints...source bytes, static code bytes, call code bytes, data bytes
+
+// profiling: while NSEEL_PROFILE_enabled is nonzero, every execution of every code handle is timed.
+extern int NSEEL_PROFILE_enabled;
+void NSEEL_code_setlabel(NSEEL_CODEHANDLE code, const char *label); // names code in NSEEL_profile_dump()
+int NSEEL_code_getprofile(NSEEL_CODEHANDLE code, double *stats); // 3 doubles... executions, total seconds, worst seconds (of one call)
+void NSEEL_profile_reset(); // clears the counts of all code handles
+// writes a line per code handle that has run, most total time first, to buf (up to maxitems lines, <=0 for all).
+// returns the length written
+int NSEEL_profile_dump(char *buf, int buf_size, int maxitems);
   
 
 // global memory control/view
@@ -132,6 +174,11 @@ extern int NSEEL_RAM_memused_errors;
 // but in theory you might be able to come up with an expression big enough? maybe?
 
 
+// number of recently compiled pieces of code whose parse trees NSEEL_code_compile() keeps, so that
+// compiling the same code again in a VM with the same variables skips the parser. 0 disables this.
+#define NSEEL_PARSECACHE_ENTRIES 64
+
+
 // maximum loop length
 #define NSEEL_LOOPFUNC_SUPPORT_MAXLEN 1048576 // scary, we can do a million entries. probably will never want to, though.
 #define NSEEL_LOOPFUNC_SUPPORT_MAXLEN_STR "1048576"
@@ -0,0 +1,571 @@
+/*
+  Expression Evaluator Library (NS-EEL) v2
+
+  nseel-bench.c: standalone benchmark, differential tester and fuzz target for the evaluator
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+*/
+
+/*
+  Pulls the code out of a directory of Milkdrop presets (per_frame_, per_pixel_,
+  wave_N_per_frame/per_point and shape_N_per_frame, each with its init code), runs
+  each program over synthetic inputs the way the plugin does (once per frame, once
+  per mesh vertex or once per wave point), and compares what the native code, the
+  bytecode interpreter and, for per-pixel code, batched execution compute with what
+  a reference run computes: native code compiled without the optimizer (constant
+  folding, dead store removal and uniform hoisting), which all of the others share.
+  Any difference in the values the code leaves behind is reported, along with the
+  time each backend took. Per-pixel code that NSEEL_code_getbatchreads() says doesn't read
+  x, y, rad or ang must also give every vertex of a row the same results.
+
+  It only needs ns-eel2, e.g. on x86-64 Linux:
+
+    gcc -O2 -o nseel-bench nseel-bench.c nseel-caltab.c nseel-cfunc.c nseel-compiler.c \
+        nseel-eval.c nseel-lextab.c nseel-ram.c nseel-yylex.c nseel-interp.c -lm
+
+    nseel-bench [-v] [-frames N] <preset dir or .milk file>...
+    nseel-bench -fuzz <file>...       runs files through the fuzz target (AFL, or reproducing a crash)
+
+  Built with -DNSEEL_FUZZ (and e.g. clang -fsanitize=fuzzer,address) it is instead a
+  libFuzzer target: each input is compiled as code by both backends and by the reference,
+  which must agree on whether it compiles, and unless it can loop or uses rand(), run and
+  compared.
+*/
+
+#ifdef _WIN32
+#error nseel-bench.c is for Linux/POSIX builds
+#endif
+
+#include "ns-eel.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <time.h>
+#include <math.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+void NSEEL_HOSTSTUB_EnterMutex() { }
+void NSEEL_HOSTSTUB_LeaveMutex() { }
+
+//------------------------------------------------------------------------------
+// inputs: registered (in this order) in every VM, so all of them have the same
+// layout, and set from the frame number before each frame
+
+static const char *g_inputs[] = {
+  // per-frame and per-vertex
+  "zoom", "zoomexp", "rot", "warp", "cx", "cy", "dx", "dy", "sx", "sy",
+  "time", "fps", "frame", "progress", "bass", "mid", "treb", "bass_att", "mid_att", "treb_att",
+  "meshx", "meshy", "pixelsx", "pixelsy", "aspectx", "aspecty",
+  "q1", "q2", "q3", "q4", "q5", "q6", "q7", "q8", "q9", "q10", "q11", "q12", "q13", "q14", "q15", "q16",
+  "q17", "q18", "q19", "q20", "q21", "q22", "q23", "q24", "q25", "q26", "q27", "q28", "q29", "q30", "q31", "q32",
+  // per-vertex only
+  "x", "y", "rad", "ang",
+  // waves and shapes
+  "sample", "value1", "value2", "r", "g", "b", "a", "r2", "g2", "b2", "a2",
+  "t1", "t2", "t3", "t4", "t5", "t6", "t7", "t8",
+  "sides", "thick", "additive", "textured", "tex_zoom", "tex_ang", "border_r", "border_g", "border_b", "border_a",
+};
+#define NUM_INPUTS (int)(sizeof(g_inputs)/sizeof(g_inputs[0]))
+#define NUM_UNIFORMS 58 // zoom..q32, see RecompileExpressions() in state.cpp
+#define IN_X 58
+
+// the per-vertex vars (see NSEEL_VM_SetBatchVars() in state.cpp): x, y, rad, ang, then zoom..sy
+static const int g_pixelvars[14] = { IN_X, IN_X+1, IN_X+2, IN_X+3, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9 };
+
+#define MESH_X 48
+#define MESH_Y 36
+#define WAVE_POINTS 512
+
+enum { KIND_FRAME, KIND_PIXEL, KIND_POINT };
+enum { MODE_REFERENCE, MODE_NATIVE, MODE_INTERP, MODE_BATCH, NUM_MODES };
+static const char *g_modenames[NUM_MODES] = { "reference", "native", "interpreted", "batched" };
+
+typedef struct
+{
+  NSEEL_VMCTX vm;
+  void *gram;
+  NSEEL_CODEHANDLE code;
+  EEL_F *in[NUM_INPUTS];
+  unsigned int hash;
+} benchVM;
+
+static int g_init, g_verbose, g_frames=100;
+static double g_time[NUM_MODES], g_batchtime[NUM_MODES]; // all programs, the ones that could be batched
+static int g_programs, g_runs[NUM_MODES], g_mismatches, g_nocompile, g_nointerp, g_random, g_uniform;
+
+// rand() shares one generator between all VMs, so code that uses it can't be compared between them
+static int isRandom(const char *code)
+{
+  for (; *code; code ++) if (!strncasecmp(code,"rand",4)) return 1;
+  return 0;
+}
+
+static double timeNow()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC,&ts);
+  return (double)ts.tv_sec + ts.tv_nsec*0.000000001;
+}
+
+static unsigned int hashValue(unsigned int h, EEL_F v)
+{
+  unsigned char *p=(unsigned char *)&v;
+  int x;
+  if (v != v) v=(EEL_F)NAN; // all NaNs are the same NaN
+  for (x = 0; x < (int)sizeof(v); x ++) h = (h ^ p[x]) * 16777619;
+  return h;
+}
+
+static int hashVar(const char *name, EEL_F *val, void *ctx)
+{
+  unsigned int *h=(unsigned int *)ctx;
+  while (*name) *h = (*h ^ (unsigned char)*name++) * 16777619;
+  *h = hashValue(*h,*val);
+  return 1;
+}
+
+//------------------------------------------------------------------------------
+static int vmCompile(benchVM *b, int mode, int kind, const char *init, const char *code)
+{
+  char *buf;
+  int x;
+  memset(b,0,sizeof(benchVM));
+  b->hash=2166136261u;
+  memset(NSEEL_getglobalregs(),0,100*sizeof(EEL_F));
+
+  b->vm=NSEEL_VM_alloc();
+  if (!b->vm) return 0;
+  NSEEL_VM_SetInterpreted(b->vm,mode == MODE_INTERP);
+  NSEEL_VM_SetOptimize(b->vm,mode != MODE_REFERENCE);
+  NSEEL_VM_SetGRAM(b->vm,&b->gram);
+  for (x = 0; x < NUM_INPUTS; x ++) b->in[x]=NSEEL_VM_regvar(b->vm,g_inputs[x]);
+  if (kind == KIND_PIXEL)
+  {
+    EEL_F *batch[14];
+    for (x = 0; x < 14; x ++) batch[x]=b->in[g_pixelvars[x]];
+    NSEEL_VM_SetUniformVars(b->vm,b->in,NUM_UNIFORMS);
+    NSEEL_VM_SetBatchVars(b->vm,batch,14);
+  }
+
+  if (init && *init)
+  {
+    NSEEL_CODEHANDLE h;
+    buf=strdup(init);
+    if ((h=NSEEL_code_compile(b->vm,buf,0)))
+    {
+      NSEEL_code_execute(h);
+      NSEEL_code_free(h);
+    }
+    free(buf);
+  }
+
+  buf=strdup(code);
+  b->code=NSEEL_code_compile(b->vm,buf,0);
+  free(buf);
+  return b->code != NULL;
+}
+
+static void vmFree(benchVM *b)
+{
+  if (b->code) NSEEL_code_free(b->code);
+  if (b->vm) NSEEL_VM_free(b->vm);
+  NSEEL_VM_FreeGRAM(&b->gram);
+  b->code=NULL;
+  b->vm=NULL;
+}
+
+static void setFrameInputs(benchVM *b, int frame)
+{
+  double t=frame/60.0;
+  int x;
+  *b->in[0]=1.0; *b->in[1]=1.0; *b->in[2]=0.0; *b->in[3]=1.0; *b->in[4]=0.5; *b->in[5]=0.5; // zoom..cy
+  *b->in[6]=0.0; *b->in[7]=0.0; *b->in[8]=1.0; *b->in[9]=1.0; // dx..sy
+  *b->in[10]=t; *b->in[11]=60.0; *b->in[12]=frame; *b->in[13]=fmod(t/16.0,1.0);
+  *b->in[14]=1.0+0.6*sin(t*7.1); *b->in[15]=1.0+0.5*sin(t*5.3+1.0); *b->in[16]=1.0+0.4*sin(t*9.7+2.0);
+  *b->in[17]=1.0+0.3*sin(t*3.1); *b->in[18]=1.0+0.3*sin(t*2.3+1.0); *b->in[19]=1.0+0.2*sin(t*4.7+2.0);
+  *b->in[20]=MESH_X; *b->in[21]=MESH_Y; *b->in[22]=1024; *b->in[23]=768; *b->in[24]=1.0; *b->in[25]=0.75;
+  for (x = 26; x < NUM_UNIFORMS; x ++) *b->in[x]=sin(t*(x-25)*0.37);
+}
+
+static void setVertex(EEL_F **v, int i, int j)
+{
+  double x=i/(double)MESH_X, y=j/(double)MESH_Y, dx=(x-0.5)*2.0, dy=(y-0.5)*2.0*0.75;
+  *v[0]=x; *v[1]=y; *v[2]=sqrt(dx*dx+dy*dy)*0.8; *v[3]=atan2(dy,dx);
+}
+
+// runs one program for g_frames frames, hashing the values it leaves in its outputs. for per-pixel
+// code only running the code is timed (for the backends that run a vertex at a time, that includes
+// moving its values in and out of the variables, like the plugin does), not setting up the mesh.
+static double vmRun(benchVM *b, int kind, int mode)
+{
+  double t0=timeNow(), t=0.0, tpixel=0.0;
+  int f, i, j, x;
+  for (f = 0; f < g_frames; f ++)
+  {
+    setFrameInputs(b,f);
+    if (kind == KIND_FRAME)
+    {
+      NSEEL_code_execute(b->code);
+      for (x = 0; x < NUM_INPUTS; x ++) b->hash=hashValue(b->hash,*b->in[x]);
+    }
+    else if (kind == KIND_POINT)
+    {
+      for (i = 0; i < WAVE_POINTS; i ++)
+      {
+        *b->in[IN_X+4]=i/(double)(WAVE_POINTS-1);
+        *b->in[IN_X+5]=sin(i*0.05+f*0.1);
+        *b->in[IN_X+6]=cos(i*0.07+f*0.1);
+        *b->in[IN_X]=0.5; *b->in[IN_X+1]=0.5;
+        NSEEL_code_execute(b->code);
+        for (x = 0; x < 2; x ++) b->hash=hashValue(b->hash,*b->in[IN_X+x]);
+        for (x = 7; x < 11; x ++) b->hash=hashValue(b->hash,*b->in[IN_X+x]);
+      }
+    }
+    else
+    {
+      EEL_F frameval[10], rows[14][MESH_X+1], *data[14], *v[14];
+      for (x = 0; x < 14; x ++)
+      {
+        v[x]=b->in[g_pixelvars[x]];
+        data[x]=rows[x];
+      }
+      for (x = 0; x < 10; x ++) frameval[x]=*v[4+x];
+      NSEEL_code_execute_prologue(b->code);
+      for (j = 0; j <= MESH_Y; j ++)
+      {
+        double trow;
+        for (i = 0; i <= MESH_X; i ++)
+        {
+          setVertex(v,i,j);
+          for (x = 0; x < 4; x ++) rows[x][i]=*v[x];
+          for (x = 0; x < 10; x ++) rows[4+x][i]=frameval[x];
+        }
+
+        trow=timeNow();
+        if (mode == MODE_BATCH)
+          NSEEL_code_execute_batch(b->code,data,MESH_X+1);
+        else
+        {
+          for (i = 0; i <= MESH_X; i ++)
+          {
+            for (x = 0; x < 14; x ++) *v[x]=rows[x][i];
+            NSEEL_code_execute(b->code);
+            for (x = 0; x < 14; x ++) rows[x][i]=*v[x];
+          }
+        }
+        tpixel+=timeNow()-trow;
+
+        for (i = 0; i <= MESH_X; i ++)
+          for (x = 0; x < 14; x ++) b->hash=hashValue(b->hash,rows[x][i]);
+        if (mode == MODE_BATCH && !(NSEEL_code_getbatchreads(b->code) & 15)) // doesn't read x, y, rad, ang
+          for (i = 1; i <= MESH_X; i ++)
+            for (x = 4; x < 14; x ++)
+              if (hashValue(0,rows[x][i]) != hashValue(0,rows[x][0])) b->hash=hashValue(b->hash,-1.0); // reported as a mismatch
+      }
+      if (mode == MODE_BATCH) // left in the vars by the last vertex
+        for (x = 0; x < 14; x ++) *v[x]=rows[x][MESH_X];
+    }
+  }
+  t=kind == KIND_PIXEL ? tpixel : timeNow()-t0;
+  NSEEL_VM_enumallvars(b->vm,hashVar,&b->hash);
+  return t;
+}
+
+//------------------------------------------------------------------------------
+static void benchProgram(const char *where, int kind, const char *init, const char *code)
+{
+  unsigned int hash[NUM_MODES];
+  double t[NUM_MODES];
+  int m, ran[NUM_MODES]={0}, compare=!isRandom(code) && !(init && isRandom(init));
+
+  if (!*code) return;
+  g_programs++;
+  if (!compare) g_random++;
+
+  for (m = 0; m < NUM_MODES; m ++)
+  {
+    benchVM b;
+    if (m == MODE_BATCH && kind != KIND_PIXEL) break;
+    if (!vmCompile(&b,m,kind,init,code))
+    {
+      if (m == MODE_REFERENCE)
+      {
+        g_nocompile++;
+        if (g_verbose) printf("%s: doesn't compile: %s\n",where,NSEEL_code_getcodeerror(b.vm));
+        vmFree(&b);
+        return;
+      }
+      if (m == MODE_NATIVE)
+      {
+        g_mismatches++;
+        printf("MISMATCH %s: native doesn't compile: %s\n",where,NSEEL_code_getcodeerror(b.vm));
+      }
+      if (m == MODE_INTERP) g_nointerp++;
+    }
+    else if (m != MODE_BATCH || NSEEL_code_execute_batch(b.code,NULL,0))
+    {
+      if (m == MODE_BATCH && !(NSEEL_code_getbatchreads(b.code) & 15)) g_uniform++;
+      t[m]=vmRun(&b,kind,m);
+      hash[m]=b.hash;
+      ran[m]=1;
+      g_time[m]+=t[m];
+      g_runs[m]++;
+    }
+    vmFree(&b);
+  }
+  if (ran[MODE_BATCH])
+    for (m = 0; m < NUM_MODES; m ++) g_batchtime[m]+=t[m];
+
+  for (m = 1; m < NUM_MODES; m ++)
+  {
+    if (ran[m] && compare && hash[m] != hash[0])
+    {
+      g_mismatches++;
+      printf("MISMATCH %s: %s differs from the reference\n",where,g_modenames[m]);
+    }
+  }
+  if (g_verbose)
+  {
+    printf("%-60s",where);
+    for (m = 0; m < NUM_MODES; m ++) if (ran[m]) printf(" %s %.3fms",g_modenames[m],t[m]*1000.0/g_frames);
+    printf("\n");
+  }
+}
+
+//------------------------------------------------------------------------------
+// presets
+
+typedef struct { char *key, *value; } presetLine;
+
+static char *readFile(const char *fn, int *len)
+{
+  FILE *fp=fopen(fn,"rb");
+  char *buf=NULL;
+  long l;
+  if (!fp) return NULL;
+  fseek(fp,0,SEEK_END);
+  l=ftell(fp);
+  fseek(fp,0,SEEK_SET);
+  if (l >= 0 && (buf=(char *)malloc(l+1)))
+  {
+    l=(long)fread(buf,1,l,fp);
+    buf[l]=0;
+    if (len) *len=(int)l;
+  }
+  fclose(fp);
+  return buf;
+}
+
+// joins key prefix1, prefix2, ... like ReadCode() and StripLinefeedCharsAndComments() in state.cpp
+static char *presetCode(presetLine *lines, int nlines, const char *prefix)
+{
+  int size=0, len=0, n, x;
+  char *code=(char *)calloc(1,1);
+  for (n = 1; code; n ++)
+  {
+    char key[64];
+    const char *v=NULL;
+    snprintf(key,sizeof(key),"%s%d",prefix,n);
+    for (x = 0; x < nlines && !v; x ++) if (!strcasecmp(lines[x].key,key)) v=lines[x].value;
+    if (!v) break;
+    if (*v == '`') v++;
+    x=0;
+    while (v[x] && !(v[x] == '/' && v[x+1] == '/') && !(v[x] == '\\' && v[x+1] == '\\')) x++;
+    if (len+x+1 > size)
+    {
+      char *nc=(char *)realloc(code,size=(len+x+1)*2);
+      if (!nc) break;
+      code=nc;
+    }
+    memcpy(code+len,v,x);
+    code[len+=x]=0;
+  }
+  return code;
+}
+
+static void benchPreset(const char *fn)
+{
+  presetLine *lines=NULL;
+  int nlines=0, x;
+  char *buf=readFile(fn,NULL), *p, where[1024], prefix[64];
+  if (!buf) return;
+
+  for (p = buf; *p; )
+  {
+    char *eol=p, *eq;
+    while (*eol && *eol != '\n' && *eol != '\r') eol++;
+    if (*eol) *eol++=0;
+    if ((eq=strchr(p,'=')))
+    {
+      presetLine *nl=(presetLine *)realloc(lines,(nlines+1)*sizeof(presetLine));
+      if (!nl) break;
+      lines=nl;
+      *eq=0;
+      lines[nlines].key=p;
+      lines[nlines++].value=eq+1;
+    }
+    p=eol;
+  }
+
+  {
+    char *init=presetCode(lines,nlines,"per_frame_init_");
+    char *code=presetCode(lines,nlines,"per_frame_");
+    snprintf(where,sizeof(where),"%s: per-frame",fn);
+    if (init && code) benchProgram(where,KIND_FRAME,init,code);
+    free(code);
+    code=presetCode(lines,nlines,"per_pixel_");
+    snprintf(where,sizeof(where),"%s: per-pixel",fn);
+    if (code) benchProgram(where,KIND_PIXEL,NULL,code);
+    free(code);
+    free(init);
+  }
+  for (x = 0; x < 8; x ++) // MAX_CUSTOM_WAVES, MAX_CUSTOM_SHAPES
+  {
+    int s;
+    for (s = 0; s < 2; s ++)
+    {
+      const char *obj = s ? "shape" : "wave";
+      char *init, *code;
+      snprintf(prefix,sizeof(prefix),"%s_%d_init",obj,x);
+      init=presetCode(lines,nlines,prefix);
+      snprintf(prefix,sizeof(prefix),"%s_%d_per_frame",obj,x);
+      code=presetCode(lines,nlines,prefix);
+      snprintf(where,sizeof(where),"%s: %s %d per-frame",fn,obj,x);
+      if (init && code) benchProgram(where,KIND_FRAME,init,code);
+      free(code);
+      if (!s)
+      {
+        snprintf(prefix,sizeof(prefix),"wave_%d_per_point",x);
+        code=presetCode(lines,nlines,prefix);
+        snprintf(where,sizeof(where),"%s: wave %d per-point",fn,x);
+        if (code) benchProgram(where,KIND_POINT,init,code);
+        free(code);
+      }
+      free(init);
+    }
+  }
+  free(lines);
+  free(buf);
+}
+
+static void benchPath(const char *path)
+{
+  struct stat st;
+  if (stat(path,&st)) return;
+  if (S_ISDIR(st.st_mode))
+  {
+    DIR *d=opendir(path);
+    struct dirent *de;
+    if (!d) return;
+    while ((de=readdir(d)))
+    {
+      char fn[4096];
+      int l=(int)strlen(de->d_name);
+      if (de->d_name[0] == '.') continue;
+      snprintf(fn,sizeof(fn),"%s/%s",path,de->d_name);
+      if (l > 5 && !strcasecmp(de->d_name+l-5,".milk")) benchPreset(fn);
+      else if (!stat(fn,&st) && S_ISDIR(st.st_mode)) benchPath(fn);
+    }
+    closedir(d);
+  }
+  else benchPreset(path);
+}
+
+//------------------------------------------------------------------------------
+// fuzz target: the input is one program
+
+int LLVMFuzzerTestOneInput(const unsigned char *data, size_t size)
+{
+  benchVM b[3];
+  char *code=(char *)malloc(size+1), *p;
+  int ok[3], x, norun=0;
+  if (!code) return 0;
+  if (!g_init) g_init=!NSEEL_init(); // libFuzzer has its own main()
+  memcpy(code,data,size);
+  code[size]=0;
+  for (p = code; *p; p ++) if (!strncasecmp(p,"loop",4) || !strncasecmp(p,"while",5)) norun=1;
+  if (isRandom(code)) norun=1;
+
+  NSEEL_RAM_limitmem=16<<20;
+  g_frames=1;
+  for (x = 0; x < 3; x ++) // MODE_REFERENCE, MODE_NATIVE, MODE_INTERP
+  {
+    ok[x]=vmCompile(b+x,x,KIND_FRAME,NULL,code);
+    if (ok[x] && !norun) vmRun(b+x,KIND_FRAME,x);
+  }
+  // the interpreter can't do functions with custom machine code, but anything it compiles, native has to
+  if (ok[0] != ok[1] || (ok[2] && !ok[1])) abort();
+  for (x = 1; x < 3; x ++)
+    if (ok[0] && ok[x] && !norun && b[0].hash != b[x].hash) abort();
+  for (x = 0; x < 3; x ++) vmFree(b+x);
+  free(code);
+  return 0;
+}
+
+#ifndef NSEEL_FUZZ
+
+int main(int argc, char **argv)
+{
+  int x, m, fuzz=0, n=0;
+  g_init=!NSEEL_init();
+  for (x = 1; x < argc; x ++)
+  {
+    if (!strcmp(argv[x],"-v")) g_verbose=1;
+    else if (!strcmp(argv[x],"-fuzz")) fuzz=1;
+    else if (!strcmp(argv[x],"-frames") && x+1 < argc) g_frames=atoi(argv[++x]) > 0 ? atoi(argv[x]) : 1;
+    else if (fuzz)
+    {
+      int len=0;
+      char *buf=readFile(argv[x],&len);
+      if (buf) LLVMFuzzerTestOneInput((unsigned char *)buf,len);
+      free(buf);
+      n++;
+    }
+    else
+    {
+      benchPath(argv[x]);
+      n++;
+    }
+  }
+  if (!n)
+  {
+    fprintf(stderr,"usage: %s [-v] [-frames N] <preset dir or .milk file>...\n"
+                   "       %s -fuzz <file>...\n",argv[0],argv[0]);
+    return 1;
+  }
+  if (!fuzz)
+  {
+    printf("%d programs, %d didn't compile, %d not interpretable, %d not compared (rand), %d mismatches\n",
+           g_programs,g_nocompile,g_nointerp,g_random,g_mismatches);
+    printf("%d per-pixel programs are uniform (don't read x, y, rad or ang)\n",g_uniform);
+    for (m = 0; m < NUM_MODES; m ++)
+      if (g_runs[m]) printf("%-12s %5d programs %10.3f ms/frame\n",g_modenames[m],g_runs[m],g_time[m]*1000.0/g_frames);
+    if (g_runs[MODE_BATCH])
+    {
+      printf("on the %d batched programs:",g_runs[MODE_BATCH]);
+      for (m = 0; m < NUM_MODES; m ++) printf(" %s %.3f",g_modenames[m],g_batchtime[m]*1000.0/g_frames);
+      printf(" ms/frame\n");
+    }
+  }
+  NSEEL_quit();
+  return g_mismatches ? 2 : 0;
+}
+
+#endif
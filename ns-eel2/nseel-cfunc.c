@@ -117,6 +117,8 @@ EEL_F NSEEL_CGEN_CALL nseel_int_rand(EEL_F *f)
 
 #ifdef __ppc__
 #include "asm-nseel-ppc-gcc.c"
+#elif defined(EEL_TARGET_X64_SSE2)
+#include "asm-nseel-x64-sse2.c"
 #else
   #ifdef _MSC_VER
     #ifdef _WIN64
@@ -43,6 +43,8 @@
   #ifdef __LP64__
     #define EEL_USE_MPROTECT
   #endif
+#elif defined(EEL_TARGET_X64_SSE2) && !defined(_WIN32)
+  #define EEL_USE_MPROTECT
 #endif
 
 #ifdef EEL_USE_MPROTECT
@@ -51,6 +53,10 @@
 #include <unistd.h>
 #endif
 
+#ifndef _WIN32
+#include <time.h>
+#endif
+
 #ifdef NSEEL_EEL1_COMPAT_MODE
 
 #ifndef EEL_NO_CHANGE_FPFLAGS
@@ -59,7 +65,7 @@
 
 #endif
 
-#ifndef _WIN64
+#if !defined(_WIN64) && !defined(EEL_TARGET_X64_SSE2)
 #if !defined(_RC_CHOP) && !defined(EEL_NO_CHANGE_FPFLAGS)
 
 #include <fpu_control.h>
@@ -163,6 +169,15 @@ INT_PTR *EEL_GLUE_set_immediate(void *_p, void *newv)
   return (INT_PTR*)++p;
 }
 
+// runs a preprocessor on a dummy immediate, to find out what it would have stored
+void *nseel_getPProcValue(compileContext *ctx, NSEEL_PPPROC pProc)
+{
+  unsigned int p[2]={0x0000dead, 0x0000beef};
+  if (!pProc) return 0;
+  pProc(p,sizeof(p),ctx);
+  return (void *)(INT_PTR)(((p[0]&0xFFFF)<<16) | (p[1]&0xFFFF));
+}
+
 
 #else
 
@@ -173,7 +188,7 @@ INT_PTR *EEL_GLUE_set_immediate(void *_p, void *newv)
 const static unsigned int GLUE_FUNC_ENTER[1];
 const static unsigned int GLUE_FUNC_LEAVE[1];
 
-#if defined(_WIN64) || defined(__LP64__)
+#if defined(_WIN64) || defined(__LP64__) || defined(EEL_TARGET_X64_SSE2)
 #define GLUE_MOV_EAX_DIRECTVALUE_SIZE 10
 static void GLUE_MOV_EAX_DIRECTVALUE_GEN(void *b, INT_PTR v) {   
   unsigned short *bb = (unsigned short *)b;
@@ -202,7 +217,7 @@ const static unsigned char  GLUE_RET=0xC3;
 
 static int GLUE_RESET_ESI(unsigned char *out, void *ptr)
 {
-#if defined(_WIN64) || defined(__LP64__)
+#if defined(_WIN64) || defined(__LP64__) || defined(EEL_TARGET_X64_SSE2)
   if (out)
   {
 	  *out++ = 0x48;
@@ -224,7 +239,7 @@ static int GLUE_RESET_ESI(unsigned char *out, void *ptr)
 
 static void GLUE_CALL_CODE(INT_PTR bp, INT_PTR cp) 
 {
-  #if defined(_WIN64) || defined(__LP64__)
+  #if defined(_WIN64) || defined(__LP64__) || defined(EEL_TARGET_X64_SSE2)
 	  extern void win64_callcode(INT_PTR code);
 	  win64_callcode(cp);
   #else // non-64 bit
@@ -267,12 +282,27 @@ INT_PTR *EEL_GLUE_set_immediate(void *_p, void *newv)
   return ((INT_PTR*)p)+1;
 }
 
+// runs a preprocessor on a dummy immediate, to find out what it would have stored
+void *nseel_getPProcValue(compileContext *ctx, NSEEL_PPPROC pProc)
+{
+  INT_PTR p=~(INT_PTR)0;
+  if (!pProc) return 0;
+  pProc(&p,sizeof(p),ctx);
+  return (void *)p;
+}
+
 #endif
 
 
 static void *GLUE_realAddress(void *fn, void *fn_e, int *size)
 {
-#if defined(_MSC_VER) || defined(__LP64__)
+#if defined(EEL_TARGET_X64_SSE2)
+
+  // SSE2 templates are bare labels (asm-nseel-x64-sse2.c), no prologue or ret to skip
+  *size = (char *)fn_e - (char *)fn;
+  return fn;
+
+#elif defined(_MSC_VER) || defined(__LP64__)
 
   unsigned char *p;
 
@@ -314,7 +344,8 @@ static void *GLUE_realAddress(void *fn, void *fn_e, int *size)
 
 
 
-static int nseel_evallib_stats[5]; // source bytes, static code bytes, call code bytes, data bytes, segments
+static int nseel_evallib_stats[9]; // source bytes, static code bytes, call code bytes, data bytes, segments,
+                                   // arena bytes and blocks of the last compile, blocks allocated, blocks pooled
 int *NSEEL_getstats()
 {
   return nseel_evallib_stats;
@@ -345,6 +376,30 @@ static int findByteOffsetInSource(compileContext *ctx, int byteoffs,int *destoff
 }
 
 
+static void setCompileError(compileContext *ctx, char *_expression, int byteoffs, int lineoffs)
+{
+  int destoffs,linenumber;
+  char buf[21], *p;
+  int x,le;
+
+  linenumber=findByteOffsetInSource(ctx,byteoffs,&destoffs);
+  if (destoffs < 0) destoffs=0;
+
+  le=strlen(_expression);
+  if (destoffs >= le) destoffs=le;
+  p= _expression + destoffs;
+  for (x = 0;x < 20; x ++)
+  {
+    if (!*p || *p == '\r' || *p == '\n') break;
+    buf[x]=*p++;
+  }
+  buf[x]=0;
+
+  _snprintf(ctx->last_error_string,ARRAYSIZE(ctx->last_error_string),"Around line %d '%s'",linenumber+lineoffs,buf);
+
+  ctx->last_error_string[sizeof(ctx->last_error_string)-1]=0;
+}
+
 static void onCompileNewLine(compileContext *ctx, int srcBytes, int destBytes)
 {
 	if (!ctx->compileLineRecs || ctx->compileLineRecs_size >= ctx->compileLineRecs_alloc)
@@ -365,46 +420,71 @@ static void onCompileNewLine(compileContext *ctx, int srcBytes, int destBytes)
 typedef struct _llBlock {
 	struct _llBlock *next;
   int sizeused;
+  int alloc_size;
+  int wantExec;
 	char block[LLB_DSIZE];
 } llBlock;
 
+// freed blocks of the standard size are kept for reuse, so that compiling (and freeing) code doesn't go back to
+// the system each time. [0] is for data, [1] for executable blocks. each context also keeps one block of its
+// compile-time arena (tmpblocks_head) between compiles, see resetBlocks().
+#ifndef NSEEL_BLOCKPOOL_SIZE
+#define NSEEL_BLOCKPOOL_SIZE 32
+#endif
+static llBlock *nseel_blockpool[2];
+static int nseel_blockpool_size[2];
+
 typedef struct _startPtr {
   struct _startPtr *next;
   void *startptr;
+  char *expr; // source of the statement, for error reporting
 } startPtr;
 
-typedef struct {
+typedef struct _codeHandleType {
   void *workTable;
 
   llBlock *blocks;
   void *code;
   int code_stats[4];
+  int interpreted; // code is bytecode for nseel_interp_execute()
+  void *prologue; // hoisted uniform code, see NSEEL_VM_SetUniformVars()
+  void *batch; // NSEEL_code_execute_batch() code, if the code can be batched
+  int batch_reads; // see NSEEL_code_getbatchreads()
+
+  // NSEEL_PROFILE_enabled
+  struct _codeHandleType *prof_prev, *prof_next; // all live handles, for NSEEL_profile_dump()
+  char prof_label[128];
+  double prof_runs, prof_time, prof_worst; // seconds
 } codeHandleType;
 
 #ifndef NSEEL_MAX_TEMPSPACE_ENTRIES
 #define NSEEL_MAX_TEMPSPACE_ENTRIES 2048
 #endif
 
-static void *__newBlock(llBlock **start,int size);
+static void *__newBlock(llBlock **start,int size,int wantExec);
 
 #define newTmpBlock(x) __newTmpBlock((llBlock **)&ctx->tmpblocks_head,x)
-#define newBlock(x,a) __newBlock_align(ctx,x,a)
+#define newBlock(x,a) __newBlock_align((llBlock **)&ctx->blocks_head,x,a,!ctx->interpreted) // interpreted code never needs executable memory
+#define newOpCode() ((opcodeRec *)__newBlock_align((llBlock **)&ctx->tmpblocks_head,sizeof(opcodeRec),8,0))
+#define newTmpData(x) __newBlock_align((llBlock **)&ctx->tmpblocks_head,x,8,0) // compile-time data, gone after the compile
 
 static void *__newTmpBlock(llBlock **start, int size)
 {
-  void *p=__newBlock(start,size+4);
+  void *p=__newBlock(start,size+4,0);
   if (p && size>=0) *((int *)p) = size;
   return p;
 }
 
-static void *__newBlock_align(compileContext *ctx, int size, int align) // makes sure block is aligned to 32 byte boundary, for code
+static void *__newBlock_align(llBlock **start, int size, int align, int wantExec) // makes sure block is aligned to 32 byte boundary, for code
 {
   int a1=align-1;
-  char *p=(char*)__newBlock((llBlock **)&ctx->blocks_head,size+a1);
+  char *p=(char*)__newBlock(start,size+a1,wantExec);
+  if (!p) return 0;
   return p+((align-(((INT_PTR)p)&a1))&a1);
 }
 
 static void freeBlocks(llBlock **start);
+static void resetBlocks(llBlock **start);
 
 #define DECL_ASMFUNC(x)         \
   void nseel_asm_##x(void);        \
@@ -469,7 +549,9 @@ static EEL_F g_signs[2]={1.0,-1.0};
 static EEL_F negativezeropointfive=-0.5f;
 static EEL_F onepointfive=1.5f;
 static EEL_F g_closefact = NSEEL_CLOSEFACTOR;
-static const EEL_F eel_zero=0.0, eel_one=1.0;
+#ifdef __ppc__
+static const EEL_F eel_zero=0.0, eel_one=1.0; // the ppc compares and sign load their results
+#endif
 
 #if defined(_MSC_VER) && _MSC_VER >= 1400 && _MSC_VER < 1929
 static double __floor(double a) { return floor(a); }
@@ -494,6 +576,12 @@ static double eel1sigmoid(double x, double constraint)
 
 EEL_F NSEEL_CGEN_CALL nseel_int_rand(EEL_F *f);
 
+static EEL_F * NSEEL_CGEN_CALL nseel_hoist_store(void *opaque, EEL_F *dest, EEL_F *src)
+{
+  *dest = *src; // unlike _set, stores denormals/inf/nan as-is
+  return dest;
+}
+
 static functionType fnTable1[] = {
   { "_if",     nseel_asm_if,nseel_asm_if_end,    3,  {&g_closefact} },
   { "_and",   nseel_asm_band,nseel_asm_band_end,  2 } ,
@@ -530,7 +618,7 @@ static functionType fnTable1[] = {
   { "_modop",nseel_asm_mod_op,nseel_asm_mod_op_end,2},
 
 
-#ifdef __ppc__
+#if defined(__ppc__) || defined(EEL_TARGET_X64_SSE2)
    { "sin",   nseel_asm_1pdd,nseel_asm_1pdd_end,   1, {&sin} },
    { "cos",    nseel_asm_1pdd,nseel_asm_1pdd_end,   1, {&cos} },
    { "tan",    nseel_asm_1pdd,nseel_asm_1pdd_end,   1, {&tan}  },
@@ -552,7 +640,7 @@ static functionType fnTable1[] = {
    { "pow",    nseel_asm_2pdd,nseel_asm_2pdd_end,   2, {&pow}, },
    { "_powop",    nseel_asm_2pdds,nseel_asm_2pdds_end,   2, {&pow}, },
    { "exp",    nseel_asm_1pdd,nseel_asm_1pdd_end,   1, {&exp}, },
-#ifdef __ppc__
+#if defined(__ppc__) || defined(EEL_TARGET_X64_SSE2)
    { "log",    nseel_asm_1pdd,nseel_asm_1pdd_end,   1, {&log} },
    { "log10",  nseel_asm_1pdd,nseel_asm_1pdd_end, 1, {&log10} },
 #else
@@ -598,6 +686,7 @@ static functionType fnTable1[] = {
   {"freembuf",_asm_generic1parm,_asm_generic1parm_end,1,{&__NSEEL_RAM_MemFree},NSEEL_PProc_RAM},
   {"memcpy",_asm_generic3parm,_asm_generic3parm_end,3,{&__NSEEL_RAM_MemCpy},NSEEL_PProc_RAM},
   {"memset",_asm_generic3parm,_asm_generic3parm_end,3,{&__NSEEL_RAM_MemSet},NSEEL_PProc_RAM},
+  {"_hoist",_asm_generic2parm,_asm_generic2parm_end,2,{&nseel_hoist_store},NSEEL_PProc_THIS},
 };
 
 static functionType *fnTableUser;
@@ -641,34 +730,109 @@ void NSEEL_addfunctionex2(const char *name, int nparms, char *code_startaddr, in
   }
 }
 
+static void parseCacheClear();
+static void releaseBlock(llBlock *llb);
+
 void NSEEL_quit()
 {
+  int x;
+  parseCacheClear();
+
+  NSEEL_HOSTSTUB_EnterMutex();
+  for (x = 0; x < 2; x ++)
+  {
+    while (nseel_blockpool[x])
+    {
+      llBlock *llb=nseel_blockpool[x];
+      nseel_blockpool[x]=llb->next;
+      releaseBlock(llb);
+    }
+    nseel_blockpool_size[x]=0;
+  }
+  nseel_evallib_stats[8]=0;
+  NSEEL_HOSTSTUB_LeaveMutex();
+
   free(fnTableUser);
   fnTableUser_size=0;
   fnTableUser=0;
 }
 
 //---------------------------------------------------------------------------------------------------------------
+static void releaseBlock(llBlock *llb)
+{
+#ifdef _WIN32
+		VirtualFree(llb, 0 /*LLB_DSIZE*/, MEM_RELEASE);
+#else
+    free(llb);
+#endif
+}
+
 static void freeBlocks(llBlock **start)
 {
   llBlock *s=*start;
   *start=0;
+  if (!s) return;
+  NSEEL_HOSTSTUB_EnterMutex();
   while (s)
   {
     llBlock *llB = s->next;
-#ifdef _WIN32
-		VirtualFree(s, 0 /*LLB_DSIZE*/, MEM_RELEASE);
-#else
-    free(s);
-#endif
+    if (s->alloc_size == sizeof(llBlock) && nseel_blockpool_size[s->wantExec] < NSEEL_BLOCKPOOL_SIZE)
+    {
+      s->next=nseel_blockpool[s->wantExec];
+      nseel_blockpool[s->wantExec]=s;
+      nseel_blockpool_size[s->wantExec]++;
+      nseel_evallib_stats[8]++;
+    }
+    else releaseBlock(s);
     s=llB;
   }
+  NSEEL_HOSTSTUB_LeaveMutex();
+}
+
+// empties an arena, keeping one block of it for the next use
+static void resetBlocks(llBlock **start)
+{
+  llBlock *s=*start, *keep=NULL, *rest=NULL;
+  while (s)
+  {
+    llBlock *llB = s->next;
+    if (!keep && s->alloc_size == sizeof(llBlock)) keep=s;
+    else
+    {
+      s->next=rest;
+      rest=s;
+    }
+    s=llB;
+  }
+  freeBlocks(&rest);
+  if (keep)
+  {
+    keep->next=NULL;
+    keep->sizeused=0;
+  }
+  *start=keep;
+}
+
+// grows the last allocation from __newBlock(start,oldsize,0), moving it if it doesn't fit
+static void *__growBlock(llBlock **start, void *p, int oldsize, int newsize)
+{
+  llBlock *llb=*start;
+  char *np;
+  if (p && llb && (char *)p >= llb->block && (char *)p + ((oldsize+7)&~7) == llb->block+llb->sizeused &&
+      (char *)p - llb->block + newsize <= LLB_DSIZE)
+  {
+    llb->sizeused = (int)((char *)p - llb->block) + ((newsize+7)&~7);
+    return p;
+  }
+  np=(char *)__newBlock(start,newsize,0);
+  if (np && p) memcpy(np,p,oldsize);
+  return np;
 }
 
 //---------------------------------------------------------------------------------------------------------------
-static void *__newBlock(llBlock **start, int size)
+static void *__newBlock(llBlock **start, int size, int wantExec)
 {
-  llBlock *llb;
+  llBlock *llb=NULL;
   int alloc_size;
   if (*start && (LLB_DSIZE - (*start)->sizeused) >= size)
   {
@@ -677,15 +841,36 @@ static void *__newBlock(llBlock **start, int size)
     return t;
   }
 
+  wantExec = wantExec ? 1 : 0;
   alloc_size=sizeof(llBlock);
   if ((int)size > LLB_DSIZE) alloc_size += size - LLB_DSIZE;
+  else if (nseel_blockpool[wantExec])
+  {
+    NSEEL_HOSTSTUB_EnterMutex();
+    if ((llb=nseel_blockpool[wantExec]))
+    {
+      nseel_blockpool[wantExec]=llb->next;
+      nseel_blockpool_size[wantExec]--;
+      nseel_evallib_stats[8]--;
+    }
+    NSEEL_HOSTSTUB_LeaveMutex();
+    if (llb)
+    {
+      llb->sizeused=(size+7)&~7;
+      llb->next = *start;
+      *start = llb;
+      return llb->block;
+    }
+  }
  
 #ifdef _WIN32
-	llb = (llBlock *)VirtualAlloc(NULL, alloc_size, MEM_COMMIT, PAGE_EXECUTE_READWRITE);
+	llb = (llBlock *)VirtualAlloc(NULL, alloc_size, MEM_COMMIT, wantExec ? PAGE_EXECUTE_READWRITE : PAGE_READWRITE);
 #else
 	llb = (llBlock *)malloc(alloc_size); // grab bigger block if absolutely necessary (heh)
 #endif
+  if (!llb) return 0;
 #if defined(EEL_USE_MPROTECT)
+  if (wantExec)
   {
     static int pagesize = 0;
     if (!pagesize)
@@ -699,6 +884,9 @@ static void *__newBlock(llBlock **start, int size)
     mprotect((void*)offs,eoffs-offs,PROT_WRITE|PROT_READ|PROT_EXEC);
   }
 #endif
+  nseel_evallib_stats[7]++;
+  llb->alloc_size=alloc_size;
+  llb->wantExec=wantExec;
   llb->sizeused=(size+7)&~7;
   llb->next = *start;  
   *start = llb;
@@ -707,7 +895,59 @@ static void *__newBlock(llBlock **start, int size)
 
 
 //---------------------------------------------------------------------------------------------------------------
+// the parser builds a tree of opcodeRecs (in tmpblocks), which is then either
+// stitched into native code (compileOpcodes) or turned into bytecode (nseel-interp.c)
+
 INT_PTR nseel_createCompiledValue(compileContext *ctx, EEL_F value, EEL_F *addrValue)
+{
+  opcodeRec *r=newOpCode();
+  if (!r) return 0;
+  memset(r,0,sizeof(opcodeRec));
+  if (addrValue)
+  {
+    r->opcodeType = OPCODETYPE_VARPTR;
+    r->valuePtr = addrValue;
+  }
+  else
+  {
+    r->opcodeType = OPCODETYPE_DIRECTVALUE;
+    r->directValue = value;
+  }
+  return (INT_PTR)r;
+}
+
+static INT_PTR createCompiledFunction(compileContext *ctx, int nparms, int fntype, INT_PTR fn, INT_PTR code1, INT_PTR code2, INT_PTR code3)
+{
+  opcodeRec *r;
+  if (!code1 || (nparms>1 && !code2) || (nparms>2 && !code3)) return 0;
+
+  r=newOpCode();
+  if (!r) return 0;
+  memset(r,0,sizeof(opcodeRec));
+  r->opcodeType = OPCODETYPE_FUNC1+nparms-1;
+  r->fntype = fntype;
+  r->fn = fn;
+  r->parms[0] = (opcodeRec *)code1;
+  r->parms[1] = (opcodeRec *)code2;
+  r->parms[2] = (opcodeRec *)code3;
+  return (INT_PTR)r;
+}
+
+INT_PTR nseel_createCompiledFunction1(compileContext *ctx, int fntype, INT_PTR fn, INT_PTR code)
+{
+  return createCompiledFunction(ctx,1,fntype,fn,code,0,0);
+}
+INT_PTR nseel_createCompiledFunction2(compileContext *ctx, int fntype, INT_PTR fn, INT_PTR code1, INT_PTR code2)
+{
+  return createCompiledFunction(ctx,2,fntype,fn,code1,code2,0);
+}
+INT_PTR nseel_createCompiledFunction3(compileContext *ctx, int fntype, INT_PTR fn, INT_PTR code1, INT_PTR code2, INT_PTR code3)
+{
+  return createCompiledFunction(ctx,3,fntype,fn,code1,code2,code3);
+}
+
+//---------------------------------------------------------------------------------------------------------------
+static INT_PTR genCompiledValue(compileContext *ctx, EEL_F value, EEL_F *addrValue)
 {
   unsigned char *block;
 
@@ -773,7 +1013,7 @@ static void *nseel_getFunctionAddress(int fntype, int fn, int *size, NSEEL_PPPRO
 
 
 //---------------------------------------------------------------------------------------------------------------
-INT_PTR nseel_createCompiledFunction3(compileContext *ctx, int fntype, INT_PTR fn, INT_PTR code1, INT_PTR code2, INT_PTR code3)
+static INT_PTR genCompiledFunction3(compileContext *ctx, int fntype, INT_PTR fn, INT_PTR code1, INT_PTR code2, INT_PTR code3)
 {
   int sizes1=((int *)code1)[0];
   int sizes2=((int *)code2)[0];
@@ -867,7 +1107,7 @@ INT_PTR nseel_createCompiledFunction3(compileContext *ctx, int fntype, INT_PTR f
 }
 
 //---------------------------------------------------------------------------------------------------------------
-INT_PTR nseel_createCompiledFunction2(compileContext *ctx, int fntype, INT_PTR fn, INT_PTR code1, INT_PTR code2)
+static INT_PTR genCompiledFunction2(compileContext *ctx, int fntype, INT_PTR fn, INT_PTR code1, INT_PTR code2)
 {
   int size2;
   int sizes1=((int *)code1)[0];
@@ -946,7 +1186,7 @@ INT_PTR nseel_createCompiledFunction2(compileContext *ctx, int fntype, INT_PTR f
 
 
 //---------------------------------------------------------------------------------------------------------------
-INT_PTR nseel_createCompiledFunction1(compileContext *ctx, int fntype, INT_PTR fn, INT_PTR code)
+static INT_PTR genCompiledFunction1(compileContext *ctx, int fntype, INT_PTR fn, INT_PTR code)
 {
   NSEEL_PPPROC preProc=0;
   int size,size2;
@@ -1008,13 +1248,456 @@ INT_PTR nseel_createCompiledFunction1(compileContext *ctx, int fntype, INT_PTR f
   }
 }
 
+//---------------------------------------------------------------------------------------------------------------
+static INT_PTR compileOpcodes(compileContext *ctx, opcodeRec *op)
+{
+  INT_PTR c1,c2,c3;
+  if (!op) return 0;
+  switch (op->opcodeType)
+  {
+    case OPCODETYPE_DIRECTVALUE:
+      return genCompiledValue(ctx,op->directValue,NULL);
+    case OPCODETYPE_VARPTR:
+      return genCompiledValue(ctx,0,op->valuePtr);
+    case OPCODETYPE_FUNC1:
+      if (!(c1=compileOpcodes(ctx,op->parms[0]))) return 0;
+      return genCompiledFunction1(ctx,op->fntype,op->fn,c1);
+    case OPCODETYPE_FUNC2:
+      if (!(c1=compileOpcodes(ctx,op->parms[0])) ||
+          !(c2=compileOpcodes(ctx,op->parms[1]))) return 0;
+      return genCompiledFunction2(ctx,op->fntype,op->fn,c1,c2);
+    case OPCODETYPE_FUNC3:
+      if (!(c1=compileOpcodes(ctx,op->parms[0])) ||
+          !(c2=compileOpcodes(ctx,op->parms[1])) ||
+          !(c3=compileOpcodes(ctx,op->parms[2]))) return 0;
+      return genCompiledFunction3(ctx,op->fntype,op->fn,c1,c2,c3);
+  }
+  return 0;
+}
+
+
+//---------------------------------------------------------------------------------------------------------------
+// tree optimizations, run on all statements of a code block before code generation
+
+#define OPT_NEEDPTR 1 // the pointer returned by this node may be written through, or read after later side effects
+
+static int optIsUserFunction(opcodeRec *op)
+{
+  return op->fntype == MATH_FN && op->fn >= (INT_PTR)(sizeof(fnTable1)/sizeof(fnTable1[0]));
+}
+
+// functions that write to their first parameter
+static int optIsStoreFunction(opcodeRec *op)
+{
+  functionType *f;
+  if (op->fntype == MATH_SIMPLE) return op->fn == FN_ASSIGN;
+  if (optIsUserFunction(op) || !(f=nseel_getFunctionFromTable((int)op->fn))) return 0;
+  return f->afunc == (void*)nseel_asm_assign ||
+         f->afunc == (void*)nseel_asm_add_op || f->afunc == (void*)nseel_asm_sub_op ||
+         f->afunc == (void*)nseel_asm_mul_op || f->afunc == (void*)nseel_asm_div_op ||
+         f->afunc == (void*)nseel_asm_mod_op || f->afunc == (void*)nseel_asm_or_op ||
+         f->afunc == (void*)nseel_asm_and_op || f->afunc == (void*)nseel_asm_2pdds;
+}
+
+static int optIsPureFunction(opcodeRec *op)
+{
+  functionType *f;
+  if (op->fntype == MATH_SIMPLE) return op->fn != FN_ASSIGN;
+  if (op->fn >= 0 && op->fn < 3) return 1; // _if, _and, _or
+  if (op->fn < 5 || optIsUserFunction(op)) return 0; // loop/while, user functions
+  f=nseel_getFunctionFromTable((int)op->fn);
+  return f && !f->pProc && f->afunc != (void*)nseel_asm_1pp /* rand */ && !optIsStoreFunction(op);
+}
+
+static int optHasSideEffects(opcodeRec *op)
+{
+  int x;
+  if (op->opcodeType < OPCODETYPE_FUNC1) return 0;
+  if (!optIsPureFunction(op)) return 1;
+  for (x = 0; x <= op->opcodeType - OPCODETYPE_FUNC1; x ++)
+    if (optHasSideEffects(op->parms[x])) return 1;
+  return 0;
+}
+
+// conservative: user functions might access anything
+static int optReferencesVar(opcodeRec *op, EEL_F *var)
+{
+  int x;
+  if (op->opcodeType == OPCODETYPE_VARPTR) return op->valuePtr == var;
+  if (op->opcodeType < OPCODETYPE_FUNC1) return 0;
+  if (optIsUserFunction(op)) return 1;
+  for (x = 0; x <= op->opcodeType - OPCODETYPE_FUNC1; x ++)
+    if (optReferencesVar(op->parms[x],var)) return 1;
+  return 0;
+}
+
+static int optIsConst(opcodeRec *op, EEL_F v)
+{
+  return op->opcodeType == OPCODETYPE_DIRECTVALUE && op->directValue == v;
+}
+
+static opcodeRec *optSetConst(opcodeRec *op, EEL_F v)
+{
+  op->opcodeType = OPCODETYPE_DIRECTVALUE;
+  op->directValue = v;
+  return op;
+}
+
+// returns the variable a statement of the form "var = expr" stores to
+static EEL_F *optGetStoreTarget(opcodeRec *op)
+{
+  functionType *f;
+  if (op->opcodeType != OPCODETYPE_FUNC2 || op->parms[0]->opcodeType != OPCODETYPE_VARPTR) return 0;
+  if (op->fntype == MATH_SIMPLE) return op->fn == FN_ASSIGN ? op->parms[0]->valuePtr : 0;
+  if (optIsUserFunction(op) || !(f=nseel_getFunctionFromTable((int)op->fn))) return 0;
+  return f->afunc == (void*)nseel_asm_assign ? op->parms[0]->valuePtr : 0;
+}
+
+static opcodeRec *optimizeOpcodes(compileContext *ctx, opcodeRec *op, int flags)
+{
+  opcodeRec **parms = op->parms;
+  int x, np, allconst=1;
+  if (op->opcodeType < OPCODETYPE_FUNC1) return op;
+
+  np = op->opcodeType - OPCODETYPE_FUNC1 + 1;
+  for (x = 0; x < np; x ++)
+  {
+    int f = flags;
+    int y;
+    if ((!x && optIsStoreFunction(op)) || optIsUserFunction(op)) f |= OPT_NEEDPTR;
+    for (y = x+1; y < np && !(f&OPT_NEEDPTR); y ++)
+      if (optHasSideEffects(parms[y])) f |= OPT_NEEDPTR; // parameters are dereferenced after all are evaluated
+
+    parms[x] = optimizeOpcodes(ctx,parms[x],f);
+    if (parms[x]->opcodeType != OPCODETYPE_DIRECTVALUE) allconst=0;
+  }
+
+  if (op->fntype == MATH_SIMPLE)
+  {
+    switch (op->fn)
+    {
+      case FN_UPLUS:
+      return parms[0]; // no code, returns its parameter
+      case FN_MULTIPLY:
+        // (not x*0: that's NaN if x is inf or NaN, which the folding below gets right for constant x)
+        if (flags&OPT_NEEDPTR) break;
+        if (optIsConst(parms[1],1.0)) return parms[0];
+        if (optIsConst(parms[0],1.0)) return parms[1];
+      break;
+      case FN_DIVIDE:
+        if (!(flags&OPT_NEEDPTR) && optIsConst(parms[1],1.0)) return parms[0];
+      break;
+      case FN_ADD:
+        if (flags&OPT_NEEDPTR) break;
+        if (optIsConst(parms[1],0.0)) return parms[0];
+        if (optIsConst(parms[0],0.0)) return parms[1];
+      break;
+      case FN_SUB:
+        if (!(flags&OPT_NEEDPTR) && optIsConst(parms[1],0.0)) return parms[0];
+      break;
+    }
+  }
+  else if (parms[0]->opcodeType == OPCODETYPE_DIRECTVALUE && op->fn >= 0 && op->fn < 4)
+  {
+    EEL_F v = parms[0]->directValue;
+    int t = fabs(v) >= NSEEL_CLOSEFACTOR;
+    switch (op->fn)
+    {
+      case 0: // _if
+      return parms[t ? 1 : 2];
+      case 1: // _and
+        if (!t) return optSetConst(op,0.0);
+      break;
+      case 2: // _or
+        if (t) return optSetConst(op,1.0);
+      break;
+      case 3: // loop: with a count below 1 the body is skipped, and the count is the result
+        if (!(v > -2147483649.0 && v < 2147483648.0 && (int)v >= 1)) return parms[0];
+      break;
+    }
+  }
+
+  if (allconst && optIsPureFunction(op))
+  {
+    EEL_F v;
+    if (nseel_interp_evalConstant(ctx,op,&v)) return optSetConst(op,v);
+  }
+  return op;
+}
+
+// folds constants in each statement, and removes stores to variables that are overwritten
+// by a later statement before anything reads them.
+static void optimizeStatements(compileContext *ctx, startPtr *list)
+{
+  startPtr *p;
+  for (p = list; p; p = p->next)
+  {
+    p->startptr = optimizeOpcodes(ctx,(opcodeRec *)p->startptr,0);
+  }
+
+  for (p = list; p; p = p->next)
+  {
+    startPtr *q;
+    EEL_F *var = p->startptr ? optGetStoreTarget((opcodeRec *)p->startptr) : NULL;
+    if (!var) continue;
+
+    for (q = p->next; q; q = q->next)
+    {
+      opcodeRec *op = (opcodeRec *)q->startptr;
+      if (!op) continue;
+      if (optGetStoreTarget(op) == var)
+      {
+        if (!optReferencesVar(op->parms[1],var))
+        {
+          opcodeRec *src = ((opcodeRec *)p->startptr)->parms[1];
+          p->startptr = optHasSideEffects(src) ? src : NULL;
+        }
+        break;
+      }
+      if (optReferencesVar(op,var)) break;
+    }
+  }
+}
+
+
+//---------------------------------------------------------------------------------------------------------------
+// uniform hoisting: subexpressions that only depend on the variables given to NSEEL_VM_SetUniformVars()
+// (and that the code never writes to) are moved to a prologue, which stores them in hidden variables.
+
+static void hoistRemoveStored(opcodeRec *op, EEL_F **vars, int nvars, int store)
+{
+  int x;
+  if (op->opcodeType == OPCODETYPE_VARPTR)
+  {
+    if (store) for (x = 0; x < nvars; x ++) if (vars[x] == op->valuePtr) vars[x]=NULL;
+    return;
+  }
+  if (op->opcodeType < OPCODETYPE_FUNC1) return;
+  for (x = 0; x <= op->opcodeType - OPCODETYPE_FUNC1; x ++)
+    hoistRemoveStored(op->parms[x],vars,nvars,store || optIsUserFunction(op) || (!x && optIsStoreFunction(op)));
+}
+
+static int hoistIsInvariant(opcodeRec *op, EEL_F **vars, int nvars)
+{
+  int x;
+  if (op->opcodeType == OPCODETYPE_DIRECTVALUE) return 1;
+  if (op->opcodeType == OPCODETYPE_VARPTR)
+  {
+    for (x = 0; x < nvars; x ++) if (vars[x] == op->valuePtr) return 1;
+    return 0;
+  }
+  if (!optIsPureFunction(op)) return 0;
+  for (x = 0; x <= op->opcodeType - OPCODETYPE_FUNC1; x ++)
+    if (!hoistIsInvariant(op->parms[x],vars,nvars)) return 0;
+  return 1;
+}
+
+static int hoistOpcodes(compileContext *ctx, opcodeRec **pop, EEL_F **vars, int nvars, int store, int storefn, startPtr ***tail, char *expr)
+{
+  opcodeRec *op = *pop;
+  int x;
+  if (op->opcodeType < OPCODETYPE_FUNC1) return 1;
+
+  if (!store && hoistIsInvariant(op,vars,nvars))
+  {
+    EEL_F *slot = (EEL_F *)newBlock(sizeof(EEL_F),8);
+    opcodeRec *ref = newOpCode(), *ref2 = newOpCode(), *st = newOpCode();
+    startPtr *s = (startPtr *)__newBlock((llBlock **)&ctx->tmpblocks_head,sizeof(startPtr),0);
+    if (!slot || !ref || !ref2 || !st || !s) return 0;
+
+    *slot = 0.0;
+    memset(ref,0,sizeof(opcodeRec));
+    ref->opcodeType = OPCODETYPE_VARPTR;
+    ref->valuePtr = slot;
+    *ref2 = *ref;
+
+    // prologue: _hoist(slot, expr)
+    memset(st,0,sizeof(opcodeRec));
+    st->opcodeType = OPCODETYPE_FUNC2;
+    st->fntype = MATH_FN;
+    st->fn = storefn;
+    st->parms[0] = ref2;
+    st->parms[1] = op;
+
+    s->startptr = st;
+    s->expr = expr;
+    s->next = NULL;
+    **tail = s;
+    *tail = &s->next;
+
+    *pop = ref;
+    return 1;
+  }
+
+  for (x = 0; x <= op->opcodeType - OPCODETYPE_FUNC1; x ++)
+    if (!hoistOpcodes(ctx,&op->parms[x],vars,nvars,store || optIsUserFunction(op) || (!x && optIsStoreFunction(op)),storefn,tail,expr)) return 0;
+  return 1;
+}
+
+// moves uniform subexpressions of list to a new list of statements, returns 0 on error
+static int hoistUniforms(compileContext *ctx, startPtr *list, startPtr **prologue)
+{
+  startPtr *p, **tail=prologue;
+  EEL_F **vars;
+  int nvars=ctx->uniformVars_size, storefn, ok=1;
+
+  *prologue=NULL;
+  if (!nvars) return 1;
+
+  for (storefn = 0; storefn < sizeof(fnTable1)/sizeof(fnTable1[0]); storefn ++)
+    if (fnTable1[storefn].replptrs[0] == (void *)&nseel_hoist_store) break;
+
+  vars = (EEL_F **)newTmpData(nvars*sizeof(EEL_F *));
+  if (!vars) return 1; // not fatal, just slower
+  memcpy(vars,ctx->uniformVars,nvars*sizeof(EEL_F *));
+
+  for (p = list; p; p = p->next)
+    if (p->startptr) hoistRemoveStored((opcodeRec *)p->startptr,vars,nvars,0);
+
+  for (p = list; p && ok; p = p->next)
+    if (p->startptr) ok = hoistOpcodes(ctx,(opcodeRec **)&p->startptr,vars,nvars,0,storefn,&tail,p->expr);
+
+  return ok;
+}
+
+//---------------------------------------------------------------------------------------------------------------
+// generates code for each statement, dropping the ones the optimizer removed. returns 0 on error
+static int compileStatements(compileContext *ctx, startPtr **list, char *_expression, char *expression_start, int lineoffs, int *computable_size)
+{
+  startPtr *p, **pp=list;
+  while ((p=*pp))
+  {
+    void *startptr=p->startptr;
+    ctx->computTableTop=0;
+
+    if (!startptr)
+    {
+      *pp=p->next; // removed by optimizeStatements()
+      continue;
+    }
+
+    if (ctx->interpreted)
+    {
+      if (!nseel_interp_compileStatement(ctx,(opcodeRec *)startptr)) startptr=NULL;
+    }
+    else startptr=(void *)compileOpcodes(ctx,(opcodeRec *)startptr);
+
+    if (ctx->computTableTop > NSEEL_MAX_TEMPSPACE_ENTRIES- /* safety */ 16 - /* alignment */4 ||
+        !startptr) 
+    {
+#ifdef NSEEL_EEL1_COMPAT_MODE
+      if (!startptr) { *pp=p->next; continue; }
+#endif
+      setCompileError(ctx,_expression,(int)(p->expr - expression_start),lineoffs);
+      return 0;
+    }
+
+    if (*computable_size < ctx->computTableTop)
+    {
+      *computable_size=ctx->computTableTop;
+    }
+    p->startptr=startptr;
+    pp=&p->next;
+  }
+  return 1;
+}
+
+static void *assembleInterpCode(compileContext *ctx, int *size)
+{
+  void *code;
+  *size=nseel_interp_finish(ctx,NULL);
+  code = newBlock(*size,16);
+  if (code) nseel_interp_finish(ctx,code);
+  return code;
+}
+
+// compiles the (optimized and hoisted) statements for batched execution, returns NULL if they can't be
+static void *assembleBatchCode(compileContext *ctx, startPtr *list, int *size)
+{
+  startPtr *p;
+  opcodeRec **ops;
+  void *state, *code=NULL;
+  int n=0;
+
+  *size=0;
+  if (!ctx->batchVars_size) return NULL;
+  for (p = list; p; p = p->next) if (p->startptr) n++;
+  if (!n || !(ops = (opcodeRec **)newTmpData(n*sizeof(opcodeRec *)))) return NULL;
+
+  n=0;
+  for (p = list; p; p = p->next) if (p->startptr) ops[n++]=(opcodeRec *)p->startptr;
+  state=nseel_batch_compile(ctx,ops,n);
+
+  if (state)
+  {
+    *size=nseel_batch_finish(state,NULL);
+    code = newBlock(*size,32);
+    if (code) nseel_batch_finish(state,code);
+    else nseel_batch_free(state);
+  }
+  return code;
+}
+
+// marks the batch vars whose incoming value op might read (bit 31 stands for all vars past the 31st).
+// conservative: any reference that isn't the target of a plain assignment counts, whatever the order.
+static void batchMarkReads(compileContext *ctx, opcodeRec *op, int *mask)
+{
+  int x;
+  if (op->opcodeType == OPCODETYPE_VARPTR)
+  {
+    for (x = 0; x < ctx->batchVars_size; x ++)
+      if (ctx->batchVars[x] == op->valuePtr) *mask |= 1 << (x < 31 ? x : 31);
+    return;
+  }
+  if (op->opcodeType < OPCODETYPE_FUNC1) return;
+  for (x = 0; x <= op->opcodeType - OPCODETYPE_FUNC1; x ++)
+    if (x || !optGetStoreTarget(op)) batchMarkReads(ctx,op->parms[x],mask);
+}
+
+// builds one big code segment out of the statements, inserting a mov esi, computable before each item
+static void *assembleNativeCode(compileContext *ctx, startPtr *list, char *tabptr, int *size)
+{
+  startPtr *p=list;
+  unsigned char *code;
+  *size=sizeof(GLUE_RET)+GLUE_FUNC_ENTER_SIZE+GLUE_FUNC_LEAVE_SIZE; // for ret at end :)
+
+  while (p)
+  {
+    *size += GLUE_RESET_ESI(NULL,0);
+    *size+=*(int *)p->startptr;
+    p=p->next;
+  }
+  code = (unsigned char *)newBlock(*size,32);
+  if (code)
+  {
+    unsigned char *writeptr=code;
+    memcpy(writeptr,&GLUE_FUNC_ENTER,GLUE_FUNC_ENTER_SIZE); writeptr += GLUE_FUNC_ENTER_SIZE;
+    p=list;
+    while (p)
+    {
+      int thissize=*(int *)p->startptr;
+      writeptr+=GLUE_RESET_ESI(writeptr,tabptr);
+      //memcpy(writeptr,&GLUE_MOV_ESI_EDI,sizeof(GLUE_MOV_ESI_EDI));
+      //writeptr+=sizeof(GLUE_MOV_ESI_EDI);
+      memcpy(writeptr,(char*)p->startptr + 4,thissize);
+      writeptr += thissize;
+      
+      p=p->next;
+    }
+    memcpy(writeptr,&GLUE_FUNC_LEAVE,GLUE_FUNC_LEAVE_SIZE); writeptr += GLUE_FUNC_LEAVE_SIZE;
+    memcpy(writeptr,&GLUE_RET,sizeof(GLUE_RET)); /*writeptr += sizeof(GLUE_RET);*/
+  }
+  return code;
+}
+
 
+// the result (and its working copies) are in the compile-time arena
 static char *preprocessCode(compileContext *ctx, char *expression)
 {
   char *expression_start=expression;
   int len=0;
   int alloc_len=strlen(expression)+1+64;
-  char *buf=(char *)malloc(alloc_len);
+  char *buf=(char *)__newBlock((llBlock **)&ctx->tmpblocks_head,alloc_len,0);
   int semicnt=0;
   // we need to call onCompileNewLine for each new line we get
  
@@ -1024,8 +1707,8 @@ static char *preprocessCode(compileContext *ctx, char *expression)
   {
     if (len > alloc_len-64)
     {
-      alloc_len = len+128;
-      buf=(char*)realloc(buf,alloc_len);
+      buf=(char*)__growBlock((llBlock **)&ctx->tmpblocks_head,buf,alloc_len,len*2+128);
+      alloc_len = len*2+128;
     }
 
     if (expression[0] == '/')
@@ -1275,7 +1958,12 @@ static char *preprocessCode(compileContext *ctx, char *expression)
 
 					len = l_ptr - buf;
 
-					l_ptr = _strdup(l_ptr); // doesn't need to be preprocessed since it just was
+					{
+						// doesn't need to be preprocessed since it just was
+						char *t = (char *)__newBlock((llBlock **)&ctx->tmpblocks_head,strlen(l_ptr)+1,0);
+						if (t) strcpy(t,l_ptr);
+						l_ptr = t;
+					}
 	       		}
 				if (preprocSymbols[n].op[1]) ++expression;
 
@@ -1368,8 +2056,8 @@ static char *preprocessCode(compileContext *ctx, char *expression)
 
 	    			if (len+thisl > alloc_len-64)
     				{
-      					alloc_len = len+thisl+128;
-      					buf=(char*)realloc(buf,alloc_len);
+      					buf=(char*)__growBlock((llBlock **)&ctx->tmpblocks_head,buf,alloc_len,(len+thisl)*2+128);
+      					alloc_len = (len+thisl)*2+128;
     				}
 
 
@@ -1438,8 +2126,6 @@ static char *preprocessCode(compileContext *ctx, char *expression)
 
 				}
 
-				free(r_ptr);
-				free(l_ptr);
 
 
 				c = ')'; // close parenth below
@@ -1468,7 +2154,7 @@ int main(int argc, char* argv[])
 	compileContext ctx={0};
 	char *p=preprocessCode(&ctx,argv[1]);
 	if (p)printf("%s\n",p);
-	free(p);
+	freeBlocks((llBlock **)&ctx.tmpblocks_head);
 	return 0;
 }
 
@@ -1493,6 +2179,384 @@ static void movestringover(char *str, int amount)
 }
 #endif
 
+//------------------------------------------------------------------------------
+// parse cache: the parse trees of recently compiled code are kept, keyed by the preprocessed source and the
+// names of the VM's variables at the time, so compiling the same code again (a preset being revisited) skips
+// the parser. variables are stored by their index in the VM's table, which the key makes stable; variables
+// the parser created are recreated on a hit, in the same order.
+
+typedef struct
+{
+  int opcodeType, fntype;
+  INT_PTR fn;
+  EEL_F directValue;
+  int var; // OPCODETYPE_VARPTR: var table index, -1-n for regNN, or NSEEL_PARSECACHE_NOVAR
+  int parms[3];
+} parseCacheNode;
+
+typedef struct
+{
+  unsigned int hash, layout;
+  char *source;
+  int source_len;
+  parseCacheNode *nodes;
+  int nodes_size, nodes_alloc;
+  int *statements; // pairs of root node, offset of the statement in source
+  int nstatements;
+  char *vars; // names of the VM's variables before parsing, NSEEL_MAX_VARIABLE_NAMELEN each
+  int nvars;
+  char *newvars; // names of the variables the parser created, NSEEL_MAX_VARIABLE_NAMELEN each
+  int nnewvars;
+  unsigned int lastuse;
+} parseCacheEntry;
+
+#define NSEEL_PARSECACHE_NOVAR 0x7fffffff
+
+static parseCacheEntry nseel_parsecache[NSEEL_PARSECACHE_ENTRIES > 0 ? NSEEL_PARSECACHE_ENTRIES : 1];
+static unsigned int nseel_parsecache_time;
+
+static unsigned int parseCacheHash(unsigned int h, const void *data, int len)
+{
+  const unsigned char *p = (const unsigned char *)data;
+  while (len-- > 0) h = (h ^ *p++) * 16777619; // FNV-1a
+  return h;
+}
+
+static int parseCacheNumVars(compileContext *ctx)
+{
+  int wb, ti, n=0;
+  for (wb = 0; wb < ctx->varTable_numBlocks; wb ++)
+  {
+    for (ti = 0; ti < NSEEL_VARS_PER_BLOCK; ti ++, n ++)
+      if (!ctx->varTable_Names[wb][ti*NSEEL_MAX_VARIABLE_NAMELEN]) return n;
+  }
+  return n;
+}
+
+static const char *parseCacheVarName(compileContext *ctx, int idx)
+{
+  return ctx->varTable_Names[idx/NSEEL_VARS_PER_BLOCK] + (idx%NSEEL_VARS_PER_BLOCK)*NSEEL_MAX_VARIABLE_NAMELEN;
+}
+
+static unsigned int parseCacheLayout(compileContext *ctx, int nvars)
+{
+  unsigned int h = 2166136261u;
+  int x;
+  for (x = 0; x < nvars; x ++) h = parseCacheHash(h,parseCacheVarName(ctx,x),NSEEL_MAX_VARIABLE_NAMELEN);
+  return parseCacheHash(h,&nvars,sizeof(nvars));
+}
+
+// the layout hash only rules entries out, the names themselves have to match for the var indices to be valid
+static int parseCacheSameVars(compileContext *ctx, parseCacheEntry *e, int nvars)
+{
+  int x;
+  if (e->nvars != nvars) return 0;
+  for (x = 0; x < nvars; x ++)
+    if (memcmp(e->vars+x*NSEEL_MAX_VARIABLE_NAMELEN,parseCacheVarName(ctx,x),NSEEL_MAX_VARIABLE_NAMELEN)) return 0;
+  return 1;
+}
+
+static void parseCacheFree(parseCacheEntry *e)
+{
+  free(e->source);
+  free(e->nodes);
+  free(e->statements);
+  free(e->vars);
+  free(e->newvars);
+  memset(e,0,sizeof(parseCacheEntry));
+}
+
+static int parseCacheStoreNode(compileContext *ctx, parseCacheEntry *e, opcodeRec *op)
+{
+  parseCacheNode *n;
+  int idx, x;
+  if (e->nodes_size >= e->nodes_alloc)
+  {
+    parseCacheNode *nn = (parseCacheNode *)realloc(e->nodes,(e->nodes_size*2+64)*sizeof(parseCacheNode));
+    if (!nn) return -1;
+    e->nodes = nn;
+    e->nodes_alloc = e->nodes_size*2+64;
+  }
+  idx = e->nodes_size++;
+  n = e->nodes+idx;
+  memset(n,0,sizeof(parseCacheNode));
+  n->opcodeType = op->opcodeType;
+  n->fntype = op->fntype;
+  n->fn = op->fn;
+  n->directValue = op->directValue;
+  n->var = NSEEL_PARSECACHE_NOVAR;
+
+  if (op->opcodeType == OPCODETYPE_VARPTR)
+  {
+    if (op->valuePtr >= nseel_globalregs && op->valuePtr < nseel_globalregs+100)
+      n->var = -1 - (int)(op->valuePtr - nseel_globalregs);
+    for (x = 0; x < ctx->varTable_numBlocks && n->var == NSEEL_PARSECACHE_NOVAR; x ++)
+      if (op->valuePtr >= ctx->varTable_Values[x] && op->valuePtr < ctx->varTable_Values[x]+NSEEL_VARS_PER_BLOCK)
+        n->var = x*NSEEL_VARS_PER_BLOCK + (int)(op->valuePtr - ctx->varTable_Values[x]);
+    if (n->var == NSEEL_PARSECACHE_NOVAR) return -1;
+  }
+  else if (op->opcodeType >= OPCODETYPE_FUNC1)
+  {
+    for (x = 0; x <= op->opcodeType - OPCODETYPE_FUNC1; x ++)
+    {
+      int p = parseCacheStoreNode(ctx,e,op->parms[x]);
+      if (p < 0) return -1;
+      e->nodes[idx].parms[x] = p; // e->nodes may have moved
+    }
+  }
+  return idx;
+}
+
+static opcodeRec *parseCacheLoadNode(compileContext *ctx, parseCacheEntry *e, int idx)
+{
+  parseCacheNode *n = e->nodes+idx;
+  opcodeRec *op = newOpCode();
+  int x;
+  if (!op) return 0;
+  memset(op,0,sizeof(opcodeRec));
+  op->opcodeType = n->opcodeType;
+  op->fntype = n->fntype;
+  op->fn = n->fn;
+  op->directValue = n->directValue;
+  if (op->opcodeType == OPCODETYPE_VARPTR)
+  {
+    if (n->var < 0) op->valuePtr = nseel_globalregs + (-1 - n->var);
+    else op->valuePtr = ctx->varTable_Values[n->var/NSEEL_VARS_PER_BLOCK] + n->var%NSEEL_VARS_PER_BLOCK;
+  }
+  else if (op->opcodeType >= OPCODETYPE_FUNC1)
+  {
+    for (x = 0; x <= op->opcodeType - OPCODETYPE_FUNC1; x ++)
+      if (!(op->parms[x] = parseCacheLoadNode(ctx,e,n->parms[x]))) return 0;
+  }
+  return op;
+}
+
+// stores the statements parsed from source (the preprocessed code, before it was split up)
+static void parseCacheStore(compileContext *ctx, const char *source, int source_len, unsigned int layout, int nvars_before,
+                            startPtr *list, char *expression_start)
+{
+  parseCacheEntry e={0}, *slot;
+  startPtr *p;
+  int x, nvars=parseCacheNumVars(ctx);
+
+  if (NSEEL_PARSECACHE_ENTRIES < 1) return;
+  e.hash = parseCacheHash(2166136261u,source,source_len);
+  e.layout = layout;
+  e.source_len = source_len;
+  for (p = list; p; p = p->next) e.nstatements++;
+  e.nvars = nvars_before;
+  e.nnewvars = nvars-nvars_before;
+
+  if (!(e.source = (char *)malloc(source_len)) ||
+      !(e.statements = (int *)malloc((e.nstatements*2+1)*sizeof(int))) ||
+      !(e.vars = (char *)malloc(e.nvars*NSEEL_MAX_VARIABLE_NAMELEN+1)) ||
+      !(e.newvars = (char *)malloc(e.nnewvars*NSEEL_MAX_VARIABLE_NAMELEN+1)))
+  {
+    parseCacheFree(&e);
+    return;
+  }
+  memcpy(e.source,source,source_len);
+  for (x = 0; x < e.nvars; x ++)
+    memcpy(e.vars+x*NSEEL_MAX_VARIABLE_NAMELEN,parseCacheVarName(ctx,x),NSEEL_MAX_VARIABLE_NAMELEN);
+  for (x = 0; x < e.nnewvars; x ++)
+    memcpy(e.newvars+x*NSEEL_MAX_VARIABLE_NAMELEN,parseCacheVarName(ctx,nvars_before+x),NSEEL_MAX_VARIABLE_NAMELEN);
+
+  for (x = 0, p = list; p; p = p->next, x += 2)
+  {
+    if ((e.statements[x] = parseCacheStoreNode(ctx,&e,(opcodeRec *)p->startptr)) < 0)
+    {
+      parseCacheFree(&e);
+      return;
+    }
+    e.statements[x+1] = (int)(p->expr - expression_start);
+  }
+
+  NSEEL_HOSTSTUB_EnterMutex();
+  slot = nseel_parsecache;
+  for (x = 1; x < NSEEL_PARSECACHE_ENTRIES; x ++) // least recently used
+    if (nseel_parsecache[x].lastuse < slot->lastuse) slot = nseel_parsecache+x;
+  parseCacheFree(slot);
+  e.lastuse = ++nseel_parsecache_time;
+  *slot = e;
+  NSEEL_HOSTSTUB_LeaveMutex();
+}
+
+// rebuilds the statements of source, returns 0 if it wasn't cached
+static int parseCacheLookup(compileContext *ctx, const char *source, int source_len, unsigned int layout, int nvars,
+                            startPtr **list, char *expression_start)
+{
+  unsigned int hash = parseCacheHash(2166136261u,source,source_len);
+  parseCacheEntry *e=NULL;
+  startPtr **tail=list;
+  int x, ok=1;
+
+  NSEEL_HOSTSTUB_EnterMutex();
+  for (x = 0; x < NSEEL_PARSECACHE_ENTRIES && !e; x ++)
+  {
+    parseCacheEntry *t = nseel_parsecache+x;
+    if (t->source && t->hash == hash && t->layout == layout && t->source_len == source_len &&
+        !memcmp(t->source,source,source_len) && parseCacheSameVars(ctx,t,nvars)) e=t;
+  }
+  if (e)
+  {
+    e->lastuse = ++nseel_parsecache_time;
+
+    for (x = 0; x < e->nnewvars; x ++)
+    {
+      char name[NSEEL_MAX_VARIABLE_NAMELEN+1];
+      memcpy(name,e->newvars+x*NSEEL_MAX_VARIABLE_NAMELEN,NSEEL_MAX_VARIABLE_NAMELEN);
+      name[NSEEL_MAX_VARIABLE_NAMELEN]=0;
+      if (!NSEEL_VM_regvar(ctx,name)) ok=0;
+    }
+
+    *list=NULL;
+    for (x = 0; x < e->nstatements && ok; x ++)
+    {
+      startPtr *s=(startPtr *)__newBlock((llBlock **)&ctx->tmpblocks_head,sizeof(startPtr),0);
+      if (!s || !(s->startptr = parseCacheLoadNode(ctx,e,e->statements[x*2]))) ok=0;
+      else
+      {
+        s->expr = expression_start + e->statements[x*2+1];
+        s->next = NULL;
+        *tail = s;
+        tail = &s->next;
+      }
+    }
+  }
+  NSEEL_HOSTSTUB_LeaveMutex();
+  return e && ok;
+}
+
+static void parseCacheClear()
+{
+  int x;
+  NSEEL_HOSTSTUB_EnterMutex();
+  for (x = 0; x < NSEEL_PARSECACHE_ENTRIES; x ++) parseCacheFree(nseel_parsecache+x);
+  NSEEL_HOSTSTUB_LeaveMutex();
+}
+
+//------------------------------------------------------------------------------
+// profiling: with NSEEL_PROFILE_enabled set, each execution of a code handle is timed
+
+int NSEEL_PROFILE_enabled=0;
+
+static codeHandleType *nseel_profile_handles;
+
+static double profileTime() // seconds
+{
+#ifdef _WIN32
+  static double scale;
+  LARGE_INTEGER t;
+  if (!scale)
+  {
+    LARGE_INTEGER f;
+    QueryPerformanceFrequency(&f);
+    scale = 1.0/(double)f.QuadPart;
+  }
+  QueryPerformanceCounter(&t);
+  return (double)t.QuadPart*scale;
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC,&ts);
+  return (double)ts.tv_sec + ts.tv_nsec*0.000000001;
+#endif
+}
+
+static void profileRecord(codeHandleType *h, double t, int runs)
+{
+  h->prof_runs += runs;
+  h->prof_time += t;
+  if (t > h->prof_worst) h->prof_worst = t;
+}
+
+static void profileLink(codeHandleType *h)
+{
+  NSEEL_HOSTSTUB_EnterMutex();
+  h->prof_prev = NULL;
+  h->prof_next = nseel_profile_handles;
+  if (nseel_profile_handles) nseel_profile_handles->prof_prev = h;
+  nseel_profile_handles = h;
+  NSEEL_HOSTSTUB_LeaveMutex();
+}
+
+static void profileUnlink(codeHandleType *h)
+{
+  NSEEL_HOSTSTUB_EnterMutex();
+  if (h->prof_prev) h->prof_prev->prof_next = h->prof_next;
+  else nseel_profile_handles = h->prof_next;
+  if (h->prof_next) h->prof_next->prof_prev = h->prof_prev;
+  NSEEL_HOSTSTUB_LeaveMutex();
+}
+
+static int profileCompare(const void *a, const void *b)
+{
+  double ta = (*(codeHandleType **)a)->prof_time, tb = (*(codeHandleType **)b)->prof_time;
+  return ta < tb ? 1 : ta > tb ? -1 : 0;
+}
+
+void NSEEL_code_setlabel(NSEEL_CODEHANDLE code, const char *label)
+{
+  codeHandleType *h = (codeHandleType *)code;
+  if (!h) return;
+  strncpy(h->prof_label,label ? label : "",sizeof(h->prof_label)-1);
+  h->prof_label[sizeof(h->prof_label)-1]=0;
+}
+
+int NSEEL_code_getprofile(NSEEL_CODEHANDLE code, double *stats)
+{
+  codeHandleType *h = (codeHandleType *)code;
+  if (!h) return 0;
+  stats[0] = h->prof_runs;
+  stats[1] = h->prof_time;
+  stats[2] = h->prof_worst;
+  return h->prof_runs > 0.0;
+}
+
+void NSEEL_profile_reset()
+{
+  codeHandleType *h;
+  NSEEL_HOSTSTUB_EnterMutex();
+  for (h = nseel_profile_handles; h; h = h->prof_next) h->prof_runs = h->prof_time = h->prof_worst = 0.0;
+  NSEEL_HOSTSTUB_LeaveMutex();
+}
+
+int NSEEL_profile_dump(char *buf, int buf_size, int maxitems)
+{
+  codeHandleType *h, **list;
+  int n=0, x, len=0;
+
+  if (!buf || buf_size < 1) return 0;
+  buf[0]=0;
+
+  NSEEL_HOSTSTUB_EnterMutex();
+  for (h = nseel_profile_handles; h; h = h->prof_next) if (h->prof_runs > 0.0) n++;
+  if (n && (list = (codeHandleType **)malloc(n*sizeof(codeHandleType *))))
+  {
+    n=0;
+    for (h = nseel_profile_handles; h; h = h->prof_next) if (h->prof_runs > 0.0) list[n++]=h;
+    qsort(list,n,sizeof(codeHandleType *),profileCompare);
+
+    for (x = 0; x < n && (maxitems <= 0 || x < maxitems) && len < buf_size-1; x ++)
+    {
+      int l;
+      h=list[x];
+      l=_snprintf(buf+len,buf_size-len,"%-48s %10.0f runs %10.3f ms total %9.3f us avg %9.3f us worst\n",
+                  h->prof_label[0] ? h->prof_label : "(unnamed)",h->prof_runs,
+                  h->prof_time*1000.0,h->prof_time*1000000.0/h->prof_runs,h->prof_worst*1000000.0);
+      if (l < 0 || l >= buf_size-len) // truncated
+      {
+        buf[buf_size-1]=0;
+        len=buf_size-1;
+        break;
+      }
+      len+=l;
+    }
+    free(list);
+  }
+  NSEEL_HOSTSTUB_LeaveMutex();
+  return len;
+}
+
 //------------------------------------------------------------------------------
 NSEEL_CODEHANDLE NSEEL_code_compile(NSEEL_VMCTX _ctx, char *_expression, int lineoffs)
 {
@@ -1502,6 +2566,11 @@ NSEEL_CODEHANDLE NSEEL_code_compile(NSEEL_VMCTX _ctx, char *_expression, int lin
   codeHandleType *handle;
   startPtr *scode=NULL;
   startPtr *startpts=NULL;
+  startPtr *prologue=NULL;
+  int size=0;
+  char *source_copy;
+  int source_len, nvars=0, cached=0;
+  unsigned int layout=0;
 
   if (!ctx) return 0;
 
@@ -1509,10 +2578,10 @@ NSEEL_CODEHANDLE NSEEL_code_compile(NSEEL_VMCTX _ctx, char *_expression, int lin
 
   if (!_expression || !*_expression) return 0;
 
-  freeBlocks((llBlock **)&ctx->tmpblocks_head);  // free blocks
+  resetBlocks((llBlock **)&ctx->tmpblocks_head);  // empty the arena
   freeBlocks((llBlock **)&ctx->blocks_head);  // free blocks
   memset(ctx->l_stats,0,sizeof(ctx->l_stats));
-  free(ctx->compileLineRecs); ctx->compileLineRecs=0; ctx->compileLineRecs_size=0; ctx->compileLineRecs_alloc=0;
+  ctx->compileLineRecs_size=0;
 
   handle = (codeHandleType*)newBlock(sizeof(codeHandleType),8);
 
@@ -1525,13 +2594,28 @@ NSEEL_CODEHANDLE NSEEL_code_compile(NSEEL_VMCTX _ctx, char *_expression, int lin
 
   expression_start=expression=preprocessCode(ctx,_expression);
 
+  source_len=(int)strlen(expression_start)+1;
+  source_copy=(char *)newTmpData(source_len);
+  if (source_copy)
+  {
+    memcpy(source_copy,expression_start,source_len); // the parse loop splits expression_start up
+    nvars=parseCacheNumVars(ctx);
+    layout=parseCacheLayout(ctx,nvars);
+    if (parseCacheLookup(ctx,source_copy,source_len,layout,nvars,&startpts,expression_start))
+    {
+      for (scode=startpts; scode->next; scode=scode->next);
+      cached=1;
+      source_copy=NULL;
+    }
+    else startpts=NULL;
+  }
 
-  while (*expression)
+  // parse all statements first, so the optimizer can look across them
+  while (!cached && *expression)
   {
 	void *startptr;
     char *expr;
     ctx->colCount=0;
-	ctx->computTableTop=0;
 
     // single out segment
     while (*expression == ';' || isspace(*expression)) ++expression;
@@ -1545,57 +2629,65 @@ NSEEL_CODEHANDLE NSEEL_code_compile(NSEEL_VMCTX _ctx, char *_expression, int lin
     
     startptr=nseel_compileExpression(ctx,expr);
 
-    if (ctx->computTableTop > NSEEL_MAX_TEMPSPACE_ENTRIES- /* safety */ 16 - /* alignment */4 ||
-        !startptr) 
+    if (!startptr) 
     { 
-      int byteoffs = expr - expression_start;
-      int destoffs,linenumber;
-      char buf[21], *p;
-      int x,le;
-
 #ifdef NSEEL_EEL1_COMPAT_MODE
-      if (!startptr) continue;
+      continue;
 #endif
-      if (ctx->errVar > 0) byteoffs += ctx->errVar;
-      linenumber=findByteOffsetInSource(ctx,byteoffs,&destoffs);
-      if (destoffs < 0) destoffs=0;
-
-      le=strlen(_expression);
-      if (destoffs >= le) destoffs=le;
-      p= _expression + destoffs;
-      for (x = 0;x < 20; x ++)
-      {
-	      if (!*p || *p == '\r' || *p == '\n') break;
-	      buf[x]=*p++;
-      }
-      buf[x]=0;
-
-      _snprintf(ctx->last_error_string,ARRAYSIZE(ctx->last_error_string),"Around line %d '%s'",linenumber+lineoffs,buf);
-
-      ctx->last_error_string[sizeof(ctx->last_error_string)-1]=0;
+      setCompileError(ctx,_expression,(int)(expr - expression_start) + (ctx->errVar > 0 ? ctx->errVar : 0),lineoffs);
       scode=NULL; 
       break; 
     }
-    if (computable_size < ctx->computTableTop)
-    {
-      computable_size=ctx->computTableTop;
-    }
 
     {
-      startPtr *tmp=(startPtr*) __newBlock((llBlock **)&ctx->tmpblocks_head,sizeof(startPtr));
+      startPtr *tmp=(startPtr*) __newBlock((llBlock **)&ctx->tmpblocks_head,sizeof(startPtr),0);
       if (!tmp) break;
 
       tmp->startptr = startptr;
-    tmp->next=NULL;
-    if (!scode) scode=startpts=tmp;
+      tmp->expr = expr;
+      tmp->next=NULL;
+      if (!scode) scode=startpts=tmp;
+      else
+      {
+        scode->next=tmp;
+        scode=tmp;
+      }
+    }
+  }
+
+  if (source_copy && scode) parseCacheStore(ctx,source_copy,source_len,layout,nvars,startpts,expression_start);
+
+  if (scode)
+  {
+    if (!ctx->unoptimized) optimizeStatements(ctx,startpts);
+
+    if (!ctx->unoptimized && !hoistUniforms(ctx,startpts,&prologue)) scode=NULL;
     else
     {
-      scode->next=tmp;
-      scode=tmp;
+      handle->batch=assembleBatchCode(ctx,startpts,&size);
+      ctx->l_stats[1]+=size;
+      handle->batch_reads=-1;
+      if (handle->batch)
+      {
+        startPtr *p;
+        handle->batch_reads=0;
+        for (p = startpts; p; p = p->next)
+          if (p->startptr) batchMarkReads(ctx,(opcodeRec *)p->startptr,&handle->batch_reads);
+      }
     }
+
+    if (scode && prologue)
+    {
+      if (!compileStatements(ctx,&prologue,_expression,expression_start,lineoffs,&computable_size)) scode=NULL;
+      else if (ctx->interpreted && prologue)
+      {
+        handle->prologue=assembleInterpCode(ctx,&size);
+        ctx->l_stats[1]+=size;
+      }
+    }
+    if (scode && !compileStatements(ctx,&startpts,_expression,expression_start,lineoffs,&computable_size)) scode=NULL;
   }
-}
-  free(ctx->compileLineRecs); ctx->compileLineRecs=0; ctx->compileLineRecs_size=0; ctx->compileLineRecs_alloc=0;
+  ctx->compileLineRecs_size=0;
 
   // check to see if failed on the first startingCode
   if (!scode)
@@ -1605,50 +2697,46 @@ NSEEL_CODEHANDLE NSEEL_code_compile(NSEEL_VMCTX _ctx, char *_expression, int lin
   else 
   {
     char *tabptr = (char *)(handle->workTable=calloc(computable_size+64,  sizeof(EEL_F)));
-    startPtr *p=startpts;
-    int size=sizeof(GLUE_RET)+GLUE_FUNC_ENTER_SIZE+GLUE_FUNC_LEAVE_SIZE; // for ret at end :)
 
     if (((INT_PTR)tabptr)&31)
       tabptr += 32-(((INT_PTR)tabptr)&31);
 
-    // now we build one big code segment out of our list of them, inserting a mov esi, computable before each item
-    while (p)
+    if (ctx->interpreted)
     {
-      size += GLUE_RESET_ESI(NULL,0);
-      size+=*(int *)p->startptr;
-      p=p->next;
+      handle->code = assembleInterpCode(ctx,&size);
+      handle->interpreted=1;
     }
-    handle->code = newBlock(size,32);
-    if (handle->code)
+    else
     {
-      unsigned char *writeptr=(unsigned char *)handle->code;
-      memcpy(writeptr,&GLUE_FUNC_ENTER,GLUE_FUNC_ENTER_SIZE); writeptr += GLUE_FUNC_ENTER_SIZE;
-      p=startpts;
-      while (p)
+      if (prologue)
       {
-        int thissize=*(int *)p->startptr;
-        writeptr+=GLUE_RESET_ESI(writeptr,tabptr);
-        //memcpy(writeptr,&GLUE_MOV_ESI_EDI,sizeof(GLUE_MOV_ESI_EDI));
-        //writeptr+=sizeof(GLUE_MOV_ESI_EDI);
-        memcpy(writeptr,(char*)p->startptr + 4,thissize);
-        writeptr += thissize;
-      
-        p=p->next;
+        handle->prologue = assembleNativeCode(ctx,prologue,tabptr,&size);
+        ctx->l_stats[1]+=size;
       }
-      memcpy(writeptr,&GLUE_FUNC_LEAVE,GLUE_FUNC_LEAVE_SIZE); writeptr += GLUE_FUNC_LEAVE_SIZE;
-      memcpy(writeptr,&GLUE_RET,sizeof(GLUE_RET)); /*writeptr += sizeof(GLUE_RET);*/
-      ctx->l_stats[1]=size;
+      handle->code = assembleNativeCode(ctx,startpts,tabptr,&size);
     }
+    ctx->l_stats[1]+=size;
     handle->blocks = ctx->blocks_head;
     ctx->blocks_head=0;
 
   }
-  freeBlocks((llBlock **)&ctx->tmpblocks_head);  // free blocks
+  {
+    llBlock *llb;
+    nseel_evallib_stats[5]=nseel_evallib_stats[6]=0;
+    for (llb = (llBlock *)ctx->tmpblocks_head; llb; llb = llb->next)
+    {
+      nseel_evallib_stats[5]+=llb->sizeused;
+      nseel_evallib_stats[6]++;
+    }
+  }
+  resetBlocks((llBlock **)&ctx->tmpblocks_head);  // empty the arena
   freeBlocks((llBlock **)&ctx->blocks_head);  // free blocks
+  nseel_interp_free(ctx);
 
   if (handle)
   {
     memcpy(handle->code_stats,ctx->l_stats,sizeof(ctx->l_stats));
+    profileLink(handle);
     nseel_evallib_stats[0]+=ctx->l_stats[0];
     nseel_evallib_stats[1]+=ctx->l_stats[1];
     nseel_evallib_stats[2]+=ctx->l_stats[2];
@@ -1657,20 +2745,16 @@ NSEEL_CODEHANDLE NSEEL_code_compile(NSEEL_VMCTX _ctx, char *_expression, int lin
   }
   memset(ctx->l_stats,0,sizeof(ctx->l_stats));
 
-  free(expression_start);
-
   return (NSEEL_CODEHANDLE)handle;
 }
 
 //------------------------------------------------------------------------------
-void NSEEL_code_execute(NSEEL_CODEHANDLE code)
+static void executeCode(codeHandleType *h, void *code)
 {
   INT_PTR tabptr;
   INT_PTR codeptr;
-  codeHandleType *h = (codeHandleType *)code;
-  if (!h || !h->code) return;
 
-  codeptr = (INT_PTR) h->code;
+  codeptr = (INT_PTR) code;
 #if 0
   {
 	unsigned int *p=(unsigned int *)codeptr;
@@ -1685,11 +2769,90 @@ void NSEEL_code_execute(NSEEL_CODEHANDLE code)
   tabptr=(INT_PTR)h->workTable;
   if (tabptr&31)
     tabptr += 32-((tabptr)&31);
+
+  if (h->interpreted)
+  {
+    nseel_interp_execute(code,(EEL_F *)tabptr);
+    return;
+  }
   //printf("calling code!\n");
   GLUE_CALL_CODE(tabptr,codeptr);
 
 }
 
+void NSEEL_code_execute(NSEEL_CODEHANDLE code)
+{
+  codeHandleType *h = (codeHandleType *)code;
+  if (!h || !h->code) return;
+  if (NSEEL_PROFILE_enabled)
+  {
+    double t=profileTime();
+    executeCode(h,h->code);
+    profileRecord(h,profileTime()-t,1);
+  }
+  else executeCode(h,h->code);
+}
+
+void NSEEL_code_execute_prologue(NSEEL_CODEHANDLE code)
+{
+  codeHandleType *h = (codeHandleType *)code;
+  if (!h || !h->prologue) return;
+  if (NSEEL_PROFILE_enabled)
+  {
+    double t=profileTime();
+    executeCode(h,h->prologue);
+    profileRecord(h,profileTime()-t,0); // counted with the executions it precedes
+  }
+  else executeCode(h,h->prologue);
+}
+
+int NSEEL_code_getbatchreads(NSEEL_CODEHANDLE code)
+{
+  codeHandleType *h = (codeHandleType *)code;
+  return (h && h->batch) ? h->batch_reads : -1;
+}
+
+int NSEEL_code_execute_batch(NSEEL_CODEHANDLE code, EEL_F **data, int nitems)
+{
+  codeHandleType *h = (codeHandleType *)code;
+  if (!h || !h->batch) return 0;
+  if (NSEEL_PROFILE_enabled)
+  {
+    double t=profileTime();
+    nseel_batch_execute(h->batch,data,nitems);
+    profileRecord(h,profileTime()-t,nitems);
+  }
+  else nseel_batch_execute(h->batch,data,nitems);
+  return 1;
+}
+
+NSEEL_CODEHANDLE NSEEL_code_clone_batch(NSEEL_CODEHANDLE code)
+{
+  codeHandleType *h = (codeHandleType *)code, *c;
+  llBlock *blocks=NULL;
+  int size;
+  if (!h || !h->batch) return 0;
+
+  size=nseel_batch_clone(h->batch,NULL);
+  c=(codeHandleType *)__newBlock_align(&blocks,sizeof(codeHandleType),8,0);
+  if (!c) return 0;
+  memset(c,0,sizeof(codeHandleType));
+  if (!(c->batch=__newBlock_align(&blocks,size,32,0)))
+  {
+    freeBlocks(&blocks);
+    return 0;
+  }
+  nseel_batch_clone(h->batch,c->batch);
+  c->batch_reads=h->batch_reads;
+  c->blocks=blocks;
+
+  c->code_stats[1]=size;
+  profileLink(c);
+  nseel_evallib_stats[1]+=size;
+  ++nseel_evallib_stats[4];
+  return (NSEEL_CODEHANDLE)c;
+}
+
 
 char *NSEEL_code_getcodeerror(NSEEL_VMCTX ctx)
 {
@@ -1705,6 +2868,7 @@ void NSEEL_code_free(NSEEL_CODEHANDLE code)
   if (h != NULL)
   {
     free(h->workTable);
+    profileUnlink(h);
     nseel_evallib_stats[0]-=h->code_stats[0];
     nseel_evallib_stats[1]-=h->code_stats[1];
     nseel_evallib_stats[2]-=h->code_stats[2];
@@ -1737,6 +2901,14 @@ void NSEEL_VM_resetvars(NSEEL_VMCTX _ctx)
     ctx->varTable_Names=0;
 
     ctx->varTable_numBlocks=0;
+
+    free(ctx->uniformVars); // these pointed into the var table
+    ctx->uniformVars=0;
+    ctx->uniformVars_size=0;
+
+    free(ctx->batchVars);
+    ctx->batchVars=0;
+    ctx->batchVars_size=0;
   }
 }
 
@@ -1758,6 +2930,7 @@ void NSEEL_VM_free(NSEEL_VMCTX _ctx) // free when done with a VM and ALL of its
 
     freeBlocks((llBlock **)&ctx->tmpblocks_head);  // free blocks
     freeBlocks((llBlock **)&ctx->blocks_head);  // free blocks
+    nseel_interp_free(ctx);
     free(ctx->compileLineRecs);
     free(ctx);
   }
@@ -1783,6 +2956,56 @@ void NSEEL_VM_SetCustomFuncThis(NSEEL_VMCTX ctx, void *thisptr)
   }
 }
 
+void NSEEL_VM_SetInterpreted(NSEEL_VMCTX ctx, int interpreted)
+{
+  if (ctx)
+  {
+    compileContext *c=(compileContext*)ctx;
+    c->interpreted=interpreted;
+  }
+}
+
+void NSEEL_VM_SetOptimize(NSEEL_VMCTX ctx, int optimize)
+{
+  if (ctx)
+  {
+    compileContext *c=(compileContext*)ctx;
+    c->unoptimized=!optimize;
+  }
+}
+
+void NSEEL_VM_SetUniformVars(NSEEL_VMCTX ctx, EEL_F **vars, int nvars)
+{
+  if (ctx)
+  {
+    compileContext *c=(compileContext*)ctx;
+    free(c->uniformVars);
+    c->uniformVars=0;
+    c->uniformVars_size=0;
+    if (vars && nvars>0 && (c->uniformVars=(EEL_F **)malloc(nvars*sizeof(EEL_F *))))
+    {
+      memcpy(c->uniformVars,vars,nvars*sizeof(EEL_F *));
+      c->uniformVars_size=nvars;
+    }
+  }
+}
+
+void NSEEL_VM_SetBatchVars(NSEEL_VMCTX ctx, EEL_F **vars, int nvars)
+{
+  if (ctx)
+  {
+    compileContext *c=(compileContext*)ctx;
+    free(c->batchVars);
+    c->batchVars=0;
+    c->batchVars_size=0;
+    if (vars && nvars>0 && (c->batchVars=(EEL_F **)malloc(nvars*sizeof(EEL_F *))))
+    {
+      memcpy(c->batchVars,vars,nvars*sizeof(EEL_F *));
+      c->batchVars_size=nvars;
+    }
+  }
+}
+
 
 
 
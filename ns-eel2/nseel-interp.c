@@ -0,0 +1,1360 @@
+/*
+  Expression Evaluator Library (NS-EEL) v2
+
+  nseel-interp.c: bytecode backend for NSEEL_VM_SetInterpreted(), and batched execution (NSEEL_code_execute_batch())
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+*/
+
+/*
+  The parse tree is flattened into a stack machine that works on EEL_F pointers,
+  exactly like the native templates do (eax = pointer to result): functions like
+  min()/max()/_set()/megabuf() return pointers to their parameters or to RAM, and
+  everything else writes its result to the next slot of the code handle's worktable.
+  Temporaries are allocated in the same order as the native code, and loops restore
+  the temp pointer each iteration, so results (including aliasing quirks) match.
+
+  Functions are mapped by the template they use (fnTable1 and any functions added
+  with NSEEL_addfunction*() using the generic templates), calling the same C
+  functions the native code would call. Functions with custom machine code can't
+  be interpreted, and fail to compile.
+*/
+
+#include "ns-eel-int.h"
+#include <math.h>
+#include <string.h>
+
+#if defined(__GNUC__) && !defined(EEL_INTERP_NO_THREADED)
+#define EEL_INTERP_THREADED // dispatch with computed gotos
+#endif
+
+#define INTERP_OPS \
+  OP(END) OP(RESET) OP(PUSHPTR) OP(PUSHCONST) OP(TEMPCONST) \
+  OP(JMP) OP(JMP_IF_FALSE) OP(JMP_IF_TRUE) \
+  OP(LOOP_BEGIN) OP(LOOP_NEXT) OP(WHILE_BEGIN) OP(WHILE_NEXT) \
+  OP(EXEC) OP(SET) OP(MIN) OP(MAX) \
+  OP(ADD) OP(SUB) OP(MUL) OP(DIV) OP(MOD) OP(OR) OP(AND) \
+  OP(ADDOP) OP(SUBOP) OP(MULOP) OP(DIVOP) OP(MODOP) OP(OROP) OP(ANDOP) \
+  OP(UMINUS) OP(ABS) OP(SQR) OP(SQRT) OP(SIN) OP(COS) OP(TAN) OP(LOG) OP(LOG10) \
+  OP(INVSQRT) OP(SIGN) OP(NOT) \
+  OP(EQUAL) OP(NOTEQ) OP(BELOW) OP(BELEQ) OP(ABOVE) OP(ABOEQ) \
+  OP(CALL_1PDD) OP(CALL_2PDD) OP(CALL_2PDDS) OP(CALL_1PP) OP(CALL_2PP) \
+  OP(MEGABUF) \
+  OP(GENERIC1) OP(GENERIC2) OP(GENERIC3) \
+  OP(GENERIC1_RETD) OP(GENERIC2_RETD) OP(GENERIC3_RETD)
+
+#define OP(x) IOP_##x,
+enum { INTERP_OPS IOP_NUM };
+#undef OP
+
+typedef struct
+{
+  int op;
+  int parm; // jump target, constant index, or parameter count
+  void *ptr; // value or function pointer
+  void *ctx; // context pointer for megabuf/generic functions
+} interpOp;
+
+typedef struct
+{
+  int count;
+  EEL_F *tp;
+} interpLoop;
+
+typedef struct
+{
+  interpOp *ops;
+  EEL_F *consts;
+  EEL_F **stack;
+  interpLoop *loops;
+} interpCode;
+
+typedef struct
+{
+  interpOp *ops;
+  int ops_size, ops_alloc;
+  EEL_F *consts;
+  int consts_size, consts_alloc;
+  int depth, maxdepth;
+  int loopdepth, maxloopdepth;
+} interpState;
+
+typedef EEL_F (*interp_fn_1pdd)(EEL_F);
+typedef EEL_F (*interp_fn_2pdd)(EEL_F, EEL_F);
+typedef EEL_F (NSEEL_CGEN_CALL *interp_fn_1pp)(EEL_F *);
+typedef EEL_F (NSEEL_CGEN_CALL *interp_fn_2pp)(EEL_F *, EEL_F *);
+typedef EEL_F * (NSEEL_CGEN_CALL *interp_fn_megabuf)(void *, int);
+typedef EEL_F * (NSEEL_CGEN_CALL *interp_fn_g1)(void *, EEL_F *);
+typedef EEL_F * (NSEEL_CGEN_CALL *interp_fn_g2)(void *, EEL_F *, EEL_F *);
+typedef EEL_F * (NSEEL_CGEN_CALL *interp_fn_g3)(void *, EEL_F *, EEL_F *, EEL_F *);
+typedef EEL_F (NSEEL_CGEN_CALL *interp_fn_g1d)(void *, EEL_F *);
+typedef EEL_F (NSEEL_CGEN_CALL *interp_fn_g2d)(void *, EEL_F *, EEL_F *);
+typedef EEL_F (NSEEL_CGEN_CALL *interp_fn_g3d)(void *, EEL_F *, EEL_F *, EEL_F *);
+
+#define DECL_ASMFUNC(x)         \
+  void nseel_asm_##x(void);        \
+  void nseel_asm_##x##_end(void);    \
+
+  DECL_ASMFUNC(sin)
+  DECL_ASMFUNC(cos)
+  DECL_ASMFUNC(tan)
+  DECL_ASMFUNC(1pdd)
+  DECL_ASMFUNC(2pdd)
+  DECL_ASMFUNC(2pdds)
+  DECL_ASMFUNC(1pp)
+  DECL_ASMFUNC(2pp)
+  DECL_ASMFUNC(sqr)
+  DECL_ASMFUNC(sqrt)
+  DECL_ASMFUNC(log)
+  DECL_ASMFUNC(log10)
+  DECL_ASMFUNC(abs)
+  DECL_ASMFUNC(min)
+  DECL_ASMFUNC(max)
+  DECL_ASMFUNC(sign)
+  DECL_ASMFUNC(bnot)
+  DECL_ASMFUNC(equal)
+  DECL_ASMFUNC(notequal)
+  DECL_ASMFUNC(below)
+  DECL_ASMFUNC(above)
+  DECL_ASMFUNC(beloweq)
+  DECL_ASMFUNC(aboveeq)
+  DECL_ASMFUNC(assign)
+  DECL_ASMFUNC(add)
+  DECL_ASMFUNC(sub)
+  DECL_ASMFUNC(add_op)
+  DECL_ASMFUNC(sub_op)
+  DECL_ASMFUNC(mul)
+  DECL_ASMFUNC(div)
+  DECL_ASMFUNC(mul_op)
+  DECL_ASMFUNC(div_op)
+  DECL_ASMFUNC(mod)
+  DECL_ASMFUNC(mod_op)
+  DECL_ASMFUNC(or)
+  DECL_ASMFUNC(and)
+  DECL_ASMFUNC(or_op)
+  DECL_ASMFUNC(and_op)
+  DECL_ASMFUNC(uplus)
+  DECL_ASMFUNC(uminus)
+  DECL_ASMFUNC(invsqrt)
+  DECL_ASMFUNC(exec2)
+
+// template -> opcode (matched on both ends, since empty templates share their address with the next one)
+static const struct { void (*afunc)(void), (*func_e)(void); int op; } interp_fnmap[]=
+{
+  { nseel_asm_bnot, nseel_asm_bnot_end, IOP_NOT },
+  { nseel_asm_equal, nseel_asm_equal_end, IOP_EQUAL },
+  { nseel_asm_notequal, nseel_asm_notequal_end, IOP_NOTEQ },
+  { nseel_asm_below, nseel_asm_below_end, IOP_BELOW },
+  { nseel_asm_above, nseel_asm_above_end, IOP_ABOVE },
+  { nseel_asm_beloweq, nseel_asm_beloweq_end, IOP_BELEQ },
+  { nseel_asm_aboveeq, nseel_asm_aboveeq_end, IOP_ABOEQ },
+  { nseel_asm_assign, nseel_asm_assign_end, IOP_SET },
+  { nseel_asm_add, nseel_asm_add_end, IOP_ADD },
+  { nseel_asm_sub, nseel_asm_sub_end, IOP_SUB },
+  { nseel_asm_mul, nseel_asm_mul_end, IOP_MUL },
+  { nseel_asm_div, nseel_asm_div_end, IOP_DIV },
+  { nseel_asm_mod, nseel_asm_mod_end, IOP_MOD },
+  { nseel_asm_or, nseel_asm_or_end, IOP_OR },
+  { nseel_asm_and, nseel_asm_and_end, IOP_AND },
+  { nseel_asm_add_op, nseel_asm_add_op_end, IOP_ADDOP },
+  { nseel_asm_sub_op, nseel_asm_sub_op_end, IOP_SUBOP },
+  { nseel_asm_mul_op, nseel_asm_mul_op_end, IOP_MULOP },
+  { nseel_asm_div_op, nseel_asm_div_op_end, IOP_DIVOP },
+  { nseel_asm_mod_op, nseel_asm_mod_op_end, IOP_MODOP },
+  { nseel_asm_or_op, nseel_asm_or_op_end, IOP_OROP },
+  { nseel_asm_and_op, nseel_asm_and_op_end, IOP_ANDOP },
+  { nseel_asm_uminus, nseel_asm_uminus_end, IOP_UMINUS },
+  { nseel_asm_abs, nseel_asm_abs_end, IOP_ABS },
+  { nseel_asm_sqr, nseel_asm_sqr_end, IOP_SQR },
+  { nseel_asm_sqrt, nseel_asm_sqrt_end, IOP_SQRT },
+#if !defined(__ppc__) && !defined(EEL_TARGET_X64_SSE2)
+  { nseel_asm_sin, nseel_asm_sin_end, IOP_SIN },
+  { nseel_asm_cos, nseel_asm_cos_end, IOP_COS },
+  { nseel_asm_tan, nseel_asm_tan_end, IOP_TAN },
+  { nseel_asm_log, nseel_asm_log_end, IOP_LOG },
+  { nseel_asm_log10, nseel_asm_log10_end, IOP_LOG10 },
+#endif
+  { nseel_asm_invsqrt, nseel_asm_invsqrt_end, IOP_INVSQRT },
+  { nseel_asm_sign, nseel_asm_sign_end, IOP_SIGN },
+  { nseel_asm_min, nseel_asm_min_end, IOP_MIN },
+  { nseel_asm_max, nseel_asm_max_end, IOP_MAX },
+  { nseel_asm_exec2, nseel_asm_exec2_end, IOP_EXEC },
+  { nseel_asm_1pdd, nseel_asm_1pdd_end, IOP_CALL_1PDD },
+  { nseel_asm_2pdd, nseel_asm_2pdd_end, IOP_CALL_2PDD },
+  { nseel_asm_2pdds, nseel_asm_2pdds_end, IOP_CALL_2PDDS },
+  { nseel_asm_1pp, nseel_asm_1pp_end, IOP_CALL_1PP },
+  { nseel_asm_2pp, nseel_asm_2pp_end, IOP_CALL_2PP },
+  { _asm_megabuf, _asm_megabuf_end, IOP_MEGABUF },
+  { _asm_generic1parm, _asm_generic1parm_end, IOP_GENERIC1 },
+  { _asm_generic2parm, _asm_generic2parm_end, IOP_GENERIC2 },
+  { _asm_generic3parm, _asm_generic3parm_end, IOP_GENERIC3 },
+  { _asm_generic1parm_retd, _asm_generic1parm_retd_end, IOP_GENERIC1_RETD },
+  { _asm_generic2parm_retd, _asm_generic2parm_retd_end, IOP_GENERIC2_RETD },
+  { _asm_generic3parm_retd, _asm_generic3parm_retd_end, IOP_GENERIC3_RETD },
+};
+
+
+//---------------------------------------------------------------------------------------------------------------
+// compilation
+
+static interpOp *interp_emit(interpState *st, int op, int parm, void *ptr, void *ctx)
+{
+  interpOp *o;
+  if (st->ops_size >= st->ops_alloc)
+  {
+    interpOp *n;
+    st->ops_alloc = st->ops_size*2+256;
+    n = (interpOp *)realloc(st->ops,st->ops_alloc*sizeof(interpOp));
+    if (!n) return 0;
+    st->ops = n;
+  }
+  o = st->ops + st->ops_size++;
+  o->op = op;
+  o->parm = parm;
+  o->ptr = ptr;
+  o->ctx = ctx;
+  return o;
+}
+
+static void interp_push(interpState *st, int n)
+{
+  st->depth += n;
+  if (st->depth > st->maxdepth) st->maxdepth = st->depth;
+}
+
+static int interp_compile(compileContext *ctx, interpState *st, opcodeRec *op);
+
+// evaluates all parameters, leaving their pointers on the stack
+static int interp_compileParms(compileContext *ctx, interpState *st, opcodeRec *op, int np)
+{
+  int x;
+  for (x = 0; x < np; x ++)
+    if (!interp_compile(ctx,st,op->parms[x])) return 0;
+  return 1;
+}
+
+// finds the opcode for a function table entry by its template, -1 if it can't be interpreted
+static int interp_lookupFunction(compileContext *ctx, opcodeRec *op, int np, void **fptr, void **fctx)
+{
+  functionType *f=nseel_getFunctionFromTable((int)op->fn);
+  int x, iop=-1;
+  if (!f || f->nParams != np) return -1;
+
+  for (x = 0; x < sizeof(interp_fnmap)/sizeof(interp_fnmap[0]); x ++)
+  {
+    if ((void *)interp_fnmap[x].afunc == f->afunc && (void *)interp_fnmap[x].func_e == f->func_e)
+    {
+      iop = interp_fnmap[x].op;
+      break;
+    }
+  }
+  switch (iop)
+  {
+    case IOP_MEGABUF:
+      *fctx=nseel_getPProcValue(ctx,f->pProc);
+      *fptr=f->replptrs[1];
+    break;
+    case IOP_GENERIC1: case IOP_GENERIC2: case IOP_GENERIC3:
+    case IOP_GENERIC1_RETD: case IOP_GENERIC2_RETD: case IOP_GENERIC3_RETD:
+      *fctx=nseel_getPProcValue(ctx,f->pProc);
+      *fptr=f->replptrs[0];
+    break;
+    default:
+      *fptr=f->replptrs[0];
+    break;
+  }
+  return iop;
+}
+
+static int interp_compileFunction(compileContext *ctx, interpState *st, opcodeRec *op)
+{
+  int np = op->opcodeType - OPCODETYPE_FUNC1 + 1;
+  int iop=-1;
+  void *fptr=0, *fctx=0;
+
+  if (op->fntype == MATH_SIMPLE)
+  {
+    switch (op->fn)
+    {
+      case FN_ASSIGN: iop=IOP_SET; break;
+      case FN_MULTIPLY: iop=IOP_MUL; break;
+      case FN_DIVIDE: iop=IOP_DIV; break;
+      case FN_MODULO: iop=IOP_EXEC; break; // exec2
+      case FN_ADD: iop=IOP_ADD; break;
+      case FN_SUB: iop=IOP_SUB; break;
+      case FN_AND: iop=IOP_AND; break;
+      case FN_OR: iop=IOP_OR; break;
+      case FN_UMINUS: iop=IOP_UMINUS; break;
+      case FN_UPLUS: return interp_compileParms(ctx,st,op,1);
+    }
+  }
+  else if (op->fntype == MATH_FN)
+  {
+    int a,b,c;
+    switch (op->fn)
+    {
+      case 0: // _if
+        if (np != 3 || !interp_compile(ctx,st,op->parms[0])) return 0;
+        a=st->ops_size;
+        if (!interp_emit(st,IOP_JMP_IF_FALSE,0,0,0)) return 0;
+        st->depth--;
+        if (!interp_compile(ctx,st,op->parms[1])) return 0;
+        b=st->ops_size;
+        if (!interp_emit(st,IOP_JMP,0,0,0)) return 0;
+        st->depth--;
+        st->ops[a].parm=st->ops_size;
+        if (!interp_compile(ctx,st,op->parms[2])) return 0;
+        st->ops[b].parm=st->ops_size;
+      return 1;
+      case 1: // _and
+      case 2: // _or
+        {
+          int jop = op->fn == 1 ? IOP_JMP_IF_FALSE : IOP_JMP_IF_TRUE;
+          if (np != 2 || !interp_compile(ctx,st,op->parms[0])) return 0;
+          a=st->ops_size;
+          if (!interp_emit(st,jop,0,0,0)) return 0;
+          st->depth--;
+          if (!interp_compile(ctx,st,op->parms[1])) return 0;
+          b=st->ops_size;
+          if (!interp_emit(st,jop,0,0,0)) return 0;
+          st->depth--;
+          if (!interp_emit(st,IOP_TEMPCONST,op->fn == 1,0,0)) return 0;
+          c=st->ops_size;
+          if (!interp_emit(st,IOP_JMP,0,0,0)) return 0;
+          st->ops[a].parm=st->ops[b].parm=st->ops_size;
+          if (!interp_emit(st,IOP_TEMPCONST,op->fn != 1,0,0)) return 0;
+          st->ops[c].parm=st->ops_size;
+          interp_push(st,1);
+          ++ctx->computTableTop;
+        }
+      return 1;
+      case 3: // loop
+        if (np != 2 || !interp_compile(ctx,st,op->parms[0])) return 0;
+        a=st->ops_size;
+        if (!interp_emit(st,IOP_LOOP_BEGIN,0,0,0)) return 0;
+        st->depth--;
+        if (++st->loopdepth > st->maxloopdepth) st->maxloopdepth=st->loopdepth;
+        b=st->ops_size;
+        if (!interp_compile(ctx,st,op->parms[1])) return 0;
+        if (!interp_emit(st,IOP_LOOP_NEXT,b,0,0)) return 0;
+        st->loopdepth--;
+        st->ops[a].parm=st->ops_size;
+        ++ctx->computTableTop;
+      return 1;
+      case 4: // while
+        if (np != 1 || !interp_emit(st,IOP_WHILE_BEGIN,0,0,0)) return 0;
+        if (++st->loopdepth > st->maxloopdepth) st->maxloopdepth=st->loopdepth;
+        b=st->ops_size;
+        if (!interp_compile(ctx,st,op->parms[0])) return 0;
+        if (!interp_emit(st,IOP_WHILE_NEXT,b,0,0)) return 0;
+        st->loopdepth--;
+        ++ctx->computTableTop;
+      return 1;
+      default:
+        iop=interp_lookupFunction(ctx,op,np,&fptr,&fctx);
+      break;
+    }
+  }
+
+  if (iop < 0) return 0;
+  if (!interp_compileParms(ctx,st,op,np)) return 0;
+  if (!interp_emit(st,iop,np-1,fptr,fctx)) return 0;
+  st->depth -= np-1;
+  ++ctx->computTableTop;
+  return 1;
+}
+
+static int interp_compile(compileContext *ctx, interpState *st, opcodeRec *op)
+{
+  if (!op) return 0;
+  switch (op->opcodeType)
+  {
+    case OPCODETYPE_DIRECTVALUE:
+      // each constant gets its own slot, since (like the native code) they can be assigned to
+      if (st->consts_size >= st->consts_alloc)
+      {
+        EEL_F *n;
+        st->consts_alloc = st->consts_size*2+64;
+        n = (EEL_F *)realloc(st->consts,st->consts_alloc*sizeof(EEL_F));
+        if (!n) return 0;
+        st->consts = n;
+      }
+      st->consts[st->consts_size] = op->directValue;
+      if (!interp_emit(st,IOP_PUSHCONST,st->consts_size++,0,0)) return 0;
+      interp_push(st,1);
+    return 1;
+    case OPCODETYPE_VARPTR:
+      if (!interp_emit(st,IOP_PUSHPTR,0,op->valuePtr,0)) return 0;
+      interp_push(st,1);
+    return 1;
+    case OPCODETYPE_FUNC1:
+    case OPCODETYPE_FUNC2:
+    case OPCODETYPE_FUNC3:
+    return interp_compileFunction(ctx,st,op);
+  }
+  return 0;
+}
+
+int nseel_interp_compileStatement(compileContext *ctx, opcodeRec *op)
+{
+  interpState *st = (interpState *)ctx->interp_state;
+  int ops_size, consts_size;
+  if (!st)
+  {
+    st = (interpState *)calloc(1,sizeof(interpState));
+    if (!st) return 0;
+    ctx->interp_state = st;
+  }
+  ops_size = st->ops_size;
+  consts_size = st->consts_size;
+
+  st->depth = st->loopdepth = 0;
+  if (!interp_emit(st,IOP_RESET,0,0,0) || !interp_compile(ctx,st,op))
+  {
+    st->ops_size = ops_size;
+    st->consts_size = consts_size;
+    return 0;
+  }
+  return 1;
+}
+
+int nseel_interp_finish(compileContext *ctx, void *buf)
+{
+  interpState *st = (interpState *)ctx->interp_state;
+  int nops = st ? st->ops_size+1 : 1;
+  int nconsts = st ? st->consts_size : 0;
+  int stacksize = st ? st->maxdepth+1 : 1;
+  int loopsize = st ? st->maxloopdepth+1 : 1;
+  int size = sizeof(interpCode) + 8 + nconsts*sizeof(EEL_F) + nops*sizeof(interpOp) + loopsize*sizeof(interpLoop) + stacksize*sizeof(EEL_F *);
+
+  if (buf)
+  {
+    interpCode *c = (interpCode *)buf;
+    char *p = (char *)(c+1);
+    int x;
+
+    p += (8 - (((INT_PTR)p)&7))&7;
+    c->consts = (EEL_F *)p; p += nconsts*sizeof(EEL_F);
+    c->ops = (interpOp *)p; p += nops*sizeof(interpOp);
+    c->loops = (interpLoop *)p; p += loopsize*sizeof(interpLoop);
+    c->stack = (EEL_F **)p;
+
+    if (nconsts) memcpy(c->consts,st->consts,nconsts*sizeof(EEL_F));
+    if (nops>1) memcpy(c->ops,st->ops,(nops-1)*sizeof(interpOp));
+    memset(c->ops+nops-1,0,sizeof(interpOp)); // IOP_END
+
+    for (x = 0; x < nops-1; x ++)
+    {
+      if (c->ops[x].op == IOP_PUSHCONST)
+      {
+        c->ops[x].op = IOP_PUSHPTR;
+        c->ops[x].ptr = c->consts + c->ops[x].parm;
+      }
+    }
+    nseel_interp_free(ctx);
+  }
+  return size;
+}
+
+// evaluates a tree of constants and pure functions at compile time, with the same code used at runtime
+int nseel_interp_evalConstant(compileContext *ctx, opcodeRec *op, EEL_F *out)
+{
+  void *state = ctx->interp_state;
+  int tabtop = ctx->computTableTop;
+  int ok=0;
+
+  ctx->interp_state = 0;
+  if (nseel_interp_compileStatement(ctx,op))
+  {
+    int size = nseel_interp_finish(ctx,NULL);
+    void *code = malloc(size);
+    EEL_F *workTable = (EEL_F *)malloc((ctx->computTableTop-tabtop+4)*sizeof(EEL_F));
+    if (code && workTable)
+    {
+      nseel_interp_finish(ctx,code);
+      nseel_interp_execute(code,workTable);
+      *out = *((interpCode *)code)->stack[0];
+      ok=1;
+    }
+    free(workTable);
+    free(code);
+  }
+  nseel_interp_free(ctx);
+
+  ctx->interp_state = state;
+  ctx->computTableTop = tabtop;
+  return ok;
+}
+
+void nseel_interp_free(compileContext *ctx)
+{
+  interpState *st = (interpState *)ctx->interp_state;
+  if (st)
+  {
+    free(st->ops);
+    free(st->consts);
+    free(st);
+    ctx->interp_state=0;
+  }
+}
+
+
+//---------------------------------------------------------------------------------------------------------------
+// execution
+
+#define ITRUE(x) (fabs(x) >= NSEEL_CLOSEFACTOR) // NaN is false, like the native code
+
+// cvttsd2si/fistp(chop) semantics: out of range gives the "integer indefinite" value
+static int interp_trunc32(EEL_F v)
+{
+  if (v > -2147483649.0 && v < 2147483648.0) return (int)v;
+  return (int)0x80000000;
+}
+
+static long long interp_trunc64(EEL_F v)
+{
+  if (v >= -9223372036854775808.0 && v < 9223372036854775808.0) return (long long)v;
+  return (long long)0x8000000000000000ULL;
+}
+
+static unsigned long long interp_bits(EEL_F v)
+{
+  unsigned long long i;
+  memcpy(&i,&v,sizeof(i));
+  return i;
+}
+
+// _set(): denormals, inf and nan are stored as 0
+static EEL_F interp_sanitize(EEL_F v)
+{
+  unsigned int e = (unsigned int)(interp_bits(v)>>52)&0x7ff;
+  return (!e || e == 0x7ff) ? 0.0 : v;
+}
+
+static EEL_F interp_mod(EEL_F a, EEL_F b)
+{
+  unsigned int ia=(unsigned int)interp_trunc32(fabs(a)), ib=(unsigned int)interp_trunc32(fabs(b));
+  return (EEL_F)(int)(ib ? ia%ib : 0);
+}
+
+static EEL_F interp_invsqrt(EEL_F x)
+{
+  float f=(float)x;
+  int i;
+  EEL_F y;
+  memcpy(&i,&f,sizeof(i));
+  i = 0x5f3759df - (i>>1);
+  memcpy(&f,&i,sizeof(f));
+  y=f;
+  return ((-0.5*x)*y*y + 1.5)*y;
+}
+
+void nseel_interp_execute(void *code, EEL_F *workTable)
+{
+  const interpCode *c = (const interpCode *)code;
+  const interpOp *ip = c->ops;
+  EEL_F **sp = c->stack;
+  interpLoop *lp = c->loops;
+  EEL_F *tp = workTable;
+  EEL_F *a, *b;
+
+#ifdef EEL_INTERP_THREADED
+  #define OP(x) &&lbl_##x,
+  static const void *optab[IOP_NUM] = { INTERP_OPS };
+  #undef OP
+  #define OPCASE(x) lbl_##x:
+  #define NEXT() goto *optab[(++ip)->op]
+  #define JUMP(n) do { ip = c->ops + (n); goto *optab[ip->op]; } while (0)
+  goto *optab[ip->op];
+#else
+  #define OPCASE(x) case IOP_##x:
+  #define NEXT() { ++ip; continue; }
+  #define JUMP(n) { ip = c->ops + (n); continue; }
+  for (;;) switch (ip->op)
+#endif
+  {
+    // result helpers
+    #define POP2() (b = *--sp, a = sp[-1])
+    #define RET_TEMP(v) { *tp = (v); sp[-1] = tp++; NEXT(); }
+    #define RET_A(v) { *a = (v); sp[-1] = a; NEXT(); }
+
+    OPCASE(END) return;
+    OPCASE(RESET) tp = workTable; NEXT();
+    OPCASE(PUSHPTR) *sp++ = (EEL_F *)ip->ptr; NEXT();
+    OPCASE(PUSHCONST) NEXT(); // resolved to IOP_PUSHPTR by nseel_interp_finish()
+    OPCASE(TEMPCONST) *tp = (EEL_F)ip->parm; *sp++ = tp++; NEXT();
+
+    OPCASE(JMP) JUMP(ip->parm);
+    OPCASE(JMP_IF_FALSE) if (!ITRUE(**--sp)) JUMP(ip->parm); NEXT();
+    OPCASE(JMP_IF_TRUE) if (ITRUE(**--sp)) JUMP(ip->parm); NEXT();
+
+    OPCASE(LOOP_BEGIN)
+      {
+        int cnt = interp_trunc32(*sp[-1]);
+        if (cnt < 1) JUMP(ip->parm); // count pointer is the result
+        --sp;
+        lp->count = cnt < NSEEL_LOOPFUNC_SUPPORT_MAXLEN ? cnt : NSEEL_LOOPFUNC_SUPPORT_MAXLEN;
+        lp->tp = tp;
+        lp++;
+      }
+    NEXT();
+    OPCASE(LOOP_NEXT)
+      tp = lp[-1].tp;
+      if (--lp[-1].count > 0) { --sp; JUMP(ip->parm); }
+      --lp;
+    NEXT();
+    OPCASE(WHILE_BEGIN)
+      lp->count = NSEEL_LOOPFUNC_SUPPORT_MAXLEN;
+      lp->tp = tp;
+      lp++;
+    NEXT();
+    OPCASE(WHILE_NEXT)
+      a = *--sp;
+      tp = lp[-1].tp;
+      if (ITRUE(*a) && --lp[-1].count > 0) JUMP(ip->parm);
+      --lp;
+      *sp++ = tp; // the native code returns the (unwritten) next temp
+    NEXT();
+
+    OPCASE(EXEC) sp -= ip->parm; sp[-1] = sp[ip->parm-1]; NEXT();
+    OPCASE(SET) POP2(); *a = interp_sanitize(*b); sp[-1] = b; NEXT();
+    OPCASE(MIN) POP2(); sp[-1] = !(*a >= *b) ? a : b; NEXT();
+    OPCASE(MAX) POP2(); sp[-1] = *a >= *b ? a : b; NEXT();
+
+    OPCASE(ADD) POP2(); RET_TEMP(*a + *b);
+    OPCASE(SUB) POP2(); RET_TEMP(*a - *b);
+    OPCASE(MUL) POP2(); RET_TEMP(*a * *b);
+    OPCASE(DIV) POP2(); RET_TEMP(*a / *b);
+    OPCASE(MOD) POP2(); RET_TEMP(interp_mod(*a,*b));
+    OPCASE(OR) POP2(); RET_TEMP((EEL_F)(interp_trunc64(*a) | interp_trunc64(*b)));
+    OPCASE(AND) POP2(); RET_TEMP((EEL_F)(interp_trunc64(*a) & interp_trunc64(*b)));
+
+    OPCASE(ADDOP) POP2(); RET_A(*a + *b);
+    OPCASE(SUBOP) POP2(); RET_A(*a - *b);
+    OPCASE(MULOP) POP2(); RET_A(*a * *b);
+    OPCASE(DIVOP) POP2(); RET_A(*a / *b);
+    OPCASE(MODOP) POP2(); RET_A(interp_mod(*a,*b));
+    OPCASE(OROP) POP2(); RET_A((EEL_F)(interp_trunc64(*a) | interp_trunc64(*b)));
+    OPCASE(ANDOP) POP2(); RET_A((EEL_F)(interp_trunc64(*a) & interp_trunc64(*b)));
+
+    OPCASE(UMINUS) a = sp[-1]; RET_TEMP(-*a);
+    OPCASE(ABS) a = sp[-1]; RET_TEMP(fabs(*a));
+    OPCASE(SQR) a = sp[-1]; RET_TEMP(*a * *a);
+    OPCASE(SQRT) a = sp[-1]; RET_TEMP(sqrt(fabs(*a)));
+    OPCASE(SIN) a = sp[-1]; RET_TEMP(sin(*a));
+    OPCASE(COS) a = sp[-1]; RET_TEMP(cos(*a));
+    OPCASE(TAN) a = sp[-1]; RET_TEMP(tan(*a));
+    OPCASE(LOG) a = sp[-1]; RET_TEMP(log(*a));
+    OPCASE(LOG10) a = sp[-1]; RET_TEMP(log10(*a));
+    OPCASE(INVSQRT) a = sp[-1]; RET_TEMP(interp_invsqrt(*a));
+    OPCASE(SIGN)
+      a = sp[-1];
+      if (!(interp_bits(*a)<<1)) NEXT(); // +/-0 returns the parameter
+      RET_TEMP((interp_bits(*a)>>63) ? -1.0 : 1.0);
+    OPCASE(NOT) a = sp[-1]; RET_TEMP(!ITRUE(*a) ? 1.0 : 0.0);
+
+    OPCASE(EQUAL) POP2(); RET_TEMP(!(fabs(*b - *a) >= NSEEL_CLOSEFACTOR) ? 1.0 : 0.0);
+    OPCASE(NOTEQ) POP2(); RET_TEMP(fabs(*b - *a) >= NSEEL_CLOSEFACTOR ? 1.0 : 0.0);
+    OPCASE(BELOW) POP2(); RET_TEMP(!(*a >= *b) ? 1.0 : 0.0);
+    OPCASE(BELEQ) POP2(); RET_TEMP(*b >= *a ? 1.0 : 0.0);
+    OPCASE(ABOVE) POP2(); RET_TEMP(!(*b >= *a) ? 1.0 : 0.0);
+    OPCASE(ABOEQ) POP2(); RET_TEMP(*a >= *b ? 1.0 : 0.0);
+
+    OPCASE(CALL_1PDD) a = sp[-1]; RET_TEMP(((interp_fn_1pdd)ip->ptr)(*a));
+    OPCASE(CALL_2PDD) POP2(); RET_TEMP(((interp_fn_2pdd)ip->ptr)(*a,*b));
+    OPCASE(CALL_2PDDS) POP2(); RET_A(((interp_fn_2pdd)ip->ptr)(*a,*b));
+    OPCASE(CALL_1PP) a = sp[-1]; RET_TEMP(((interp_fn_1pp)ip->ptr)(a));
+    OPCASE(CALL_2PP) POP2(); RET_TEMP(((interp_fn_2pp)ip->ptr)(a,b));
+
+    OPCASE(MEGABUF)
+      a = ((interp_fn_megabuf)ip->ptr)(ip->ctx,interp_trunc32(*sp[-1] + NSEEL_CLOSEFACTOR));
+      if (!a) RET_TEMP(0.0);
+      sp[-1] = a;
+    NEXT();
+
+    OPCASE(GENERIC1) sp[-1] = ((interp_fn_g1)ip->ptr)(ip->ctx,sp[-1]); NEXT();
+    OPCASE(GENERIC2) --sp; sp[-1] = ((interp_fn_g2)ip->ptr)(ip->ctx,sp[-1],sp[0]); NEXT();
+    OPCASE(GENERIC3) sp-=2; sp[-1] = ((interp_fn_g3)ip->ptr)(ip->ctx,sp[-1],sp[0],sp[1]); NEXT();
+    OPCASE(GENERIC1_RETD) a = sp[-1]; RET_TEMP(((interp_fn_g1d)ip->ptr)(ip->ctx,a));
+    OPCASE(GENERIC2_RETD) POP2(); RET_TEMP(((interp_fn_g2d)ip->ptr)(ip->ctx,a,b));
+    OPCASE(GENERIC3_RETD)
+      sp-=2;
+      RET_TEMP(((interp_fn_g3d)ip->ptr)(ip->ctx,sp[-1],sp[0],sp[1]));
+
+    #undef POP2
+    #undef RET_TEMP
+    #undef RET_A
+  }
+  #undef OPCASE
+  #undef NEXT
+  #undef JUMP
+}
+
+
+//---------------------------------------------------------------------------------------------------------------
+// batched execution (NSEEL_code_execute_batch): the body is compiled again, to a register machine where
+// every register holds NSEEL_BATCH_LANES values, one per execution. each node gets its own register, and
+// variables and constants are registers too, so nodes that return a parameter's pointer simply return its
+// register. stores are masked by the lanes that are active; _if/_and/_or/loop run their branches under a
+// lane mask, and are skipped when no lane is active. everything else computes all lanes, which the compiler
+// can vectorize.
+//
+// code that can't be expressed this way isn't batched (the host falls back to NSEEL_code_execute()):
+// while(), megabuf()/gmem and the like, rand() and other functions with side effects, stores to anything
+// but a variable, functions returning a pointer where the pointer (rather than the value) matters, and
+// variables that carry state from one execution to the next, i.e. that are written but not batch vars, and
+// not assigned at the top level before anything reads them.
+
+#ifndef NSEEL_BATCH_LANES
+#define NSEEL_BATCH_LANES 8
+#endif
+
+#ifdef _MSC_VER
+#define BATCH_INLINE __inline
+#else
+#define BATCH_INLINE inline
+#endif
+
+// a 'vector' here is BW lanes: 4 doubles with AVX, 2 with SSE2, or 1 otherwise. the ops below are written
+// once against these wrappers; masks are all ones or all zeros per lane, like the SSE compares make them.
+// everything that doesn't map exactly onto IEEE ops (sin(), fmod-style %, the integer | and &) stays scalar,
+// so the results are the same as the other backends', bit for bit.
+#if EEL_F_SIZE == 8 && defined(__AVX__)
+  #include <immintrin.h>
+  #define BW 4
+  typedef __m256d bv;
+  static BATCH_INLINE bv bv_set(EEL_F a) { return _mm256_set1_pd(a); }
+  static BATCH_INLINE bv bv_load(const EEL_F *p) { return _mm256_load_pd(p); }
+  static BATCH_INLINE void bv_store(EEL_F *p, bv a) { _mm256_store_pd(p,a); }
+  static BATCH_INLINE bv bv_add(bv a, bv b) { return _mm256_add_pd(a,b); }
+  static BATCH_INLINE bv bv_sub(bv a, bv b) { return _mm256_sub_pd(a,b); }
+  static BATCH_INLINE bv bv_mul(bv a, bv b) { return _mm256_mul_pd(a,b); }
+  static BATCH_INLINE bv bv_div(bv a, bv b) { return _mm256_div_pd(a,b); }
+  static BATCH_INLINE bv bv_sqrt(bv a) { return _mm256_sqrt_pd(a); }
+  static BATCH_INLINE bv bv_and(bv a, bv b) { return _mm256_and_pd(a,b); }
+  static BATCH_INLINE bv bv_andnot(bv a, bv b) { return _mm256_andnot_pd(a,b); } // ~a & b
+  static BATCH_INLINE bv bv_or(bv a, bv b) { return _mm256_or_pd(a,b); }
+  static BATCH_INLINE bv bv_xor(bv a, bv b) { return _mm256_xor_pd(a,b); }
+  static BATCH_INLINE bv bv_ge(bv a, bv b) { return _mm256_cmp_pd(a,b,_CMP_GE_OQ); } // false for NaN
+  static BATCH_INLINE bv bv_nge(bv a, bv b) { return _mm256_cmp_pd(a,b,_CMP_NGE_UQ); } // true for NaN
+  static BATCH_INLINE bv bv_eq(bv a, bv b) { return _mm256_cmp_pd(a,b,_CMP_EQ_OQ); }
+  static BATCH_INLINE bv bv_ne(bv a, bv b) { return _mm256_cmp_pd(a,b,_CMP_NEQ_UQ); }
+  static BATCH_INLINE int bv_any(bv m) { return _mm256_movemask_pd(m); }
+#elif EEL_F_SIZE == 8 && (defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+  #include <emmintrin.h>
+  #define BW 2
+  typedef __m128d bv;
+  static BATCH_INLINE bv bv_set(EEL_F a) { return _mm_set1_pd(a); }
+  static BATCH_INLINE bv bv_load(const EEL_F *p) { return _mm_load_pd(p); }
+  static BATCH_INLINE void bv_store(EEL_F *p, bv a) { _mm_store_pd(p,a); }
+  static BATCH_INLINE bv bv_add(bv a, bv b) { return _mm_add_pd(a,b); }
+  static BATCH_INLINE bv bv_sub(bv a, bv b) { return _mm_sub_pd(a,b); }
+  static BATCH_INLINE bv bv_mul(bv a, bv b) { return _mm_mul_pd(a,b); }
+  static BATCH_INLINE bv bv_div(bv a, bv b) { return _mm_div_pd(a,b); }
+  static BATCH_INLINE bv bv_sqrt(bv a) { return _mm_sqrt_pd(a); }
+  static BATCH_INLINE bv bv_and(bv a, bv b) { return _mm_and_pd(a,b); }
+  static BATCH_INLINE bv bv_andnot(bv a, bv b) { return _mm_andnot_pd(a,b); }
+  static BATCH_INLINE bv bv_or(bv a, bv b) { return _mm_or_pd(a,b); }
+  static BATCH_INLINE bv bv_xor(bv a, bv b) { return _mm_xor_pd(a,b); }
+  static BATCH_INLINE bv bv_ge(bv a, bv b) { return _mm_cmpge_pd(a,b); }
+  static BATCH_INLINE bv bv_nge(bv a, bv b) { return _mm_cmpnge_pd(a,b); }
+  static BATCH_INLINE bv bv_eq(bv a, bv b) { return _mm_cmpeq_pd(a,b); }
+  static BATCH_INLINE bv bv_ne(bv a, bv b) { return _mm_cmpneq_pd(a,b); }
+  static BATCH_INLINE int bv_any(bv m) { return _mm_movemask_pd(m); }
+#else
+  #define BW 1
+  typedef EEL_F bv;
+  static BATCH_INLINE bv bv_frombits(unsigned long long i) { bv a; memcpy(&a,&i,sizeof(a)); return a; }
+  static BATCH_INLINE bv bv_mask(int m) { return bv_frombits(m ? ~0ULL : 0); }
+  static BATCH_INLINE bv bv_set(EEL_F a) { return a; }
+  static BATCH_INLINE bv bv_load(const EEL_F *p) { return *p; }
+  static BATCH_INLINE void bv_store(EEL_F *p, bv a) { *p = a; }
+  static BATCH_INLINE bv bv_add(bv a, bv b) { return a + b; }
+  static BATCH_INLINE bv bv_sub(bv a, bv b) { return a - b; }
+  static BATCH_INLINE bv bv_mul(bv a, bv b) { return a * b; }
+  static BATCH_INLINE bv bv_div(bv a, bv b) { return a / b; }
+  static BATCH_INLINE bv bv_sqrt(bv a) { return sqrt(a); }
+  static BATCH_INLINE bv bv_and(bv a, bv b) { return bv_frombits(interp_bits(a) & interp_bits(b)); }
+  static BATCH_INLINE bv bv_andnot(bv a, bv b) { return bv_frombits(~interp_bits(a) & interp_bits(b)); }
+  static BATCH_INLINE bv bv_or(bv a, bv b) { return bv_frombits(interp_bits(a) | interp_bits(b)); }
+  static BATCH_INLINE bv bv_xor(bv a, bv b) { return bv_frombits(interp_bits(a) ^ interp_bits(b)); }
+  static BATCH_INLINE bv bv_ge(bv a, bv b) { return bv_mask(a >= b); }
+  static BATCH_INLINE bv bv_nge(bv a, bv b) { return bv_mask(!(a >= b)); }
+  static BATCH_INLINE bv bv_eq(bv a, bv b) { return bv_mask(a == b); }
+  static BATCH_INLINE bv bv_ne(bv a, bv b) { return bv_mask(a != b); }
+  static BATCH_INLINE int bv_any(bv m) { return interp_bits(m) != 0; }
+#endif
+
+#if NSEEL_BATCH_LANES % BW
+#error NSEEL_BATCH_LANES must be a multiple of the vector width
+#endif
+
+static BATCH_INLINE bv bv_select(bv m, bv a, bv b) { return bv_or(bv_and(m,a),bv_andnot(m,b)); }
+
+enum
+{
+  BOP_COPY = IOP_NUM, // d = a
+  BOP_BLEND,          // d = m ? a : d
+  BOP_TRUTH,          // d = m ? (a ? 1 : 0) : d
+  BOP_MASK_TRUE,      // d = m && a
+  BOP_MASK_FALSE,     // d = m && !a
+  BOP_LOOP_COUNT,     // d = loop count of a
+  BOP_LOOP_MASK,      // d = m && a >= 1
+  BOP_LOOP_DEC,       // d = m ? d-1 : d
+  BOP_JMP_IF_NONE,    // jump to parm if no lane of m is set
+};
+
+typedef struct
+{
+  int op;
+  int d, a, b, m; // registers: destination, operands, lane mask (register 0 is the lanes in use)
+  int parm; // jump target
+  void *ptr; // function pointer
+} batchOp;
+
+typedef struct
+{
+  EEL_F *var;
+  int reg;
+  int idx; // index in the host's arrays, or -1
+  int written;
+  int assigned; // check pass only
+} batchVar;
+
+typedef struct
+{
+  int reg;
+  EEL_F value;
+} batchConst;
+
+typedef struct
+{
+  batchOp *ops;
+  batchVar *vars;
+  EEL_F (*regs)[NSEEL_BATCH_LANES];
+  int nops, nvars, nregs;
+  int size;
+  int clone; // nseel_batch_clone(): leaves variables other than the batch vars alone
+} batchCode;
+
+typedef struct
+{
+  compileContext *ctx;
+  batchOp *ops;
+  int ops_size, ops_alloc;
+  batchVar *vars;
+  int vars_size, vars_alloc;
+  batchConst *consts;
+  int consts_size, consts_alloc;
+  int nregs;
+} batchState;
+
+static int batch_grow(void **p, int *alloc, int size, int itemsize)
+{
+  void *n;
+  if (size < *alloc) return 1;
+  n = realloc(*p,(size*2+64)*itemsize);
+  if (!n) return 0;
+  *p = n;
+  *alloc = size*2+64;
+  return 1;
+}
+
+static int batch_emit(batchState *st, int op, int d, int a, int b, int m, void *ptr)
+{
+  batchOp *o;
+  if (!batch_grow((void **)&st->ops,&st->ops_alloc,st->ops_size,sizeof(batchOp))) return -1;
+  o = st->ops + st->ops_size;
+  o->op = op;
+  o->d = d;
+  o->a = a;
+  o->b = b;
+  o->m = m;
+  o->parm = 0;
+  o->ptr = ptr;
+  return st->ops_size++;
+}
+
+static int batch_const(batchState *st, EEL_F v)
+{
+  if (!batch_grow((void **)&st->consts,&st->consts_alloc,st->consts_size,sizeof(batchConst))) return -1;
+  st->consts[st->consts_size].reg = st->nregs;
+  st->consts[st->consts_size++].value = v;
+  return st->nregs++;
+}
+
+static batchVar *batch_var(batchState *st, EEL_F *var)
+{
+  batchVar *v;
+  int x;
+  for (x = 0; x < st->vars_size; x ++) if (st->vars[x].var == var) return st->vars+x;
+  if (!batch_grow((void **)&st->vars,&st->vars_alloc,st->vars_size,sizeof(batchVar))) return 0;
+
+  v = st->vars + st->vars_size++;
+  memset(v,0,sizeof(batchVar));
+  v->var = var;
+  v->reg = st->nregs++;
+  v->idx = -1;
+  for (x = 0; x < st->ctx->batchVars_size; x ++) if (st->ctx->batchVars[x] == var) v->idx = x;
+  return v;
+}
+
+// opcode for a function node, -1 if it can't be batched, or IOP_END for the control functions
+static int batch_getOp(compileContext *ctx, opcodeRec *op, void **fptr)
+{
+  int np = op->opcodeType - OPCODETYPE_FUNC1 + 1, iop;
+  void *fctx=0;
+  *fptr=0;
+  if (op->fntype == MATH_SIMPLE)
+  {
+    switch (op->fn)
+    {
+      case FN_ASSIGN: return IOP_SET;
+      case FN_MULTIPLY: return IOP_MUL;
+      case FN_DIVIDE: return IOP_DIV;
+      case FN_MODULO: return IOP_EXEC;
+      case FN_ADD: return IOP_ADD;
+      case FN_SUB: return IOP_SUB;
+      case FN_AND: return IOP_AND;
+      case FN_OR: return IOP_OR;
+      case FN_UMINUS: return IOP_UMINUS;
+      case FN_UPLUS: return IOP_EXEC;
+    }
+    return -1;
+  }
+  if (op->fn == 0 || op->fn == 1 || op->fn == 2 || op->fn == 3) return IOP_END; // _if, _and, _or, loop
+  if (op->fn == 4) return -1; // while
+
+  iop = interp_lookupFunction(ctx,op,np,fptr,&fctx);
+  switch (iop)
+  {
+    case IOP_CALL_1PP: case IOP_CALL_2PP: // rand() etc
+    case IOP_MEGABUF:
+    case IOP_GENERIC1: case IOP_GENERIC2: case IOP_GENERIC3:
+    case IOP_GENERIC1_RETD: case IOP_GENERIC2_RETD: case IOP_GENERIC3_RETD:
+    return -1;
+  }
+  return iop;
+}
+
+static int batch_isStore(int iop)
+{
+  return iop == IOP_SET || (iop >= IOP_ADDOP && iop <= IOP_ANDOP) || iop == IOP_CALL_2PDDS;
+}
+
+static int batch_hasStore(compileContext *ctx, opcodeRec *op)
+{
+  void *fptr;
+  int x;
+  if (op->opcodeType < OPCODETYPE_FUNC1) return 0;
+  if (batch_isStore(batch_getOp(ctx,op,&fptr))) return 1;
+  for (x = 0; x <= op->opcodeType - OPCODETYPE_FUNC1; x ++)
+    if (batch_hasStore(ctx,op->parms[x])) return 1;
+  return 0;
+}
+
+// walks op in evaluation order, failing on reads of variables that would carry state between executions
+static int batch_checkVars(batchState *st, opcodeRec *op)
+{
+  void *fptr;
+  int x;
+  if (op->opcodeType == OPCODETYPE_VARPTR)
+  {
+    batchVar *v = batch_var(st,op->valuePtr);
+    return v && (!v->written || v->idx >= 0 || v->assigned);
+  }
+  if (op->opcodeType < OPCODETYPE_FUNC1) return 1;
+
+  if (batch_getOp(st->ctx,op,&fptr) < 0) return 0;
+  for (x = 0; x <= op->opcodeType - OPCODETYPE_FUNC1; x ++)
+    if (!batch_checkVars(st,op->parms[x])) return 0;
+  return 1;
+}
+
+static void batch_markWritten(batchState *st, opcodeRec *op)
+{
+  void *fptr;
+  int x;
+  if (op->opcodeType < OPCODETYPE_FUNC1) return;
+  if (batch_isStore(batch_getOp(st->ctx,op,&fptr)) && op->parms[0]->opcodeType == OPCODETYPE_VARPTR)
+  {
+    batchVar *v = batch_var(st,op->parms[0]->valuePtr);
+    if (v) v->written=1;
+  }
+  for (x = 0; x <= op->opcodeType - OPCODETYPE_FUNC1; x ++)
+    batch_markWritten(st,op->parms[x]);
+}
+
+static int batch_compile(batchState *st, opcodeRec *op, int mask, int needptr);
+
+// _if/_and/_or/loop, which evaluate their parameters under a lane mask. none of them return a pointer to a
+// parameter in the batch code, so they're rejected where the caller uses the pointer.
+static int batch_compileControl(batchState *st, opcodeRec *op, int mask, int needptr)
+{
+  int np = op->opcodeType - OPCODETYPE_FUNC1 + 1;
+  int c, r, d, m1, m2, j, top;
+  if (needptr && op->fn != 1 && op->fn != 2) return -1;
+
+  switch (op->fn)
+  {
+    case 0: // _if
+      if (np != 3 || (c = batch_compile(st,op->parms[0],mask,0)) < 0) return -1;
+      d = st->nregs++; m1 = st->nregs++; m2 = st->nregs++;
+      if (batch_emit(st,BOP_MASK_TRUE,m1,c,0,mask,0) < 0 || batch_emit(st,BOP_MASK_FALSE,m2,c,0,mask,0) < 0) return -1;
+
+      if ((j = batch_emit(st,BOP_JMP_IF_NONE,0,0,0,m1,0)) < 0) return -1;
+      if ((r = batch_compile(st,op->parms[1],m1,0)) < 0 || batch_emit(st,BOP_BLEND,d,r,0,m1,0) < 0) return -1;
+      st->ops[j].parm = st->ops_size;
+
+      if ((j = batch_emit(st,BOP_JMP_IF_NONE,0,0,0,m2,0)) < 0) return -1;
+      if ((r = batch_compile(st,op->parms[2],m2,0)) < 0 || batch_emit(st,BOP_BLEND,d,r,0,m2,0) < 0) return -1;
+      st->ops[j].parm = st->ops_size;
+    return d;
+
+    case 1: // _and
+    case 2: // _or
+      if (np != 2 || (c = batch_compile(st,op->parms[0],mask,0)) < 0) return -1;
+      d = st->nregs++; m1 = st->nregs++;
+      if ((r = batch_const(st,op->fn == 1 ? 0.0 : 1.0)) < 0 || batch_emit(st,BOP_COPY,d,r,0,0,0) < 0) return -1;
+      if (batch_emit(st,op->fn == 1 ? BOP_MASK_TRUE : BOP_MASK_FALSE,m1,c,0,mask,0) < 0) return -1;
+
+      if ((j = batch_emit(st,BOP_JMP_IF_NONE,0,0,0,m1,0)) < 0) return -1;
+      if ((r = batch_compile(st,op->parms[1],m1,0)) < 0 || batch_emit(st,BOP_TRUTH,d,r,0,m1,0) < 0) return -1;
+      st->ops[j].parm = st->ops_size;
+    return d;
+
+    case 3: // loop
+      if (np != 2 || (c = batch_compile(st,op->parms[0],mask,0)) < 0) return -1;
+      d = st->nregs++; m1 = st->nregs++; m2 = st->nregs++;
+      if (batch_emit(st,BOP_COPY,d,c,0,0,0) < 0 || // lanes that don't loop return the count
+          batch_emit(st,BOP_LOOP_COUNT,m2,c,0,0,0) < 0 ||
+          batch_emit(st,BOP_LOOP_MASK,m1,m2,0,mask,0) < 0) return -1;
+
+      top = st->ops_size;
+      if ((j = batch_emit(st,BOP_JMP_IF_NONE,0,0,0,m1,0)) < 0) return -1;
+      if ((r = batch_compile(st,op->parms[1],m1,0)) < 0 ||
+          batch_emit(st,BOP_BLEND,d,r,0,m1,0) < 0 ||
+          batch_emit(st,BOP_LOOP_DEC,m2,0,0,m1,0) < 0 ||
+          batch_emit(st,BOP_LOOP_MASK,m1,m2,0,m1,0) < 0 ||
+          (c = batch_emit(st,IOP_JMP,0,0,0,0,0)) < 0) return -1;
+      st->ops[c].parm = top;
+      st->ops[j].parm = st->ops_size;
+    return d;
+  }
+  return -1;
+}
+
+// returns the register holding op's result, or -1 if it can't be batched.
+// needptr is set if the caller uses the result after something else that could change it was evaluated.
+static int batch_compile(batchState *st, opcodeRec *op, int mask, int needptr)
+{
+  int np, x, iop, r[3], d;
+  void *fptr;
+
+  if (!op) return -1;
+  switch (op->opcodeType)
+  {
+    case OPCODETYPE_DIRECTVALUE: return batch_const(st,op->directValue);
+    case OPCODETYPE_VARPTR:
+      {
+        batchVar *v = batch_var(st,op->valuePtr);
+        return v ? v->reg : -1;
+      }
+    case OPCODETYPE_FUNC1:
+    case OPCODETYPE_FUNC2:
+    case OPCODETYPE_FUNC3:
+    break;
+    default: return -1;
+  }
+
+  np = op->opcodeType - OPCODETYPE_FUNC1 + 1;
+  iop = batch_getOp(st->ctx,op,&fptr);
+  if (iop < 0) return -1;
+  if (iop == IOP_END) return batch_compileControl(st,op,mask,needptr);
+  if (needptr && (iop == IOP_MIN || iop == IOP_MAX || iop == IOP_SIGN)) return -1; // returns one of its parameters
+
+  if (batch_isStore(iop))
+  {
+    batchVar *v;
+    if (np != 2 || op->parms[0]->opcodeType != OPCODETYPE_VARPTR || !(v = batch_var(st,op->parms[0]->valuePtr))) return -1;
+    // _set() returns its source, the others the variable
+    if ((r[1] = batch_compile(st,op->parms[1],mask,iop == IOP_SET && needptr)) < 0) return -1;
+    if (batch_emit(st,iop,v->reg,r[1],0,mask,fptr) < 0) return -1;
+    return iop == IOP_SET ? r[1] : v->reg;
+  }
+
+  // parameters are read once all of them are evaluated, exec2/exec3 return the last one
+  for (x = 0; x < np; x ++)
+  {
+    int y, np2 = iop == IOP_EXEC && x == np-1 && needptr;
+    for (y = x+1; y < np && !np2 && iop != IOP_EXEC; y ++) np2 = batch_hasStore(st->ctx,op->parms[y]);
+    if ((r[x] = batch_compile(st,op->parms[x],mask,np2)) < 0) return -1;
+  }
+  if (iop == IOP_EXEC) return r[np-1];
+
+  d = st->nregs++;
+  if (batch_emit(st,iop,d,r[0],np > 1 ? r[1] : 0,mask,fptr) < 0) return -1;
+  return d;
+}
+
+void *nseel_batch_compile(compileContext *ctx, opcodeRec **statements, int nstatements)
+{
+  batchState *st;
+  int x, ok=1;
+  if (!ctx->batchVars_size || !(st = (batchState *)calloc(1,sizeof(batchState)))) return 0;
+  st->ctx = ctx;
+  st->nregs = 1; // lane mask
+
+  for (x = 0; x < nstatements; x ++) batch_markWritten(st,statements[x]);
+
+  for (x = 0; x < nstatements && ok; x ++)
+  {
+    opcodeRec *op = statements[x];
+    void *fptr;
+    if (op->opcodeType == OPCODETYPE_FUNC2 && batch_getOp(ctx,op,&fptr) == IOP_SET &&
+        op->parms[0]->opcodeType == OPCODETYPE_VARPTR)
+    {
+      // top level assignment, initializes the variable for the rest of the code
+      ok = batch_checkVars(st,op->parms[1]);
+      if (ok) batch_var(st,op->parms[0]->valuePtr)->assigned=1;
+    }
+    else ok = batch_checkVars(st,op);
+  }
+
+  for (x = 0; x < nstatements && ok; x ++)
+    ok = batch_compile(st,statements[x],0,0) >= 0;
+
+  if (!ok)
+  {
+    nseel_batch_free(st);
+    return 0;
+  }
+  return st;
+}
+
+int nseel_batch_finish(void *state, void *buf)
+{
+  batchState *st = (batchState *)state;
+  int nops = st->ops_size+1;
+  int size = sizeof(batchCode) + 64 + nops*sizeof(batchOp) + st->vars_size*sizeof(batchVar) +
+             st->nregs*NSEEL_BATCH_LANES*sizeof(EEL_F);
+  if (buf)
+  {
+    batchCode *c = (batchCode *)buf;
+    char *p = (char *)(c+1);
+    int x, l;
+
+    c->ops = (batchOp *)p; p += nops*sizeof(batchOp);
+    c->vars = (batchVar *)p; p += st->vars_size*sizeof(batchVar);
+    p += (64 - (((INT_PTR)p)&63))&63;
+    c->regs = (EEL_F (*)[NSEEL_BATCH_LANES])p;
+    c->nops = nops;
+    c->nvars = st->vars_size;
+    c->nregs = st->nregs;
+    c->size = size;
+    c->clone = 0;
+
+    if (nops>1) memcpy(c->ops,st->ops,(nops-1)*sizeof(batchOp));
+    memset(c->ops+nops-1,0,sizeof(batchOp)); // IOP_END
+    if (st->vars_size) memcpy(c->vars,st->vars,st->vars_size*sizeof(batchVar));
+    memset(c->regs,0,st->nregs*sizeof(c->regs[0]));
+    for (x = 0; x < st->consts_size; x ++)
+      for (l = 0; l < NSEEL_BATCH_LANES; l ++) c->regs[st->consts[x].reg][l] = st->consts[x].value;
+
+    nseel_batch_free(st);
+  }
+  return size;
+}
+
+// copies code with its own registers, so the copy can run in another thread at the same time
+int nseel_batch_clone(const void *code, void *buf)
+{
+  const batchCode *src = (const batchCode *)code;
+  if (buf)
+  {
+    batchCode *c = (batchCode *)buf;
+    char *p = (char *)(c+1);
+    memcpy(c,src,sizeof(batchCode));
+
+    c->ops = (batchOp *)p; p += src->nops*sizeof(batchOp);
+    c->vars = (batchVar *)p; p += src->nvars*sizeof(batchVar);
+    p += (64 - (((INT_PTR)p)&63))&63;
+    c->regs = (EEL_F (*)[NSEEL_BATCH_LANES])p;
+    c->clone = 1;
+
+    memcpy(c->ops,src->ops,src->nops*sizeof(batchOp));
+    if (src->nvars) memcpy(c->vars,src->vars,src->nvars*sizeof(batchVar));
+    memcpy(c->regs,src->regs,src->nregs*sizeof(c->regs[0])); // constants
+  }
+  return src->size;
+}
+
+void nseel_batch_free(void *state)
+{
+  batchState *st = (batchState *)state;
+  if (st)
+  {
+    free(st->ops);
+    free(st->vars);
+    free(st->consts);
+    free(st);
+  }
+}
+
+static void batch_run(const batchCode *c)
+{
+  const batchOp *ip = c->ops;
+  EEL_F (*regs)[NSEEL_BATCH_LANES] = c->regs;
+  const bv zero = bv_set(0.0), one = bv_set(1.0), close = bv_set(NSEEL_CLOSEFACTOR);
+  const bv signbit = bv_set(-0.0), expbits = bv_set(HUGE_VAL); // exponent all ones, mantissa zero
+  int l;
+
+  for (;;)
+  {
+    EEL_F *D = regs[ip->d];
+    const EEL_F *A = regs[ip->a], *B = regs[ip->b], *M = regs[ip->m];
+
+    // per vector: a, b, d are the operands, m the lane mask (M[l] != 0)
+    #define VLANES(x) for (l = 0; l < NSEEL_BATCH_LANES; l += BW) \
+      { const bv a = bv_load(A+l), b = bv_load(B+l), d = bv_load(D+l), m = bv_ne(bv_load(M+l),zero); \
+        (void)a; (void)b; (void)d; (void)m; bv_store(D+l,x); }
+    #define V_ABS(x) bv_andnot(signbit,x)
+    #define V_TRUE(x) bv_ge(V_ABS(x),close) // ITRUE()
+    #define V_BOOL(x) bv_and(x,one)
+    #define LANES for (l = 0; l < NSEEL_BATCH_LANES; l ++)
+    #define MASKED(x) LANES if (M[l] != 0.0) { x; }
+    switch (ip->op)
+    {
+      case IOP_END: return;
+      case IOP_JMP: ip = c->ops + ip->parm; continue;
+      case BOP_JMP_IF_NONE:
+        for (l = 0; l < NSEEL_BATCH_LANES; l += BW) if (bv_any(bv_ne(bv_load(M+l),zero))) break;
+        if (l == NSEEL_BATCH_LANES) { ip = c->ops + ip->parm; continue; }
+      break;
+
+      case BOP_COPY: VLANES(a) break;
+      case BOP_BLEND: VLANES(bv_select(m,a,d)) break;
+      case BOP_TRUTH: VLANES(bv_select(m,V_BOOL(V_TRUE(a)),d)) break;
+      case BOP_MASK_TRUE: VLANES(V_BOOL(bv_and(m,V_TRUE(a)))) break;
+      case BOP_MASK_FALSE: VLANES(V_BOOL(bv_andnot(V_TRUE(a),m))) break;
+      case BOP_LOOP_COUNT:
+        LANES
+        {
+          int cnt = interp_trunc32(A[l]);
+          D[l] = cnt < NSEEL_LOOPFUNC_SUPPORT_MAXLEN ? cnt : NSEEL_LOOPFUNC_SUPPORT_MAXLEN;
+        }
+      break;
+      case BOP_LOOP_MASK: VLANES(V_BOOL(bv_and(m,bv_ge(a,one)))) break;
+      case BOP_LOOP_DEC: VLANES(bv_select(m,bv_sub(d,one),d)) break;
+
+      case IOP_SET: // interp_sanitize(): zero unless the exponent is neither all zeros nor all ones
+        VLANES(bv_select(m,bv_and(a,bv_and(bv_ne(bv_and(a,expbits),zero),bv_ne(bv_and(a,expbits),expbits))),d))
+      break;
+      case IOP_ADDOP: VLANES(bv_select(m,bv_add(d,a),d)) break;
+      case IOP_SUBOP: VLANES(bv_select(m,bv_sub(d,a),d)) break;
+      case IOP_MULOP: VLANES(bv_select(m,bv_mul(d,a),d)) break;
+      case IOP_DIVOP: VLANES(bv_select(m,bv_div(d,a),d)) break;
+      case IOP_MODOP: MASKED(D[l] = interp_mod(D[l],A[l])) break;
+      case IOP_OROP: MASKED(D[l] = (EEL_F)(interp_trunc64(D[l]) | interp_trunc64(A[l]))) break;
+      case IOP_ANDOP: MASKED(D[l] = (EEL_F)(interp_trunc64(D[l]) & interp_trunc64(A[l]))) break;
+      case IOP_CALL_2PDDS: MASKED(D[l] = ((interp_fn_2pdd)ip->ptr)(D[l],A[l])) break;
+
+      case IOP_MIN: VLANES(bv_select(bv_ge(a,b),b,a)) break;
+      case IOP_MAX: VLANES(bv_select(bv_ge(a,b),a,b)) break;
+      case IOP_ADD: VLANES(bv_add(a,b)) break;
+      case IOP_SUB: VLANES(bv_sub(a,b)) break;
+      case IOP_MUL: VLANES(bv_mul(a,b)) break;
+      case IOP_DIV: VLANES(bv_div(a,b)) break;
+      case IOP_MOD: LANES D[l] = interp_mod(A[l],B[l]); break;
+      case IOP_OR: LANES D[l] = (EEL_F)(interp_trunc64(A[l]) | interp_trunc64(B[l])); break;
+      case IOP_AND: LANES D[l] = (EEL_F)(interp_trunc64(A[l]) & interp_trunc64(B[l])); break;
+
+      case IOP_UMINUS: VLANES(bv_xor(a,signbit)) break;
+      case IOP_ABS: VLANES(V_ABS(a)) break;
+      case IOP_SQR: VLANES(bv_mul(a,a)) break;
+      case IOP_SQRT: VLANES(bv_sqrt(V_ABS(a))) break;
+      case IOP_SIN: LANES D[l] = sin(A[l]); break;
+      case IOP_COS: LANES D[l] = cos(A[l]); break;
+      case IOP_TAN: LANES D[l] = tan(A[l]); break;
+      case IOP_LOG: LANES D[l] = log(A[l]); break;
+      case IOP_LOG10: LANES D[l] = log10(A[l]); break;
+      case IOP_INVSQRT: LANES D[l] = interp_invsqrt(A[l]); break;
+      case IOP_SIGN: VLANES(bv_select(bv_eq(a,zero),a,bv_or(bv_and(a,signbit),one))) break; // +-0 stays, NaN too gets +-1
+      case IOP_NOT: VLANES(V_BOOL(bv_nge(V_ABS(a),close))) break;
+
+      case IOP_EQUAL: VLANES(V_BOOL(bv_nge(V_ABS(bv_sub(b,a)),close))) break;
+      case IOP_NOTEQ: VLANES(V_BOOL(bv_ge(V_ABS(bv_sub(b,a)),close))) break;
+      case IOP_BELOW: VLANES(V_BOOL(bv_nge(a,b))) break;
+      case IOP_BELEQ: VLANES(V_BOOL(bv_ge(b,a))) break;
+      case IOP_ABOVE: VLANES(V_BOOL(bv_nge(b,a))) break;
+      case IOP_ABOEQ: VLANES(V_BOOL(bv_ge(a,b))) break;
+
+      case IOP_CALL_1PDD: LANES D[l] = ((interp_fn_1pdd)ip->ptr)(A[l]); break;
+      case IOP_CALL_2PDD: LANES D[l] = ((interp_fn_2pdd)ip->ptr)(A[l],B[l]); break;
+    }
+    #undef VLANES
+    #undef V_ABS
+    #undef V_TRUE
+    #undef V_BOOL
+    #undef LANES
+    #undef MASKED
+    ip++;
+  }
+}
+
+void nseel_batch_execute(void *code, EEL_F **data, int nitems)
+{
+  const batchCode *c = (const batchCode *)code;
+  int i, x, l;
+
+  for (i = 0; i < nitems; i += NSEEL_BATCH_LANES)
+  {
+    int n = nitems-i < NSEEL_BATCH_LANES ? nitems-i : NSEEL_BATCH_LANES;
+
+    // unused lanes repeat the last item, so they don't compute anything odd (denormals etc)
+    for (l = 0; l < NSEEL_BATCH_LANES; l ++) c->regs[0][l] = l < n ? 1.0 : 0.0;
+    for (x = 0; x < c->nvars; x ++)
+    {
+      const batchVar *v = c->vars+x;
+      EEL_F *r = c->regs[v->reg];
+      if (v->idx >= 0)
+      {
+        const EEL_F *src = data[v->idx]+i;
+        if (n == NSEEL_BATCH_LANES) memcpy(r,src,sizeof(c->regs[0]));
+        else for (l = 0; l < NSEEL_BATCH_LANES; l ++) r[l] = src[l < n ? l : n-1];
+      }
+      else if (!v->written) // written ones are always assigned before they're read
+      {
+        EEL_F val = *v->var;
+        for (l = 0; l < NSEEL_BATCH_LANES; l ++) r[l] = val;
+      }
+    }
+
+    batch_run(c);
+
+    for (x = 0; x < c->nvars; x ++)
+    {
+      const batchVar *v = c->vars+x;
+      const EEL_F *r = c->regs[v->reg];
+      if (v->idx >= 0)
+      {
+        if (v->written) memcpy(data[v->idx]+i,r,n*sizeof(EEL_F));
+      }
+      else if (v->written && !c->clone) *v->var = r[n-1]; // as if the items ran in order
+    }
+  }
+}
@@ -36,6 +36,57 @@ unsigned int NSEEL_RAM_limitmem=0;
 unsigned int NSEEL_RAM_memused=0;
 int NSEEL_RAM_memused_errors=0;
 
+// the block tables are filled in with compare-and-swap rather than under the host mutex, so that code
+// running in several threads at once can use megabuf()/gmegabuf() without serializing on it. a thread
+// that loses the race for a block frees its copy and uses the winner's.
+#ifdef _WIN32
+#define RAM_CAS_PTR(p,o,n) (InterlockedCompareExchangePointer((PVOID volatile *)(p),(PVOID)(n),(PVOID)(o)) == (PVOID)(o))
+#define RAM_CAS_INT(p,o,n) (InterlockedCompareExchange((volatile LONG *)(p),(LONG)(n),(LONG)(o)) == (LONG)(o))
+#else
+#define RAM_CAS_PTR(p,o,n) __sync_bool_compare_and_swap((p),(o),(n))
+#define RAM_CAS_INT(p,o,n) __sync_bool_compare_and_swap((p),(o),(n))
+#endif
+
+// adjusts NSEEL_RAM_memused by nblocks blocks, returns 0 (leaving it alone) if that would go over NSEEL_RAM_limitmem
+static int ramAccount(int nblocks)
+{
+  const unsigned int msize=sizeof(EEL_F) * NSEEL_RAM_ITEMSPERBLOCK;
+  for (;;)
+  {
+    unsigned int used=*(volatile unsigned int *)&NSEEL_RAM_memused, nused;
+    if (nblocks > 0)
+    {
+      if (NSEEL_RAM_limitmem && used+msize*nblocks >= NSEEL_RAM_limitmem) return 0;
+      nused=used+msize*nblocks;
+    }
+    else
+    {
+      if (used < msize*-nblocks)
+      {
+        ++NSEEL_RAM_memused_errors;
+        return 1;
+      }
+      nused=used-msize*-nblocks;
+    }
+    if (RAM_CAS_INT(&NSEEL_RAM_memused,used,nused)) return 1;
+  }
+}
+
+static void ramFreeBlocks(EEL_F **blocks, int startblock)
+{
+  int x, n=0;
+  for (x = startblock; x < NSEEL_RAM_BLOCKS; x ++)
+  {
+    if (blocks[x])
+    {
+      free(blocks[x]);
+      blocks[x]=0;
+      n++;
+    }
+  }
+  if (n) ramAccount(-n);
+}
+
 
 
 int NSEEL_VM_wantfreeRAM(NSEEL_VMCTX ctx)
@@ -61,23 +112,7 @@ void NSEEL_VM_freeRAMIfCodeRequested(NSEEL_VMCTX ctx) // check to see if our fre
 			{
 				INT_PTR startpos=((INT_PTR)c->ram_needfree)-1;
 	 			EEL_F **blocks = (EEL_F **)c->ram_blocks;
-				INT_PTR pos=0;
-				int x;
-  			for (x = 0; x < NSEEL_RAM_BLOCKS; x ++)
-  			{
-					if (pos >= startpos)
-					{
-						if (blocks[x])
-						{
-							if (NSEEL_RAM_memused >= sizeof(EEL_F) * NSEEL_RAM_ITEMSPERBLOCK) 
-								NSEEL_RAM_memused -= sizeof(EEL_F) * NSEEL_RAM_ITEMSPERBLOCK;
-							else ++NSEEL_RAM_memused_errors;
-						}
-       	 		free(blocks[x]);
-       	 		blocks[x]=0;
-					}
-					pos+=NSEEL_RAM_ITEMSPERBLOCK;
- 				}
+				ramFreeBlocks(blocks,(int)((startpos+NSEEL_RAM_ITEMSPERBLOCK-1)/NSEEL_RAM_ITEMSPERBLOCK));
  				if (!startpos) 
 				{
 					free(blocks);
@@ -99,11 +134,9 @@ EEL_F * NSEEL_CGEN_CALL __NSEEL_RAMAllocGMEM(EEL_F ***blocks, int w)
 
   if (!gmembuf)
   {
-    NSEEL_HOSTSTUB_EnterMutex(); 
-    /*if (!gmembuf)*/ gmembuf=(EEL_F*)calloc(sizeof(EEL_F),NSEEL_SHARED_GRAM_SIZE);
-    NSEEL_HOSTSTUB_LeaveMutex();
-
-    if (!gmembuf) return 0;
+    EEL_F *p=(EEL_F*)calloc(sizeof(EEL_F),NSEEL_SHARED_GRAM_SIZE);
+    if (!p) return 0;
+    if (!RAM_CAS_PTR(&gmembuf,NULL,p)) free(p);
   }
 
   return gmembuf+(((unsigned int)w)&((NSEEL_SHARED_GRAM_SIZE)-1));
@@ -114,19 +147,15 @@ EEL_F * NSEEL_CGEN_CALL  __NSEEL_RAMAlloc(EEL_F ***blocks, int w)
   int whichblock;
   EEL_F **pblocks=*blocks;
 
-  int is_locked=0;
-
   if (!pblocks)
   {
-    /*if (!is_locked)*/ { is_locked=1; NSEEL_HOSTSTUB_EnterMutex(); }
-
-    if (!(pblocks=*blocks))
+    EEL_F **t = (EEL_F **)calloc(sizeof(EEL_F *),NSEEL_RAM_BLOCKS);
+    if (!t) return 0;
+    if (RAM_CAS_PTR(blocks,NULL,t)) pblocks=t;
+    else
     {
-      pblocks = *blocks = (EEL_F **)calloc(sizeof(EEL_F *),NSEEL_RAM_BLOCKS);
-      if (!pblocks) {
-        /*if (is_locked)*/ NSEEL_HOSTSTUB_LeaveMutex();
-        return 0;
-      }
+      free(t);
+      pblocks=*blocks;
     }
   }
 
@@ -136,24 +165,21 @@ EEL_F * NSEEL_CGEN_CALL  __NSEEL_RAMAlloc(EEL_F ***blocks, int w)
     EEL_F *p=pblocks[whichblock];
     if (!p)
     {
-      if (!is_locked) { is_locked=1; NSEEL_HOSTSTUB_EnterMutex(); }
-
-      if (!(p=pblocks[whichblock]))
+      if (ramAccount(1))
       {
-
-      	const int msize=sizeof(EEL_F) * NSEEL_RAM_ITEMSPERBLOCK;
-      	if (!NSEEL_RAM_limitmem || NSEEL_RAM_memused+msize < NSEEL_RAM_limitmem) 
-      	{
-	      	p=pblocks[whichblock]=(EEL_F *)calloc(sizeof(EEL_F),NSEEL_RAM_ITEMSPERBLOCK);
-      		if (p) NSEEL_RAM_memused+=msize;
-      	}
-        if (!p) w=0;
+        p=(EEL_F *)calloc(sizeof(EEL_F),NSEEL_RAM_ITEMSPERBLOCK);
+        if (!p) ramAccount(-1);
+        else if (!RAM_CAS_PTR(pblocks+whichblock,NULL,p))
+        {
+          free(p);
+          ramAccount(-1);
+          p=pblocks[whichblock];
+        }
       }
+      if (!p) return 0;
     }
-    if (is_locked) NSEEL_HOSTSTUB_LeaveMutex();
     return p + (w&(NSEEL_RAM_ITEMSPERBLOCK-1));
   }
-  if (is_locked) NSEEL_HOSTSTUB_LeaveMutex();
 //  fprintf(stderr,"ret 0\n");
   return 0;
 }
@@ -278,18 +304,7 @@ void NSEEL_VM_freeRAM(NSEEL_VMCTX ctx)
     if (c->ram_blocks)
     {
       EEL_F **blocks = (EEL_F **)c->ram_blocks;
-	  int x = 0;
-      for (; x < NSEEL_RAM_BLOCKS; x ++)
-      {
-	      if (blocks[x])
-	      {
-		      if (NSEEL_RAM_memused >= sizeof(EEL_F) * NSEEL_RAM_ITEMSPERBLOCK) 
-			      NSEEL_RAM_memused -= sizeof(EEL_F) * NSEEL_RAM_ITEMSPERBLOCK;
-		      else ++NSEEL_RAM_memused_errors;
-	      }
-        free(blocks[x]);
-        blocks[x]=0;
-      }
+      ramFreeBlocks(blocks,0);
       free(blocks);
       c->ram_blocks=0;
     }
@@ -302,18 +317,7 @@ void NSEEL_VM_FreeGRAM(void **ufd)
   if (ufd[0])
   {
     EEL_F **blocks = (EEL_F **)ufd[0];
-    int x;
-    for (x = 0; x < NSEEL_RAM_BLOCKS; x ++)
-    {
-	    if (blocks[x])
-	    {
-		    if (NSEEL_RAM_memused >= sizeof(EEL_F) * NSEEL_RAM_ITEMSPERBLOCK) 
-			  NSEEL_RAM_memused -= sizeof(EEL_F) * NSEEL_RAM_ITEMSPERBLOCK;
-		    else ++NSEEL_RAM_memused_errors;
-	    }
-      free(blocks[x]);
-      blocks[x]=0;
-    }
+    ramFreeBlocks(blocks,0);
     free(blocks);
     ufd[0]=0;
   }
@@ -202,6 +202,7 @@ OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #define NUM_FREQUENCIES              512   // # of freq. samples you want *out* of the FFT, for 0-11kHz range.
                                            //   ** this must be a power of 2!
                                            //   ** the actual FFT will use twice this many frequencies **
+                                           //   (this is the default; the fft_size setting in the .ini can change it, see CPluginShell::m_fft_size)
 
 #define TEXT_MARGIN                  WASABI_API_APP->getScaleX(10)    // the # of pixels of margin to leave between text and the edge of the screen
 #define PLAYLIST_INNER_MARGIN        WASABI_API_APP->getScaleX(4)     // the extra margin between the playlist box and the text inside
@@ -31,20 +31,107 @@ OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <memory.h>
 #include "fft.h"
 
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE__)
+#include <xmmintrin.h>
+#define FFT_SIMD 1
+typedef __m128 vec4;
+#define Load4(p)     _mm_loadu_ps(p)
+#define Store4(p,v)  _mm_storeu_ps(p,v)
+#define Add4(a,b)    _mm_add_ps(a,b)
+#define Sub4(a,b)    _mm_sub_ps(a,b)
+#define Mul4(a,b)    _mm_mul_ps(a,b)
+#define Sqrt4(a)     _mm_sqrt_ps(a)
+#define Set4(f)      _mm_set1_ps(f)
+#define Reverse4(a)  _mm_shuffle_ps(a,a,_MM_SHUFFLE(0,1,2,3))
+#elif defined(_M_ARM64) || defined(__aarch64__)
+#include <arm_neon.h>
+#define FFT_SIMD 1
+typedef float32x4_t vec4;
+#define Load4(p)     vld1q_f32(p)
+#define Store4(p,v)  vst1q_f32(p,v)
+#define Add4(a,b)    vaddq_f32(a,b)
+#define Sub4(a,b)    vsubq_f32(a,b)
+#define Mul4(a,b)    vmulq_f32(a,b)
+#define Sqrt4(a)     vsqrtq_f32(a)
+#define Set4(f)      vdupq_n_f32(f)
+#define Reverse4(a)  vcombine_f32(vget_high_f32(vrev64q_f32(a)), vget_low_f32(vrev64q_f32(a)))
+#endif
+
 #define PI 3.141592653589793238462643383279502884197169399f
 
 #define SafeDeleteArray(x) { if (x) { delete [] x; x = 0; } }
 
 /*****************************************************************************/
 
+struct FFTPlan
+{
+    int    nfreq;
+    int    refs;
+    int   *bitrevtable;
+    float *cossintable;
+    float *untangletable;
+    float *equalize;
+    FFTPlan *next;
+};
+
+static FFTPlan *g_plans = 0;   // only touched by Init/CleanUp, which run on the main thread
+
+static void InitBitRevTable(FFTPlan *p);
+static void InitCosSinTable(FFTPlan *p);
+static void InitEqualizeTable(FFTPlan *p);
+
+static FFTPlan *AcquirePlan(int nfreq)
+{
+    FFTPlan *p;
+    for (p = g_plans; p; p = p->next)
+        if (p->nfreq == nfreq)
+        {
+            p->refs++;
+            return p;
+        }
+
+    p = new FFTPlan;
+    p->nfreq = nfreq;
+    p->refs = 1;
+    InitBitRevTable(p);
+    InitCosSinTable(p);
+    InitEqualizeTable(p);
+    p->next = g_plans;
+    g_plans = p;
+    return p;
+}
+
+static void ReleasePlan(FFTPlan *plan)
+{
+    FFTPlan **pp;
+    if (!plan || --plan->refs > 0)
+        return;
+    for (pp = &g_plans; *pp; pp = &(*pp)->next)
+        if (*pp == plan)
+        {
+            *pp = plan->next;
+            break;
+        }
+    SafeDeleteArray(plan->bitrevtable);
+    SafeDeleteArray(plan->cossintable);
+    SafeDeleteArray(plan->untangletable);
+    SafeDeleteArray(plan->equalize);
+    delete plan;
+}
+
+/*****************************************************************************/
+
 FFT::FFT() : m_ready(0), m_samples_in(0)
 {
     NFREQ = 0;
+    m_window_energy = 0;
 
+    m_plan = 0;
     envelope = 0;
     equalize = 0;
     bitrevtable = 0;
     cossintable = 0;
+    untangletable = 0;
     temp1 = 0;
     temp2 = 0;
 }
@@ -58,7 +145,7 @@ FFT::~FFT()
 
 /*****************************************************************************/
 
-void FFT::Init(int samples_in, int samples_out, int bEqualize, float envelope_power)
+void FFT::Init(int samples_in, int samples_out, int bEqualize, float envelope_power, int window)
 {
     // samples_in: # of waveform samples you'll feed into the FFT
     // samples_out: # of frequency samples you want out; MUST BE A POWER OF 2.
@@ -66,20 +153,25 @@ void FFT::Init(int samples_in, int samples_out, int bEqualize, float envelope_po
     //   to be roughly equalized; 0 to leave them untouched.
     // envelope_power: set to -1 to disable the envelope; otherwise, specify
     //   the envelope power you want here.  See InitEnvelopeTable for more info.
+    // window: the shape of the envelope; one of the FFT_WINDOW_ values in fft.h.
 
     CleanUp();
 
     m_samples_in = samples_in;
     NFREQ = samples_out*2;
 
-    InitBitRevTable();
-    InitCosSinTable();
-    if (envelope_power > 0)
-        InitEnvelopeTable(envelope_power);
+    m_plan = AcquirePlan(NFREQ);
+    bitrevtable   = m_plan->bitrevtable;
+    cossintable   = m_plan->cossintable;
+    untangletable = m_plan->untangletable;
     if (bEqualize)
-        InitEqualizeTable();
-    temp1 = new float[NFREQ];
-    temp2 = new float[NFREQ];
+        equalize = m_plan->equalize;
+
+    m_window_energy = (float)(m_samples_in < NFREQ ? m_samples_in : NFREQ);
+    if (envelope_power > 0)
+        InitEnvelopeTable(envelope_power, window);
+    temp1 = new float[NFREQ/2];
+    temp2 = new float[NFREQ/2];
 }
 
 /*****************************************************************************/
@@ -87,30 +179,46 @@ void FFT::Init(int samples_in, int samples_out, int bEqualize, float envelope_po
 void FFT::CleanUp()
 {
     SafeDeleteArray(envelope);
-    SafeDeleteArray(equalize);
-    SafeDeleteArray(bitrevtable);
-    SafeDeleteArray(cossintable);
     SafeDeleteArray(temp1);
     SafeDeleteArray(temp2);
+    ReleasePlan(m_plan);
+    m_plan = 0;
+    equalize = 0;
+    bitrevtable = 0;
+    cossintable = 0;
+    untangletable = 0;
 }
 
 /*****************************************************************************/
 
-void FFT::InitEqualizeTable()
+static void InitEqualizeTable(FFTPlan *p)
 {
     int i;
+    int NFREQ = p->nfreq;
     float scaling = -0.02f;
     float inv_half_nfreq = 1.0f/(float)(NFREQ/2);
 
-    equalize = new float[NFREQ/2];
+    p->equalize = new float[NFREQ/2];
 
     for (i=0; i<NFREQ/2; i++)
-        equalize[i] = scaling * logf( (float)(NFREQ/2-i)*inv_half_nfreq );
+        p->equalize[i] = scaling * logf( (float)(NFREQ/2-i)*inv_half_nfreq );
 }
 
 /*****************************************************************************/
 
-void FFT::InitEnvelopeTable(float power)
+static double BesselI0(double x)
+{
+    // modified Bessel function of the first kind, order 0 (for the Kaiser window)
+    double term = 1, sum = 1;
+    for (int k=1; k<32 && term > sum*1e-10; k++)
+    {
+        term *= (x*0.5/k)*(x*0.5/k);
+        sum += term;
+    }
+    return sum;
+}
+
+void FFT::InitEnvelopeTable(float power, int window)
 {
     // this precomputation is for multiplying the waveform sample 
     // by a bell-curve-shaped envelope, so we don't see the ugly 
@@ -124,30 +232,57 @@ void FFT::InitEnvelopeTable(float power)
     //   approaches zero; the peaks get tighter and more precise, but
     //   you also see small oscillations around their bases.
 
+    // the Blackman-Harris and Kaiser windows trade wider peaks for much
+    //   less leakage into the bins around them than the raised cosine,
+    //   which matters once the bins are narrow (big FFTs, long windows).
+
     int i;
     float mult = 1.0f/(float)m_samples_in * 6.2831853f;
 
     envelope = new float[m_samples_in];
 
-    if (power==1.0f)
+    if (window == FFT_WINDOW_BLACKMAN_HARRIS)
+    {
         for (i=0; i<m_samples_in; i++)
-            envelope[i] = 0.5f + 0.5f*sinf(i*mult - 1.5707963268f);
+            envelope[i] = 0.35875f - 0.48829f*cosf(i*mult) + 0.14128f*cosf(2*i*mult) - 0.01168f*cosf(3*i*mult);
+    }
+    else if (window == FFT_WINDOW_KAISER)
+    {
+        // I0(beta*sqrt(1-x^2)) / I0(beta), for x in [-1,1)
+        double inv_i0_beta = 1.0/BesselI0(FFT_KAISER_BETA);
+        for (i=0; i<m_samples_in; i++)
+        {
+            double x = 2.0*i/(double)m_samples_in - 1.0;
+            envelope[i] = (float)(BesselI0(FFT_KAISER_BETA*sqrt(1.0 - x*x)) * inv_i0_beta);
+        }
+    }
     else
+    {
+        for (i=0; i<m_samples_in; i++)
+            envelope[i] = 0.5f + 0.5f*sinf(i*mult - 1.5707963268f);
+    }
+
+    if (power != 1.0f)
         for (i=0; i<m_samples_in; i++)
-            envelope[i] = powf(0.5f + 0.5f*sinf(i*mult - 1.5707963268f), power);
+            envelope[i] = powf(envelope[i], power);
+
+    m_window_energy = 0;
+    for (i=0; i<m_samples_in && i<NFREQ; i++)
+        m_window_energy += envelope[i]*envelope[i];
 }
 
 /*****************************************************************************/
 
-void FFT::InitBitRevTable() 
+static void InitBitRevTable(FFTPlan *p) 
 {
     int i,j,temp;
-    bitrevtable = new int[NFREQ];
+    int n = p->nfreq/2;
+    int *bitrevtable = p->bitrevtable = new int[n];
 
-    for (i=0; i<NFREQ; i++) 
+    for (i=0; i<n; i++) 
         bitrevtable[i] = i;
 
-    for (i=0,j=0; i < NFREQ; i++) 
+    for (i=0,j=0; i < n; i++) 
     {
         if (j > i) 
         {
@@ -156,7 +291,7 @@ void FFT::InitBitRevTable()
             bitrevtable[j] = temp;
         }
         
-        int m = NFREQ >> 1;
+        int m = n >> 1;
         
         while (m >= 1 && j >= m) 
         {
@@ -170,30 +305,35 @@ void FFT::InitBitRevTable()
 
 /*****************************************************************************/
 
-void FFT::InitCosSinTable()
+static void InitCosSinTable(FFTPlan *plan)
 {
-
-    int i,dftsize,tabsize;
-
-    dftsize = 2;
-    tabsize = 0;
-    while (dftsize <= NFREQ) 
+    // the first two passes (dft sizes 2 and 4) only need twiddles of 1 and -i, so they
+    // are done together without a table; each later pass, with half size h, gets h
+    // cosines followed by h sines, so its butterflies can read 4 at a time.
+    int i,h,n = plan->nfreq/2;
+    float *p;
+
+    plan->cossintable = new float[n > 8 ? 2*n : 16];
+    p = plan->cossintable;
+    for (h=4; h<n; h<<=1) 
     {
-        ++tabsize;
-        dftsize <<= 1;
+        for (i=0; i<h; i++) 
+        {
+            float theta = -PI*(float)i/(float)h;
+            p[i]   = cosf(theta);
+            p[h+i] = sinf(theta);
+        }
+        p += 2*h;
     }
 
-    cossintable = new float[tabsize][2];
-
-    dftsize = 2;
-    i = 0;
-    while (dftsize <= NFREQ) 
+    // turns the complex transform of the even (real) & odd (imaginary) samples 
+    // into the transform of the real input; see time_to_frequency_domain.
+    plan->untangletable = new float[n*2];
+    for (i=0; i<n; i++) 
     {
-        float theta = (float)(-2.0f*PI/(float)dftsize);
-        cossintable[i][0] = (float)cosf(theta);
-        cossintable[i][1] = (float)sinf(theta);
-        ++i;
-        dftsize <<= 1;
+        float theta = -2.0f*PI*(float)i/(float)plan->nfreq;
+        plan->untangletable[i]   = 0.5f*cosf(theta);
+        plan->untangletable[n+i] = 0.5f*sinf(theta);
     }
 }
 
@@ -238,82 +378,520 @@ void FFT::time_to_frequency_domain(float *in_wavedata, float *out_spectraldata)
     //   of a very high quality, to reduce high-frequency noise that would
     //   otherwise show up in the output.
 
-    int j, m, i, dftsize, t;
-    float wtemp, tempr, tempi;
+    // The real input is transformed as half as many complex samples - the even samples
+    //   as the real parts, the odd ones as the imaginary parts - whose spectrum Z is 
+    //   then untangled into that of the input: with n = NFREQ/2 and w = e^(-2*pi*i/NFREQ),
+    //   X[k] = (Z[k] + conj(Z[n-k]))/2 + w^k * (Z[k] - conj(Z[n-k]))/2i.
+
+    int i, m, g, h, n = NFREQ/2;
 
     if (!bitrevtable) return;
-    //if (!envelope) return;
-    //if (!equalize) return;
     if (!temp1) return;
     if (!temp2) return;
     if (!cossintable) return;
+    if (!untangletable) return;
 
     // 1. set up input to the fft
     if (envelope)
     {
-        for (i=0; i<NFREQ; i++) 
+        for (i=0; i<n; i++) 
         {
-            int idx = bitrevtable[i];
-            if (idx < m_samples_in)
-                temp1[i] = in_wavedata[idx] * envelope[idx];
-            else
-                temp1[i] = 0;
+            int idx = bitrevtable[i]*2;
+            temp1[i] = (idx   < m_samples_in) ? in_wavedata[idx]   * envelope[idx]   : 0;
+            temp2[i] = (idx+1 < m_samples_in) ? in_wavedata[idx+1] * envelope[idx+1] : 0;
         }
     }
     else
     {
-        for (i=0; i<NFREQ; i++) 
+        for (i=0; i<n; i++) 
         {
-            int idx = bitrevtable[i];
-            if (idx < m_samples_in)
-                temp1[i] = in_wavedata[idx];// * envelope[idx];
-            else
-                temp1[i] = 0;
+            int idx = bitrevtable[i]*2;
+            temp1[i] = (idx   < m_samples_in) ? in_wavedata[idx]   : 0;
+            temp2[i] = (idx+1 < m_samples_in) ? in_wavedata[idx+1] : 0;
         }
     }
-    memset(temp2, 0, sizeof(float)*NFREQ);
     
     // 2. perform FFT
     float *real = temp1;
     float *imag = temp2;
-    dftsize = 2;
-    t = 0;
-    while (dftsize <= NFREQ) 
+
+    // the first two passes: dft sizes 2 and 4
+    if (n >= 4)
     {
-        float wpr = cossintable[t][0];
-        float wpi = cossintable[t][1];
-        float wr = 1.0f;
-        float wi = 0.0f;
-        int hdftsize = dftsize >> 1;
+        for (g = 0; g < n; g += 4) 
+        {
+            float *r = real + g;
+            float *q = imag + g;
+            float ar0 = r[0] + r[1], ai0 = q[0] + q[1];
+            float ar1 = r[0] - r[1], ai1 = q[0] - q[1];
+            float ar2 = r[2] + r[3], ai2 = q[2] + q[3];
+            float ar3 = r[2] - r[3], ai3 = q[2] - q[3];
+            r[0] = ar0 + ar2;  q[0] = ai0 + ai2;
+            r[2] = ar0 - ar2;  q[2] = ai0 - ai2;
+            r[1] = ar1 + ai3;  q[1] = ai1 - ar3;   // + -i*a3
+            r[3] = ar1 - ai3;  q[3] = ai1 + ar3;
+        }
+    }
+    else if (n == 2)
+    {
+        float tr = real[1], ti = imag[1];
+        real[1] = real[0] - tr;  imag[1] = imag[0] - ti;
+        real[0] += tr;           imag[0] += ti;
+    }
 
-        for (m = 0; m < hdftsize; m+=1) 
+    // the rest, 4 butterflies at a time
+    const float *tw = cossintable;
+    for (h = 4; h < n; h <<= 1) 
+    {
+        for (g = 0; g < n; g += 2*h) 
         {
-            for (i = m; i < NFREQ; i+=dftsize) 
+            float *r = real + g;
+            float *q = imag + g;
+            for (m = 0; m < h; m += 4) 
             {
-                j = i + hdftsize;
-                tempr = wr*real[j] - wi*imag[j];
-                tempi = wr*imag[j] + wi*real[j];
-                real[j] = real[i] - tempr;
-                imag[j] = imag[i] - tempi;
-                real[i] += tempr;
-                imag[i] += tempi;
+#ifdef FFT_SIMD
+                vec4 wr = Load4(tw+m), wi = Load4(tw+h+m);
+                vec4 xr = Load4(r+h+m), xi = Load4(q+h+m);
+                vec4 tr = Sub4(Mul4(wr,xr), Mul4(wi,xi));
+                vec4 ti = Add4(Mul4(wr,xi), Mul4(wi,xr));
+                vec4 ar = Load4(r+m), ai = Load4(q+m);
+                Store4(r+h+m, Sub4(ar,tr));
+                Store4(q+h+m, Sub4(ai,ti));
+                Store4(r+m, Add4(ar,tr));
+                Store4(q+m, Add4(ai,ti));
+#else
+                for (i = m; i < m+4; i++) 
+                {
+                    float tr = tw[i]*r[h+i] - tw[h+i]*q[h+i];
+                    float ti = tw[i]*q[h+i] + tw[h+i]*r[h+i];
+                    r[h+i] = r[i] - tr;
+                    q[h+i] = q[i] - ti;
+                    r[i] += tr;
+                    q[i] += ti;
+                }
+#endif
             }
+        }
+        tw += 2*h;
+    }
 
-            wr = (wtemp=wr)*wpr - wi*wpi;
-            wi = wi*wpr + wtemp*wpi;
+    // 3. untangle the real input's spectrum, take the magnitude & equalize it 
+    //    (on a log10 scale) for output
+    i = 0;
+#ifdef FFT_SIMD
+    if (n >= 8)
+    {
+        // bins i..i+3 pair with bins n-i..n-i-3, so those are loaded reversed
+        const float *uc = untangletable;
+        const float *us = untangletable + n;
+        vec4 half = Set4(0.5f);
+
+        out_spectraldata[0] = UntangledMagnitude(0);
+        if (equalize)
+            out_spectraldata[0] *= equalize[0];
+        for (i = 1; i+4 <= n; i += 4) 
+        {
+            vec4 ar = Load4(real+i), ai = Load4(imag+i);
+            vec4 br = Reverse4(Load4(real+n-i-3)), bi = Reverse4(Load4(imag+n-i-3));
+            vec4 c = Load4(uc+i), s = Load4(us+i);
+            vec4 er = Mul4(Add4(ar,br), half), ei = Mul4(Sub4(ai,bi), half);
+            vec4 odr = Add4(ai,bi), odi = Sub4(br,ar);
+            vec4 xr = Add4(er, Sub4(Mul4(c,odr), Mul4(s,odi)));
+            vec4 xi = Add4(ei, Add4(Mul4(c,odi), Mul4(s,odr)));
+            vec4 mag = Sqrt4(Add4(Mul4(xr,xr), Mul4(xi,xi)));
+            if (equalize)
+                mag = Mul4(mag, Load4(equalize+i));
+            Store4(out_spectraldata+i, mag);
         }
+    }
+#endif
+    if (equalize)
+        for (; i<n; i++) 
+            out_spectraldata[i] = equalize[i] * UntangledMagnitude(i);
+    else
+        for (; i<n; i++) 
+            out_spectraldata[i] = UntangledMagnitude(i);
+}
+
+/*****************************************************************************/
+
+float FFT::UntangledMagnitude(int k) const
+{
+    // magnitude of bin k of the real input's spectrum, from the complex one in temp1/temp2
+    int n = NFREQ/2;
+    int nk = (n-k) & (n-1);
+    float ar = temp1[k], ai = temp2[k];
+    float br = temp1[nk], bi = temp2[nk];
+    float c = untangletable[k], s = untangletable[n+k];
+    float odr = ai + bi, odi = br - ar;
+    float xr = 0.5f*(ar + br) + c*odr - s*odi;
+    float xi = 0.5f*(ai - bi) + c*odi + s*odr;
+    return sqrtf(xr*xr + xi*xi);
+}
+
+/*****************************************************************************/
+
+FFTBands::FFTBands()
+{
+    m_num_bands = 0;
+    m_rowstart = 0;
+    m_firstbin = 0;
+    m_weight = 0;
+}
+
+/*****************************************************************************/
+
+FFTBands::~FFTBands()
+{
+    CleanUp();
+}
+
+/*****************************************************************************/
+
+void FFTBands::CleanUp()
+{
+    SafeDeleteArray(m_rowstart);
+    SafeDeleteArray(m_firstbin);
+    SafeDeleteArray(m_weight);
+    m_num_bands = 0;
+}
 
-        dftsize <<= 1;
-        ++t;
+/*****************************************************************************/
+
+void FFTBands::Init(int num_freq, float max_freq_hz, int num_bands, float low_hz, float high_hz)
+{
+    // num_freq: # of spectrum samples you'll pass to Apply(); the last one is max_freq_hz.
+    // num_bands: # of bands you want out, with their peaks log-spaced from low_hz to high_hz.
+    //   each band is a triangle reaching from the peak of the band below to that of
+    //   the band above, so together they cover everything in between evenly.  bands
+    //   narrower than the spectrum's resolution are widened to a bin on either side.
+    // the weights of each band add up to 1, so a band is the average magnitude under it.
+
+    int b, k, i;
+
+    CleanUp();
+    if (num_freq < 2 || num_bands < 1 || low_hz <= 0 || high_hz <= low_hz)
+        return;
+
+    m_num_bands = num_bands;
+    m_rowstart  = new int[num_bands+1];
+    m_firstbin  = new int[num_bands];
+
+    // peaks, in bins; peak[0] and peak[num_bands+1] are the outer edges
+    float *peak = new float[num_bands+2];
+    float bins_per_hz = (num_freq-1)/max_freq_hz;
+    float step = (num_bands > 1) ? logf(high_hz/low_hz)/(float)(num_bands-1) : logf(2.0f);
+    for (b=0; b<num_bands+2; b++)
+        peak[b] = low_hz*expf((b-1)*step) * bins_per_hz;
+
+    // first pass: the range of each band, and so the # of weights
+    int *lastbin = new int[num_bands];
+    int nonzero = 0;
+    for (b=0; b<num_bands; b++)
+    {
+        float lo = peak[b], mid = peak[b+1], hi = peak[b+2];
+        if (lo > mid-1.0f) lo = mid-1.0f;
+        if (hi < mid+1.0f) hi = mid+1.0f;
+        int first = (int)ceilf(lo), last = (int)floorf(hi);
+        if (first < 0) first = 0;
+        if (last > num_freq-1) last = num_freq-1;
+        if (last < first) last = first = (first > num_freq-1) ? num_freq-1 : first;
+        m_firstbin[b] = first;
+        lastbin[b] = last;
+        m_rowstart[b] = nonzero;
+        nonzero += last-first+1;
     }
+    m_rowstart[num_bands] = nonzero;
 
-    // 3. take the magnitude & equalize it (on a log10 scale) for output
-    if (equalize)
-        for (i=0; i<NFREQ/2; i++) 
-            out_spectraldata[i] = equalize[i] * sqrtf(temp1[i]*temp1[i] + temp2[i]*temp2[i]);
+    // second pass: the weights
+    m_weight = new float[nonzero];
+    for (b=0; b<num_bands; b++)
+    {
+        float lo = peak[b], mid = peak[b+1], hi = peak[b+2];
+        if (lo > mid-1.0f) lo = mid-1.0f;
+        if (hi < mid+1.0f) hi = mid+1.0f;
+        float sum = 0;
+        for (k=m_firstbin[b], i=m_rowstart[b]; k<=lastbin[b]; k++, i++)
+        {
+            float w = (k <= mid) ? (k-lo)/(mid-lo) : (hi-k)/(hi-mid);
+            m_weight[i] = (w > 0) ? w : 0;
+            sum += m_weight[i];
+        }
+        for (i=m_rowstart[b]; i<m_rowstart[b+1]; i++)
+            m_weight[i] = (sum > 0) ? m_weight[i]/sum : 1.0f/(float)(m_rowstart[b+1]-m_rowstart[b]);
+    }
+
+    delete [] lastbin;
+    delete [] peak;
+}
+
+/*****************************************************************************/
+
+void FFTBands::Apply(const float *spectrum, float *bands) const
+{
+    int b, i;
+    for (b=0; b<m_num_bands; b++)
+    {
+        const float *s = spectrum + m_firstbin[b] - m_rowstart[b];
+        float sum = 0;
+        for (i=m_rowstart[b]; i<m_rowstart[b+1]; i++)
+            sum += m_weight[i]*s[i];
+        bands[b] = sum;
+    }
+}
+
+/*****************************************************************************/
+
+BeatTracker::BeatTracker()
+{
+    m_level = 0;
+    m_temp = 0;
+    Reset();
+}
+
+/*****************************************************************************/
+
+BeatTracker::~BeatTracker()
+{
+    CleanUp();
+}
+
+/*****************************************************************************/
+
+void BeatTracker::CleanUp()
+{
+    m_bands.CleanUp();
+    SafeDeleteArray(m_level);
+    SafeDeleteArray(m_temp);
+}
+
+/*****************************************************************************/
+
+void BeatTracker::Init(int num_freq, float max_freq_hz)
+{
+    // num_freq, max_freq_hz: as for FFTBands::Init (the spectra you'll pass to Update).
+
+    CleanUp();
+    m_bands.Init(num_freq, max_freq_hz, 20, 50.0f, 12000.0f);
+    int nb = m_bands.GetNumBands();
+    if (nb)
+    {
+        m_level = new float[nb];
+        m_temp  = new float[nb*2];
+    }
+
+    // a broad (log-gaussian, one octave wide) preference for tempos near 120 bpm,
+    //  so the autocorrelation peaks of half and double the tempo lose out to it.
+    for (int lag=BEAT_MIN_LAG; lag<=BEAT_MAX_LAG; lag++)
+    {
+        float octaves = logf(120.0f*lag/(60.0f*BEAT_OSS_RATE)) / logf(2.0f);
+        m_prior[lag] = expf(-0.5f*octaves*octaves);
+    }
+
+    Reset();
+}
+
+/*****************************************************************************/
+
+void BeatTracker::Reset()
+{
+    memset(m_oss, 0, sizeof(m_oss));
+    memset(m_acf, 0, sizeof(m_acf));
+    m_oss_pos = 0;
+    m_oss_slot = 0;
+    m_oss_count = 0;
+    m_flux_avg = 0;
+    m_time = -1.0f;
+    m_last_beat_time = -1.0f;
+    m_period = 60.0f*BEAT_OSS_RATE/120.0f;
+    m_phase = 0;
+    m_bpm = 120.0f;
+    m_beat = 0;
+    m_confidence = 0;
+}
+
+/*****************************************************************************/
+
+void BeatTracker::AddOnsetSample(float x)
+{
+    // ~4 seconds of memory; the lag-0 term (the signal's power) lives in m_acf[0].
+    const float decay = 0.9975f;
+    const int mask = BEAT_OSS_LEN-1;
+
+    m_oss_pos = (m_oss_pos+1) & mask;
+    m_oss[m_oss_pos] = x;
+    m_oss_count++;
+
+    m_acf[0] = m_acf[0]*decay + x*x;
+    for (int lag=BEAT_MIN_LAG-1; lag<=BEAT_MAX_LAG+1; lag++)
+        m_acf[lag] = m_acf[lag]*decay + x*m_oss[(m_oss_pos - lag) & mask];
+}
+
+/*****************************************************************************/
+
+float BeatTracker::ScoreLag(int lag) const
+{
+    // a period that isn't a whole # of samples splits its peak over two lags, so look at
+    //  3 of them; and for fast tempos, count their second beat too - otherwise half the
+    //  tempo (whose peak isn't split, or less so) would often win.
+    float score = m_acf[lag-1] + m_acf[lag] + m_acf[lag+1];
+    if (lag*2 < BEAT_MAX_LAG)
+        score += 0.5f*(m_acf[lag*2-1] + m_acf[lag*2] + m_acf[lag*2+1]);
+    return score*m_prior[lag];
+}
+
+/*****************************************************************************/
+
+void BeatTracker::Update(const float *spectrum, const float *spectrum2, float time)
+{
+    const int nb = m_bands.GetNumBands();
+    const int mask = BEAT_OSS_LEN-1;
+    int b;
+
+    m_beat = 0;
+    if (!nb)
+        return;
+
+    float dt = time - m_time;
+    if (m_time < 0 || dt <= 0 || dt > 1.0f)
+    {
+        // first update, or the clock jumped: start over
+        Reset();
+        dt = 0;
+    }
+    m_time = time;
+
+    // 1. onset strength: how much the (log) band levels went up since the last spectrum,
+    //    minus the recent average of that, so mostly the peaks are left.
+    m_bands.Apply(spectrum, m_temp);
+    if (spectrum2)
+    {
+        m_bands.Apply(spectrum2, m_temp + nb);
+        for (b=0; b<nb; b++)
+            m_temp[b] += m_temp[nb + b];
+    }
+    float flux = 0;
+    for (b=0; b<nb; b++)
+    {
+        float level = logf(1.0f + m_temp[b]);
+        if (level > m_level[b] && m_oss_count > 0)
+            flux += level - m_level[b];
+        m_level[b] = level;
+    }
+    flux /= (float)nb;
+
+    float mix = expf(-dt/0.5f);
+    m_flux_avg = m_flux_avg*mix + flux*(1-mix);
+    float onset = flux - m_flux_avg;
+    if (onset < 0)
+        onset = 0;
+
+    // 2. resample it: each update covers the slots since the last one.
+    int slot = (int)(time*BEAT_OSS_RATE);
+    if (m_oss_count == 0)
+    {
+        m_oss_slot = slot;
+        AddOnsetSample(onset);
+    }
+    else if (slot <= m_oss_slot)
+    {
+        if (m_oss[m_oss_pos] < onset)
+            m_oss[m_oss_pos] = onset;
+    }
     else
-        for (i=0; i<NFREQ/2; i++) 
-            out_spectraldata[i] = sqrtf(temp1[i]*temp1[i] + temp2[i]*temp2[i]);
+    {
+        for (; m_oss_slot < slot; m_oss_slot++)
+            AddOnsetSample(onset);
+    }
+
+    // 3. tempo: the best (weighted) autocorrelation peak.  stay with the current one unless
+    //    another one is clearly better, then refine it to a fraction of a sample.
+    int lag, best = BEAT_MIN_LAG;
+    float sum = 0;
+    float best_score = ScoreLag(best);
+    for (lag=BEAT_MIN_LAG; lag<=BEAT_MAX_LAG; lag++)
+    {
+        sum += m_acf[lag];
+        float score = ScoreLag(lag);
+        if (score > best_score)
+        {
+            best_score = score;
+            best = lag;
+        }
+    }
+    int lo = (int)(m_period + 0.5f) - 2, hi = lo + 4;
+    if (lo < BEAT_MIN_LAG) lo = BEAT_MIN_LAG;
+    if (hi > BEAT_MAX_LAG) hi = BEAT_MAX_LAG;
+    int cur = lo;
+    float cur_score = ScoreLag(lo);
+    for (lag=lo+1; lag<=hi; lag++)
+    {
+        float score = ScoreLag(lag);
+        if (score > cur_score)
+        {
+            cur_score = score;
+            cur = lag;
+        }
+    }
+    bool bJump = (best_score > 1.2f*cur_score);
+    if (bJump)
+        cur = best;
+
+    // (the peak itself is the biggest of the 3 lags)
+    if (m_acf[cur-1] > m_acf[cur] && cur > BEAT_MIN_LAG)
+        cur--;
+    else if (m_acf[cur+1] > m_acf[cur] && cur < BEAT_MAX_LAG)
+        cur++;
+    float period = (float)cur;
+    float y0 = m_acf[cur-1], y1 = m_acf[cur], y2 = m_acf[cur+1];
+    if (y1 >= y0 && y1 >= y2 && y0 - 2*y1 + y2 < 0)
+        period += 0.5f*(y0 - y2)/(y0 - 2*y1 + y2);
+    mix = bJump ? 0 : expf(-dt/1.0f);
+    m_period = m_period*mix + period*(1-mix);
+    m_bpm = 60.0f*BEAT_OSS_RATE/m_period;
+
+    // how far the peak stands out from the rest, relative to the signal's power
+    float avg = sum / (float)(BEAT_MAX_LAG - BEAT_MIN_LAG + 1);
+    float confidence = (m_acf[0] > avg && m_acf[cur] > avg) ? (m_acf[cur] - avg)/(m_acf[0] - avg) : 0;
+    mix = expf(-dt/1.0f);
+    if (confidence > 1.0f)
+        confidence = 1.0f;
+    m_confidence = m_confidence*mix + confidence*(1-mix);
+
+    // 4. phase: move on by the time since the last update, then pull towards the offset
+    //    of the comb (teeth one period apart) that catches the most onset strength.
+    m_phase += dt*BEAT_OSS_RATE/m_period;
+    if (m_oss_count > BEAT_COMB_BEATS*m_period)
+    {
+        int best_offset = 0;
+        float best_sum = -1.0f;
+        for (int offset=0; offset<(int)(m_period + 0.5f); offset++)
+        {
+            float s = 0;
+            for (int k=0; k<BEAT_COMB_BEATS; k++)
+                s += m_oss[(m_oss_pos - offset - (int)(k*m_period + 0.5f)) & mask];
+            if (s > best_sum)
+            {
+                best_sum = s;
+                best_offset = offset;
+            }
+        }
+        float err = best_offset/m_period - m_phase;
+        err -= floorf(err + 0.5f);
+        m_phase += err*(1 - expf(-dt/0.25f));
+    }
+    if (m_phase < 0)
+        m_phase += 1.0f;
+    if (m_phase >= 1.0f)
+    {
+        m_phase -= floorf(m_phase);
+        // (a phase correction can cross a beat twice; only count it once)
+        if (m_last_beat_time < 0 || time - m_last_beat_time > 0.5f*m_period/BEAT_OSS_RATE)
+        {
+            m_beat = 1.0f;
+            m_last_beat_time = time;
+        }
+    }
 }
 
-/*****************************************************************************/
\ No newline at end of file
+/*****************************************************************************/
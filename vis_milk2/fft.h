@@ -30,31 +30,108 @@ OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #ifndef __NULLSOFT_DX9_PLUGIN_SHELL_FFT_H__
 #define __NULLSOFT_DX9_PLUGIN_SHELL_FFT_H__ 1
 
+// window functions for FFT::Init
+#define FFT_WINDOW_HANN             0   // the original MilkDrop envelope (a raised cosine)
+#define FFT_WINDOW_BLACKMAN_HARRIS  1   // wider peaks, much lower leakage
+#define FFT_WINDOW_KAISER           2   // in between, see FFT_KAISER_BETA
+#define FFT_KAISER_BETA             8.0f
+
+struct FFTPlan;
+
 class FFT
 {
 public:
     FFT();
     ~FFT();
-    void Init(int samples_in, int samples_out, int bEqualize=1, float envelope_power=1.0f);
+    void Init(int samples_in, int samples_out, int bEqualize=1, float envelope_power=1.0f, int window=FFT_WINDOW_HANN);
     void time_to_frequency_domain(float *in_wavedata, float *out_spectraldata);
     int  GetNumFreq() const { return NFREQ; };
+    float GetWindowEnergy() const { return m_window_energy; };  // sum of the squared envelope
     void CleanUp();
 private:
     int m_ready;
     int m_samples_in;
     int NFREQ;
+    float m_window_energy;
 
-    void InitEnvelopeTable(float power);
-    void InitEqualizeTable();
-    void InitBitRevTable();
-    void InitCosSinTable();
+    void InitEnvelopeTable(float power, int window);
+    float UntangledMagnitude(int k) const;
     
-    int   *bitrevtable;
+    // the NFREQ real samples are transformed as NFREQ/2 complex ones (even samples real,
+    // odd ones imaginary), then untangled into the spectrum of the real input.
+    // all the tables but the envelope depend only on NFREQ, so FFTs of the same size share them.
+    FFTPlan *m_plan;
+    int   *bitrevtable;     // NFREQ/2
     float *envelope;
     float *equalize;
-    float *temp1;
-    float *temp2;
-    float (*cossintable)[2];
+    float *temp1;           // NFREQ/2 real parts
+    float *temp2;           // NFREQ/2 imaginary parts
+    float *cossintable;     // for each pass after the first two: h cosines, then h sines (h = half its dft size)
+    float *untangletable;   // NFREQ/2 cos, then NFREQ/2 sin (halved), for the real-input pass
+};
+
+// log-spaced (constant-Q) bands over the output of an FFT: overlapping triangular filters,
+// each covering a fixed fraction of an octave.  they are stored as one sparse matrix, so 
+// computing all of the bands is a single pass over its nonzero weights.
+class FFTBands
+{
+public:
+    FFTBands();
+    ~FFTBands();
+    void Init(int num_freq, float max_freq_hz, int num_bands, float low_hz, float high_hz);
+    void Apply(const float *spectrum, float *bands) const;
+    int  GetNumBands() const { return m_num_bands; };
+    void CleanUp();
+private:
+    int    m_num_bands;
+    int   *m_rowstart;      // num_bands+1: band b's weights are m_weight[m_rowstart[b]..m_rowstart[b+1]-1]
+    int   *m_firstbin;      // num_bands: the spectrum bin of band b's first weight (its bins are consecutive)
+    float *m_weight;
+};
+
+// tempo and beat tracking from one spectrum per frame (at any frame rate).  the spectral flux
+// over log-spaced bands is the onset strength; it is resampled at BEAT_OSS_RATE, and its
+// autocorrelation (updated incrementally, with a few seconds of memory) gives the tempo,
+// while a comb over the last few beats of it locks the phase.
+#define BEAT_OSS_RATE   100     // onset strength samples per second
+#define BEAT_OSS_LEN    512     // # of them kept: a power of 2, and at least BEAT_COMB_BEATS*BEAT_MAX_LAG
+#define BEAT_MIN_BPM    60
+#define BEAT_MAX_BPM    200
+#define BEAT_MIN_LAG    (BEAT_OSS_RATE*60/BEAT_MAX_BPM)
+#define BEAT_MAX_LAG    (BEAT_OSS_RATE*60/BEAT_MIN_BPM)
+#define BEAT_COMB_BEATS 4
+
+class BeatTracker
+{
+public:
+    BeatTracker();
+    ~BeatTracker();
+    void  Init(int num_freq, float max_freq_hz);
+    void  Update(const float *spectrum, const float *spectrum2, float time);   // spectrum2 (the other channel) can be NULL
+    float GetBeat() const { return m_beat; };               // 1 on the update a beat falls on, 0 otherwise
+    float GetBeatPhase() const { return m_phase; };         // 0..1, from one beat to the next
+    float GetBpm() const { return m_bpm; };
+    float GetConfidence() const { return m_confidence; };   // 0..1: how periodic the onsets are
+    void  CleanUp();
+private:
+    FFTBands m_bands;
+    float *m_level;         // num_bands: log levels of the last spectrum
+    float *m_temp;          // num_bands*2
+    float  m_oss[BEAT_OSS_LEN];         // onset strength; circular, m_oss_pos is the newest
+    float  m_acf[BEAT_MAX_LAG+2];       // its autocorrelation, [0] and BEAT_MIN_LAG-1..BEAT_MAX_LAG+1
+    float  m_prior[BEAT_MAX_LAG+1];     // preference for each lag (centered on 120 bpm)
+    int    m_oss_pos;
+    int    m_oss_slot;      // time*BEAT_OSS_RATE of the newest sample
+    int    m_oss_count;     // # of samples since the last reset
+    float  m_flux_avg;
+    float  m_time;          // of the last update; < 0 before the first
+    float  m_last_beat_time;
+    float  m_period;        // in samples of m_oss
+    float  m_phase, m_bpm, m_beat, m_confidence;
+
+    void  Reset();
+    void  AddOnsetSample(float x);
+    float ScoreLag(int lag) const;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,291 @@
+/*
+  LICENSE
+  -------
+Copyright 2005-2013 Nullsoft, Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, 
+are permitted provided that the following conditions are met:
+
+  * Redistributions of source code must retain the above copyright notice,
+    this list of conditions and the following disclaimer. 
+
+  * Redistributions in binary form must reproduce the above copyright notice,
+    this list of conditions and the following disclaimer in the documentation
+    and/or other materials provided with the distribution. 
+
+  * Neither the name of Nullsoft nor the names of its contributors may be used to 
+    endorse or promote products derived from this software without specific prior written permission. 
+ 
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR 
+IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND 
+FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR 
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT 
+OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include <math.h>
+#include "framepacer.h"
+#ifdef _WIN32
+#include <mmsystem.h>
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
+#else
+#include <errno.h>
+#include <sched.h>
+#include <time.h>
+#endif
+
+#define MIN_SPIN_MARGIN 0.0002  // seconds
+#define MAX_SPIN_MARGIN 0.004
+
+/*****************************************************************************/
+
+FramePacer::FramePacer()
+{
+    m_deadline = 0;
+    m_period = 0;
+    m_margin = 0.001;
+    m_oversleep_avg = 0;
+    m_oversleep_dev = 0;
+    m_refresh_hz = 0;
+    m_vsync = false;
+#ifdef _WIN32
+    m_timer = NULL;
+    m_timer_period_set = false;
+    m_ticks_per_sec = 0;
+#endif
+}
+
+/*****************************************************************************/
+
+FramePacer::~FramePacer()
+{
+    CleanUp();
+}
+
+/*****************************************************************************/
+
+bool FramePacer::Init()
+{
+    CleanUp();
+
+#ifdef _WIN32
+    LARGE_INTEGER freq;
+    if (!QueryPerformanceFrequency(&freq) || freq.QuadPart <= 0)
+        return false;
+    m_ticks_per_sec = (double)freq.QuadPart;
+
+    // Windows 10 (1803+) has high-resolution waitable timers, which don't depend on
+    // the system timer resolution.  Before that, we have to raise the resolution to 1 ms.
+    typedef HANDLE (WINAPI *CREATEWAITABLETIMEREXW)(LPSECURITY_ATTRIBUTES, LPCWSTR, DWORD, DWORD);
+    CREATEWAITABLETIMEREXW pCreateWaitableTimerExW = (CREATEWAITABLETIMEREXW)GetProcAddress(GetModuleHandleW(L"kernel32.dll"), "CreateWaitableTimerExW");
+    if (pCreateWaitableTimerExW)
+        m_timer = pCreateWaitableTimerExW(NULL, NULL, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+    if (!m_timer)
+    {
+        m_timer = CreateWaitableTimerW(NULL, TRUE, NULL);
+        m_timer_period_set = (timeBeginPeriod(1) == TIMERR_NOERROR);
+    }
+#endif
+
+    Reset();
+    return true;
+}
+
+/*****************************************************************************/
+
+void FramePacer::CleanUp()
+{
+#ifdef _WIN32
+    if (m_timer)
+    {
+        CloseHandle(m_timer);
+        m_timer = NULL;
+    }
+    if (m_timer_period_set)
+    {
+        timeEndPeriod(1);
+        m_timer_period_set = false;
+    }
+#endif
+}
+
+/*****************************************************************************/
+
+void FramePacer::SetDisplay(float refresh_hz, bool vsync)
+{
+    m_refresh_hz = (refresh_hz > 0) ? refresh_hz : 0;
+    m_vsync = vsync;
+}
+
+/*****************************************************************************/
+
+void FramePacer::Reset()
+{
+    m_deadline = 0;
+}
+
+/*****************************************************************************/
+
+double FramePacer::GetPeriodFor(float max_fps) const
+{
+    double period = 1.0/max_fps;
+
+    // lock onto a whole number of refreshes when that's within 5% (60 fps on a
+    // 59.94 Hz display, 72 fps on 144 Hz...), so frames don't beat against the display.
+    if (m_refresh_hz > 0)
+    {
+        double refresh_period = 1.0/m_refresh_hz;
+        int k = (int)(period/refresh_period + 0.5);
+        if (k >= 1 && fabs(k*refresh_period - period) < period*0.05)
+            period = k*refresh_period;
+    }
+    return period;
+}
+
+/*****************************************************************************/
+
+void FramePacer::Wait(float max_fps, int strategy)
+{
+    if (max_fps <= 0)
+    {
+        m_deadline = 0;
+        m_period = 0;
+        return;
+    }
+
+#ifdef _WIN32
+    if (m_ticks_per_sec <= 0)   // no high-precision timer
+    {
+        Sleep((DWORD)(1000/max_fps));
+        return;
+    }
+#endif
+
+    m_period = GetPeriodFor(max_fps);
+    double now = Now();
+
+    // vsync'd at one refresh per frame (the limit is at or above the refresh rate): Present()
+    // has already waited for us.  below it, even by less than a refresh, we still have to wait.
+    if (m_vsync && m_refresh_hz > 0 && m_period <= 1.001/m_refresh_hz)
+    {
+        m_deadline = now;
+        return;
+    }
+
+    // first frame, or more than a frame behind (a stall, a preset load...): start a new cadence.
+    double deadline = m_deadline + m_period;
+    if (m_deadline == 0 || now > deadline + m_period)
+    {
+        m_deadline = now;
+        return;
+    }
+    m_deadline = deadline;
+
+    // vsync'd at several refreshes per frame: release the frame half a refresh early,
+    // so that its Present() lands on the vblank at (rather than after) the deadline.
+    if (m_vsync && m_refresh_hz > 0)
+        deadline -= 0.5/m_refresh_hz;
+
+    if (now >= deadline)
+        return;
+
+    if (strategy == FRAME_PACING_TIMER)
+    {
+        SleepUntil(deadline);
+        OnWokeUp(deadline, Now());
+    }
+    else
+    {
+        double wake = deadline - m_margin;
+        if (wake > now)
+        {
+            SleepUntil(wake);
+            OnWokeUp(wake, Now());
+        }
+        SpinUntil(deadline);
+    }
+}
+
+/*****************************************************************************/
+
+void FramePacer::OnWokeUp(double requested, double actual)
+{
+    // track how late the timer wakes us up (mean & mean deviation), and keep
+    // the spin margin a few deviations above the mean.
+    double late = actual - requested;
+    if (late < 0)
+        late = 0;
+    m_oversleep_avg += (late - m_oversleep_avg)*0.1;
+    m_oversleep_dev += (fabs(late - m_oversleep_avg) - m_oversleep_dev)*0.1;
+
+    m_margin = m_oversleep_avg + 3*m_oversleep_dev + MIN_SPIN_MARGIN;
+    if (m_margin > MAX_SPIN_MARGIN)
+        m_margin = MAX_SPIN_MARGIN;
+}
+
+/*****************************************************************************/
+
+double FramePacer::Now() const
+{
+#ifdef _WIN32
+    LARGE_INTEGER t;
+    QueryPerformanceCounter(&t);
+    return (double)t.QuadPart / m_ticks_per_sec;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + ts.tv_nsec*1e-9;
+#endif
+}
+
+/*****************************************************************************/
+
+void FramePacer::SleepUntil(double t)
+{
+#ifdef _WIN32
+    double secs = t - Now();
+    if (secs <= 0)
+        return;
+    if (m_timer)
+    {
+        LARGE_INTEGER due;
+        due.QuadPart = -(LONGLONG)(secs*1e7);   // relative, in 100 ns units
+        if (SetWaitableTimer(m_timer, &due, 0, NULL, NULL, FALSE))
+        {
+            WaitForSingleObject(m_timer, INFINITE);
+            return;
+        }
+    }
+    Sleep((DWORD)(secs*1000));
+#else
+    struct timespec ts;
+    ts.tv_sec = (time_t)t;
+    ts.tv_nsec = (long)((t - (double)ts.tv_sec)*1e9);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        ;
+#endif
+}
+
+/*****************************************************************************/
+
+void FramePacer::SpinUntil(double t)
+{
+    // only ever the last fraction of a millisecond; yield so other
+    // threads (and other instances) on this core still get to run.
+    while (Now() < t)
+    {
+#ifdef _WIN32
+        YieldProcessor();
+        SwitchToThread();
+#else
+        sched_yield();
+#endif
+    }
+}
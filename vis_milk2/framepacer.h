@@ -0,0 +1,84 @@
+/*
+  LICENSE
+  -------
+Copyright 2005-2013 Nullsoft, Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, 
+are permitted provided that the following conditions are met:
+
+  * Redistributions of source code must retain the above copyright notice,
+    this list of conditions and the following disclaimer. 
+
+  * Redistributions in binary form must reproduce the above copyright notice,
+    this list of conditions and the following disclaimer in the documentation
+    and/or other materials provided with the distribution. 
+
+  * Neither the name of Nullsoft nor the names of its contributors may be used to 
+    endorse or promote products derived from this software without specific prior written permission. 
+ 
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR 
+IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND 
+FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR 
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT 
+OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#ifndef __NULLSOFT_DX9_PLUGIN_SHELL_FRAMEPACER_H__
+#define __NULLSOFT_DX9_PLUGIN_SHELL_FRAMEPACER_H__ 1
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+// pacing strategies (the 'frame_pacing' ini setting):
+#define FRAME_PACING_AUTO    0  // FRAME_PACING_HYBRID, or FRAME_PACING_TIMER when saving cpu
+#define FRAME_PACING_TIMER   1  // only sleep on the OS's high-resolution timer; wakes up a little late, but never spins
+#define FRAME_PACING_HYBRID  2  // sleep until shortly before the deadline, then spin; the margin adapts to how late the timer wakes up
+
+// keeps frames on a fixed cadence of absolute deadlines (so that errors don't add
+// up), snapped to whole refresh periods of the display when the rates are close.
+// when the display is vsync'd and the fps limit is at or above its refresh rate,
+// Present() already paces the frames, and Wait() doesn't wait at all.
+class FramePacer
+{
+public:
+    FramePacer();
+    ~FramePacer();
+    bool Init();
+    void CleanUp();
+    void SetDisplay(float refresh_hz, bool vsync);  // refresh_hz <= 0 if unknown
+    void Reset();                                   // starts a new cadence with the next frame
+
+    void Wait(float max_fps, int strategy);         // call once per frame, right after Present()
+
+    float GetPeriod() const { return (float)m_period; }         // seconds per frame, as of the last Wait(); 0 if unlimited
+    float GetMargin() const { return (float)m_margin; }         // FRAME_PACING_HYBRID's spin margin, in seconds
+    float GetOversleep() const { return (float)m_oversleep_avg; }   // how late the timer tends to wake up, in seconds
+
+private:
+    double GetPeriodFor(float max_fps) const;
+    double Now() const;
+    void   SleepUntil(double t);
+    void   SpinUntil(double t);
+    void   OnWokeUp(double requested, double actual);
+
+    double m_deadline;          // when the last frame was released; 0 = none yet
+    double m_period;
+    double m_margin;
+    double m_oversleep_avg;
+    double m_oversleep_dev;
+    float  m_refresh_hz;
+    bool   m_vsync;
+#ifdef _WIN32
+    HANDLE m_timer;
+    bool   m_timer_period_set;  // we had to raise the system timer resolution (older Windows only)
+    double m_ticks_per_sec;
+#endif
+};
+
+#endif
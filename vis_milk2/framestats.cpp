@@ -0,0 +1,225 @@
+/*
+  LICENSE
+  -------
+Copyright 2005-2013 Nullsoft, Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, 
+are permitted provided that the following conditions are met:
+
+  * Redistributions of source code must retain the above copyright notice,
+    this list of conditions and the following disclaimer. 
+
+  * Redistributions in binary form must reproduce the above copyright notice,
+    this list of conditions and the following disclaimer in the documentation
+    and/or other materials provided with the distribution. 
+
+  * Neither the name of Nullsoft nor the names of its contributors may be used to 
+    endorse or promote products derived from this software without specific prior written permission. 
+ 
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR 
+IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND 
+FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR 
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT 
+OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include "framestats.h"
+
+#define FRAME_STATS_MIN_MS   0.05f
+#define FRAME_STATS_MAX_MS   2000.0f
+
+static const char* g_szFrameStatName[NUM_FRAME_STATS] = { "total", "present", "over_budget" };
+
+/*****************************************************************************/
+
+FrameStats::FrameStats()
+{
+    Reset();
+}
+
+/*****************************************************************************/
+
+void FrameStats::Reset()
+{
+    memset(m_slice, 0, sizeof(m_slice));
+    memset(m_session, 0, sizeof(m_session));
+    memset(m_session_max, 0, sizeof(m_session_max));
+    memset(m_session_sum, 0, sizeof(m_session_sum));
+    m_cur_slice = 0;
+    m_slice_start = 0;
+}
+
+/*****************************************************************************/
+
+int FrameStats::GetBucket(float ms)
+{
+    // bucket 0 holds everything under FRAME_STATS_MIN_MS (including 0);
+    // bucket b covers [MIN * r^(b-1), MIN * r^b), and the last one everything above.
+    if (ms < FRAME_STATS_MIN_MS)
+        return 0;
+    static const float scale = (FRAME_STATS_BUCKETS - 2) / logf(FRAME_STATS_MAX_MS / FRAME_STATS_MIN_MS);
+    int b = 1 + (int)(logf(ms / FRAME_STATS_MIN_MS) * scale);
+    return (b < FRAME_STATS_BUCKETS) ? b : FRAME_STATS_BUCKETS - 1;
+}
+
+float FrameStats::GetBucketEdge(int bucket)
+{
+    return FRAME_STATS_MIN_MS * powf(FRAME_STATS_MAX_MS / FRAME_STATS_MIN_MS, bucket / (float)(FRAME_STATS_BUCKETS - 2));
+}
+
+/*****************************************************************************/
+
+void FrameStats::AddFrame(double now, float total_ms, float present_ms, float budget_ms)
+{
+    // move on to a new one-second slice when it's time; after a long gap, clear them all.
+    if (m_slice_start == 0)
+        m_slice_start = now;
+    if (now - m_slice_start >= FRAME_STATS_SLICES)
+    {
+        memset(m_slice, 0, sizeof(m_slice));
+        m_slice_start = now;
+    }
+    while (now - m_slice_start >= 1.0)
+    {
+        m_cur_slice = (m_cur_slice + 1) % FRAME_STATS_SLICES;
+        memset(&m_slice[m_cur_slice], 0, sizeof(td_slice));
+        m_slice_start += 1.0;
+    }
+
+    Add(FRAME_STAT_TOTAL, total_ms);
+    Add(FRAME_STAT_PRESENT, present_ms);
+    if (budget_ms > 0)
+        Add(FRAME_STAT_OVER, (total_ms > budget_ms) ? total_ms - budget_ms : 0);
+}
+
+void FrameStats::Add(int stat, float ms)
+{
+    int b = GetBucket(ms);
+    td_slice* s = &m_slice[m_cur_slice];
+    if (s->count[stat][b] < 65535)
+        s->count[stat][b]++;
+    if (ms > s->max[stat])
+        s->max[stat] = ms;
+
+    m_session[stat][b]++;
+    if (ms > m_session_max[stat])
+        m_session_max[stat] = ms;
+    m_session_sum[stat] += ms;
+}
+
+/*****************************************************************************/
+
+void FrameStats::GetPercentiles(const unsigned int *count, float max, td_frame_percentiles *p)
+{
+    // each percentile is reported as the upper edge of the bucket it falls in
+    // (so it errs on the slow side), but never above the actual max.
+    unsigned int frames = 0;
+    for (int b=0; b<FRAME_STATS_BUCKETS; b++)
+        frames += count[b];
+
+    const float q[3] = { 0.50f, 0.95f, 0.99f };
+    float *result[3] = { &p->p50, &p->p95, &p->p99 };
+    unsigned int seen = 0;
+    int b = 0;
+    for (int i=0; i<3; i++)
+    {
+        unsigned int rank = (unsigned int)ceil(q[i] * frames);
+        if (rank < 1)
+            rank = 1;
+        while (b < FRAME_STATS_BUCKETS-1 && seen + count[b] < rank)
+            seen += count[b++];
+        float edge = GetBucketEdge(b);
+        *result[i] = (edge < max) ? edge : max;
+    }
+    p->frames = (int)frames;
+    p->max = max;
+}
+
+bool FrameStats::GetPercentiles(int stat, float window_secs, td_frame_percentiles *p) const
+{
+    memset(p, 0, sizeof(*p));
+    if (stat < 0 || stat >= NUM_FRAME_STATS)
+        return false;
+
+    if (window_secs <= 0)
+    {
+        GetPercentiles(m_session[stat], m_session_max[stat], p);
+        return p->frames > 0;
+    }
+
+    // sum up the slices covering the window (the current, partial one included)
+    int slices = (int)ceilf(window_secs);
+    if (slices > FRAME_STATS_SLICES)
+        slices = FRAME_STATS_SLICES;
+    unsigned int count[FRAME_STATS_BUCKETS] = {0};
+    float max = 0;
+    for (int i=0; i<slices; i++)
+    {
+        const td_slice* s = &m_slice[(m_cur_slice - i + FRAME_STATS_SLICES) % FRAME_STATS_SLICES];
+        for (int b=0; b<FRAME_STATS_BUCKETS; b++)
+            count[b] += s->count[stat][b];
+        if (s->max[stat] > max)
+            max = s->max[stat];
+    }
+    GetPercentiles(count, max, p);
+    return p->frames > 0;
+}
+
+/*****************************************************************************/
+
+bool FrameStats::WriteCSV(const wchar_t *szFile) const
+{
+    FILE* f = _wfopen(szFile, L"w");
+    if (!f)
+        return false;
+
+    fprintf(f, "bucket_ms");
+    for (int stat=0; stat<NUM_FRAME_STATS; stat++)
+        fprintf(f, ",%s", g_szFrameStatName[stat]);
+    fprintf(f, "\n");
+    for (int b=0; b<FRAME_STATS_BUCKETS; b++)
+    {
+        fprintf(f, "%.3f", GetBucketEdge(b));
+        for (int stat=0; stat<NUM_FRAME_STATS; stat++)
+            fprintf(f, ",%u", m_session[stat][b]);
+        fprintf(f, "\n");
+    }
+
+    fclose(f);
+    return true;
+}
+
+bool FrameStats::WriteJSON(const wchar_t *szFile) const
+{
+    FILE* f = _wfopen(szFile, L"w");
+    if (!f)
+        return false;
+
+    fprintf(f, "{\n  \"bucket_ms\": [");
+    for (int b=0; b<FRAME_STATS_BUCKETS; b++)
+        fprintf(f, "%s%.3f", b ? ", " : "", GetBucketEdge(b));
+    fprintf(f, "]");
+
+    for (int stat=0; stat<NUM_FRAME_STATS; stat++)
+    {
+        td_frame_percentiles p;
+        GetPercentiles(m_session[stat], m_session_max[stat], &p);
+        fprintf(f, ",\n  \"%s\": {\"frames\": %d, \"mean\": %.3f, \"p50\": %.3f, \"p95\": %.3f, \"p99\": %.3f, \"max\": %.3f, \"counts\": [",
+                g_szFrameStatName[stat], p.frames, p.frames ? m_session_sum[stat]/p.frames : 0.0, p.p50, p.p95, p.p99, p.max);
+        for (int b=0; b<FRAME_STATS_BUCKETS; b++)
+            fprintf(f, "%s%u", b ? ", " : "", m_session[stat][b]);
+        fprintf(f, "]}");
+    }
+    fprintf(f, "\n}\n");
+
+    fclose(f);
+    return true;
+}
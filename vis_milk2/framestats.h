@@ -0,0 +1,83 @@
+/*
+  LICENSE
+  -------
+Copyright 2005-2013 Nullsoft, Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, 
+are permitted provided that the following conditions are met:
+
+  * Redistributions of source code must retain the above copyright notice,
+    this list of conditions and the following disclaimer. 
+
+  * Redistributions in binary form must reproduce the above copyright notice,
+    this list of conditions and the following disclaimer in the documentation
+    and/or other materials provided with the distribution. 
+
+  * Neither the name of Nullsoft nor the names of its contributors may be used to 
+    endorse or promote products derived from this software without specific prior written permission. 
+ 
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR 
+IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND 
+FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR 
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT 
+OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#ifndef __NULLSOFT_DX9_PLUGIN_SHELL_FRAMESTATS_H__
+#define __NULLSOFT_DX9_PLUGIN_SHELL_FRAMESTATS_H__ 1
+
+#include <wchar.h>
+
+#define FRAME_STAT_TOTAL    0   // from the start of one frame to the start of the next
+#define FRAME_STAT_PRESENT  1   // from the start of a frame until its Present() returns
+#define FRAME_STAT_OVER     2   // how far FRAME_STAT_TOTAL went past the frame budget (only when the fps is limited)
+#define NUM_FRAME_STATS     3
+
+#define FRAME_STATS_BUCKETS  128    // log-spaced from 0.05 ms to 2 s, ~8.6% apart
+#define FRAME_STATS_SLICES   60     // one-second slices, for windows of up to a minute
+
+typedef struct
+{
+    int   frames;
+    float p50, p95, p99, max;       // in ms
+} td_frame_percentiles;
+
+// records frame times into fixed-bucket log histograms, so percentiles over the
+// last few seconds (or the whole session) are cheap, no matter how long it runs.
+class FrameStats
+{
+public:
+    FrameStats();
+    void Reset();
+    void AddFrame(double now, float total_ms, float present_ms, float budget_ms);   // now: in seconds; budget_ms <= 0 if the fps is unlimited
+
+    bool GetPercentiles(int stat, float window_secs, td_frame_percentiles *p) const; // window_secs <= 0 for the whole session; false if there were no frames
+    bool WriteCSV(const wchar_t *szFile) const;     // the whole session's histograms
+    bool WriteJSON(const wchar_t *szFile) const;    // the whole session's percentiles & histograms
+
+private:
+    typedef struct
+    {
+        unsigned short count[NUM_FRAME_STATS][FRAME_STATS_BUCKETS];
+        float max[NUM_FRAME_STATS];
+    } td_slice;
+
+    static int   GetBucket(float ms);
+    static float GetBucketEdge(int bucket);     // upper edge, in ms
+    static void  GetPercentiles(const unsigned int *count, float max, td_frame_percentiles *p);
+    void Add(int stat, float ms);
+
+    td_slice     m_slice[FRAME_STATS_SLICES];
+    int          m_cur_slice;
+    double       m_slice_start;                 // 0 = no frames yet
+    unsigned int m_session[NUM_FRAME_STATS][FRAME_STATS_BUCKETS];
+    float        m_session_max[NUM_FRAME_STATS];
+    double       m_session_sum[NUM_FRAME_STATS];
+};
+
+#endif
@@ -35,8 +35,10 @@ OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 //#include "evallib\compiler.h"
 #include "../ns-eel2/ns-eel.h"
 #include "utility.h"
+#include "zoneprof.h"
 #include <assert.h>
 #include <math.h>
+#include <process.h>  // for _beginthreadex
 #include <shlwapi.h>
 
 #define D3DCOLOR_RGBA_01(r,g,b,a) D3DCOLOR_RGBA(((int)(r*255)),((int)(g*255)),((int)(b*255)),((int)(a*255)))
@@ -44,6 +46,8 @@ OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #define VERT_CLIP 0.75f		// warning: top/bottom can get clipped if you go < 0.65!
 
+extern CPlugin g_plugin;		// declared in main.cpp
+
 int g_title_font_sizes[] =  
 { 
     // NOTE: DO NOT EXCEED 64 FONTS HERE.
@@ -465,6 +469,17 @@ void CPlugin::LoadPerFrameEvallibVars(CState* pState) const
 	*pState->var_pf_bass_att	= (double)mysound.avg_rel[0];
 	*pState->var_pf_mid_att		= (double)mysound.avg_rel[1];
 	*pState->var_pf_treb_att	= (double)mysound.avg_rel[2];
+    for (int vi=0; vi<m_nSpectrumBands && pState->var_pf_band[vi]; vi++)
+    {
+        *pState->var_pf_band[vi]     = (double)mysound.band_imm_rel[vi];
+        *pState->var_pf_band_att[vi] = (double)mysound.band_avg_rel[vi];
+    }
+    if (pState->var_pf_beat)
+    {
+        *pState->var_pf_beat       = (double)m_sound.beat;
+        *pState->var_pf_beat_phase = (double)m_sound.beat_phase;
+        *pState->var_pf_bpm        = (double)m_sound.bpm;
+    }
 	*pState->var_pf_frame		= (double)GetFrame();
 	//*pState->var_pf_monitor     = 0;   -leave this as it was set in the per-frame INIT code!
     for (int vi=0; vi<NUM_Q_VAR; vi++)
@@ -534,6 +549,7 @@ void CPlugin::LoadPerFrameEvallibVars(CState* pState) const
 
 void CPlugin::RunPerFrameEquations(int code)
 {
+	PROFILE_ZONE("RunPerFrameEquations");
 	// run per-frame calculations
 
     /*
@@ -626,6 +642,17 @@ void CPlugin::RunPerFrameEquations(int code)
 		*pState->var_pv_bass_att	= *pState->var_pf_bass_att;
 		*pState->var_pv_mid_att		= *pState->var_pf_mid_att;	
 		*pState->var_pv_treb_att	= *pState->var_pf_treb_att;
+        for (int vi=0; vi<m_nSpectrumBands && pState->var_pv_band[vi]; vi++)
+        {
+            *pState->var_pv_band[vi]     = *pState->var_pf_band[vi];
+            *pState->var_pv_band_att[vi] = *pState->var_pf_band_att[vi];
+        }
+        if (pState->var_pv_beat)
+        {
+            *pState->var_pv_beat        = *pState->var_pf_beat;
+            *pState->var_pv_beat_phase  = *pState->var_pf_beat_phase;
+            *pState->var_pv_bpm         = *pState->var_pf_bpm;
+        }
         *pState->var_pv_meshx       = (double)m_nGridX;
         *pState->var_pv_meshy       = (double)m_nGridY;
         *pState->var_pv_pixelsx     = (double)GetWidth();
@@ -728,6 +755,8 @@ void CPlugin::RenderFrame(const int bRedraw)
 {
     const float fDeltaT = 1.0f/GetFps();
 
+    PROFILE_FRAME_LABEL(m_pState->m_szDesc);
+
     if (bRedraw)
     {
 	    // pre-un-flip buffers, so we are redoing the same work as we did last frame...
@@ -838,7 +867,10 @@ void CPlugin::RenderFrame(const int bRedraw)
 	    if (m_fNextPresetTime < GetTime())
 	    {
             if (m_nLoadingPreset==0) // don't start a load if one is already underway!
+            {
 		        LoadRandomPreset(m_fBlendTimeAuto);
+                m_bLoadingPresetOnBeat = IsBeatSynced();
+            }
 	    }
 
 	    // randomly spawn Song Title, if time
@@ -885,10 +917,15 @@ void CPlugin::RenderFrame(const int bRedraw)
 		    s_fHardCutThresh = m_fHardCutLoudnessThresh*2.0f;
 	    if (GetFps() > 1.0f && !m_bHardCutsDisabled && !m_bPresetLockedByUser && !m_bPresetLockedByCode)
 	    {
-		    if (mysound.imm_rel[0] + mysound.imm_rel[1] + mysound.imm_rel[2] > s_fHardCutThresh*3.0f)
+            // with a steady beat, loud moments between beats don't count (and the cut is made on the next one)
+            const bool bOffBeat = IsBeatSynced() && m_sound.beat_phase > 0.2f && m_sound.beat_phase < 0.8f;
+		    if (mysound.imm_rel[0] + mysound.imm_rel[1] + mysound.imm_rel[2] > s_fHardCutThresh*3.0f && !bOffBeat)
 		    {
                 if (m_nLoadingPreset==0) // don't start a load if one is already underway!
+                {
 		            LoadRandomPreset(0.0f);
+                    m_bLoadingPresetOnBeat = IsBeatSynced();
+                }
 			    s_fHardCutThresh *= 2.0f;
 		    }
 		    else
@@ -905,6 +942,7 @@ void CPlugin::RenderFrame(const int bRedraw)
 	    }
 
 	    // smooth & scale the audio data, according to m_state, for display purposes
+	    PROFILE_ZONE("SmoothWaveform");
 	    float scale = m_pState->m_fWaveScale.eval(GetTime()) / 128.0f;
 	    mysound.fWaveform[0][0] *= scale;
 	    mysound.fWaveform[1][0] *= scale;
@@ -1065,7 +1103,18 @@ void CPlugin::RenderFrame(const int bRedraw)
 						StrStrIA(driver_desc, "nVidia")) ? 2 : 0);
 	}
 
+    // (timed, for the adaptive mesh - which can only be resized here, between frames)
+    UpdateMeshSize();
+    LARGE_INTEGER t0, t1;
+    QueryPerformanceCounter(&t0);
     ComputeGridAlphaValues();
+    QueryPerformanceCounter(&t1);
+    if (m_high_perf_timer_freq.QuadPart)
+    {
+        float dt = (float)((double)(t1.QuadPart - t0.QuadPart) / (double)m_high_perf_timer_freq.QuadPart);
+        m_fMeshCost = (m_nMeshCostFrames == 0) ? dt : m_fMeshCost*0.9f + dt*0.1f;
+        ++m_nMeshCostFrames;
+    }
 
 	// do the warping for this frame [warp shader]
     if (!m_pState->m_bBlending) 
@@ -1297,6 +1346,7 @@ void CPlugin::RenderFrame(const int bRedraw)
 
 void CPlugin::DrawMotionVectors() const
 {
+	PROFILE_ZONE("DrawMotionVectors");
 	// FLEXIBLE MOTION VECTOR FIELD
 	if ((float)*m_pState->var_pf_mv_a >= 0.001f)
 	{
@@ -1590,14 +1640,14 @@ bool CPlugin::ReversePropagatePoint(float fx, float fy, float *fx2, float *fy2)
 	if (y1 > m_nGridY) return false;
 
 	float tu, tv;
-	tu  = m_verts[y0*(m_nGridX+1)+x0].tu * (1-dx)*(1-dy);
-	tv  = m_verts[y0*(m_nGridX+1)+x0].tv * (1-dx)*(1-dy);
-	tu += m_verts[y0*(m_nGridX+1)+x1].tu * (dx)*(1-dy);
-	tv += m_verts[y0*(m_nGridX+1)+x1].tv * (dx)*(1-dy);
-	tu += m_verts[y1*(m_nGridX+1)+x0].tu * (1-dx)*(dy);
-	tv += m_verts[y1*(m_nGridX+1)+x0].tv * (1-dx)*(dy);
-	tu += m_verts[y1*(m_nGridX+1)+x1].tu * (dx)*(dy);
-	tv += m_verts[y1*(m_nGridX+1)+x1].tv * (dx)*(dy);
+	tu  = m_mesh.tu[y0*(m_nGridX+1)+x0] * (1-dx)*(1-dy);
+	tv  = m_mesh.tv[y0*(m_nGridX+1)+x0] * (1-dx)*(1-dy);
+	tu += m_mesh.tu[y0*(m_nGridX+1)+x1] * (dx)*(1-dy);
+	tv += m_mesh.tv[y0*(m_nGridX+1)+x1] * (dx)*(1-dy);
+	tu += m_mesh.tu[y1*(m_nGridX+1)+x0] * (1-dx)*(dy);
+	tv += m_mesh.tv[y1*(m_nGridX+1)+x0] * (1-dx)*(dy);
+	tu += m_mesh.tu[y1*(m_nGridX+1)+x1] * (dx)*(dy);
+	tv += m_mesh.tv[y1*(m_nGridX+1)+x1] * (dx)*(dy);
 
 	*fx2 = tu;
 	*fy2 = 1.0f - tv;
@@ -1639,6 +1689,7 @@ void CPlugin::GetSafeBlurMinMax(CState* pState, float* blur_min, float* blur_max
 
 void CPlugin::BlurPasses()
 {
+    PROFILE_ZONE("BlurPasses");
     #if (NUM_BLUR_TEX>0)
 
         // Note: Blur is currently a little funky.  It blurs the *current* frame after warp;
@@ -1817,8 +1868,43 @@ void CPlugin::BlurPasses()
     m_nHighestBlurTexUsedThisFrame = 0;
 }
 
+// with bAdaptiveMesh, sizes the mesh so that ComputeGridAlphaValues() takes about fMeshBudget of
+//  the frame time.  the cost goes roughly with the # of verts (m_nGridX^2), so an over-budget mesh
+//  is cut straight to where it should fit; it only grows one step at a time, though, after a longer
+//  wait and with plenty of room, so that it doesn't hunt back and forth.
+void CPlugin::UpdateMeshSize()
+{
+    #define MESH_SHRINK_FRAMES 30   // frames measured before the mesh can shrink
+    #define MESH_GROW_FRAMES  180   // ...and before it can grow
+    if (!m_bAdaptiveMesh || m_nMeshCostFrames < MESH_SHRINK_FRAMES || m_fMeshCost <= 0)
+        return;
+
+    float budget = GetFrameBudget();
+    if (budget <= 0)
+        budget = 1.0f/60.0f;    // (unlimited fps)
+    budget *= m_fMeshBudget;
+
+    int nGridX = m_nGridX;
+    if (m_fMeshCost > budget && m_nGridX > m_nMinMeshSize)
+    {
+        nGridX = min(m_nGridX-8, (int)(m_nGridX * sqrtf(0.8f*budget/m_fMeshCost))) & ~7;
+        nGridX = max(m_nMinMeshSize, nGridX);
+    }
+    else if (m_fMeshCost < 0.5f*budget && m_nMeshCostFrames >= MESH_GROW_FRAMES)
+    {
+        nGridX = max(m_nGridX+8, (int)(m_nGridX*1.25f)) & ~7;
+        float ratio = nGridX/(float)m_nGridX;
+        if (nGridX > MAX_GRID_X || m_fMeshCost*ratio*ratio > 0.8f*budget)
+            nGridX = m_nGridX;
+    }
+
+    if (nGridX != m_nGridX && ResizeMesh(nGridX) && m_pState->m_bExpensive)
+        m_nExpensiveGridX = m_nGridX;
+}
+
 void CPlugin::ComputeGridAlphaValues()
 {
+    PROFILE_ZONE("ComputeGridAlphaValues");
     float fBlend = m_pState->m_fBlendProgress;//max(0,min(1,(m_pState->m_fBlendProgress*1.6f - 0.3f)));
     /*switch(code) //if (nPassOverride==0)
     {
@@ -1847,11 +1933,104 @@ void CPlugin::ComputeGridAlphaValues()
 	float texel_offset_x = 0.5f / (float)m_nTexSizeX;
 	float texel_offset_y = 0.5f / (float)m_nTexSizeY;
 
-    int num_reps = (m_pState->m_bBlending) ? 2 : 1;
-    int start_rep = 0;
+    m_warpJob.fBlend = fBlend;
+    m_warpJob.fWarpTime = fWarpTime;
+    m_warpJob.fWarpScaleInv = fWarpScaleInv;
+    memcpy(m_warpJob.f, f, sizeof(f));
+    m_warpJob.texel_offset_x = texel_offset_x;
+    m_warpJob.texel_offset_y = texel_offset_y;
+    m_warpJob.num_reps = (m_pState->m_bBlending) ? 2 : 1;
+    InitWarpConsts(&m_warpJob.consts, fWarpTime, fWarpScaleInv, f, m_fAspectX, m_fAspectY, texel_offset_x, texel_offset_y);
+
+    // the rows of the mesh are independent, so they're split across the worker threads -
+    //  unless the per-vertex code can't be batched, in which case it needs the (shared) VM.
+    int nThreads = min(m_nWarpThreads, m_nGridY+1);
+
+    for (int rep=0; rep<m_warpJob.num_reps; rep++)
+	{
+		CState *pState = (rep==0) ? m_pState : m_pOldState;
+
+#ifndef _NO_EXPR_
+		if (pState->m_pp_codehandle)
+		{
+			// the per-vertex code's uniform inputs are set (the i/o vars start out the same
+			//  for every vertex), so run its per-frame part once, up front.
+			*pState->var_pv_zoom	= *pState->var_pf_zoom;
+			*pState->var_pv_zoomexp	= *pState->var_pf_zoomexp;
+			*pState->var_pv_rot		= *pState->var_pf_rot;
+			*pState->var_pv_warp	= *pState->var_pf_warp;
+			*pState->var_pv_cx		= *pState->var_pf_cx;
+			*pState->var_pv_cy		= *pState->var_pf_cy;
+			*pState->var_pv_dx		= *pState->var_pf_dx;
+			*pState->var_pv_dy		= *pState->var_pf_dy;
+			*pState->var_pv_sx		= *pState->var_pf_sx;
+			*pState->var_pv_sy		= *pState->var_pf_sy;
+			NSEEL_code_execute_prologue(pState->m_pp_codehandle);
+
+			if (pState->m_pp_class == PP_CODE_UNIFORM)
+			{
+				// it can't tell the vertices apart, so one run gives the results for all of them.
+				*pState->var_pv_x		= 0.5;
+				*pState->var_pv_y		= 0.5;
+				*pState->var_pv_rad		= 0;
+				*pState->var_pv_ang		= 0;
+				NSEEL_code_execute(pState->m_pp_codehandle);
+			}
+			else
+			{
+				for (int i=1; i<nThreads; i++)
+					if (!pState->m_pp_batch_clones[i-1])
+						nThreads = i;
+			}
+		}
+#endif
+
+		// if every vertex gets the same warp params, ComputeGridRows() skips the VM and takes them from here
+		m_warpJob.bUniform[rep] = (pState->m_pp_class != PP_CODE_VARYING);
+		if (m_warpJob.bUniform[rep])
+		{
+			bool bRan = (pState->m_pp_class == PP_CODE_UNIFORM);
+			td_warpparams *wp = &m_warpJob.uniform[rep];
+			wp->zoom	= (float)(bRan ? *pState->var_pv_zoom    : *pState->var_pf_zoom);
+			wp->zoomexp	= (float)(bRan ? *pState->var_pv_zoomexp : *pState->var_pf_zoomexp);
+			wp->rot		= (float)(bRan ? *pState->var_pv_rot     : *pState->var_pf_rot);
+			wp->warp	= (float)(bRan ? *pState->var_pv_warp    : *pState->var_pf_warp);
+			wp->cx		= (float)(bRan ? *pState->var_pv_cx      : *pState->var_pf_cx);
+			wp->cy		= (float)(bRan ? *pState->var_pv_cy      : *pState->var_pf_cy);
+			wp->dx		= (float)(bRan ? *pState->var_pv_dx      : *pState->var_pf_dx);
+			wp->dy		= (float)(bRan ? *pState->var_pv_dy      : *pState->var_pf_dy);
+			wp->sx		= (float)(bRan ? *pState->var_pv_sx      : *pState->var_pf_sx);
+			wp->sy		= (float)(bRan ? *pState->var_pv_sy      : *pState->var_pf_sy);
+		}
+	}
+
+    m_warpJob.nThreads = nThreads;
+    for (int i=1; i<nThreads; i++)
+        SetEvent(m_hWarpStart[i]);
+    ComputeGridRows(0);
+    if (nThreads > 1)
+        WaitForMultipleObjects(nThreads-1, &m_hWarpDone[1], TRUE, INFINITE);
+}
+
+// computes the UVs (and blend alphas) of this thread's share of the mesh rows, see ComputeGridAlphaValues().
+//  thread 0 is the render thread; the others use their own copies of the per-vertex code.
+//  thread 0 takes the last share of rows: only its (original) code handle writes back the variables
+//  that aren't per-vertex, and they have to end up as the last vertex left them.
+void CPlugin::ComputeGridRows(int nThread)
+{
+    const float fBlend = m_warpJob.fBlend;
+    const float fWarpTime = m_warpJob.fWarpTime;
+    const float fWarpScaleInv = m_warpJob.fWarpScaleInv;
+    const float *f = m_warpJob.f;
+    const float texel_offset_x = m_warpJob.texel_offset_x;
+    const float texel_offset_y = m_warpJob.texel_offset_y;
+
+    int nShare = (nThread + m_warpJob.nThreads - 1) % m_warpJob.nThreads;
+    int y0 = (m_nGridY+1)* nShare   /m_warpJob.nThreads;
+    int y1 = (m_nGridY+1)*(nShare+1)/m_warpJob.nThreads;
 
     // FIRST WE HAVE 1-2 PASSES FOR CRUNCHING THE PER-VERTEX EQUATIONS
-    for (int rep=start_rep; rep<num_reps; rep++)
+    for (int rep=0; rep<m_warpJob.num_reps; rep++)
 	{
         // to blend the two PV equations together, we simulate both to get the final UV coords,
         // then we blend those final UV coords.  We also write out an alpha value so that
@@ -1863,6 +2042,10 @@ void CPlugin::ComputeGridAlphaValues()
 		else
 			pState = m_pOldState;
 
+		const bool bUniform = m_warpJob.bUniform[rep];
+		// the code runs a row at a time (NSEEL_code_execute_batch), a vector of vertices per op.
+		NSEEL_CODEHANDLE code = bUniform ? NULL : (nThread==0) ? pState->m_pp_codehandle : pState->m_pp_batch_clones[nThread-1];
+
 		// cache the doubles as floats so that computations are a bit faster
 		float fZoom		= (float)(*pState->var_pf_zoom);
 		float fZoomExp	= (float)(*pState->var_pf_zoomexp);
@@ -1874,125 +2057,181 @@ void CPlugin::ComputeGridAlphaValues()
 		float fDY		= (float)(*pState->var_pf_dy);
 		float fSX		= (float)(*pState->var_pf_sx);
 		float fSY		= (float)(*pState->var_pf_sy);
-		
-		int n = 0;
+		if (bUniform)
+		{
+			const td_warpparams &wp = m_warpJob.uniform[rep];
+			fZoom = wp.zoom; fZoomExp = wp.zoomexp; fRot = wp.rot; fWarp = wp.warp;
+			fCX = wp.cx; fCY = wp.cy; fDX = wp.dx; fDY = wp.dy; fSX = wp.sx; fSY = wp.sy;
+		}
+
+		int n = y0*(m_nGridX+1);
 
-		for (int y=0; y<=m_nGridY; y++)
+		for (int y=y0; y<y1; y++)
 		{
-			for (int x=0; x<=m_nGridX; x++)
+			// run the per-vertex code for the whole row, so the built-in warp can take the row at once too
+			double pv[NUM_PV_BATCH_VARS][MAX_GRID_X+1];
+			bool bPerVertex = false;
+#ifndef _NO_EXPR_
+			if (!bUniform)
 			{
-				// Note: x, y, z are now set at init. time - no need to mess with them!
-				//m_verts[n].x = i/(float)m_nGridX*2.0f - 1.0f;
-				//m_verts[n].y = j/(float)m_nGridY*2.0f - 1.0f;
-				//m_verts[n].z = 0.0f;
-				
-				if (pState->m_pp_codehandle)
+				EEL_F *pv_rows[NUM_PV_BATCH_VARS];
+				for (int i=0; i<NUM_PV_BATCH_VARS; i++)
+					pv_rows[i] = pv[i];
+
+				for (int x=0, n2=n; x<=m_nGridX; x++, n2++)
+				{
+					pv[PV_BATCH_X][x]		= (double)(m_mesh.x[n2]* 0.5f*m_fAspectX + 0.5f);
+					pv[PV_BATCH_Y][x]		= (double)(m_mesh.y[n2]*-0.5f*m_fAspectY + 0.5f);
+					pv[PV_BATCH_RAD][x]		= (double)m_mesh.rad[n2];
+					pv[PV_BATCH_ANG][x]		= (double)m_mesh.ang[n2];
+					pv[PV_BATCH_ZOOM][x]	= *pState->var_pf_zoom;
+					pv[PV_BATCH_ZOOMEXP][x]	= *pState->var_pf_zoomexp;
+					pv[PV_BATCH_ROT][x]		= *pState->var_pf_rot;
+					pv[PV_BATCH_WARP][x]	= *pState->var_pf_warp;
+					pv[PV_BATCH_CX][x]		= *pState->var_pf_cx;
+					pv[PV_BATCH_CY][x]		= *pState->var_pf_cy;
+					pv[PV_BATCH_DX][x]		= *pState->var_pf_dx;
+					pv[PV_BATCH_DY][x]		= *pState->var_pf_dy;
+					pv[PV_BATCH_SX][x]		= *pState->var_pf_sx;
+					pv[PV_BATCH_SY][x]		= *pState->var_pf_sy;
+				}
+				if (code)
+					bPerVertex = NSEEL_code_execute_batch(code, pv_rows, m_nGridX+1) != 0;
+				// the native code runs in pState's one VM, so only the render thread may fall back to it.
+				//  (it can't happen on the others: ComputeGridAlphaValues() only starts them when every one has
+				//  a batch clone, and a clone can always run.)
+				assert(bPerVertex || nThread == 0);
+				if (!bPerVertex && nThread == 0)
 				{
 					// restore all the variables to their original states,
-					//  run the user-defined equations,
-					//  then move the results into local vars for computation as floats
-
-					*pState->var_pv_x		= (double)(m_verts[n].x* 0.5f*m_fAspectX + 0.5f);
-					*pState->var_pv_y		= (double)(m_verts[n].y*-0.5f*m_fAspectY + 0.5f);
-					*pState->var_pv_rad		= (double)m_vertinfo[n].rad;
-					*pState->var_pv_ang		= (double)m_vertinfo[n].ang;
-					*pState->var_pv_zoom	= *pState->var_pf_zoom;
-					*pState->var_pv_zoomexp	= *pState->var_pf_zoomexp;
-					*pState->var_pv_rot		= *pState->var_pf_rot;
-					*pState->var_pv_warp	= *pState->var_pf_warp;
-					*pState->var_pv_cx		= *pState->var_pf_cx;
-					*pState->var_pv_cy		= *pState->var_pf_cy;
-					*pState->var_pv_dx		= *pState->var_pf_dx;
-					*pState->var_pv_dy		= *pState->var_pf_dy;
-					*pState->var_pv_sx		= *pState->var_pf_sx;
-					*pState->var_pv_sy		= *pState->var_pf_sy;
-					//*pState->var_pv_time		= *pState->var_pv_time;		// (these are all now initialized 
-					//*pState->var_pv_bass		= *pState->var_pv_bass;		//  just once per frame)
-					//*pState->var_pv_mid		= *pState->var_pv_mid;		
-					//*pState->var_pv_treb		= *pState->var_pv_treb;	
-					//*pState->var_pv_bass_att	= *pState->var_pv_bass_att;
-					//*pState->var_pv_mid_att	= *pState->var_pv_mid_att;	
-					//*pState->var_pv_treb_att	= *pState->var_pv_treb_att;
-
-#ifndef _NO_EXPR_
-					NSEEL_code_execute(pState->m_pp_codehandle);
+					//  run the user-defined equations, then collect the results
+					EEL_F *pv_vars[NUM_PV_BATCH_VARS] = {
+						pState->var_pv_x, pState->var_pv_y, pState->var_pv_rad, pState->var_pv_ang,
+						pState->var_pv_zoom, pState->var_pv_zoomexp, pState->var_pv_rot, pState->var_pv_warp, pState->var_pv_cx, pState->var_pv_cy,
+						pState->var_pv_dx, pState->var_pv_dy, pState->var_pv_sx, pState->var_pv_sy,
+					};
+					for (int x=0; x<=m_nGridX; x++)
+					{
+						for (int i=0; i<NUM_PV_BATCH_VARS; i++)
+							*pv_vars[i] = pv[i][x];
+						NSEEL_code_execute(pState->m_pp_codehandle);
+						for (int i=PV_BATCH_ZOOM; i<NUM_PV_BATCH_VARS; i++)
+							pv[i][x] = *pv_vars[i];
+					}
+					bPerVertex = true;
+				}
+			}
 #endif
 
-					fZoom = (float)(*pState->var_pv_zoom);
-					fZoomExp = (float)(*pState->var_pv_zoomexp);
-					fRot  = (float)(*pState->var_pv_rot);
-					fWarp = (float)(*pState->var_pv_warp);
-					fCX   = (float)(*pState->var_pv_cx);
-					fCY   = (float)(*pState->var_pv_cy);
-					fDX   = (float)(*pState->var_pv_dx);
-					fDY   = (float)(*pState->var_pv_dy);
-					fSX   = (float)(*pState->var_pv_sx);
-					fSY   = (float)(*pState->var_pv_sy);
+			// the built-in warp, for the whole row: vectorised if it can be, else one vertex at a time
+			float row_u[MAX_GRID_X+1], row_v[MAX_GRID_X+1];
+			bool bVectorised = false;
+			if (bPerVertex)
+			{
+				float pf[NUM_WARP_PARAMS][MAX_GRID_X+1];
+				const float* pf_rows[NUM_WARP_PARAMS];
+				for (int i=0; i<NUM_WARP_PARAMS; i++)
+				{
+					for (int x=0; x<=m_nGridX; x++)
+						pf[i][x] = (float)pv[PV_BATCH_ZOOM + i][x];
+					pf_rows[i] = pf[i];
 				}
+				bVectorised = WarpVerts_Varying(&m_warpJob.consts, pf_rows, &m_mesh.x[n], &m_mesh.y[n], &m_mesh.rad[n], row_u, row_v, m_nGridX+1);
+			}
+			else if (bUniform)
+			{
+				bVectorised = WarpVerts_Uniform(&m_warpJob.consts, &m_warpJob.uniform[rep], &m_mesh.x[n], &m_mesh.y[n], &m_mesh.rad[n], row_u, row_v, m_nGridX+1);
+			}
 
-				float fZoom2 = powf(fZoom, powf(fZoomExp, m_vertinfo[n].rad*2.0f - 1.0f));
-
-				// initial texcoords, w/built-in zoom factor
-				float fZoom2Inv = 1.0f/fZoom2;
-				float u =  m_verts[n].x*m_fAspectX*0.5f*fZoom2Inv + 0.5f;
-				float v = -m_verts[n].y*m_fAspectY*0.5f*fZoom2Inv + 0.5f;
-                    //float u_orig = u;
-                    //float v_orig = v;
-                    //m_verts[n].tr = u_orig + texel_offset_x;
-                    //m_verts[n].ts = v_orig + texel_offset_y;
-
-				// stretch on X, Y:
-				u = (u - fCX)/fSX + fCX;
-				v = (v - fCY)/fSY + fCY;
-
-				// warping:
-				//if (fWarp > 0.001f || fWarp < -0.001f)
-				//{
-					u += fWarp*0.0035f*sinf(fWarpTime*0.333f + fWarpScaleInv*(m_verts[n].x*f[0] - m_verts[n].y*f[3]));
-					v += fWarp*0.0035f*cosf(fWarpTime*0.375f - fWarpScaleInv*(m_verts[n].x*f[2] + m_verts[n].y*f[1]));
-					u += fWarp*0.0035f*cosf(fWarpTime*0.753f - fWarpScaleInv*(m_verts[n].x*f[1] - m_verts[n].y*f[2]));
-					v += fWarp*0.0035f*sinf(fWarpTime*0.825f + fWarpScaleInv*(m_verts[n].x*f[0] + m_verts[n].y*f[3]));
-				//}
-
-				// rotation:
-				float u2 = u - fCX;
-				float v2 = v - fCY;
+			if (!bVectorised)
+				for (int x=0; x<=m_nGridX; x++)
+				{
+					// Note: x, y are set at init. time - no need to mess with them!
+					const float fx = m_mesh.x[n+x];
+					const float fy = m_mesh.y[n+x];
 				
-				float cos_rot = cosf(fRot);
-				float sin_rot = sinf(fRot);
-				u = u2*cos_rot - v2*sin_rot + fCX;
-				v = u2*sin_rot + v2*cos_rot + fCY;
-
-				// translation:
-				u -= fDX;
-				v -= fDY;
-
-                // undo aspect ratio fix:
-                u = (u-0.5f)*m_fInvAspectX + 0.5f;
-                v = (v-0.5f)*m_fInvAspectY + 0.5f;
-
-				// final half-texel-offset translation:
-				u += texel_offset_x;
-				v += texel_offset_y;
-                
+					if (bPerVertex)
+					{
+						fZoom = (float)pv[PV_BATCH_ZOOM][x];
+						fZoomExp = (float)pv[PV_BATCH_ZOOMEXP][x];
+						fRot  = (float)pv[PV_BATCH_ROT][x];
+						fWarp = (float)pv[PV_BATCH_WARP][x];
+						fCX   = (float)pv[PV_BATCH_CX][x];
+						fCY   = (float)pv[PV_BATCH_CY][x];
+						fDX   = (float)pv[PV_BATCH_DX][x];
+						fDY   = (float)pv[PV_BATCH_DY][x];
+						fSX   = (float)pv[PV_BATCH_SX][x];
+						fSY   = (float)pv[PV_BATCH_SY][x];
+					}
+
+					float fZoom2 = powf(fZoom, powf(fZoomExp, m_mesh.rad[n+x]*2.0f - 1.0f));
+
+					// initial texcoords, w/built-in zoom factor
+					float fZoom2Inv = 1.0f/fZoom2;
+					float u =  fx*m_fAspectX*0.5f*fZoom2Inv + 0.5f;
+					float v = -fy*m_fAspectY*0.5f*fZoom2Inv + 0.5f;
+
+					// stretch on X, Y:
+					u = (u - fCX)/fSX + fCX;
+					v = (v - fCY)/fSY + fCY;
+
+					// warping:
+					//if (fWarp > 0.001f || fWarp < -0.001f)
+					//{
+						u += fWarp*0.0035f*sinf(fWarpTime*0.333f + fWarpScaleInv*(fx*f[0] - fy*f[3]));
+						v += fWarp*0.0035f*cosf(fWarpTime*0.375f - fWarpScaleInv*(fx*f[2] + fy*f[1]));
+						u += fWarp*0.0035f*cosf(fWarpTime*0.753f - fWarpScaleInv*(fx*f[1] - fy*f[2]));
+						v += fWarp*0.0035f*sinf(fWarpTime*0.825f + fWarpScaleInv*(fx*f[0] + fy*f[3]));
+					//}
+
+					// rotation:
+					float u2 = u - fCX;
+					float v2 = v - fCY;
+				
+					float cos_rot = cosf(fRot);
+					float sin_rot = sinf(fRot);
+					u = u2*cos_rot - v2*sin_rot + fCX;
+					v = u2*sin_rot + v2*cos_rot + fCY;
+
+					// translation:
+					u -= fDX;
+					v -= fDY;
+
+                    // undo aspect ratio fix:
+                    u = (u-0.5f)*m_fInvAspectX + 0.5f;
+                    v = (v-0.5f)*m_fInvAspectY + 0.5f;
+
+					// final half-texel-offset translation:
+					u += texel_offset_x;
+					v += texel_offset_y;
+
+					row_u[x] = u;
+					row_v[x] = v;
+				}
+
+			for (int x=0; x<=m_nGridX; x++)
+			{
+				float u = row_u[x];
+				float v = row_v[x];
+
                 if (rep==0)
 				{
                     // UV's for m_pState
-					m_verts[n].tu = u;
-					m_verts[n].tv = v;
-					m_verts[n].Diffuse = 0xFFFFFFFF;		
+					m_mesh.tu[n] = u;
+					m_mesh.tv[n] = v;
+					m_mesh.alpha[n] = 1;
 				}
 				else
 				{
                     // blend to UV's for m_pOldState
-                    float mix2 = m_vertinfo[n].a*fBlend + m_vertinfo[n].c;//fCosineBlend2;
+                    float mix2 = m_mesh.a[n]*fBlend + m_mesh.c[n];//fCosineBlend2;
                     mix2 = max(0,min(1,mix2));   
                     //     if fBlend un-flipped, then mix2 is 0 at the beginning of a blend, 1 at the end...
                     //                           and alphas are 0 at the beginning, 1 at the end.
-					m_verts[n].tu = m_verts[n].tu*(mix2) + u*(1-mix2);
-					m_verts[n].tv = m_verts[n].tv*(mix2) + v*(1-mix2);
+					m_mesh.tu[n] = m_mesh.tu[n]*(mix2) + u*(1-mix2);
+					m_mesh.tv[n] = m_mesh.tv[n]*(mix2) + v*(1-mix2);
                     // this sets the alpha values for blending between two presets:
-					m_verts[n].Diffuse = 0x00FFFFFF | (((DWORD)(mix2*255))<<24);		
+					m_mesh.alpha[n] = mix2;
 				}
 
 				++n;
@@ -2002,8 +2241,271 @@ void CPlugin::ComputeGridAlphaValues()
 	}
 }
 
+unsigned __stdcall CPlugin::WarpThreadProc(void *param)
+{
+    int nThread = (int)(INT_PTR)param;
+    MungeFPCW(NULL);	// same precision as the render thread
+
+    for (;;)
+    {
+        WaitForSingleObject(g_plugin.m_hWarpStart[nThread], INFINITE);
+        if (g_plugin.m_bWarpThreadsQuit)
+            break;
+        g_plugin.ComputeGridRows(nThread);
+        SetEvent(g_plugin.m_hWarpDone[nThread]);
+    }
+
+    _endthreadex(0);
+    return 0;
+}
+
+void CPlugin::StartWarpThreads()
+{
+    SYSTEM_INFO si = {0};
+    GetSystemInfo(&si);
+
+    m_nWarpThreads = max(1, min(MAX_WARP_THREADS, (int)si.dwNumberOfProcessors));
+    m_bWarpThreadsQuit = false;
+    for (int i=1; i<m_nWarpThreads; i++)
+    {
+        m_hWarpStart[i] = CreateEvent(NULL, FALSE, FALSE, NULL);
+        m_hWarpDone[i]  = CreateEvent(NULL, FALSE, FALSE, NULL);
+        m_hWarpThread[i] = (m_hWarpStart[i] && m_hWarpDone[i]) ? (HANDLE)_beginthreadex(NULL, 0, WarpThreadProc, (void*)(INT_PTR)i, 0, 0) : NULL;
+        if (!m_hWarpThread[i])
+        {
+            if (m_hWarpStart[i]) CloseHandle(m_hWarpStart[i]);
+            if (m_hWarpDone[i])  CloseHandle(m_hWarpDone[i]);
+            m_nWarpThreads = i;
+            break;
+        }
+    }
+}
+
+void CPlugin::StopWarpThreads()
+{
+    m_bWarpThreadsQuit = true;
+    for (int i=1; i<m_nWarpThreads; i++)
+        SetEvent(m_hWarpStart[i]);
+    for (int i=1; i<m_nWarpThreads; i++)
+    {
+        WaitForSingleObject(m_hWarpThread[i], INFINITE);
+        CloseHandle(m_hWarpThread[i]);
+        CloseHandle(m_hWarpStart[i]);
+        CloseHandle(m_hWarpDone[i]);
+    }
+    m_nWarpThreads = 1;
+}
+
+bool CPlugin::AllocateWarpBuffers()
+{
+    // The topology of the warp mesh never changes, so the triangle list lives in
+    //  a static index buffer, and each pass only streams the grid verts into a
+    //  dynamic vertex buffer (instead of 6 un-indexed verts per cell, every frame).
+    // The bottom half of the mesh wants the verts along the angle-wrap seam (the
+    //  left half of the middle row) to have ang == -pi, and the top half wants +pi;
+    //  so those m_nGridX/2 verts are duplicated at the end of the vertex buffer,
+    //  and the top half's indices point at the duplicates.
+    LPDIRECT3DDEVICE9 lpDevice = GetDevice();
+    if (!lpDevice || !m_indices_list)
+        return false;
+
+    int nGridVerts = (m_nGridX+1)*(m_nGridY+1);
+    int nSeamVerts = m_nGridX/2;
+    int nVerts     = nGridVerts + nSeamVerts;
+    int nIndices   = m_nGridX*m_nGridY*6;
+    DWORD max_index = GetCaps()->MaxVertexIndex;
+    if (nVerts > 65536 || (DWORD)(nVerts-1) > max_index)
+        return false;
+
+    m_warp_indices = new WORD[nIndices];
+    if (!m_warp_indices)
+        return false;
+    int seam = (m_nGridY/2)*(m_nGridX+1);
+    for (int i=0; i<nIndices; i++)
+    {
+        int v = m_indices_list[i];
+        if (i >= nIndices/2 && v >= seam && v < seam + nSeamVerts)
+            v += nGridVerts - seam;
+        m_warp_indices[i] = (WORD)v;
+    }
+
+    // keep room for 2 meshes in each dynamic buffer, so that the second pass of a
+    //  preset blend can append with D3DLOCK_NOOVERWRITE, and only the first pass of
+    //  each frame has to D3DLOCK_DISCARD.  (the base vertex index gets added to the
+    //  indices, though, so that has to stay under MaxVertexIndex too.)
+    int nMeshes = ((DWORD)(nVerts*2-1) <= max_index) ? 2 : 1;
+
+    void* p = NULL;
+    if (D3D_OK != lpDevice->CreateIndexBuffer(nIndices*sizeof(WORD), D3DUSAGE_WRITEONLY, D3DFMT_INDEX16, D3DPOOL_MANAGED, &m_lpWarpIB, NULL) ||
+        D3D_OK != m_lpWarpIB->Lock(0, 0, &p, 0))
+    {
+        CleanUpWarpBuffers();
+        return false;
+    }
+    memcpy(p, m_warp_indices, nIndices*sizeof(WORD));
+    m_lpWarpIB->Unlock();
+
+    if (D3D_OK != lpDevice->CreateVertexBuffer(nVerts*nMeshes*sizeof(MYVERTEX), D3DUSAGE_DYNAMIC | D3DUSAGE_WRITEONLY, MYVERTEX_FORMAT, D3DPOOL_DEFAULT, &m_lpWarpVB, NULL) ||
+        D3D_OK != lpDevice->CreateIndexBuffer(nIndices*2*sizeof(WORD), D3DUSAGE_DYNAMIC | D3DUSAGE_WRITEONLY, D3DFMT_INDEX16, D3DPOOL_DEFAULT, &m_lpWarpCullIB, NULL))
+    {
+        CleanUpWarpBuffers();
+        return false;
+    }
+
+    m_nWarpVerts      = nVerts;
+    m_nWarpVBSize     = nVerts*nMeshes;
+    m_nWarpVBPos      = m_nWarpVBSize;  // forces a D3DLOCK_DISCARD on first use
+    m_nWarpCullIBSize = nIndices*2;
+    m_nWarpCullIBPos  = m_nWarpCullIBSize;
+    return true;
+}
+
+void CPlugin::CleanUpWarpBuffers()
+{
+    SafeRelease(m_lpWarpVB);
+    SafeRelease(m_lpWarpIB);
+    SafeRelease(m_lpWarpCullIB);
+    if (m_warp_indices)
+    {
+        delete [] m_warp_indices;
+        m_warp_indices = NULL;
+    }
+    m_nWarpVerts      = 0;
+    m_nWarpVBSize     = 0;
+    m_nWarpVBPos      = 0;
+    m_nWarpCullIBSize = 0;
+    m_nWarpCullIBPos  = 0;
+}
+
+// interleaves m_mesh into MYVERTEX's, for upload.  (dst may be write-combined memory,
+//  so it's only ever written, front to back.)  bFlipY and rgb are for the fixed-function
+//  path: y is negated, and rgb (the decay color) goes in the low 24 bits of Diffuse.
+//  with bSeam, the angle-wrap seam is split too (see AllocateWarpBuffers()): the left half
+//  of the center row gets ang = -pi, and copies of those verts, with ang = +pi, follow the grid.
+void CPlugin::PackWarpVerts(MYVERTEX* dst, bool bFlipY, DWORD rgb, bool bSeam) const
+{
+    const float ysign = bFlipY ? -1.0f : 1.0f;
+    int nVerts = (m_nGridX+1)*(m_nGridY+1);
+    int nSeamVerts = bSeam ? m_nGridX/2 : 0;
+    int seam = (m_nGridY/2)*(m_nGridX+1);
+    for (int j=0; j<nVerts + nSeamVerts; j++)
+    {
+        int i = (j < nVerts) ? j : seam + j - nVerts;
+        float ang = m_mesh.ang[i];
+        if (j >= nVerts)
+            ang = 3.1415926535897932384626433832795f;
+        else if (j >= seam && j < seam + nSeamVerts)
+            ang = -3.1415926535897932384626433832795f;
+
+        dst[j].x       = m_mesh.x[i];
+        dst[j].y       = m_mesh.y[i]*ysign;
+        dst[j].z       = 0.0f;
+        dst[j].Diffuse = (rgb & 0x00FFFFFF) | (((DWORD)(m_mesh.alpha[i]*255))<<24);
+        dst[j].tu      = m_mesh.tu[i];
+        dst[j].tv      = m_mesh.tv[i];
+        dst[j].tu_orig = m_mesh.tu_orig[i];
+        dst[j].tv_orig = m_mesh.tv_orig[i];
+        dst[j].rad     = m_mesh.rad[i];
+        dst[j].ang     = ang;
+    }
+}
+
+bool CPlugin::DrawWarpMesh(bool bNoShaders, D3DCOLOR cDecay, bool bCullTiles, bool bFlipCulling)
+{
+    // Draws the whole warp mesh from m_mesh (with the current FVF/decl, shaders
+    //  & render states) in a single DrawIndexedPrimitive, split only if the card's
+    //  MaxPrimitiveCount is too low.  Returns false if the GPU-resident buffers are
+    //  unavailable, in which case the caller falls back to DrawPrimitiveUP.
+    // For the fixed-function path (bNoShaders), y is flipped and the decay color
+    //  replaces the rgb of each vertex's Diffuse color, as it's written.
+    // If bCullTiles, only the triangles that aren't completely alpha-blended out
+    //  (or completely opaque, if bFlipCulling) are drawn.
+    LPDIRECT3DDEVICE9 lpDevice = GetDevice();
+    if (!lpDevice || !m_lpWarpVB || !m_lpWarpIB || !m_lpWarpCullIB)
+        return false;
+
+    int nIndices = m_nGridX*m_nGridY*6;
+
+    // 1. stream the verts into the dynamic VB
+    DWORD flags = D3DLOCK_NOOVERWRITE;
+    if (m_nWarpVBPos + m_nWarpVerts > m_nWarpVBSize)
+    {
+        flags = D3DLOCK_DISCARD;
+        m_nWarpVBPos = 0;
+    }
+    MYVERTEX* v = NULL;
+    if (D3D_OK != m_lpWarpVB->Lock(m_nWarpVBPos*sizeof(MYVERTEX), m_nWarpVerts*sizeof(MYVERTEX), (void**)&v, flags))
+        return false;
+    PackWarpVerts(v, bNoShaders, bNoShaders ? cDecay : 0x00FFFFFF, true);
+    m_lpWarpVB->Unlock();
+    int base_vertex = m_nWarpVBPos;
+    m_nWarpVBPos += m_nWarpVerts;
+
+    // 2. pick the indices: the static list, or the culled subset of it
+    LPDIRECT3DINDEXBUFFER9 lpIB = m_lpWarpIB;
+    int start_index = 0;
+    int primCount = nIndices/3;
+    if (bCullTiles)
+    {
+        flags = D3DLOCK_NOOVERWRITE;
+        if (m_nWarpCullIBPos + nIndices > m_nWarpCullIBSize)
+        {
+            flags = D3DLOCK_DISCARD;
+            m_nWarpCullIBPos = 0;
+        }
+        WORD* idx = NULL;
+        if (D3D_OK != m_lpWarpCullIB->Lock(m_nWarpCullIBPos*sizeof(WORD), nIndices*sizeof(WORD), (void**)&idx, flags))
+            return false;
+        int count = 0;
+        for (int i=0; i<nIndices; i+=3)
+        {
+            // (the seam duplicates have the same alpha as the originals)
+            DWORD d1 = (DWORD)(m_mesh.alpha[ m_indices_list[i  ] ]*255);
+            DWORD d2 = (DWORD)(m_mesh.alpha[ m_indices_list[i+1] ]*255);
+            DWORD d3 = (DWORD)(m_mesh.alpha[ m_indices_list[i+2] ]*255);
+            bool bIsNeeded;
+            if (bFlipCulling)
+                bIsNeeded = ((d1 & d2 & d3) < 255);
+            else
+                bIsNeeded = ((d1|d2|d3) > 0);
+            if (bIsNeeded)
+            {
+                idx[count++] = m_warp_indices[i  ];
+                idx[count++] = m_warp_indices[i+1];
+                idx[count++] = m_warp_indices[i+2];
+            }
+        }
+        m_lpWarpCullIB->Unlock();
+        lpIB = m_lpWarpCullIB;
+        start_index = m_nWarpCullIBPos;
+        primCount = count/3;
+        m_nWarpCullIBPos += nIndices;
+    }
+
+    // 3. draw
+    if (primCount > 0)
+    {
+        lpDevice->SetStreamSource(0, m_lpWarpVB, 0, sizeof(MYVERTEX));
+        lpDevice->SetIndices(lpIB);
+        int max_prims_per_batch = (int)min(GetCaps()->MaxPrimitiveCount, (DWORD)primCount);
+        while (primCount > 0)
+        {
+            int prims = min(primCount, max_prims_per_batch);
+            lpDevice->DrawIndexedPrimitive(D3DPT_TRIANGLELIST, base_vertex, 0, m_nWarpVerts, start_index, prims);
+            start_index += prims*3;
+            primCount   -= prims;
+        }
+        // unbind, so the D3DPOOL_DEFAULT buffers can really be released on a device reset.
+        lpDevice->SetStreamSource(0, NULL, 0, 0);
+        lpDevice->SetIndices(NULL);
+    }
+
+    return true;
+}
+
 void CPlugin::WarpedBlit_NoShaders(int nPass, bool bAlphaBlend, bool bFlipAlpha, bool bCullTiles, bool bFlipCulling)
 {
+	PROFILE_ZONE("WarpedBlit_NoShaders");
 	MungeFPCW(NULL);	// puts us in single-precision mode & disables exceptions
 
     LPDIRECT3DDEVICE9 lpDevice = GetDevice();
@@ -2088,11 +2590,18 @@ void CPlugin::WarpedBlit_NoShaders(int nPass, bool bAlphaBlend, bool bFlipAlpha,
     if (bFlipCulling)
         nAlphaTestValue = 1-nAlphaTestValue;
 
-    // Hurl the triangles at the video card.
-    // We're going to un-index it, so that we don't stress any crappy (AHEM intel g33)
+    // Hurl the triangles at the video card - from the GPU-resident mesh, if we have it.
+    if (DrawWarpMesh(true, cDecay, bCullTiles, bFlipCulling))
+    {
+        lpDevice->SetRenderState(D3DRS_ALPHABLENDENABLE, FALSE);
+        return;
+    }
+
+    // Otherwise, we're going to un-index it, so that we don't stress any crappy (AHEM intel g33)
     //  drivers out there.  
     // If we're blending, we'll skip any polygon that is all alpha-blended out.
     // This also respects the MaxPrimCount limit of the video card.
+    PackWarpVerts(m_verts, false, 0x00FFFFFF, false);
     MYVERTEX tempv[1024 * 3] = {0};
     int max_prims_per_batch = min( GetCaps()->MaxPrimitiveCount, (ARRAYSIZE(tempv))/3) - 4;
     int primCount = m_nGridX*m_nGridY*2;  
@@ -2227,6 +2736,7 @@ void CPlugin::WarpedBlit_NoShaders(int nPass, bool bAlphaBlend, bool bFlipAlpha,
 
 void CPlugin::WarpedBlit_Shaders(int nPass, bool bAlphaBlend, bool bFlipAlpha, bool bCullTiles, bool bFlipCulling)
 {
+    PROFILE_ZONE("WarpedBlit_Shaders");
     // if nPass==0, it draws old preset (blending 1 of 2).
     // if nPass==1, it draws new preset (blending 2 of 2, OR done blending)
 
@@ -2288,16 +2798,21 @@ void CPlugin::WarpedBlit_Shaders(int nPass, bool bAlphaBlend, bool bFlipAlpha, b
         
         ApplyShaderParams( &(si->params), si->CT, state );
 
-        // Hurl the triangles at the video card.
-        // We're going to un-index it, so that we don't stress any crappy (AHEM intel g33)
+        // Hurl the triangles at the video card - from the GPU-resident mesh, if we have it.
+        // (DrawWarpMesh() handles the angle-wrap seam with duplicate verts; see AllocateWarpBuffers().)
+        bool bDrawn = DrawWarpMesh(false, 0, bCullTiles, bFlipCulling);
+        if (!bDrawn)
+            PackWarpVerts(m_verts, false, 0x00FFFFFF, false);
+
+        // Otherwise, we're going to un-index it, so that we don't stress any crappy (AHEM intel g33)
         //  drivers out there.  
         // We divide it into the two halves of the screen (top/bottom) so we can hack
         //  the 'ang' values along the angle-wrap seam, halfway through the draw.
         // If we're blending, we'll skip any polygon that is all alpha-blended out.
         // This also respects the MaxPrimCount limit of the video card.
-        MYVERTEX tempv[1024 * 3] = {0};
+        MYVERTEX tempv[1024 * 3];   // (every vert is written before it's drawn)
         int max_prims_per_batch = min( GetCaps()->MaxPrimitiveCount, (ARRAYSIZE(tempv))/3) - 4;
-        for (int half=0; half<2; half++)
+        for (int half=0; half<2 && !bDrawn; half++)
         {
             // hack / restore the ang values along the angle-wrap [0 <-> 2pi] seam...
             float new_ang = half ? 3.1415926535897932384626433832795f : -3.1415926535897932384626433832795f;
@@ -2349,6 +2864,7 @@ void CPlugin::WarpedBlit_Shaders(int nPass, bool bAlphaBlend, bool bFlipAlpha, b
 
 void CPlugin::DrawCustomShapes() const
 {
+    PROFILE_ZONE("DrawCustomShapes");
     LPDIRECT3DDEVICE9 lpDevice = GetDevice();
     if (!lpDevice)
         return;
@@ -2544,6 +3060,17 @@ void CPlugin::LoadCustomShapePerFrameEvallibVars(CState* pState, int i, int inst
 	*pState->m_shape[i].var_pf_bass_att	= (double)mysound.avg_rel[0];
 	*pState->m_shape[i].var_pf_mid_att	= (double)mysound.avg_rel[1];
 	*pState->m_shape[i].var_pf_treb_att	= (double)mysound.avg_rel[2];
+    for (int vi=0; vi<m_nSpectrumBands && pState->m_shape[i].var_pf_band[vi]; vi++)
+    {
+        *pState->m_shape[i].var_pf_band[vi]     = (double)mysound.band_imm_rel[vi];
+        *pState->m_shape[i].var_pf_band_att[vi] = (double)mysound.band_avg_rel[vi];
+    }
+    if (pState->m_shape[i].var_pf_beat)
+    {
+        *pState->m_shape[i].var_pf_beat       = (double)m_sound.beat;
+        *pState->m_shape[i].var_pf_beat_phase = (double)m_sound.beat_phase;
+        *pState->m_shape[i].var_pf_bpm        = (double)m_sound.bpm;
+    }
     for (int vi=0; vi<NUM_Q_VAR; vi++)
         *pState->m_shape[i].var_pf_q[vi] = *pState->var_pf_q[vi];
     for (int vi=0; vi<NUM_T_VAR; vi++)
@@ -2586,6 +3113,17 @@ void CPlugin::LoadCustomWavePerFrameEvallibVars(CState* pState, int i) const
 	*pState->m_wave[i].var_pf_bass_att	= (double)mysound.avg_rel[0];
 	*pState->m_wave[i].var_pf_mid_att	= (double)mysound.avg_rel[1];
 	*pState->m_wave[i].var_pf_treb_att	= (double)mysound.avg_rel[2];
+    for (int vi=0; vi<m_nSpectrumBands && pState->m_wave[i].var_pf_band[vi]; vi++)
+    {
+        *pState->m_wave[i].var_pf_band[vi]     = (double)mysound.band_imm_rel[vi];
+        *pState->m_wave[i].var_pf_band_att[vi] = (double)mysound.band_avg_rel[vi];
+    }
+    if (pState->m_wave[i].var_pf_beat)
+    {
+        *pState->m_wave[i].var_pf_beat       = (double)m_sound.beat;
+        *pState->m_wave[i].var_pf_beat_phase = (double)m_sound.beat_phase;
+        *pState->m_wave[i].var_pf_bpm        = (double)m_sound.bpm;
+    }
     for (int vi=0; vi<NUM_Q_VAR; vi++)
 	    *pState->m_wave[i].var_pf_q[vi] = *pState->var_pf_q[vi];
     for (int vi=0; vi<NUM_T_VAR; vi++)
@@ -2629,6 +3167,7 @@ int SmoothWave(WFVERTEX* vi, int nVertsIn, WFVERTEX* vo)
 
 void CPlugin::DrawCustomWaves() const
 {
+    PROFILE_ZONE("DrawCustomWaves");
     LPDIRECT3DDEVICE9 lpDevice = GetDevice();
     if (!lpDevice)
         return;
@@ -2671,6 +3210,17 @@ void CPlugin::DrawCustomWaves() const
 			    *pState->m_wave[i].var_pp_bass_att	= *pState->m_wave[i].var_pf_bass_att;
 			    *pState->m_wave[i].var_pp_mid_att	= *pState->m_wave[i].var_pf_mid_att;
 			    *pState->m_wave[i].var_pp_treb_att	= *pState->m_wave[i].var_pf_treb_att;
+                for (int vi=0; vi<m_nSpectrumBands && pState->m_wave[i].var_pp_band[vi]; vi++)
+                {
+                    *pState->m_wave[i].var_pp_band[vi]     = *pState->m_wave[i].var_pf_band[vi];
+                    *pState->m_wave[i].var_pp_band_att[vi] = *pState->m_wave[i].var_pf_band_att[vi];
+                }
+			    if (pState->m_wave[i].var_pp_beat)
+			    {
+			        *pState->m_wave[i].var_pp_beat       = *pState->m_wave[i].var_pf_beat;
+			        *pState->m_wave[i].var_pp_beat_phase = *pState->m_wave[i].var_pf_beat_phase;
+			        *pState->m_wave[i].var_pp_bpm        = *pState->m_wave[i].var_pf_bpm;
+			    }
 
 				NSEEL_code_execute(pState->m_wave[i].m_pf_codehandle);
 
@@ -2692,7 +3242,7 @@ void CPlugin::DrawCustomWaves() const
                     // initialize tempdata[2][512]
                     int j0 = (pState->m_wave[i].bSpectrum) ? 0 : (max_samples - nSamples)/2/**(1-pState->m_wave[i].bSpectrum)*/ - pState->m_wave[i].sep/2;
                     int j1 = (pState->m_wave[i].bSpectrum) ? 0 : (max_samples - nSamples)/2/**(1-pState->m_wave[i].bSpectrum)*/ + pState->m_wave[i].sep/2;
-                    float t = (pState->m_wave[i].bSpectrum) ? (max_samples - pState->m_wave[i].sep)/(float)nSamples : 1;
+                    float t = (pState->m_wave[i].bSpectrum) ? (max_samples - pState->m_wave[i].sep)/(float)nSamples * (m_sound.nFrequencies/512.0f) : 1;
                     float mix1 = powf(pState->m_wave[i].smoothing*0.98f, 0.5f);  // lower exponent -> more default smoothing
                     float mix2 = 1-mix1;
                     // SMOOTHING:
@@ -2814,6 +3364,7 @@ void CPlugin::DrawCustomWaves() const
 
 void CPlugin::DrawWave()
 {
+    PROFILE_ZONE("DrawWave");
     LPDIRECT3DDEVICE9 lpDevice = GetDevice();
     if (!lpDevice)
         return;
@@ -3261,7 +3812,13 @@ void CPlugin::DrawWave()
 					//256 verts
 					for (i=0; i<nVerts; i++)
 					{
-						float f = 0.1f*logf(mysound.fSpecLeft[i*2] + mysound.fSpecLeft[i*2+1]);
+						// (2 bins per vertex at the default fft_size)
+						int j0 = i*mysound.nSpecLeft/256;
+						int j1 = max(j0+1, (i+1)*mysound.nSpecLeft/256);
+						float sum = 0;
+						for (int j=j0; j<j1; j++)
+							sum += mysound.fSpecLeft[j];
+						float f = 0.1f*logf(sum*2.0f/(float)(j1-j0));
 						v[i].x = edge_x[0] + dx*i + perp_dx*f;
 						v[i].y = edge_y[0] + dy*i + perp_dy*f;
 						//v[i].Diffuse = color;
@@ -3432,6 +3989,7 @@ SKIP_DRAW_WAVE:
 
 void CPlugin::DrawSprites() const
 {
+    PROFILE_ZONE("DrawSprites");
     LPDIRECT3DDEVICE9 lpDevice = GetDevice();
     if (!lpDevice)
         return;
@@ -3562,6 +4120,7 @@ bool CPlugin::SetMilkdropRenderTarget(LPDIRECTDRAWSURFACE7 lpSurf, int w, int h,
 
 void CPlugin::DrawUserSprites()	// from system memory, to back buffer.
 {
+    PROFILE_ZONE("DrawUserSprites");
     LPDIRECT3DDEVICE9 lpDevice = GetDevice();
     if (!lpDevice)
         return;
@@ -4096,6 +4655,7 @@ void CPlugin::ApplyShaderParams(CShaderParams* p, LPD3DXCONSTANTTABLE pCT, CStat
 
 void CPlugin::ShowToUser_NoShaders()//int bRedraw, int nPassOverride)
 {
+    PROFILE_ZONE("ShowToUser_NoShaders");
     // note: this one has to draw the whole screen!  (one big quad)
 
     LPDIRECT3DDEVICE9 lpDevice = GetDevice();
@@ -4416,6 +4976,7 @@ void CPlugin::ShowToUser_NoShaders()//int bRedraw, int nPassOverride)
 
 void CPlugin::ShowToUser_Shaders(int nPass, bool bAlphaBlend, bool bFlipAlpha, bool bCullTiles, bool bFlipCulling)//int bRedraw, int nPassOverride, bool bFlipAlpha)
 {
+    PROFILE_ZONE("ShowToUser_Shaders");
     LPDIRECT3DDEVICE9 lpDevice = GetDevice();
     if (!lpDevice)
         return;
@@ -4499,15 +5060,14 @@ void CPlugin::ShowToUser_Shaders(int nPass, bool bAlphaBlend, bool bFlipAlpha, b
                     int ny = (int)y;
                     double dx = x - nx;
                     double dy = y - ny;
-                    double alpha00 = (m_verts[(ny  )*(m_nGridX+1) + (nx  )].Diffuse >> 24);
-                    double alpha01 = (m_verts[(ny  )*(m_nGridX+1) + (nx+1)].Diffuse >> 24);
-                    double alpha10 = (m_verts[(ny+1)*(m_nGridX+1) + (nx  )].Diffuse >> 24);
-                    double alpha11 = (m_verts[(ny+1)*(m_nGridX+1) + (nx+1)].Diffuse >> 24);
+                    double alpha00 = m_mesh.alpha[(ny  )*(m_nGridX+1) + (nx  )];
+                    double alpha01 = m_mesh.alpha[(ny  )*(m_nGridX+1) + (nx+1)];
+                    double alpha10 = m_mesh.alpha[(ny+1)*(m_nGridX+1) + (nx  )];
+                    double alpha11 = m_mesh.alpha[(ny+1)*(m_nGridX+1) + (nx+1)];
                     alpha = alpha00*(1-dx)*(1-dy) + 
                             alpha01*(  dx)*(1-dy) + 
                             alpha10*(1-dx)*(  dy) + 
                             alpha11*(  dx)*(  dy);
-                    alpha /= 255.0f;
                     //if (bFlipAlpha)
                     //    alpha = 1-alpha;
 
@@ -4603,6 +5163,7 @@ void CPlugin::ShowToUser_Shaders(int nPass, bool bAlphaBlend, bool bFlipAlpha, b
 
 void CPlugin::ShowSongTitleAnim(int w, int h, float fProgress)
 {
+	PROFILE_ZONE("ShowSongTitleAnim");
 	int i,x,y;
 
     if (!m_lpDDSTitle)  // this *can* be NULL, if not much video mem!
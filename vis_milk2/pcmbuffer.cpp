@@ -0,0 +1,204 @@
+/*
+  LICENSE
+  -------
+Copyright 2005-2013 Nullsoft, Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, 
+are permitted provided that the following conditions are met:
+
+  * Redistributions of source code must retain the above copyright notice,
+    this list of conditions and the following disclaimer. 
+
+  * Redistributions in binary form must reproduce the above copyright notice,
+    this list of conditions and the following disclaimer in the documentation
+    and/or other materials provided with the distribution. 
+
+  * Neither the name of Nullsoft nor the names of its contributors may be used to 
+    endorse or promote products derived from this software without specific prior written permission. 
+ 
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR 
+IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND 
+FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR 
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT 
+OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include <memory.h>
+#include "pcmbuffer.h"
+
+#define SafeDeleteArray(x) { if (x) { delete [] x; x = 0; } }
+
+/*****************************************************************************/
+
+PCMRingBuffer::PCMRingBuffer()
+{
+    m_data[0] = m_data[1] = 0;
+    m_size = 0;
+    m_rate = 44100;
+    m_write = 0;
+    m_read = 0;
+    m_marks_write = 0;
+    m_marks_read = 0;
+    m_last_mark.pos = 0;
+    m_last_mark.time = -1;
+}
+
+/*****************************************************************************/
+
+PCMRingBuffer::~PCMRingBuffer()
+{
+    CleanUp();
+}
+
+/*****************************************************************************/
+
+bool PCMRingBuffer::Init(int frames)
+{
+    CleanUp();
+
+    int size = 1;
+    while (size < frames && size < (1<<30))
+        size *= 2;
+
+    m_data[0] = new float[size];
+    m_data[1] = new float[size];
+    m_size = size;
+    m_write = 0;
+    m_read = 0;
+    m_marks_write = 0;
+    m_marks_read = 0;
+    m_last_mark.time = -1;
+    return true;
+}
+
+/*****************************************************************************/
+
+void PCMRingBuffer::CleanUp()
+{
+    SafeDeleteArray(m_data[0]);
+    SafeDeleteArray(m_data[1]);
+    m_size = 0;
+    m_write = 0;
+    m_read = 0;
+    m_marks_write = 0;
+    m_marks_read = 0;
+    m_last_mark.time = -1;
+}
+
+/*****************************************************************************/
+
+void PCMRingBuffer::SetRate(int sample_rate)
+{
+    if (sample_rate > 0)
+        m_rate = sample_rate;
+}
+
+/*****************************************************************************/
+
+int PCMRingBuffer::Write(const float *left, const float *right, int frames, double time)
+{
+    // (only the producer changes m_write, so it can read it relaxed; the acquire on
+    //  m_read makes sure the consumer is done with the space before we reuse it.)
+    const unsigned int w = m_write.load(std::memory_order_relaxed);
+    const unsigned int r = m_read.load(std::memory_order_acquire);
+    const int space = m_size - (int)(w - r);
+    if (frames > space)
+        frames = space;
+    if (frames <= 0)
+        return 0;
+
+    if (time >= 0)
+    {
+        // (if the consumer has fallen so far behind that the marks are full, this one is
+        //  dropped, and its frames get timed from the previous one.)
+        const unsigned int mw = m_marks_write.load(std::memory_order_relaxed);
+        if (mw - m_marks_read.load(std::memory_order_acquire) < MAX_MARKS)
+        {
+            m_marks[mw % MAX_MARKS].pos  = w;
+            m_marks[mw % MAX_MARKS].time = time;
+            m_marks_write.store(mw + 1, std::memory_order_release);
+        }
+    }
+
+    const int pos   = (int)(w & (unsigned int)(m_size-1));
+    const int first = (frames < m_size - pos) ? frames : m_size - pos;
+    if (!right)
+        right = left;
+    memcpy(m_data[0] + pos, left,  sizeof(float)*first);
+    memcpy(m_data[1] + pos, right, sizeof(float)*first);
+    memcpy(m_data[0], left  + first, sizeof(float)*(frames - first));
+    memcpy(m_data[1], right + first, sizeof(float)*(frames - first));
+
+    m_write.store(w + frames, std::memory_order_release);
+    return frames;
+}
+
+/*****************************************************************************/
+
+int PCMRingBuffer::GetReadable() const
+{
+    return (int)(m_write.load(std::memory_order_acquire) - m_read.load(std::memory_order_relaxed));
+}
+
+/*****************************************************************************/
+
+int PCMRingBuffer::Read(float *left, float *right, int frames, double *time)
+{
+    const unsigned int r = m_read.load(std::memory_order_relaxed);
+    const unsigned int w = m_write.load(std::memory_order_acquire);
+    if (frames > (int)(w - r))
+        frames = (int)(w - r);
+    if (frames <= 0)
+        return 0;
+
+    PopMarks(r);
+    if (time)
+        *time = (m_last_mark.time < 0) ? -1 : m_last_mark.time + (double)(r - m_last_mark.pos)/m_rate;
+
+    const int pos   = (int)(r & (unsigned int)(m_size-1));
+    const int first = (frames < m_size - pos) ? frames : m_size - pos;
+    memcpy(left,  m_data[0] + pos, sizeof(float)*first);
+    memcpy(right, m_data[1] + pos, sizeof(float)*first);
+    memcpy(left  + first, m_data[0], sizeof(float)*(frames - first));
+    memcpy(right + first, m_data[1], sizeof(float)*(frames - first));
+
+    m_read.store(r + frames, std::memory_order_release);
+    return frames;
+}
+
+/*****************************************************************************/
+
+void PCMRingBuffer::Skip(int frames)
+{
+    const unsigned int r = m_read.load(std::memory_order_relaxed);
+    const unsigned int w = m_write.load(std::memory_order_acquire);
+    if (frames > (int)(w - r))
+        frames = (int)(w - r);
+    if (frames > 0)
+    {
+        PopMarks(r + frames);
+        m_read.store(r + frames, std::memory_order_release);
+    }
+}
+
+/*****************************************************************************/
+
+void PCMRingBuffer::PopMarks(unsigned int pos)
+{
+    // move m_last_mark up to the newest mark at or before 'pos'
+    unsigned int mr = m_marks_read.load(std::memory_order_relaxed);
+    const unsigned int mw = m_marks_write.load(std::memory_order_acquire);
+    while (mr != mw && (int)(m_marks[mr % MAX_MARKS].pos - pos) <= 0)
+    {
+        m_last_mark = m_marks[mr % MAX_MARKS];
+        mr++;
+    }
+    m_marks_read.store(mr, std::memory_order_release);
+}
+
+/*****************************************************************************/
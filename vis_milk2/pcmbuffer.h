@@ -0,0 +1,78 @@
+/*
+  LICENSE
+  -------
+Copyright 2005-2013 Nullsoft, Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, 
+are permitted provided that the following conditions are met:
+
+  * Redistributions of source code must retain the above copyright notice,
+    this list of conditions and the following disclaimer. 
+
+  * Redistributions in binary form must reproduce the above copyright notice,
+    this list of conditions and the following disclaimer in the documentation
+    and/or other materials provided with the distribution. 
+
+  * Neither the name of Nullsoft nor the names of its contributors may be used to 
+    endorse or promote products derived from this software without specific prior written permission. 
+ 
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR 
+IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND 
+FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR 
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT 
+OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#ifndef __NULLSOFT_DX9_PLUGIN_SHELL_PCMBUFFER_H__
+#define __NULLSOFT_DX9_PLUGIN_SHELL_PCMBUFFER_H__ 1
+
+#include <atomic>
+
+// a lock-free ring of stereo float PCM, for one producer thread (the host, pushing
+// whatever it has, whenever it has it) and one consumer thread (the sound analysis,
+// pulling fixed-size hops).  Init() and CleanUp() must not overlap either of them.
+// the producer can timestamp what it writes; Read() then tells the consumer when the
+// first frame it got plays, extrapolated at SetRate()'s rate from the last timestamp.
+class PCMRingBuffer
+{
+public:
+    PCMRingBuffer();
+    ~PCMRingBuffer();
+    bool Init(int frames);      // capacity, rounded up to a power of 2
+    void CleanUp();
+    void SetRate(int sample_rate);
+
+    // producer:
+    int  Write(const float *left, const float *right, int frames, double time = -1);    // right can be NULL (mono); time: when left[0] plays, in seconds, or -1 if it just follows on; returns # of frames written - the rest didn't fit
+    // consumer:
+    int  GetReadable() const;
+    int  Read(float *left, float *right, int frames, double *time = 0);                 // returns # of frames read; *time = when left[0] plays, or -1 if nothing was ever timestamped
+    void Skip(int frames);
+
+private:
+    void PopMarks(unsigned int pos);
+
+    enum { MAX_MARKS = 64 };
+    struct td_mark
+    {
+        unsigned int pos;       // in m_write/m_read terms
+        double time;
+    };
+
+    float *m_data[2];
+    int    m_size;              // a power of 2
+    int    m_rate;
+    std::atomic<unsigned int> m_write;  // # of frames written/read so far (wrapping); the
+    std::atomic<unsigned int> m_read;   //  difference is the # of frames in the buffer
+    td_mark m_marks[MAX_MARKS];         // timestamps not yet reached by m_read, oldest first,
+    std::atomic<unsigned int> m_marks_write;    //  in a ring of their own (with the same scheme)
+    std::atomic<unsigned int> m_marks_read;
+    td_mark m_last_mark;        // (consumer) the newest one that was reached; time < 0 if none
+};
+
+#endif
@@ -541,6 +541,7 @@ SPOUT NOTES :
 #include "shell_defines.h"
 #include <assert.h>
 #include <locale.h>
+#include <malloc.h>   // for _aligned_malloc
 #include <process.h>  // for beginthread, etc.
 #include <shellapi.h>
 #include <strsafe.h>
@@ -971,6 +972,8 @@ void CPlugin::MyPreInitialize()
 	m_fTimeBetweenPresetsRand	= 10.0f;
 	m_bSequentialPresetOrder    = false;
 	m_bHardCutsDisabled			= true;
+	m_bBeatSyncedSwitches		= false;
+	m_bProfileCode				= false;
 	m_fHardCutLoudnessThresh	= 2.5f;
 	m_fHardCutHalflife			= 60.0f;
 	//m_nWidth			= 1024;
@@ -982,6 +985,14 @@ void CPlugin::MyPreInitialize()
 	m_nTexBitsPerCh     =  8;
 	m_nGridX			= 48;//32;
 	m_nGridY			= 36;//24;
+	m_nGridXCfg			= 48;
+	m_bAdaptiveMesh		= false;
+	m_nMinMeshSize		= 16;
+	m_fMeshBudget		= 0.25f;
+	m_fMeshCost			= 0;
+	m_nMeshCostFrames	= 0;
+	m_nExpensiveGridX	= 16;
+    m_nSpectrumBands    = 16;
 
 	m_bShowPressF1ForHelp = true;
 	//strcpy(m_szMonitorName, "[don't use multimon]");
@@ -1053,6 +1064,7 @@ void CPlugin::MyPreInitialize()
 	m_fPresetStartTime = 0.0f;
 	m_fNextPresetTime  = -1.0f;	// negative value means no time set (...it will be auto-set on first call to UpdateTime)
     m_nLoadingPreset   = 0;
+    m_bLoadingPresetOnBeat = false;
     m_nPresetsLoadedTotal = 0;
     m_fSnapPoint = 0.5f;
 	m_pState    = &m_state_DO_NOT_USE[0];
@@ -1089,7 +1101,6 @@ void CPlugin::MyPreInitialize()
 	memset(&m_szUpdatePresetMask, 0, sizeof(m_szUpdatePresetMask));
     //m_nRatingReadProgress = -1;
 
-    myfft.Init(576, MY_FFT_SAMPLES, -1);
 	memset(&mysound, 0, sizeof(mysound));
 
     for (int i=0; i<PRESET_HIST_LEN; i++)
@@ -1125,9 +1136,20 @@ void CPlugin::MyPreInitialize()
     m_nTitleTexSizeY        = 0;
 	m_verts					= NULL;
 	m_verts_temp            = NULL;
-	m_vertinfo				= NULL;
+    memset(&m_mesh, 0, sizeof(m_mesh));
 	m_indices_list			= NULL;
 	m_indices_strip			= NULL;
+    m_lpWarpVB              = NULL;
+    m_lpWarpIB              = NULL;
+    m_lpWarpCullIB          = NULL;
+    m_warp_indices          = NULL;
+    m_nWarpVerts            = 0;
+    m_nWarpVBSize           = 0;
+    m_nWarpVBPos            = 0;
+    m_nWarpCullIBSize       = 0;
+    m_nWarpCullIBPos        = 0;
+    m_nWarpThreads          = 1;    // see StartWarpThreads()
+    m_bWarpThreadsQuit      = false;
 
     m_bHasFocus             = true;
     m_bHadFocus             = false;
@@ -1194,6 +1216,9 @@ void CPlugin::MyReadConfig()
 	m_bEnableRating = GetPrivateProfileBoolW(L"settings",L"bEnableRating",m_bEnableRating,pIni);
     //m_bInstaScan    = GetPrivateProfileBool("settings","bInstaScan",m_bInstaScan,pIni);
 	m_bHardCutsDisabled = GetPrivateProfileBoolW(L"settings",L"bHardCutsDisabled",m_bHardCutsDisabled,pIni);
+	m_bBeatSyncedSwitches = GetPrivateProfileBoolW(L"settings",L"bBeatSyncedSwitches",m_bBeatSyncedSwitches,pIni);
+	m_bProfileCode = GetPrivateProfileBoolW(L"settings",L"bProfileCode",m_bProfileCode,pIni);
+	NSEEL_PROFILE_enabled = m_bProfileCode;
 #ifdef _DEBUG
 	g_bDebugOutput	= GetPrivateProfileBoolW(L"settings",L"bDebugOutput",g_bDebugOutput,pIni);
 #endif
@@ -1239,6 +1264,10 @@ void CPlugin::MyReadConfig()
 	m_nTexBitsPerCh = GetPrivateProfileIntW(L"settings", L"nTexBitsPerCh", m_nTexBitsPerCh, pIni);
 	m_nGridX		= GetPrivateProfileIntW(L"settings",L"nMeshSize"   ,m_nGridX      ,pIni);
 	m_nGridY        = m_nGridX*3/4;
+	m_bAdaptiveMesh = GetPrivateProfileBoolW(L"settings",L"bAdaptiveMesh",m_bAdaptiveMesh,pIni);
+	m_nMinMeshSize  = GetPrivateProfileIntW(L"settings",L"nMinMeshSize",m_nMinMeshSize,pIni);
+	m_fMeshBudget   = GetPrivateProfileFloatW(L"settings",L"fMeshBudget",m_fMeshBudget,pIni);
+    m_nSpectrumBands = GetPrivateProfileIntW(L"settings",L"nSpectrumBands",m_nSpectrumBands,pIni);
     m_nMaxPSVersion_ConfigPanel = GetPrivateProfileIntW(L"settings",L"MaxPSVersion",m_nMaxPSVersion_ConfigPanel,pIni);
     m_nMaxImages    = GetPrivateProfileIntW(L"settings",L"MaxImages",m_nMaxImages,pIni);
     m_nMaxBytes     = GetPrivateProfileIntW(L"settings",L"MaxBytes" ,m_nMaxBytes ,pIni);
@@ -1264,6 +1293,12 @@ void CPlugin::MyReadConfig()
 		m_nGridX = MAX_GRID_X;
 	if (m_nGridY > MAX_GRID_Y)
 		m_nGridY = MAX_GRID_Y;
+	m_nGridXCfg = m_nGridX;
+	// (the adaptive sizes are multiples of 8, so that m_nGridY = m_nGridX*3/4 stays even)
+	m_nMinMeshSize = max(8, min(MAX_GRID_X, m_nMinMeshSize)) & ~7;
+	m_nExpensiveGridX = m_nMinMeshSize;
+	m_fMeshBudget = max(0.01f, min(1.0f, m_fMeshBudget));
+    m_nSpectrumBands = max(0, min(MAX_SPECTRUM_BANDS, m_nSpectrumBands));
 	if (m_fTimeBetweenPresetsRand < 0)
 		m_fTimeBetweenPresetsRand = 0;
 	if (m_fTimeBetweenPresets < 0.1f)
@@ -1305,6 +1340,8 @@ void CPlugin::MyWriteConfig()
 
 	WritePrivateProfileIntW(m_bSongTitleAnims,    1,		L"bSongTitleAnims",		pIni, L"settings");
 	WritePrivateProfileIntW(m_bHardCutsDisabled,  1,	    L"bHardCutsDisabled",	pIni, L"settings");
+	WritePrivateProfileIntW(m_bBeatSyncedSwitches, 0,	    L"bBeatSyncedSwitches",	pIni, L"settings");
+	WritePrivateProfileIntW(m_bProfileCode,       0,	    L"bProfileCode",		pIni, L"settings");
 	WritePrivateProfileIntW(m_bEnableRating,      1,	    L"bEnableRating",		pIni, L"settings");
 	//WritePrivateProfileIntW(m_bInstaScan,            "bInstaScan",		    pIni, "settings");
 #ifdef _DEBUG
@@ -1333,7 +1370,11 @@ void CPlugin::MyWriteConfig()
     WritePrivateProfileIntW(m_nCanvasStretch, 0,       L"nCanvasStretch",   	pIni, L"settings");
     WritePrivateProfileIntW(m_nTexSizeX, -1,	    L"nTexSize",				pIni, L"settings");
 	WritePrivateProfileIntW(m_nTexBitsPerCh, 8,        L"nTexBitsPerCh",        pIni, L"settings");
-	WritePrivateProfileIntW(m_nGridX, 48,				L"nMeshSize",			pIni, L"settings");
+	WritePrivateProfileIntW(m_nGridXCfg, 48,			L"nMeshSize",			pIni, L"settings");
+	WritePrivateProfileIntW(m_bAdaptiveMesh, 0,		L"bAdaptiveMesh",		pIni, L"settings");
+	WritePrivateProfileIntW(m_nMinMeshSize, 16,		L"nMinMeshSize",		pIni, L"settings");
+	WritePrivateProfileFloatW(m_fMeshBudget, 0.25f,	L"fMeshBudget",			pIni, L"settings");
+	WritePrivateProfileIntW(m_nSpectrumBands, 16,		L"nSpectrumBands",		pIni, L"settings");
 	WritePrivateProfileIntW(m_nMaxPSVersion_ConfigPanel, -1, L"MaxPSVersion",  	pIni, L"settings");
     WritePrivateProfileIntW(m_nMaxImages, 32, L"MaxImages",  	pIni, L"settings");
     WritePrivateProfileIntW(m_nMaxBytes, 16000000, L"MaxBytes",  	pIni, L"settings");
@@ -1437,11 +1478,20 @@ int CPlugin::AllocateMyNonDx9Stuff()
 		m_hBlackBrush = CreateSolidBrush(RGB(0,0,0));
     */
 
+    myfft.Init(GetFFTWindowLen(), m_fft_size/2, -1, 1.0f, m_fft_window);
+    mysound.nSpecLeft = m_fft_size/2;
+    mysound.fSpecLeft = new float[mysound.nSpecLeft];
+    memset(mysound.fSpecLeft, 0, sizeof(float)*mysound.nSpecLeft);
+    // 40 Hz - 16 kHz; fSpecLeft[k] is k*22050/nSpecLeft Hz (assuming 44.1 kHz audio)
+    mybands.Init(mysound.nSpecLeft, 22050.0f*(mysound.nSpecLeft-1)/mysound.nSpecLeft, m_nSpectrumBands, 40.0f, 16000.0f);
+
     g_hThread = INVALID_HANDLE_VALUE;
     g_bThreadAlive = false;
     g_bThreadShouldQuit = false;
 	InitializeCriticalSection(&g_cs);
 
+    StartWarpThreads();
+
     // read in 'm_szShaderIncludeText'
     bool bSuccess = ReadFileToString(L"include.fx", m_szShaderIncludeText, ARRAYSIZE(m_szShaderIncludeText)-4, false);
 	if (!bSuccess) return false;
@@ -1502,6 +1552,13 @@ void CPlugin::CleanUpMyNonDx9Stuff()
     // Be sure to clean up any objects here that were 
     //   created/initialized in AllocateMyNonDx9Stuff.
     
+    DumpCodeProfile();
+
+    myfft.CleanUp();
+    mybands.CleanUp();
+    SafeDeleteArray(mysound.fSpecLeft);
+    mysound.nSpecLeft = 0;
+
 #ifdef SPOUT_SUPPORT
 	// =========================================================
 	// SPOUT cleanup on exit
@@ -1529,6 +1586,8 @@ void CPlugin::CleanUpMyNonDx9Stuff()
 
     CancelThread(0);
 
+    StopWarpThreads();
+
 	m_menuPreset  .Finish();
 	m_menuWave    .Finish();
 	m_menuAugment .Finish();
@@ -2314,12 +2373,7 @@ int CPlugin::AllocateMyDX9Stuff()
     m_texmgr.Init(GetDevice());
 
 	//dumpmsg("Init: mesh allocation");
-	m_verts      = new MYVERTEX[(m_nGridX+1)*(m_nGridY+1)];
-	m_verts_temp = new MYVERTEX[(m_nGridX+2) * 4];
-	m_vertinfo   = new td_vertinfo[(m_nGridX+1)*(m_nGridY+1)];
-	m_indices_strip = new int[(m_nGridX+2)*(m_nGridY*2)];
-	m_indices_list  = new int[m_nGridX*m_nGridY*6];
-	if (!m_verts || !m_vertinfo)
+	if (!AllocateMesh())
 	{
 		_snwprintf(buf, ARRAYSIZE(buf), L"couldn't allocate mesh - out of memory");
 		//dumpmsg(buf); 
@@ -2327,94 +2381,6 @@ int CPlugin::AllocateMyDX9Stuff()
 		return false;
 	}
 
-	int nVert = 0;
-	float texel_offset_x = 0.5f / (float)m_nTexSizeX;
-	float texel_offset_y = 0.5f / (float)m_nTexSizeY;
-	for (int y=0; y<=m_nGridY; y++)
-	{
-		for (int x=0; x<=m_nGridX; x++)
-		{
-			// precompute x,y,z
-			m_verts[nVert].x = x/(float)m_nGridX*2.0f - 1.0f;
-			m_verts[nVert].y = y/(float)m_nGridY*2.0f - 1.0f;
-			m_verts[nVert].z = 0.0f;
-
-			// precompute rad, ang, being conscious of aspect ratio
-			m_vertinfo[nVert].rad = sqrtf(m_verts[nVert].x*m_verts[nVert].x*m_fAspectX*m_fAspectX + m_verts[nVert].y*m_verts[nVert].y*m_fAspectY*m_fAspectY);
-			if (y==m_nGridY/2 && x==m_nGridX/2)
-				m_vertinfo[nVert].ang = 0.0f;
-			else
-				m_vertinfo[nVert].ang = atan2f(m_verts[nVert].y*m_fAspectY, m_verts[nVert].x*m_fAspectX);
-            m_vertinfo[nVert].a = 1;
-            m_vertinfo[nVert].c = 0;
-
-            m_verts[nVert].rad = m_vertinfo[nVert].rad;
-            m_verts[nVert].ang = m_vertinfo[nVert].ang;
-            m_verts[nVert].tu_orig =  m_verts[nVert].x*0.5f + 0.5f + texel_offset_x;
-            m_verts[nVert].tv_orig = -m_verts[nVert].y*0.5f + 0.5f + texel_offset_y;
-
-			++nVert;
-		}
-	}
-	
-    // generate triangle strips for the 4 quadrants.
-    // each quadrant has m_nGridY/2 strips.
-    // each strip has m_nGridX+2 *points* in it, or m_nGridX/2 polygons.
-	int xref, yref;
-	int nVert_strip = 0;
-	for (int quadrant=0; quadrant<4; quadrant++)
-	{
-		for (int slice=0; slice < m_nGridY/2; slice++)
-		{
-			for (int i=0; i < m_nGridX + 2; i++)
-			{
-				// quadrants:	2 3
-				//				0 1
-				xref = i/2;
-				yref = (i%2) + slice;
-
-				if (quadrant & 1)
-					xref = m_nGridX - xref;
-				if (quadrant & 2)
-					yref = m_nGridY - yref;
-
-                int v = xref + (yref)*(m_nGridX+1);
-
-				m_indices_strip[nVert_strip++] = v;
-			}
-		}
-	}
-
-    // also generate triangle lists for drawing the main warp mesh.
-    int nVert_list = 0;
-	for (int quadrant=0; quadrant<4; quadrant++)
-	{
-		for (int slice=0; slice < m_nGridY/2; slice++)
-		{
-			for (int i=0; i < m_nGridX/2; i++)
-			{
-				// quadrants:	2 3
-				//				0 1
-				xref = i;
-				yref = slice;
-
-				if (quadrant & 1)
-					xref = m_nGridX-1 - xref;
-				if (quadrant & 2)
-					yref = m_nGridY-1 - yref;
-
-                int v = xref + (yref)*(m_nGridX+1);
-
-                m_indices_list[nVert_list++] = v;
-                m_indices_list[nVert_list++] = v           +1;
-                m_indices_list[nVert_list++] = v+m_nGridX+1  ;
-                m_indices_list[nVert_list++] = v           +1;
-                m_indices_list[nVert_list++] = v+m_nGridX+1  ;
-                m_indices_list[nVert_list++] = v+m_nGridX+1+1;
-			}
-		}
-	}
-
     // GENERATED TEXTURES FOR SHADERS
     //-------------------------------------
     if (m_nMaxPSVersion > 0)
@@ -3874,6 +3840,7 @@ void CPlugin::CleanUpMyDX9Stuff(const int final_cleanup)
     if (m_nLoadingPreset != 0) {
         // finish up the pre-load & start the official blend
         m_nLoadingPreset = 8;
+        m_bLoadingPresetOnBeat = false;
         LoadPresetTick();        
     }
     // just force this:
@@ -3952,6 +3919,136 @@ void CPlugin::CleanUpMyDX9Stuff(const int final_cleanup)
 
     m_texmgr.Finish();
 
+    CleanUpMesh();
+
+    ClearErrors();
+}
+
+//----------------------------------------------------------------------
+
+bool CPlugin::AllocateMesh()
+{
+    // allocates the warp mesh for the current m_nGridX x m_nGridY and sets up its
+    //  static parts.  on failure, whatever did get allocated is left for CleanUpMesh().
+	m_verts      = new MYVERTEX[(m_nGridX+1)*(m_nGridY+1)];
+	m_verts_temp = new MYVERTEX[(m_nGridX+2) * 4];
+	m_indices_strip = new int[(m_nGridX+2)*(m_nGridY*2)];
+	m_indices_list  = new int[m_nGridX*m_nGridY*6];
+
+    // the mesh state itself is kept as one (aligned) float array per field; see td_meshsoa.
+    m_mesh.nStride = ((m_nGridX+1)*(m_nGridY+1) + 3) & ~3;
+    m_mesh.block = (float*)_aligned_malloc(m_mesh.nStride*MESH_SOA_ARRAYS*sizeof(float), 16);
+    if (m_mesh.block)
+    {
+        float* p = m_mesh.block;
+        float** arrays[MESH_SOA_ARRAYS] = { &m_mesh.x, &m_mesh.y, &m_mesh.rad, &m_mesh.ang, &m_mesh.tu_orig, &m_mesh.tv_orig,
+                                            &m_mesh.a, &m_mesh.c, &m_mesh.tu, &m_mesh.tv, &m_mesh.alpha };
+        for (int i=0; i<MESH_SOA_ARRAYS; i++, p += m_mesh.nStride)
+            *arrays[i] = p;
+    }
+	if (!m_verts || !m_verts_temp || !m_indices_strip || !m_indices_list || !m_mesh.block)
+		return false;
+
+	int nVert = 0;
+	float texel_offset_x = 0.5f / (float)m_nTexSizeX;
+	float texel_offset_y = 0.5f / (float)m_nTexSizeY;
+	for (int y=0; y<=m_nGridY; y++)
+	{
+		for (int x=0; x<=m_nGridX; x++)
+		{
+			// precompute x,y
+			float fx = x/(float)m_nGridX*2.0f - 1.0f;
+			float fy = y/(float)m_nGridY*2.0f - 1.0f;
+			m_mesh.x[nVert] = fx;
+			m_mesh.y[nVert] = fy;
+
+			// precompute rad, ang, being conscious of aspect ratio
+			m_mesh.rad[nVert] = sqrtf(fx*fx*m_fAspectX*m_fAspectX + fy*fy*m_fAspectY*m_fAspectY);
+			if (y==m_nGridY/2 && x==m_nGridX/2)
+				m_mesh.ang[nVert] = 0.0f;
+			else
+				m_mesh.ang[nVert] = atan2f(fy*m_fAspectY, fx*m_fAspectX);
+            m_mesh.a[nVert] = 1;
+            m_mesh.c[nVert] = 0;
+
+            m_mesh.tu_orig[nVert] =  fx*0.5f + 0.5f + texel_offset_x;
+            m_mesh.tv_orig[nVert] = -fy*0.5f + 0.5f + texel_offset_y;
+            m_mesh.tu[nVert]    = m_mesh.tu_orig[nVert];
+            m_mesh.tv[nVert]    = m_mesh.tv_orig[nVert];
+            m_mesh.alpha[nVert] = 1;
+
+			++nVert;
+		}
+	}
+	
+    // generate triangle strips for the 4 quadrants.
+    // each quadrant has m_nGridY/2 strips.
+    // each strip has m_nGridX+2 *points* in it, or m_nGridX/2 polygons.
+	int xref, yref;
+	int nVert_strip = 0;
+	for (int quadrant=0; quadrant<4; quadrant++)
+	{
+		for (int slice=0; slice < m_nGridY/2; slice++)
+		{
+			for (int i=0; i < m_nGridX + 2; i++)
+			{
+				// quadrants:	2 3
+				//				0 1
+				xref = i/2;
+				yref = (i%2) + slice;
+
+				if (quadrant & 1)
+					xref = m_nGridX - xref;
+				if (quadrant & 2)
+					yref = m_nGridY - yref;
+
+                int v = xref + (yref)*(m_nGridX+1);
+
+				m_indices_strip[nVert_strip++] = v;
+			}
+		}
+	}
+
+    // also generate triangle lists for drawing the main warp mesh.
+    int nVert_list = 0;
+	for (int quadrant=0; quadrant<4; quadrant++)
+	{
+		for (int slice=0; slice < m_nGridY/2; slice++)
+		{
+			for (int i=0; i < m_nGridX/2; i++)
+			{
+				// quadrants:	2 3
+				//				0 1
+				xref = i;
+				yref = slice;
+
+				if (quadrant & 1)
+					xref = m_nGridX-1 - xref;
+				if (quadrant & 2)
+					yref = m_nGridY-1 - yref;
+
+                int v = xref + (yref)*(m_nGridX+1);
+
+                m_indices_list[nVert_list++] = v;
+                m_indices_list[nVert_list++] = v           +1;
+                m_indices_list[nVert_list++] = v+m_nGridX+1  ;
+                m_indices_list[nVert_list++] = v           +1;
+                m_indices_list[nVert_list++] = v+m_nGridX+1  ;
+                m_indices_list[nVert_list++] = v+m_nGridX+1+1;
+			}
+		}
+	}
+
+    // upload the mesh topology to the card.  (not fatal if this fails.)
+    AllocateWarpBuffers();
+
+    return true;
+}
+
+void CPlugin::CleanUpMesh()
+{
+    CleanUpWarpBuffers();
+
 	if (m_verts != NULL)
 	{
 		delete m_verts;
@@ -3964,10 +4061,10 @@ void CPlugin::CleanUpMyDX9Stuff(const int final_cleanup)
 		m_verts_temp = NULL;
 	}
 
-	if (m_vertinfo != NULL)
+	if (m_mesh.block != NULL)
 	{
-		delete m_vertinfo;
-		m_vertinfo = NULL;
+		_aligned_free(m_mesh.block);
+		memset(&m_mesh, 0, sizeof(m_mesh));
 	}
 
 	if (m_indices_list != NULL)
@@ -3981,8 +4078,36 @@ void CPlugin::CleanUpMyDX9Stuff(const int final_cleanup)
 		delete m_indices_strip;
 		m_indices_strip = NULL;
 	}
+}
 
-    ClearErrors();
+bool CPlugin::ResizeMesh(int nGridX)
+{
+    // reallocates the warp mesh at nGridX x nGridX*3/4, between frames (the warp
+    //  threads must be idle).  the device doesn't need a reset for this: the warp
+    //  buffers are just released and created again, and they're unbound after each draw.
+    int nOldX = m_nGridX;
+    int nOldY = m_nGridY;
+
+    CleanUpMesh();
+    m_nGridX = nGridX;
+    m_nGridY = nGridX*3/4;
+    if (!AllocateMesh())
+    {
+        // (only if we're out of memory) go back to the old size, and stay there.
+        CleanUpMesh();
+        m_nGridX = nOldX;
+        m_nGridY = nOldY;
+        m_bAdaptiveMesh = false;
+        AllocateMesh();
+        return false;
+    }
+
+    // the new verts start out unblended
+    if (m_pState->m_bBlending)
+        RandomizeBlendPattern();
+
+    m_nMeshCostFrames = 0;
+    return true;
 }
 
 //----------------------------------------------------------------------
@@ -5789,6 +5914,12 @@ LRESULT CPlugin::MyWindowProc(HWND hWnd, unsigned uMsg, WPARAM wParam, LPARAM lP
 			}
 			case VK_F5:
 			{
+				if (bShiftHeldDown)
+				{
+					m_show_frame_stats = !m_show_frame_stats;
+					WritePrivateProfileIntW(m_show_frame_stats, 0, L"show_frame_stats", GetConfigIniFile(), L"settings");
+					return 0; // we processed (or absorbed) the key
+				}
 				m_bShowFPS = !m_bShowFPS;
 				WritePrivateProfileIntW(m_bShowFPS, 0, L"bShowFPS", GetConfigIniFile(), L"settings");
 				return 0; // we processed (or absorbed) the key
@@ -7253,7 +7384,7 @@ BOOL CPlugin::MyConfigTabProc(int nPage, HWND hwnd,UINT msg,WPARAM wParam,LPARAM
                 AddItem(ctrl, WASABI_API_LNGSTRINGW(IDS_160X120_SLOW), 160);
                 AddItem(ctrl, WASABI_API_LNGSTRINGW(IDS_192X144_SLOW), 192);
                 SelectItemByPos(ctrl, 0); //as a safe default
-                SelectItemByValue(ctrl, m_nGridX);
+                SelectItemByValue(ctrl, m_nGridXCfg);
 
 			    //-------------- canvas stretch combo box ---------------------
                 ctrl = GetDlgItem( hwnd, IDC_STRETCH );
@@ -7365,7 +7496,7 @@ BOOL CPlugin::MyConfigTabProc(int nPage, HWND hwnd,UINT msg,WPARAM wParam,LPARAM
                 ReadCBValue(hwnd, IDC_SHADERS      , &m_nMaxPSVersion_ConfigPanel );
                 ReadCBValue(hwnd, IDC_TEXFORMAT    , &m_nTexBitsPerCh );
                 ReadCBValue(hwnd, IDC_TEXSIZECOMBO , &m_nTexSizeX );
-                ReadCBValue(hwnd, IDC_MESHSIZECOMBO, &m_nGridX );
+                ReadCBValue(hwnd, IDC_MESHSIZECOMBO, &m_nGridXCfg );
                 ReadCBValue(hwnd, IDC_STRETCH      , &m_nCanvasStretch);
 
 				// 16-bit-brightness slider - this one doesn't use item values... just item pos.
@@ -8312,7 +8443,7 @@ void CPlugin::LoadRandomPreset(float fBlendTime)
 
 void CPlugin::RandomizeBlendPattern()
 {
-    if (!m_vertinfo)
+    if (!m_mesh.block)
         return;
 
     // note: we now avoid constant uniform blend b/c it's half-speed for shader blending. 
@@ -8327,8 +8458,8 @@ void CPlugin::RandomizeBlendPattern()
 	    {
 		    for (int x=0; x<=m_nGridX; x++)
 		    {
-                m_vertinfo[nVert].a = 1;
-                m_vertinfo[nVert].c = 0;
+                m_mesh.a[nVert] = 1;
+                m_mesh.c[nVert] = 0;
 			    ++nVert;
             }
         }
@@ -8356,8 +8487,8 @@ void CPlugin::RandomizeBlendPattern()
                 float t = (fx-0.5f)*vx + (fy-0.5f)*vy + 0.5f;
                 t = (t-0.5f)/sqrtf(2.0f) + 0.5f;
 
-                m_vertinfo[nVert].a = inv_band * (1 + band);
-                m_vertinfo[nVert].c = -inv_band + inv_band*t;//(x/(float)m_nGridX - 0.5f)/band;
+                m_mesh.a[nVert] = inv_band * (1 + band);
+                m_mesh.c[nVert] = -inv_band + inv_band*t;//(x/(float)m_nGridX - 0.5f)/band;
 			    ++nVert;
 		    }
 	    }
@@ -8369,24 +8500,24 @@ void CPlugin::RandomizeBlendPattern()
         float inv_band = 1.0f/band;
 
         // first generate plasma array of height values
-        m_vertinfo[                               0].c = FRAND;
-        m_vertinfo[                        m_nGridX].c = FRAND;
-        m_vertinfo[m_nGridY*(m_nGridX+1)           ].c = FRAND;
-        m_vertinfo[m_nGridY*(m_nGridX+1) + m_nGridX].c = FRAND;
+        m_mesh.c[                               0] = FRAND;
+        m_mesh.c[                        m_nGridX] = FRAND;
+        m_mesh.c[m_nGridY*(m_nGridX+1)           ] = FRAND;
+        m_mesh.c[m_nGridY*(m_nGridX+1) + m_nGridX] = FRAND;
         GenPlasma(0, m_nGridX, 0, m_nGridY, 0.25f);
 
         // then find min,max so we can normalize to [0..1] range and then to the proper 'constant offset' range.
-        float minc = m_vertinfo[0].c, maxc = minc;
+        float minc = m_mesh.c[0], maxc = minc;
         int x,y,nVert = 0;
     
 	    for (y=0; y<=m_nGridY; y++)
 	    {
 		    for (x=0; x<=m_nGridX; x++)
             {
-                if (minc > m_vertinfo[nVert].c)
-                    minc = m_vertinfo[nVert].c;
-                if (maxc < m_vertinfo[nVert].c)
-                    maxc = m_vertinfo[nVert].c;
+                if (minc > m_mesh.c[nVert])
+                    minc = m_mesh.c[nVert];
+                if (maxc < m_mesh.c[nVert])
+                    maxc = m_mesh.c[nVert];
 			    ++nVert;
 		    }
 	    }
@@ -8397,9 +8528,9 @@ void CPlugin::RandomizeBlendPattern()
 	    {
 		    for (x=0; x<=m_nGridX; x++)
             {
-                float t = (m_vertinfo[nVert].c - minc)*mult;
-                m_vertinfo[nVert].a = inv_band * (1 + band);
-                m_vertinfo[nVert].c = -inv_band + inv_band*t;
+                float t = (m_mesh.c[nVert] - minc)*mult;
+                m_mesh.a[nVert] = inv_band * (1 + band);
+                m_mesh.c[nVert] = -inv_band + inv_band*t;
                 ++nVert;
             }
         }
@@ -8422,8 +8553,8 @@ void CPlugin::RandomizeBlendPattern()
                 if (dir==-1)
                     t = 1-t;
 
-                m_vertinfo[nVert].a = inv_band * (1 + band);
-                m_vertinfo[nVert].c = -inv_band + inv_band*t;
+                m_mesh.a[nVert] = inv_band * (1 + band);
+                m_mesh.c[nVert] = -inv_band + inv_band*t;
 			    ++nVert;
             }
         }
@@ -8434,32 +8565,32 @@ void CPlugin::GenPlasma(int x0, int x1, int y0, int y1, float dt)
 {
     int midx = (x0+x1)/2;
     int midy = (y0+y1)/2;
-    float t00 = m_vertinfo[y0*(m_nGridX+1) + x0].c;
-    float t01 = m_vertinfo[y0*(m_nGridX+1) + x1].c;
-    float t10 = m_vertinfo[y1*(m_nGridX+1) + x0].c;
-    float t11 = m_vertinfo[y1*(m_nGridX+1) + x1].c;
+    float t00 = m_mesh.c[y0*(m_nGridX+1) + x0];
+    float t01 = m_mesh.c[y0*(m_nGridX+1) + x1];
+    float t10 = m_mesh.c[y1*(m_nGridX+1) + x0];
+    float t11 = m_mesh.c[y1*(m_nGridX+1) + x1];
 
     if (y1-y0 >= 2)
     {
         if (x0==0)
-            m_vertinfo[midy*(m_nGridX+1) + x0].c = 0.5f*(t00 + t10) + (FRAND*2-1)*dt*m_fAspectY;
-        m_vertinfo[midy*(m_nGridX+1) + x1].c = 0.5f*(t01 + t11) + (FRAND*2-1)*dt*m_fAspectY;
+            m_mesh.c[midy*(m_nGridX+1) + x0] = 0.5f*(t00 + t10) + (FRAND*2-1)*dt*m_fAspectY;
+        m_mesh.c[midy*(m_nGridX+1) + x1] = 0.5f*(t01 + t11) + (FRAND*2-1)*dt*m_fAspectY;
     }
     if (x1-x0 >= 2)
     {
         if (y0==0)
-            m_vertinfo[y0*(m_nGridX+1) + midx].c = 0.5f*(t00 + t01) + (FRAND*2-1)*dt*m_fAspectX;
-        m_vertinfo[y1*(m_nGridX+1) + midx].c = 0.5f*(t10 + t11) + (FRAND*2-1)*dt*m_fAspectX;
+            m_mesh.c[y0*(m_nGridX+1) + midx] = 0.5f*(t00 + t01) + (FRAND*2-1)*dt*m_fAspectX;
+        m_mesh.c[y1*(m_nGridX+1) + midx] = 0.5f*(t10 + t11) + (FRAND*2-1)*dt*m_fAspectX;
     }
 
     if (y1-y0 >= 2 && x1-x0 >= 2)
     {
         // do midpoint & recurse:
-        t00 = m_vertinfo[midy*(m_nGridX+1) + x0].c;
-        t01 = m_vertinfo[midy*(m_nGridX+1) + x1].c;
-        t10 = m_vertinfo[y0*(m_nGridX+1) + midx].c;
-        t11 = m_vertinfo[y1*(m_nGridX+1) + midx].c;
-        m_vertinfo[midy*(m_nGridX+1) + midx].c = 0.25f*(t10 + t11 + t00 + t01) + (FRAND*2-1)*dt;
+        t00 = m_mesh.c[midy*(m_nGridX+1) + x0];
+        t01 = m_mesh.c[midy*(m_nGridX+1) + x1];
+        t10 = m_mesh.c[y0*(m_nGridX+1) + midx];
+        t11 = m_mesh.c[y1*(m_nGridX+1) + midx];
+        m_mesh.c[midy*(m_nGridX+1) + midx] = 0.25f*(t10 + t11 + t00 + t01) + (FRAND*2-1)*dt;
 
         GenPlasma(x0, midx, y0, midy, dt*0.5f);
         GenPlasma(midx, x1, y0, midy, dt*0.5f);
@@ -8502,6 +8633,9 @@ void CPlugin::LoadPreset(const wchar_t *szPresetFilename, float fBlendTime)
         return;
     }
 
+    // log what the outgoing preset(s) cost before their code goes away
+    DumpCodeProfile();
+
     if ( !m_bSequentialPresetOrder )
     {
         // save preset in the history.  keep in mind - maybe we are searching back through it already!
@@ -8577,6 +8711,7 @@ void CPlugin::LoadPreset(const wchar_t *szPresetFilename, float fBlendTime)
         m_pNewState->Import(szPresetFilename, GetTime(), m_pOldState, ApplyFlags);
         
         m_nLoadingPreset = 1;   // this will cause LoadPresetTick() to get called over the next few frames...
+        m_bLoadingPresetOnBeat = false;
 
         m_fLoadingPresetBlendTime = fBlendTime;
 		if (m_szLoadingPreset)
@@ -8596,6 +8731,39 @@ void CPlugin::OnFinishedLoadingPreset()
     
     for (int mash=0; mash<MASH_SLOTS; mash++)
         m_nMashPreset[mash] = m_nCurrentPreset;
+
+    // presets marked expensive don't wait for the adaptive mesh to notice them; they
+    //  start out at the size the last one settled at.  (see UpdateMeshSize())
+    if (m_bAdaptiveMesh && m_pState->m_bExpensive && m_nGridX > m_nExpensiveGridX)
+        ResizeMesh(m_nExpensiveGridX);
+}
+
+void CPlugin::DumpCodeProfile()
+{
+    // with bProfileCode set in the .ini, appends the preset code that took the most
+    //  time since the last call to milkdrop2_profile.txt (next to the .ini), then
+    //  starts counting again.  each line is labelled with the preset name and which
+    //  of its programs it was (see SetCodeLabel() in state.cpp).
+    if (!m_bProfileCode)
+        return;
+
+    char buf[4096] = {0};
+    if (NSEEL_profile_dump(buf, ARRAYSIZE(buf), 16) > 0)
+    {
+        wchar_t szFile[MAX_PATH] = {0};
+        wcsncpy(szFile, GetConfigIniFile(), ARRAYSIZE(szFile));
+        wchar_t* p = wcsrchr(szFile, L'\\');
+        if (p) *(p+1) = 0;
+        wcsncat(szFile, L"milkdrop2_profile.txt", ARRAYSIZE(szFile) - wcslen(szFile) - 1);
+
+        FILE* f = _wfopen(szFile, L"a");
+        if (f)
+        {
+            fprintf(f, "--- frame %d, %.1f s ---\n%s\n", GetFrame(), GetTime(), buf);
+            fclose(f);
+        }
+    }
+    NSEEL_profile_reset();
 }
 
 void CPlugin::LoadPresetTick()
@@ -8607,6 +8775,12 @@ void CPlugin::LoadPresetTick()
     }
     else if (m_nLoadingPreset == 8)
     {
+        // if it was an automatic switch, wait for the beat: apply it on the last frame before one.
+        if (m_bLoadingPresetOnBeat && 
+            m_sound.beat_phase + m_sound.bpm/60.0f/GetFps() < 1.0f &&
+            GetTime() < m_fLoadingPresetReadyTime + 60.0f/m_sound.bpm)
+            return;
+
         // finished loading the shaders - apply the preset!
 	    wcsncpy(m_szCurrentPresetFile, (m_szLoadingPreset ? m_szLoadingPreset : L""), ARRAYSIZE(m_szCurrentPresetFile));
 	    free(m_szLoadingPreset);
@@ -8642,7 +8816,16 @@ void CPlugin::LoadPresetTick()
     }
 
     if (m_nLoadingPreset > 0)
+    {
         ++m_nLoadingPreset;
+        if (m_nLoadingPreset == 8)
+            m_fLoadingPresetReadyTime = GetTime();
+    }
+}
+
+bool CPlugin::IsBeatSynced() const
+{
+    return m_bBeatSyncedSwitches && m_sound.beat_confidence > 0.25f && m_sound.bpm > 0 && GetFps() > 1.0f;
 }
 
 void CPlugin::SeekToPreset(/*wchar_t cStartChar*/)
@@ -10132,20 +10315,25 @@ void CPlugin::DoCustomSoundAnalysis()
     memcpy(mysound.fWaveform[1], m_sound.fWaveform[1], sizeof(float)*576);*/
 	memcpy(mysound.fWaveform, m_sound.fWaveform, sizeof(mysound.fWaveform));
 
-    // do our own [UN-NORMALIZED] fft
-	float fWaveLeft[576] = {0};
-	for (int i=0; i<576; i++) 
-        fWaveLeft[i] = m_sound.fWaveform[0][i];
-
-	myfft.time_to_frequency_domain(fWaveLeft, mysound.fSpecLeft);
+    // do our own [UN-NORMALIZED] fft, of the raw (unaligned) samples
+	const int nFreq = mysound.nSpecLeft;
+	if (!nFreq)
+		return;
+	myfft.time_to_frequency_domain((float*)GetRecentSamples(0), mysound.fSpecLeft);
 	//for (i=0; i<MY_FFT_SAMPLES; i++) fSpecLeft[i] = sqrtf(fSpecLeft[i]*fSpecLeft[i] + fSpecTemp[i]*fSpecTemp[i]);
 
+	// bigger ffts / other windows: back to the levels of the 576-sample one
+	const float gain = GetFFTGain(myfft);
+	if (gain != 1.0f)
+		for (int i=0; i<nFreq; i++)
+			mysound.fSpecLeft[i] *= gain;
+
 	// sum spectrum up into 3 bands
 	for (int i=0; i<3; i++)
 	{
 		// note: only look at bottom half of spectrum!  (hence divide by 6 instead of 3)
-		int start = MY_FFT_SAMPLES*i/6;
-		int end   = MY_FFT_SAMPLES*(i+1)/6;
+		int start = nFreq*i/6;
+		int end   = nFreq*(i+1)/6;
 		int j;
 
 		mysound.imm[i] = 0;
@@ -10154,35 +10342,43 @@ void CPlugin::DoCustomSoundAnalysis()
 			mysound.imm[i] += mysound.fSpecLeft[j];
 	}
 
+	// the log-spaced bands
+	mybands.Apply(mysound.fSpecLeft, mysound.band_imm);
+
 	// do temporal blending to create attenuated and super-attenuated versions
 	for (int i=0; i<3; i++)
-	{
-        float rate;
+		SmoothBandLevel(mysound.imm[i], mysound.avg[i], mysound.long_avg[i], mysound.imm_rel[i], mysound.avg_rel[i]);
+	for (int i=0; i<mybands.GetNumBands(); i++)
+		SmoothBandLevel(mysound.band_imm[i], mysound.band_avg[i], mysound.band_long_avg[i], mysound.band_imm_rel[i], mysound.band_avg_rel[i]);
+}
 
-		if (mysound.imm[i] > mysound.avg[i])
-			rate = 0.2f;
-		else
-			rate = 0.5f;
-        rate = AdjustRateToFPS(rate, 30.0f, GetFps());
-        mysound.avg[i] = mysound.avg[i]*rate + mysound.imm[i]*(1-rate);
+void CPlugin::SmoothBandLevel(float imm, float &avg, float &long_avg, float &imm_rel, float &avg_rel)
+{
+    float rate;
 
-		if (GetFrame() < 50)
-			rate = 0.9f;
-		else
-			rate = 0.992f;
-        rate = AdjustRateToFPS(rate, 30.0f, GetFps());
-        mysound.long_avg[i] = mysound.long_avg[i]*rate + mysound.imm[i]*(1-rate);
+	if (imm > avg)
+		rate = 0.2f;
+	else
+		rate = 0.5f;
+    rate = AdjustRateToFPS(rate, 30.0f, GetFps());
+    avg = avg*rate + imm*(1-rate);
 
-		// also get bass/mid/treble levels *relative to the past*
-		if (fabsf(mysound.long_avg[i]) < 0.001f)
-		{
-			mysound.imm_rel[i] = mysound.avg_rel[i] = 1.0f;
-		}
-		else
-		{
-			mysound.imm_rel[i] = mysound.imm[i] / mysound.long_avg[i];
-			mysound.avg_rel[i] = mysound.avg[i] / mysound.long_avg[i];
-		}
+	if (GetFrame() < 50)
+		rate = 0.9f;
+	else
+		rate = 0.992f;
+    rate = AdjustRateToFPS(rate, 30.0f, GetFps());
+    long_avg = long_avg*rate + imm*(1-rate);
+
+	// also get the level *relative to the past*
+	if (fabsf(long_avg) < 0.001f)
+	{
+		imm_rel = avg_rel = 1.0f;
+	}
+	else
+	{
+		imm_rel = imm / long_avg;
+		avg_rel = avg / long_avg;
 	}
 }
 
@@ -36,6 +36,7 @@ OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "support.h"
 #include "texmgr.h"
 #include "state.h"
+#include "warpmath.h"
 #include <nu/Vector.h>
 #include "../ns-eel2/ns-eel.h"
 #include <string>
@@ -55,11 +56,35 @@ extern "C" int (*warand)(void);
 
 typedef enum { TEX_DISK, TEX_VS, TEX_BLUR0, TEX_BLUR1, TEX_BLUR2, TEX_BLUR3, TEX_BLUR4, TEX_BLUR5, TEX_BLUR6, TEX_BLUR_LAST } tex_code;
 typedef enum { UI_REGULAR, UI_MENU, UI_LOAD, UI_LOAD_DEL, UI_LOAD_RENAME, UI_SAVEAS, UI_SAVE_OVERWRITE, UI_EDIT_MENU_STRING, UI_CHANGEDIR, UI_IMPORT_WAVE, UI_EXPORT_WAVE, UI_IMPORT_SHAPE, UI_EXPORT_SHAPE, UI_UPGRADE_PIXEL_SHADER, UI_MASHUP } ui_mode;
-typedef struct { float rad; float ang; float a; float c;  } td_vertinfo; // blending: mix = max(0,min(1,a*t + c));
+typedef struct
+{
+    // static; set when the mesh is allocated
+    float   *x, *y;             // position, -1..1
+    float   *rad, *ang;
+    float   *tu_orig, *tv_orig;
+    // the blend pattern; set by RandomizeBlendPattern().  blending: mix = max(0,min(1,a*t + c));
+    float   *a, *c;
+    // outputs of the per-vertex stage (ComputeGridRows()), rewritten every frame
+    float   *tu, *tv;
+    float   *alpha;             // blend alpha, 0..1
+    int     nStride;            // floats per array: the vert count, rounded up to a multiple of 4
+    float   *block;             // the (16-byte aligned) allocation they all live in
+} td_meshsoa;   // the warp mesh, as one contiguous array per field; see PackWarpVerts()
+#define MESH_SOA_ARRAYS 11
+typedef struct 
+{
+    int     nThreads;       // threads splitting the rows this frame
+    int     num_reps;       // 2 while blending presets
+    float   fBlend;
+    float   fWarpTime, fWarpScaleInv, f[4];
+    float   texel_offset_x, texel_offset_y;
+    td_warpconsts consts;   // the same, pre-digested for WarpVerts_Uniform/Varying()
+    bool    bUniform[2];    // per rep: the warp params are the same for every vertex (no per-pixel code, or PP_CODE_UNIFORM)
+    td_warpparams uniform[2];   // ...and if so, what they are
+} td_warpjob;   // per-frame inputs of CPlugin::ComputeGridRows()
 typedef char* CHARPTR;
 LRESULT CALLBACK WndProc(HWND hwnd, UINT message, WPARAM wParam, LPARAM lParam);
 
-#define MY_FFT_SAMPLES 512     // for old [pre-vms] milkdrop sound analysis
 typedef struct 
 {
 	float   imm[3];			// bass, mids, treble (absolute)
@@ -67,8 +92,14 @@ typedef struct
 	float	avg[3];			// bass, mids, treble (absolute)
 	float	avg_rel[3];		// bass, mids, treble (relative to song; 1=avg, 0.9~below, 1.1~above)
 	float	long_avg[3];	// bass, mids, treble (absolute)
+    float   band_imm[MAX_SPECTRUM_BANDS];       // same as the above, but for each of the m_nSpectrumBands log-spaced bands
+    float   band_imm_rel[MAX_SPECTRUM_BANDS];
+    float   band_avg[MAX_SPECTRUM_BANDS];
+    float   band_avg_rel[MAX_SPECTRUM_BANDS];
+    float   band_long_avg[MAX_SPECTRUM_BANDS];
     float   fWaveform[2][576];
-    float   fSpecLeft[MY_FFT_SAMPLES];
+    float  *fSpecLeft;      // nSpecLeft samples (m_fft_size/2)
+    int     nSpecLeft;
 } td_mysounddata;
 
 typedef struct
@@ -323,6 +354,8 @@ public:
         /// CONFIG PANEL SETTINGS THAT WE'VE ADDED (TAB #2)
         bool        m_bSequentialPresetOrder;
         bool		m_bHardCutsDisabled;
+        bool		m_bBeatSyncedSwitches;	// when there's a steady beat, make hard cuts & auto-switches on it
+        bool		m_bProfileCode;			// time preset code and log the worst of it (see DumpCodeProfile)
         float		m_fBlendTimeAuto;		// blend time when preset auto-switches
         float		m_fBlendTimeUser;		// blend time when user loads a new preset
         float		m_fTimeBetweenPresets;		// <- this is in addition to m_fBlendTimeAuto
@@ -341,8 +374,16 @@ public:
         float       m_fInvAspectX;
         float       m_fInvAspectY;
 		int         m_nTexBitsPerCh;
-        int			m_nGridX;
+        int			m_nGridX;           // the mesh size in use; with m_bAdaptiveMesh, this moves around (see UpdateMeshSize())
         int			m_nGridY;
+        int         m_nGridXCfg;        // nMeshSize, as configured (what m_nGridX starts out at)
+        bool        m_bAdaptiveMesh;    // resize the mesh to keep ComputeGridAlphaValues() within m_fMeshBudget
+        int         m_nMinMeshSize;     // ...but never below this (a multiple of 8)
+        float       m_fMeshBudget;      // ...as a fraction of the frame time
+        float       m_fMeshCost;        // smoothed time taken by ComputeGridAlphaValues(), in seconds
+        int         m_nMeshCostFrames;  // # of frames m_fMeshCost has been measured at the current size
+        int         m_nExpensiveGridX;  // where the mesh last settled for a preset marked bExpensive
+        int         m_nSpectrumBands;   // 0-64: # of log-spaced bands given to presets as band1..bandN (+ band1_att..)
 
         bool		m_bShowPressF1ForHelp;
         //char		m_szMonitorName[256];
@@ -447,6 +488,8 @@ public:
         int         m_nLoadingPreset;
         wchar_t     *m_szLoadingPreset;
         float       m_fLoadingPresetBlendTime;
+        bool        m_bLoadingPresetOnBeat;     // hold the loaded preset until the next beat (at most a beat)...
+        float       m_fLoadingPresetReadyTime;  // ...counting from when it finished loading
         int         m_nPresetsLoadedTotal; //important for texture eviction age-tracking...
         CState		m_state_DO_NOT_USE[3];	// do not use; use pState and pOldState instead.
         ui_mode		m_UI_mode;				// can be UI_REGULAR, UI_LOAD, UI_SAVEHOW, or UI_SAVEAS 
@@ -505,6 +548,7 @@ public:
         void        OnFinishedLoadingPreset();
 
         FFT            myfft;
+        FFTBands       mybands;     // mysound.fSpecLeft -> mysound.band_imm
         td_mysounddata mysound;
         
         // stuff for displaying text to user:
@@ -575,12 +619,30 @@ public:
         int m_nHighestBlurTexUsedThisFrame;
         IDirect3DTexture9 *m_lpDDSTitle;    // CAREFUL: MIGHT BE NULL (if not enough mem)!
         int               m_nTitleTexSizeX, m_nTitleTexSizeY;
-        MYVERTEX          *m_verts;
+        td_meshsoa        m_mesh;
+        MYVERTEX          *m_verts;         // m_mesh, packed - only for the DrawPrimitiveUP fallbacks
         MYVERTEX          *m_verts_temp;
-        td_vertinfo       *m_vertinfo;
         int               *m_indices_strip;
         int               *m_indices_list;
 
+        // GPU-resident warp mesh (see AllocateWarpBuffers()); if these are NULL,
+        //  the WarpedBlit functions fall back to un-indexed DrawPrimitiveUP.
+        IDirect3DVertexBuffer9 *m_lpWarpVB;     // dynamic; the grid verts, rewritten every pass
+        IDirect3DIndexBuffer9  *m_lpWarpIB;     // static; m_indices_list w/ the angle seam remapped
+        IDirect3DIndexBuffer9  *m_lpWarpCullIB; // dynamic; the culled subset of m_lpWarpIB, when blending
+        WORD              *m_warp_indices;      // system-memory copy of m_lpWarpIB (for culling)
+        int               m_nWarpVerts;         // (m_nGridX+1)*(m_nGridY+1) + m_nGridX/2 seam duplicates
+        int               m_nWarpVBSize, m_nWarpVBPos;        // in vertices
+        int               m_nWarpCullIBSize, m_nWarpCullIBPos; // in indices
+
+        // worker threads for ComputeGridAlphaValues() (index 0, the render thread, has none)
+        int               m_nWarpThreads;
+        HANDLE            m_hWarpThread[MAX_WARP_THREADS];
+        HANDLE            m_hWarpStart[MAX_WARP_THREADS];
+        HANDLE            m_hWarpDone[MAX_WARP_THREADS];
+        volatile bool     m_bWarpThreadsQuit;
+        td_warpjob        m_warpJob;
+
         // for final composite grid:
         #define FCGSX 32 // final composite gridsize - # verts - should be EVEN.  
         #define FCGSY 24 // final composite gridsize - # verts - should be EVEN.  
@@ -641,6 +703,7 @@ public:
 	    void		LoadRandomPreset(float fBlendTime);
 	    void		LoadPreset(const wchar_t *szPresetFilename, float fBlendTime);
         void        LoadPresetTick();
+        void        DumpCodeProfile();
         void        FindValidPresetDir();
 	    //char*		GetConfigIniFile() { return m_szConfigIniFile; };
 	    wchar_t*	GetMsgIniFile()    { return m_szMsgIniFile; };
@@ -670,6 +733,18 @@ public:
         void        DrawCustomShapes() const;
 	    void		DrawSprites() const;
         void        ComputeGridAlphaValues();
+        void        ComputeGridRows(int nThread);
+        void        StartWarpThreads();
+        void        StopWarpThreads();
+        static unsigned __stdcall WarpThreadProc(void *param);
+        bool        AllocateMesh();
+        void        CleanUpMesh();
+        bool        ResizeMesh(int nGridX);
+        void        UpdateMeshSize();
+        bool        AllocateWarpBuffers();
+        void        CleanUpWarpBuffers();
+        void        PackWarpVerts(MYVERTEX* dst, bool bFlipY, DWORD rgb, bool bSeam) const;
+        bool        DrawWarpMesh(bool bNoShaders, D3DCOLOR cDecay, bool bCullTiles, bool bFlipCulling);
         //void        WarpedBlit();
                      // note: 'bFlipAlpha' just flips the alpha blending in fixed-fn pipeline - not the values for culling tiles.
 	    void		 WarpedBlit_Shaders  (int nPass, bool bAlphaBlend, bool bFlipAlpha, bool bCullTiles, bool bFlipCulling);
@@ -687,6 +762,8 @@ public:
 	    bool		LaunchSprite(int nSpriteNum, int nSlot);
 	    void		KillSprite(int iSlot);
         void        DoCustomSoundAnalysis();
+        bool        IsBeatSynced() const;
+        void        SmoothBandLevel(float imm, float &avg, float &long_avg, float &imm_rel, float &avg_rel);
         void        DrawMotionVectors() const;
         
         bool        LoadShaders(PShaderSet* sh, CState* pState, bool bTick);
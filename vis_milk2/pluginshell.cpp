@@ -111,10 +111,10 @@ OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
             to keep the taskbar from popping up [potentially overtop of
             the plugin] when you click on something besides the plugin.
             To get around this, use true fullscreen mode.
-        -kiv: max_fps implementation assumptions:
+        -kiv: max_fps implementation assumptions (see framepacer.cpp):
             -that most computers support high-precision timer
-            -that no computers [regularly] sleep for more than 1-2 ms
-                when you call Sleep(1) after timeBeginPeriod(1).
+            -that waitable timers wake up within a few ms (on Windows
+                older than 10 1803, only after timeBeginPeriod(1)).
         -reminder: if vms_desktop.dll's interface needs changed,
             it will have to be renamed!  (version # upgrades are ok
             as long as it won't break on an old version; if the
@@ -137,6 +137,7 @@ OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "api.h"
 #include "pluginshell.h"
 #include "utility.h"
+#include "zoneprof.h"
 #include "defines.h"
 #include "shell_defines.h"
 #include "resource.h"
@@ -206,6 +207,16 @@ float CPluginShell::GetFps() const
 	return m_fps;
 };
 
+bool CPluginShell::GetFramePercentiles(int stat, float window_secs, td_frame_percentiles *p) const
+{
+	return m_frame_stats.GetPercentiles(stat, window_secs, p);
+};
+
+float CPluginShell::GetFrameBudget() const
+{
+	return m_pacer.GetPeriod();
+};
+
 HWND CPluginShell::GetPluginWindow() const
 {
 	if (m_lpDX) return m_lpDX->GetHwnd(); else return NULL;
@@ -301,10 +312,47 @@ char* CPluginShell::GetDriverDescription() const
 	if (m_lpDX) return m_lpDX->GetDesc(); else return NULL;
 };
 
+int CPluginShell::GetFFTWindowLen() const
+{
+	// every frame brings 576 new samples; with overlap, older ones make up the rest of the window
+	return min(576*100/(100 - m_fft_overlap), m_fft_size);
+}
+
+float CPluginShell::GetFFTGain(const FFT &fft) const
+{
+	// longer or different windows put more energy into each bin; scale so that the
+	// (mostly noise-like) music spectrum keeps the levels of the original 576-sample
+	// raised cosine window (whose squares add up to 576*3/8), which the band averages
+	// in AnalyzeWaveform were calibrated with.
+	if (m_fft_window == FFT_WINDOW_HANN && GetFFTWindowLen() == 576)
+		return 1.0f;
+	return sqrtf(216.0f / fft.GetWindowEnergy());
+}
+
 int CPluginShell::InitNondx9Stuff()
 {
 	//timeBeginPeriod(1);
-	m_fftobj.Init(576, NUM_FREQUENCIES);
+	int len = GetFFTWindowLen();
+	m_fftobj.Init(len, m_fft_size/2, 1, 1.0f, m_fft_window);
+	m_fft_gain = GetFFTGain(m_fftobj);
+	m_recent_len = max(len, 576);
+	m_fft_in = new float[len];
+	m_pcm.Init(65536);	// ~1.5 s
+	m_pcm.SetRate(m_stream_rate);
+	m_pacer.Init();
+	m_stream_pos = 0;
+	m_stream_t0 = -1;
+	m_hop_time = 0;
+	m_hop_rate = m_stream_rate/576.0f;
+	m_sound.nFrequencies = m_fft_size/2;
+	m_beattracker.Init(m_sound.nFrequencies, 22050.0f*(m_sound.nFrequencies-1)/m_sound.nFrequencies);
+	for (int ch=0; ch<2; ch++)
+	{
+		m_recent[ch] = new float[m_recent_len];
+		memset(m_recent[ch], 0, sizeof(float)*m_recent_len);
+		m_sound.fSpectrum[ch] = new float[m_sound.nFrequencies];
+		memset(m_sound.fSpectrum[ch], 0, sizeof(float)*m_sound.nFrequencies);
+	}
 	if (!InitGDIStuff()) return false;
 	return AllocateMyNonDx9Stuff();
 }
@@ -315,6 +363,17 @@ void CPluginShell::CleanUpNondx9Stuff()
 	CleanUpMyNonDx9Stuff();
 	CleanUpGDIStuff();
 	m_fftobj.CleanUp();
+	m_beattracker.CleanUp();
+	m_pcm.CleanUp();
+	m_pacer.CleanUp();
+	for (int ch=0; ch<2; ch++)
+	{
+		SafeDeleteArray(m_recent[ch]);
+		SafeDeleteArray(m_sound.fSpectrum[ch]);
+	}
+	SafeDeleteArray(m_fft_in);
+	m_recent_len = 0;
+	m_sound.nFrequencies = 0;
 }
 
 int CPluginShell::InitGDIStuff()
@@ -973,6 +1032,7 @@ void CPluginShell::ToggleDesktop()
 			SuggestHowToFreeSomeMem();
 		return;
 	}
+	UpdateFramePacerDisplay();
 
 	if (!AllocateDX9Stuff())
 	{
@@ -1024,6 +1084,7 @@ void CPluginShell::ToggleFullScreen()
 			SuggestHowToFreeSomeMem();
 		return;
 	}
+	UpdateFramePacerDisplay();
 
 	if (!AllocateDX9Stuff())
 	{
@@ -1087,6 +1148,7 @@ int CPluginShell::InitDirectX()
 		m_lpDX = NULL;
 		return FALSE;
 	}
+	UpdateFramePacerDisplay();
 
 	return TRUE;
 }
@@ -1131,6 +1193,12 @@ int CPluginShell::PluginPreInitialize(HWND hWinampWnd, HINSTANCE hWinampInstance
 	m_skin                  = 1;
 #endif
 	m_fix_slow_text         = 0;
+	m_fft_size              = NUM_FREQUENCIES*2;
+	m_fft_window            = FFT_WINDOW_HANN;
+	m_fft_overlap           = 0;
+	m_frame_pacing          = FRAME_PACING_AUTO;
+	m_show_frame_stats      = 0;
+	m_frame_stats_dump      = 0;
 
 	// initialize font settings:
 	wcscpy(m_fontinfo[SIMPLE_FONT    ].szFace,        SIMPLE_FONT_DEFAULT_FACE);
@@ -1221,6 +1289,12 @@ int CPluginShell::PluginPreInitialize(HWND hWinampWnd, HINSTANCE hWinampInstance
 	m_d3dx_desktop_font = NULL;
 	m_lpDDSText = NULL;
 	memset(&m_sound, 0, sizeof(td_soundinfo));
+	m_recent[0] = m_recent[1] = NULL;
+	m_recent_len = 0;
+	m_fft_in = NULL;
+	m_fft_gain = 1.0f;
+	m_stream_rate = 44100;
+	m_stream_pos = 0;
 
 	for (int ch=0; ch<2; ch++)
 		for (int i=0; i<3; i++)
@@ -1367,21 +1441,18 @@ int CPluginShell::PluginPreInitialize(HWND hWinampWnd, HINSTANCE hWinampInstance
 	m_last_raw_time = 0;
 	memset(m_time_hist, 0, sizeof(m_time_hist));
 	m_time_hist_pos = 0;
+	m_frame_start.QuadPart = 0;
+	m_frame_present_ms = 0;
 #ifndef OLD_WINDOWS_SUPPORT
 	QueryPerformanceFrequency(&m_high_perf_timer_freq);
 #else
 	if (!QueryPerformanceFrequency(&m_high_perf_timer_freq))
 		m_high_perf_timer_freq.QuadPart = 0;
 #endif
-	m_prev_end_of_frame.QuadPart = 0;
 
 	// PRIVATE AUDIO PROCESSING DATA
 	//(m_fftobj needs no init)
-	memset(m_oldwave[0], 0, sizeof(float)*576);
-	memset(m_oldwave[1], 0, sizeof(float)*576);
-	m_prev_align_offset[0] = 0;
-	m_prev_align_offset[1] = 0;
-	m_align_weights_ready = 0;
+	InitAlignWaves();
 
 	// SEPARATE TEXT WINDOW (FOR VJ MODE)
 	m_vj_mode       = 0;
@@ -1438,6 +1509,12 @@ int CPluginShell::PluginInitialize()
 
 void CPluginShell::PluginQuit()
 {
+	if (m_frame_stats_dump)
+		DumpFrameStats();
+#ifdef ZONE_PROFILER
+	DumpZoneProfile();
+#endif
+
 	CleanUpVJStuff();
 	CleanUpDX9Stuff(1);
 	CleanUpNondx9Stuff();
@@ -1542,6 +1619,23 @@ void CPluginShell::ReadConfig()
 	m_skin                 = GetPrivateProfileIntW(L"settings",L"skin",m_skin,m_szConfigIniFile);
 #endif
 	m_fix_slow_text        = GetPrivateProfileIntW(L"settings",L"fix_slow_text",m_fix_slow_text,m_szConfigIniFile);
+	m_fft_size             = GetPrivateProfileIntW(L"settings",L"fft_size",m_fft_size,m_szConfigIniFile);
+	m_fft_window           = GetPrivateProfileIntW(L"settings",L"fft_window",m_fft_window,m_szConfigIniFile);
+	m_fft_overlap          = GetPrivateProfileIntW(L"settings",L"fft_overlap",m_fft_overlap,m_szConfigIniFile);
+	m_frame_pacing         = GetPrivateProfileIntW(L"settings",L"frame_pacing",m_frame_pacing,m_szConfigIniFile);
+	m_show_frame_stats     = GetPrivateProfileIntW(L"settings",L"show_frame_stats",m_show_frame_stats,m_szConfigIniFile);
+	m_frame_stats_dump     = GetPrivateProfileIntW(L"settings",L"frame_stats_dump",m_frame_stats_dump,m_szConfigIniFile);
+	{
+		int size = 256;
+		while (size < 8192 && size*2 <= m_fft_size)
+			size *= 2;
+		m_fft_size = size;
+	}
+	if (m_fft_window < FFT_WINDOW_HANN || m_fft_window > FFT_WINDOW_KAISER)
+		m_fft_window = FFT_WINDOW_HANN;
+	m_fft_overlap = max(0, min(90, m_fft_overlap));
+	if (m_frame_pacing < FRAME_PACING_AUTO || m_frame_pacing > FRAME_PACING_HYBRID)
+		m_frame_pacing = FRAME_PACING_AUTO;
 	m_vj_mode              = GetPrivateProfileBoolW(L"settings",L"vj_mode",m_vj_mode,m_szConfigIniFile);
 
 	//D3DDISPLAYMODE m_fs_disp_mode
@@ -1707,6 +1801,12 @@ void CPluginShell::WriteConfig()
 	WritePrivateProfileIntW(m_skin,1,L"skin",m_szConfigIniFile,L"settings");
 #endif
 	WritePrivateProfileIntW(m_fix_slow_text,0,L"fix_slow_text",m_szConfigIniFile,L"settings");
+	WritePrivateProfileIntW(m_fft_size,NUM_FREQUENCIES*2,L"fft_size",m_szConfigIniFile,L"settings");
+	WritePrivateProfileIntW(m_fft_window,FFT_WINDOW_HANN,L"fft_window",m_szConfigIniFile,L"settings");
+	WritePrivateProfileIntW(m_fft_overlap,0,L"fft_overlap",m_szConfigIniFile,L"settings");
+	WritePrivateProfileIntW(m_frame_pacing,FRAME_PACING_AUTO,L"frame_pacing",m_szConfigIniFile,L"settings");
+	WritePrivateProfileIntW(m_show_frame_stats,0,L"show_frame_stats",m_szConfigIniFile,L"settings");
+	WritePrivateProfileIntW(m_frame_stats_dump,0,L"frame_stats_dump",m_szConfigIniFile,L"settings");
 	WritePrivateProfileIntW(m_vj_mode,0,L"vj_mode",m_szConfigIniFile,L"settings");
 
 	//D3DDISPLAYMODE m_fs_disp_mode
@@ -1726,7 +1826,7 @@ void CPluginShell::WriteConfig()
 //----------------------------------------------------------------------
 //----------------------------------------------------------------------
 
-int CPluginShell::PluginRender(unsigned char *pWaveL, unsigned char *pWaveR)//, unsigned char *pSpecL, unsigned char *pSpecR)
+int CPluginShell::PluginRender()
 {
 	// return FALSE here to tell Winamp to terminate the plugin
 
@@ -1748,6 +1848,7 @@ int CPluginShell::PluginRender(unsigned char *pWaveL, unsigned char *pWaveR)//,
 	    (m_screenmode==WINDOWED   && m_resizing)
 	   )
 	{
+		m_frame_start.QuadPart = 0;     // don't count the time away as one slow frame
 		Sleep(10);
 		return true;
 	}
@@ -1774,6 +1875,7 @@ int CPluginShell::PluginRender(unsigned char *pWaveL, unsigned char *pWaveR)//,
 	else if (hr != D3D_OK)
 	{
 		// device is lost, and not yet ready to come back; sleep.
+		m_frame_start.QuadPart = 0;     // don't count the time away as one slow frame
 		Sleep(10);
 		return true;
 	}
@@ -1810,13 +1912,23 @@ int CPluginShell::PluginRender(unsigned char *pWaveL, unsigned char *pWaveR)//,
 	}
 #endif
 
+	PROFILE_FRAME_BEGIN();
+	RecordFrameStart();
 	DoTime();
-	AnalyzeNewSound(pWaveL, pWaveR);
-	AlignWaves();
+	{
+		PROFILE_ZONE("AnalyzeSound");
+		AnalyzeAudioStream();
+		AlignWaves();
+	}
 
 	DrawAndDisplay(0);
+	RecordFramePresented();
 
-	EnforceMaxFPS();
+	{
+		PROFILE_ZONE("EnforceMaxFPS");
+		EnforceMaxFPS();
+	}
+	PROFILE_FRAME_END();
 
 	++m_frame;
 
@@ -1919,7 +2031,10 @@ void CPluginShell::DrawAndDisplay(int redraw)
 
 	if (D3D_OK==m_lpDX->m_lpDevice->BeginScene())
 	{
-		MyRenderFn(redraw);
+		{
+			PROFILE_ZONE("RenderFrame");
+			MyRenderFn(redraw);
+		}
 
 		PrepareFor2DDrawing_B(GetDevice(), GetWidth(), GetHeight());
 #ifdef LEGACY_DESKTOP_MODE
@@ -1965,6 +2080,7 @@ void CPluginShell::DrawAndDisplay(int redraw)
 	}
 #endif
 
+	PROFILE_ZONE("Present");
 	if (m_screenmode == WINDOWED && (m_lpDX->m_client_width != m_lpDX->m_REAL_client_width || m_lpDX->m_client_height != m_lpDX->m_REAL_client_height))
 	{
 		int real_w = m_lpDX->m_REAL_client_width;   // real client size, in pixels
@@ -1996,108 +2112,84 @@ void CPluginShell::EnforceMaxFPS()
 		case DESKTOP:         max_fps = m_max_fps_dm; break;
 	}
 
-	if (max_fps <= 0)
-		return;
-
-	float fps_lo = (float)max_fps;
-	float fps_hi = (float)max_fps;
-
-	if (m_save_cpu)
-	{
-		// Find the optimal lo/hi bounds for the fps
-		// that will result in a maximum difference,
-		// in the time for a single frame, of 0.003 seconds -
-		// the assumed granularity for Sleep(1) -
-
-		// Using this range of acceptable fps
-		// will allow us to do (sloppy) fps limiting
-		// using only Sleep(1), and never the
-		// second half of it: Sleep(0) in a tight loop,
-		// which sucks up the CPU (whereas Sleep(1)
-		// leaves it idle).
+	// 'save cpu' never spins: it just sleeps on the high-resolution timer,
+	// accepting that it wakes up a little late.
+	int strategy = m_frame_pacing;
+	if (strategy == FRAME_PACING_AUTO)
+		strategy = m_save_cpu ? FRAME_PACING_TIMER : FRAME_PACING_HYBRID;
 
-		// The original equation:
-		//   1/(max_fps*t1) = 1/(max*fps/t1) - 0.003
-		// where:
-		//   t1 > 0
-		//   max_fps*t1 is the upper range for fps
-		//   max_fps/t1 is the lower range for fps
-
-		float a = 1;
-		float b = -0.003f * max_fps;
-		float c = -1.0f;
-		float det = b*b - 4*a*c;
-		if (det>0)
-		{
-			float t1 = (-b + sqrtf(det)) / (2*a);
-			//float t2 = (-b - sqrtf(det)) / (2*a);
+	m_pacer.Wait((float)max_fps, strategy);
+}
 
-			if (t1 > 1.0f)
-			{
-				fps_lo = max_fps / t1;
-				fps_hi = max_fps * t1;
-				// verify: now [1.0f/fps_lo - 1.0f/fps_hi] should equal 0.003 seconds.
-				// note: allowing tolerance to go beyond these values for
-				// fps_lo and fps_hi would gain nothing.
-			}
-		}
-	}
+void CPluginShell::UpdateFramePacerDisplay()
+{
+	// tell the frame pacer the refresh rate & present interval of the device we just (re)started
+	float refresh_hz = 0;
+	D3DDISPLAYMODE mode;
+	if (m_lpDX->m_lpDevice && SUCCEEDED(m_lpDX->m_lpDevice->GetDisplayMode(0, &mode)))
+		refresh_hz = (float)mode.RefreshRate;
+	m_pacer.SetDisplay(refresh_hz, m_lpDX->m_d3dpp.PresentationInterval != D3DPRESENT_INTERVAL_IMMEDIATE);
+	m_pacer.Reset();
+}
 
-	if (m_high_perf_timer_freq.QuadPart > 0)
+void CPluginShell::RecordFrameStart()
+{
+	// a frame's total time is only known at the start of the next one
+	if (m_high_perf_timer_freq.QuadPart <= 0)
+		return;
+	LARGE_INTEGER t;
+	QueryPerformanceCounter(&t);
+	if (m_frame_start.QuadPart != 0)
 	{
-		LARGE_INTEGER t;
-		QueryPerformanceCounter(&t);
-
-		if (m_prev_end_of_frame.QuadPart != 0)
-		{
-			int ticks_to_wait_lo = (int)((float)m_high_perf_timer_freq.QuadPart / (float)fps_hi);
-			int ticks_to_wait_hi = (int)((float)m_high_perf_timer_freq.QuadPart / (float)fps_lo);
-			int done = 0;
-			do
-			{
-				QueryPerformanceCounter(&t);
-
-				__int64 t2 = t.QuadPart - m_prev_end_of_frame.QuadPart;
-				if (t2 > 2147483000)
-					done = 1;
-				if (t.QuadPart < m_prev_end_of_frame.QuadPart)    // time wrap
-					done = 1;
+		const double freq = (double)m_high_perf_timer_freq.QuadPart;
+		float total_ms = (float)((t.QuadPart - m_frame_start.QuadPart)*1000.0/freq);
+		m_frame_stats.AddFrame(t.QuadPart/freq, total_ms, m_frame_present_ms, m_pacer.GetPeriod()*1000.0f);
+	}
+	m_frame_start = t;
+}
 
-				// this is sloppy - if your freq. is high, this can overflow (to a (-) int) in just a few minutes
-				// but it's ok, we have protection for that above.
-				const int ticks_passed = (int)(t.QuadPart - m_prev_end_of_frame.QuadPart);
-				if (ticks_passed >= ticks_to_wait_lo)
-					done = 1;
+void CPluginShell::RecordFramePresented()
+{
+	if (m_high_perf_timer_freq.QuadPart <= 0 || m_frame_start.QuadPart == 0)
+		return;
+	LARGE_INTEGER t;
+	QueryPerformanceCounter(&t);
+	m_frame_present_ms = (float)((t.QuadPart - m_frame_start.QuadPart)*1000.0/(double)m_high_perf_timer_freq.QuadPart);
+}
 
-				if (!done)
-				{
-					// if > 0.01s left, do Sleep(1), which will actually sleep some
-					//   steady amount of up to 3 ms (depending on the OS),
-					//   and do so in a nice way (cpu meter drops; laptop battery spared).
-					// otherwise, do a few Sleep(0)'s, which just give up the timeslice,
-					//   but don't really save cpu or battery, but do pass a tiny
-					//   amount of time.
-
-					//if (ticks_left > (int)m_high_perf_timer_freq.QuadPart/500)
-					if (ticks_to_wait_hi - ticks_passed > (int)m_high_perf_timer_freq.QuadPart/100)
-						Sleep(5);
-					else if (ticks_to_wait_hi - ticks_passed > (int)m_high_perf_timer_freq.QuadPart/1000)
-						Sleep(1);
-					else
-						for (int i=0; i<10; i++)
-							Sleep(0);  // causes thread to give up its timeslice
-				}
-			}
-			while (!done);
-		}
+void CPluginShell::DumpFrameStats()
+{
+	// next to the .ini, like milkdrop2_profile.txt
+	wchar_t szFile[MAX_PATH] = {0};
+	wcsncpy(szFile, GetConfigIniFile(), ARRAYSIZE(szFile));
+	wchar_t* p = wcsrchr(szFile, L'\\');
+	if (p) *(p+1) = 0;
+	size_t len = wcslen(szFile);
+
+	wcsncat(szFile, L"milkdrop2_frame_stats.csv", ARRAYSIZE(szFile) - len - 1);
+	m_frame_stats.WriteCSV(szFile);
+	szFile[len] = 0;
+	wcsncat(szFile, L"milkdrop2_frame_stats.json", ARRAYSIZE(szFile) - len - 1);
+	m_frame_stats.WriteJSON(szFile);
+}
 
-		m_prev_end_of_frame = t;
-	}
-	else
-	{
-		Sleep(1000/max_fps);
-	}
+#ifdef ZONE_PROFILER
+void CPluginShell::DumpZoneProfile()
+{
+	// next to the .ini, like the frame stats
+	wchar_t szFile[MAX_PATH] = {0};
+	wcsncpy(szFile, GetConfigIniFile(), ARRAYSIZE(szFile));
+	wchar_t* p = wcsrchr(szFile, L'\\');
+	if (p) *(p+1) = 0;
+	size_t len = wcslen(szFile);
+
+	wcsncat(szFile, L"milkdrop2_trace.json", ARRAYSIZE(szFile) - len - 1);
+	g_zoneprof.WriteTrace(szFile);
+	szFile[len] = 0;
+	wcsncat(szFile, L"milkdrop2_zones.csv", ARRAYSIZE(szFile) - len - 1);
+	g_zoneprof.WriteByLabel(szFile);
 }
+#endif
 
 void CPluginShell::DoTime()
 {
@@ -2213,9 +2305,77 @@ void CPluginShell::DoTime()
 		mod1.latencyMs = (int)(1000.0f/m_fps*m_lpDX->m_frame_delay + 0.5f);
 }
 
-void CPluginShell::AnalyzeNewSound(unsigned char *pWaveL, unsigned char *pWaveR)
+void CPluginShell::PluginSetAudioStreamRate(int sample_rate)
+{
+	if (sample_rate > 0)
+	{
+		m_stream_rate = sample_rate;
+		m_pcm.SetRate(sample_rate);
+	}
+}
+
+int CPluginShell::PushAudio(const float *pLeft, const float *pRight, int frames, double time)
+{
+	// (producer side of m_pcm: can be called from any one thread)
+	return m_pcm.Write(pLeft, pRight, frames, time);
+}
+
+void CPluginShell::AnalyzeAudioStream()
 {
-	// we get 576 samples in from winamp.
+	// analyse every 576-sample hop pushed since the last frame, each at the time it plays
+	//   (from the PushAudio timestamps, or else its position in the stream), so the results
+	//   don't depend on the frame rate.  if rendering stalled for long, only the most recent
+	//   audio is worth catching up on.
+	const int max_hops = 32;
+	int hops = m_pcm.GetReadable() / 576;
+	if (hops > max_hops)
+	{
+		m_pcm.Skip((hops - max_hops)*576);
+		m_stream_pos += (hops - max_hops)*576;
+		hops = max_hops;
+	}
+
+	float beat = 0;
+	for (int h=0; h<hops; h++)
+	{
+		double t;
+		m_pcm.Read(m_sound.fWaveform[0], m_sound.fWaveform[1], 576, &t);
+		for (int i=0; i<576; i++)
+		{
+			// same scale as the 8-bit samples from winamp
+			m_sound.fWaveform[0][i] *= 128.0f;
+			m_sound.fWaveform[1][i] *= 128.0f;
+		}
+		if (t < 0)
+			t = (double)m_stream_pos/m_stream_rate;
+		t += 576.0/m_stream_rate;	// AnalyzeWaveform wants the end of the hop
+		m_stream_pos += 576;
+
+		// relative to the first hop, so it keeps its precision as a float.  the hop rate
+		//   follows the clock the host times the hops with (winamp's, for instance, runs
+		//   at whatever rate render1 gets called), smoothed over the jitter.
+		if (m_stream_t0 < 0)
+			m_stream_t0 = t;
+		t -= m_stream_t0;
+		if (t > m_hop_time)
+		{
+			float rate = (float)(1.0/(t - m_hop_time));
+			rate = max(m_stream_rate/576.0f*0.1f, min(m_stream_rate/576.0f*10.0f, rate));
+			m_hop_rate = m_hop_rate*0.9f + rate*0.1f;
+		}
+		m_hop_time = t;
+
+		AnalyzeWaveform((float)t, m_hop_rate);
+		if (m_sound.beat > beat)
+			beat = m_sound.beat;
+	}
+	m_sound.beat = beat;   // a beat in any of them is a beat this frame
+}
+
+void CPluginShell::AnalyzeWaveform(float time, float rate)
+{
+	// analyses the 576 new samples in m_sound.fWaveform[], which end at 'time';
+	//   this gets called about 'rate' times per second.
 	// the output of the fft has 'num_frequencies' samples,
 	//   and represents the frequency range 0 hz - 22,050 hz.
 	// usually, plugins only use half of this output (the range 0 hz - 11,025 hz),
@@ -2224,27 +2384,32 @@ void CPluginShell::AnalyzeNewSound(unsigned char *pWaveL, unsigned char *pWaveR)
 	int i;
 
     float imm[2][3] = {0};    // bass, mids, treble, no damping, for each channel (long-term average is 1)
-	float temp_wave[2][576] = {0};
 
-	int old_i = 0;
-	for (i=0; i<576; i++)
-	{
-		m_sound.fWaveform[0][i] = (float)((pWaveL[i] ^ 128) - 128);
-		m_sound.fWaveform[1][i] = (float)((pWaveR[i] ^ 128) - 128);
+	if (!m_fft_in)
+		return;
 
-		// simulating single frequencies from 200 to 11,025 Hz:
-		//float freq = 1.0f + 11050*(GetFrame() % 100)*0.01f;
-		//m_sound.fWaveform[0][i] = 10*sinf(i*freq*6.28f/44100.0f);
+	// keep the last m_recent_len samples, for analysis windows longer than a frame
+	const int len = GetFFTWindowLen();
+	const int nFreq = m_sound.nFrequencies;
+	const float damp = 0.5f*m_fft_gain;
+	for (int ch=0; ch<2; ch++)
+	{
+		float *recent = m_recent[ch];
+		if (m_recent_len > 576)
+			memmove(recent, recent + 576, sizeof(float)*(m_recent_len - 576));
+		memcpy(recent + m_recent_len - 576, m_sound.fWaveform[ch], sizeof(float)*576);
 
 		// damp the input into the FFT a bit, to reduce high-frequency noise:
-		temp_wave[0][i] = 0.5f*(m_sound.fWaveform[0][i] + m_sound.fWaveform[0][old_i]);
-		temp_wave[1][i] = 0.5f*(m_sound.fWaveform[1][i] + m_sound.fWaveform[1][old_i]);
-		old_i = i;
+		const float *w = GetRecentSamples(ch);
+		int old_i = 0;
+		for (i=0; i<len; i++)
+		{
+			m_fft_in[i] = damp*(w[i] + w[old_i]);
+			old_i = i;
+		}
+		m_fftobj.time_to_frequency_domain(m_fft_in, m_sound.fSpectrum[ch]);
 	}
 
-	m_fftobj.time_to_frequency_domain(temp_wave[0], m_sound.fSpectrum[0]);
-	m_fftobj.time_to_frequency_domain(temp_wave[1], m_sound.fSpectrum[1]);
-
 	// sum (left channel) spectrum up into 3 bands
 	// [note: the new ranges do it so that the 3 bands are equally spaced, pitch-wise]
 	float min_freq = 200.0f;
@@ -2266,10 +2431,10 @@ void CPluginShell::AnalyzeNewSound(unsigned char *pWaveL, unsigned char *pWaveR)
 			//   bass:  0-1097          200-761
 			//   mids:  1097-4705       761-2897
 			//   treb:  4705-11025      2897-11025
-			int start = (int)(NUM_FREQUENCIES * min_freq*powf(mult, (float)i)/11025.0f);
-			int end   = (int)(NUM_FREQUENCIES * min_freq*powf(mult, (float)(i+1))/11025.0f);
+			int start = (int)(nFreq * min_freq*powf(mult, (float)i)/11025.0f);
+			int end   = (int)(nFreq * min_freq*powf(mult, (float)(i+1))/11025.0f);
 			if (start < 0) start = 0;
-			if (end > NUM_FREQUENCIES) end = NUM_FREQUENCIES;
+			if (end > nFreq) end = nFreq;
 
 			for (int j=start; j<end; j++)
 				imm[ch][i] += m_sound.fSpectrum[ch][j];
@@ -2340,9 +2505,9 @@ void CPluginShell::AnalyzeNewSound(unsigned char *pWaveL, unsigned char *pWaveR)
 			{
 				float avg_mix;
 				if (imm[ch][i] > m_sound.avg[ch][i])
-					avg_mix = AdjustRateToFPS(0.2f, 14.0f, m_fps);
+					avg_mix = AdjustRateToFPS(0.2f, 14.0f, rate);
 				else
-					avg_mix = AdjustRateToFPS(0.5f, 14.0f, m_fps);
+					avg_mix = AdjustRateToFPS(0.5f, 14.0f, rate);
 				m_sound.avg[ch][i] = m_sound.avg[ch][i]*avg_mix + imm[ch][i]*(1-avg_mix);
 			}
 
@@ -2351,13 +2516,20 @@ void CPluginShell::AnalyzeNewSound(unsigned char *pWaveL, unsigned char *pWaveR)
 			{
 				//float med_mix  = 0.91f;//0.800f + 0.11f*powf(t, 0.4f);    // primarily used for velocity_damping
 				//float long_mix = 0.96f;//0.800f + 0.16f*powf(t, 0.2f);    // primarily used for smoke plumes
-				const float med_mix  = AdjustRateToFPS(0.91f, 14.0f, m_fps),
-							long_mix = AdjustRateToFPS(0.96f, 14.0f, m_fps);
+				const float med_mix  = AdjustRateToFPS(0.91f, 14.0f, rate),
+							long_mix = AdjustRateToFPS(0.96f, 14.0f, rate);
 				m_sound.med_avg[ch][i]  =  m_sound.med_avg[ch][i]*(med_mix) + imm[ch][i]*(1-med_mix);
 				m_sound.long_avg[ch][i] = m_sound.long_avg[ch][i]*(long_mix) + imm[ch][i]*(1-long_mix);
 			}
 		}
 	}
+
+	// tempo & beats
+	m_beattracker.Update(m_sound.fSpectrum[0], m_sound.fSpectrum[1], time);
+	m_sound.beat            = m_beattracker.GetBeat();
+	m_sound.beat_phase      = m_beattracker.GetBeatPhase();
+	m_sound.bpm             = m_beattracker.GetBpm();
+	m_sound.beat_confidence = m_beattracker.GetConfidence();
 }
 
 void CPluginShell::PrepareFor2DDrawing_B(IDirect3DDevice9 *pDevice, int w, int h)
@@ -2507,6 +2679,9 @@ void CPluginShell::RenderBuiltInTextMsgs()
 			m_upper_left_corner_y += r.bottom-r.top + PLAYLIST_INNER_MARGIN*3;
 		}
 
+		if (m_show_frame_stats)
+			RenderFrameStats();
+
 		// render 'Press F1 for Help' message in lower-right corner:
 		if (_show_press_f1_NOW)
 		{
@@ -2520,6 +2695,42 @@ void CPluginShell::RenderBuiltInTextMsgs()
 	}
 }
 
+void CPluginShell::RenderFrameStats()
+{
+	// frame time percentiles (in ms) over the last 10 seconds, in a box in the upper-left corner
+	if (!m_d3dx_font[SIMPLE_FONT])
+		return;
+
+	static const wchar_t* names[NUM_FRAME_STATS] = { L"frame", L"present", L"over" };
+	wchar_t buf[512] = L"10 s\tp50\tp95\tp99\tmax";
+	for (int stat=0; stat<NUM_FRAME_STATS; stat++)
+	{
+		td_frame_percentiles p;
+		if (!m_frame_stats.GetPercentiles(stat, 10.0f, &p))
+			continue;
+		size_t len = wcslen(buf);
+		_snwprintf(buf + len, ARRAYSIZE(buf) - len, L"\n%s\t%.1f\t%.1f\t%.1f\t%.1f", names[stat], p.p50, p.p95, p.p99, p.max);
+	}
+
+	RECT r = { 0 };
+	SetRect(&r, 0, 0, GetWidth(), GetHeight());
+	m_d3dx_font[SIMPLE_FONT]->DrawTextW(NULL, buf, -1, &r, DT_CALCRECT | DT_EXPANDTABS, 0xFFFFFFFF);
+
+	r.top += m_upper_left_corner_y;
+	r.left += m_left_edge;
+	r.right += m_left_edge + PLAYLIST_INNER_MARGIN*2;
+	r.bottom += m_upper_left_corner_y + PLAYLIST_INNER_MARGIN*2;
+	DrawDarkTranslucentBox(&r);
+
+	r.top += PLAYLIST_INNER_MARGIN;
+	r.left += PLAYLIST_INNER_MARGIN;
+	r.right -= PLAYLIST_INNER_MARGIN;
+	r.bottom -= PLAYLIST_INNER_MARGIN;
+	m_d3dx_font[SIMPLE_FONT]->DrawTextW(NULL, buf, -1, &r, DT_EXPANDTABS, 0xFFFFFFFF);
+
+	m_upper_left_corner_y += r.bottom-r.top + PLAYLIST_INNER_MARGIN*3;
+}
+
 void CPluginShell::RenderPlaylist()
 {
 	// draw playlist:
@@ -3640,112 +3851,189 @@ LRESULT CPluginShell::PluginShellDesktopWndProc(HWND hWnd, unsigned uMsg, WPARAM
 }
 #endif
 
-void CPluginShell::AlignWaves()
-{
-	// align waves, using recursive (mipmap-style) least-error matching
-	// note: NUM_WAVEFORM_SAMPLES must be between 32 and 576.
-
-	int align_offset[2] = { 0, 0 };
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE__)
+#include <xmmintrin.h>
+#define ALIGN_SIMD_SSE 1
+#elif defined(_M_ARM64) || defined(__aarch64__)
+#include <arm_neon.h>
+#define ALIGN_SIMD_NEON 1
+#endif
 
-#if (NUM_WAVEFORM_SAMPLES < 576) // [don't let this code bloat our DLL size if it's not going to be used]
+// returns the sum of |a[i]-b[i]|*w[i] for i in [0..count); the weights must be >= 0.
+static float WeightedAbsDiff(const float* a, const float* b, const float* w, int count)
+{
+	float err_sum = 0;
+	int i = 0;
+#if defined(ALIGN_SIMD_SSE)
+	const __m128 zero = _mm_setzero_ps();
+	__m128 sum = zero;
+	for (; i+4<=count; i+=4)
+	{
+		__m128 d = _mm_sub_ps(_mm_loadu_ps(a+i), _mm_loadu_ps(b+i));
+		d = _mm_max_ps(d, _mm_sub_ps(zero, d));
+		sum = _mm_add_ps(sum, _mm_mul_ps(d, _mm_loadu_ps(w+i)));
+	}
+	float lanes[4];
+	_mm_storeu_ps(lanes, sum);
+	err_sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#elif defined(ALIGN_SIMD_NEON)
+	float32x4_t sum = vdupq_n_f32(0);
+	for (; i+4<=count; i+=4)
+		sum = vmlaq_f32(sum, vabdq_f32(vld1q_f32(a+i), vld1q_f32(b+i)), vld1q_f32(w+i));
+	err_sum = vaddvq_f32(sum);
+#endif
+	for (; i<count; i++)
+	{
+		float x = (a[i] - b[i]) * w[i];
+		err_sum += (x > 0) ? x : -x;
+	}
+	return err_sum;
+}
 
+void CPluginShell::InitAlignWaves()
+{
+	// lay out the octaves of the wave pyramid (each one is half the size of the one
+	// before it, all packed into one array) and the weights used to compare them.
+	// note: NUM_WAVEFORM_SAMPLES must be between 32 and 576.
 	const int nSamples = NUM_WAVEFORM_SAMPLES;
 
-#define MAX_OCTAVES 10
+	memset(m_align_pyr_old, 0, sizeof(m_align_pyr_old));
+	memset(m_align_pyr_new, 0, sizeof(m_align_pyr_new));
+	memset(m_align_weight, 0, sizeof(m_align_weight));
 
-	int octaves = (int)floorf(logf((float)(576-nSamples))/logf(2.0f));
+	m_align_octaves = 0;
+	if (nSamples >= ALIGN_WAVE_SAMPLES)
+		return;
+	int octaves = (int)floorf(logf((float)(ALIGN_WAVE_SAMPLES-nSamples))/logf(2.0f));
 	if (octaves < 4)
 		return;
-	if (octaves > MAX_OCTAVES)
-		octaves = MAX_OCTAVES;
+	if (octaves > ALIGN_MAX_OCTAVES)
+		octaves = ALIGN_MAX_OCTAVES;
+	m_align_octaves = octaves;
 
-	for (int ch=0; ch<2; ch++)
+	for (int octave=0; octave<octaves; octave++)
 	{
-		// only worry about matching the lower 'nSamples' samples
-		float temp_new[MAX_OCTAVES][576] = {0};
-		float temp_old[MAX_OCTAVES][576] = {0};
-		static float temp_weight[MAX_OCTAVES][576];
-		static int   first_nonzero_weight[MAX_OCTAVES];
-		static int   last_nonzero_weight[MAX_OCTAVES];
-		int spls[MAX_OCTAVES] = {0};
-		int space[MAX_OCTAVES] = {0};
-
-		memcpy(temp_new[0], m_sound.fWaveform[ch], sizeof(float)*576);
-		memcpy(temp_old[0], &m_oldwave[ch][m_prev_align_offset[ch]], sizeof(float)*nSamples);
-		spls[0] = 576;
-		space[0] = 576 - nSamples;
-
-		// potential optimization: could reuse (instead of recompute) mip levels for m_oldwave[2][]?
-		for (int octave=1; octave<octaves; octave++)
-		{
-			spls[octave] = spls[octave-1]/2;
-			space[octave] = space[octave-1]/2;
-			for (int n=0; n<spls[octave]; n++)
-			{
-				temp_new[octave][n] = 0.5f*(temp_new[octave-1][n*2] + temp_new[octave-1][n*2+1]);
-				temp_old[octave][n] = 0.5f*(temp_old[octave-1][n*2] + temp_old[octave-1][n*2+1]);
-			}
+		td_align_octave* p = &m_align_oct[octave];
+		if (octave == 0)
+		{
+			p->start = 0;
+			p->spls  = ALIGN_WAVE_SAMPLES;
+			p->space = ALIGN_WAVE_SAMPLES - nSamples;
+		}
+		else
+		{
+			p->start = p[-1].start + p[-1].spls;
+			p->spls  = p[-1].spls/2;
+			p->space = p[-1].space/2;
 		}
 
-		if (!m_align_weights_ready)
+		float* weight = &m_align_weight[p->start];
+		int compare_samples = p->spls - p->space;
+		int n = 0;
+		for (; n<compare_samples; n++)
 		{
-			m_align_weights_ready = 1;
-			for (int octave=0; octave<octaves; octave++)
-			{
-				int compare_samples = spls[octave] - space[octave];
-				int n = 0;
-				for (; n<compare_samples; n++)
-				{
-					// start with pyramid-shaped pdf, from 0..1..0
-					if (n < compare_samples/2)
-						temp_weight[octave][n] = n*2/(float)compare_samples;
-					else
-						temp_weight[octave][n] = (compare_samples-1 - n)*2/(float)compare_samples;
+			// start with pyramid-shaped pdf, from 0..1..0
+			if (n < compare_samples/2)
+				weight[n] = n*2/(float)compare_samples;
+			else
+				weight[n] = (compare_samples-1 - n)*2/(float)compare_samples;
 
-					// TWEAK how much the center matters, vs. the edges:
-					temp_weight[octave][n] = (temp_weight[octave][n] - 0.8f)*5.0f + 0.8f;
+			// TWEAK how much the center matters, vs. the edges:
+			weight[n] = (weight[n] - 0.8f)*5.0f + 0.8f;
 
-					// clip:
-					if (temp_weight[octave][n]>1) temp_weight[octave][n] = 1;
-					if (temp_weight[octave][n]<0) temp_weight[octave][n] = 0;
-				}
+			// clip:
+			if (weight[n]>1) weight[n] = 1;
+			if (weight[n]<0) weight[n] = 0;
+		}
 
-				n = 0;
-				while (temp_weight[octave][n] == 0 && n < compare_samples)
-					++n;
-				first_nonzero_weight[octave] = n;
+		n = 0;
+		while (n < compare_samples && weight[n] == 0)
+			++n;
+		p->first_weight = n;
 
-				n = compare_samples-1;
-				while (temp_weight[octave][n] == 0 && n >= 0)
-					--n;
-				last_nonzero_weight[octave] = n;
-			}
+		n = compare_samples-1;
+		while (n >= 0 && weight[n] == 0)
+			--n;
+		p->last_weight = n;
+	}
+}
+
+void CPluginShell::BuildAlignPyramid(float* pyr, const float* wave, int nValid)
+{
+	// octave 0 is the wave itself (zero-padded past 'nValid' samples);
+	// each octave after that averages pairs of samples from the one before it.
+	memcpy(pyr, wave, sizeof(float)*nValid);
+	memset(&pyr[nValid], 0, sizeof(float)*(ALIGN_WAVE_SAMPLES - nValid));
+	for (int octave=1; octave<m_align_octaves; octave++)
+	{
+		const float* src = &pyr[m_align_oct[octave-1].start];
+		float* dest = &pyr[m_align_oct[octave].start];
+		for (int n=0; n<m_align_oct[octave].spls; n++)
+			dest[n] = 0.5f*(src[n*2] + src[n*2+1]);
+	}
+}
+
+void CPluginShell::ShiftAlignPyramid(float* dest, const float* pyr, int offset)
+{
+	// makes 'dest' the pyramid of the wave of 'pyr', scooted back by 'offset' samples,
+	// without going back to the wave: an octave whose samples line up with the offset
+	// is just a shifted copy, the others average the (already shifted) octave before.
+	// only the samples AlignWaves() compares against are filled in.
+	for (int octave=0; octave<m_align_octaves; octave++)
+	{
+		const td_align_octave* p = &m_align_oct[octave];
+		const int count = p->spls - p->space;
+		float* d = &dest[p->start];
+		if ((offset & ((1<<octave)-1)) == 0)
+			memcpy(d, &pyr[p->start + (offset>>octave)], sizeof(float)*count);
+		else
+		{
+			const float* src = &dest[p[-1].start];
+			for (int n=0; n<count; n++)
+				d[n] = 0.5f*(src[n*2] + src[n*2+1]);
 		}
+	}
+}
+
+void CPluginShell::AlignWaves()
+{
+	// align waves, using recursive (mipmap-style) least-error matching.
+	// the pyramid of the previous frame's (already aligned) waves is kept in
+	// m_align_pyr_old; it's carried over from the new waves' pyramid, so only
+	// that one is built here.
+
+	if (m_align_octaves < 4)
+		return;
+
+	const int nSamples = NUM_WAVEFORM_SAMPLES;
+	const int octaves = m_align_octaves;
+	int align_offset[2] = { 0, 0 };
+
+	for (int ch=0; ch<2; ch++)
+	{
+		// only worry about matching the lower 'nSamples' samples
+		BuildAlignPyramid(m_align_pyr_new, m_sound.fWaveform[ch], ALIGN_WAVE_SAMPLES);
 
 		int n1 = 0;
-		int n2 = space[octaves-1];
+		int n2 = m_align_oct[octaves-1].space;
 		for (int octave = octaves-1; octave>=0; octave--)
 		{
 			// for example:
-			//  space[octave] == 4
-			//  spls[octave] == 36
+			//  space == 4
+			//  spls == 36
 			//  (so we test 32 samples, w/4 offsets)
+			const td_align_octave* p = &m_align_oct[octave];
+			const int first = p->first_weight;
+			const int count = p->last_weight - p->first_weight + 1;
+			const float* pnew   = &m_align_pyr_new[p->start + first];
+			const float* pold   = &m_align_pyr_old[ch][p->start + first];
+			const float* weight = &m_align_weight[p->start + first];
 
 			int lowest_err_offset = -1;
 			float lowest_err_amount = 0;
 			for (int n=n1; n<n2; n++)
 			{
-				float err_sum = 0;
-				//for (int i=0; i<compare_samples; i++)
-				for (int i=first_nonzero_weight[octave]; i<=last_nonzero_weight[octave]; i++)
-				{
-					float x = (temp_new[octave][i+n] - temp_old[octave][i]) * temp_weight[octave][i];
-					if (x>0)
-						err_sum += x;
-					else
-						err_sum -= x;
-				}
-
+				float err_sum = WeightedAbsDiff(pnew + n, pold, weight, count);
 				if (lowest_err_offset == -1 || err_sum < lowest_err_amount)
 				{
 					lowest_err_offset = n;
@@ -3754,8 +4042,8 @@ void CPluginShell::AlignWaves()
 			}
 
 			// now use 'lowest_err_offset' to guide bounds of search in next octave:
-			//  space[octave] == 8
-			//  spls[octave] == 72
+			//  space == 8
+			//  spls == 72
 			//     -say 'lowest_err_offset' was 2
 			//     -that corresponds to samples 4 & 5 of the next octave
 			//     -also, expand about this by 2 samples?  YES.
@@ -3765,21 +4053,16 @@ void CPluginShell::AlignWaves()
 				n1 = lowest_err_offset*2  -1;
 				n2 = lowest_err_offset*2+2+1;
 				if (n1 < 0) n1=0;
-				if (n2 > space[octave-1]) n2 = space[octave-1];
+				if (n2 > p[-1].space) n2 = p[-1].space;
 			}
 			else
 				align_offset[ch] = lowest_err_offset;
 		}
-	}
-#endif
-	memcpy(m_oldwave[0], m_sound.fWaveform[0], sizeof(float)*576);
-	memcpy(m_oldwave[1], m_sound.fWaveform[1], sizeof(float)*576);
-	m_prev_align_offset[0] = align_offset[0];
-	m_prev_align_offset[1] = align_offset[1];
 
-	// finally, apply the results: modify m_sound.fWaveform[2][0..576]
-	// by scooting the aligned samples so that they start at m_sound.fWaveform[2][0].
-	for (int ch=0; ch<2; ch++)
+		// finally, apply the results: modify m_sound.fWaveform[ch][0..576]
+		// by scooting the aligned samples so that they start at m_sound.fWaveform[ch][0],
+		// and keep their pyramid around as the reference for the next frame.
+		ShiftAlignPyramid(m_align_pyr_old[ch], m_align_pyr_new, align_offset[ch]);
 		if (align_offset[ch]>0)
 		{
 			for (int i=0; i<nSamples; i++)
@@ -3787,6 +4070,7 @@ void CPluginShell::AlignWaves()
 			// zero the rest out, so it's visually evident that these samples are now bogus:
 			memset(&m_sound.fWaveform[ch][nSamples], 0, (576-nSamples)*sizeof(float));
 		}
+	}
 }
 
 LRESULT CALLBACK CPluginShell::VJModeWndProc(HWND hWnd, unsigned uMsg, WPARAM wParam, LPARAM lParam)
@@ -33,6 +33,9 @@ OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "shell_defines.h"
 #include "dxcontext.h"
 #include "fft.h"
+#include "pcmbuffer.h"
+#include "framepacer.h"
+#include "framestats.h"
 #include "defines.h"
 #include "textmgr.h"
 
@@ -41,6 +44,18 @@ OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #define TIME_HIST_SLOTS 128     // # of slots used if fps > 60.  half this many if fps==30.
 #define MAX_SONGS_PER_PAGE 128
+#define ALIGN_WAVE_SAMPLES 576  // length of the waves AlignWaves() searches within
+#define ALIGN_MAX_OCTAVES 10
+#define ALIGN_PYRAMID_SIZE (ALIGN_WAVE_SAMPLES*2)  // room for every octave of a wave, packed
+
+typedef struct
+{
+    int start;          // index of this octave's first sample within the pyramid
+    int spls;           // # of samples in this octave
+    int space;          // # of offsets to search at this octave
+    int first_weight;   // first & last samples with a nonzero weight
+    int last_weight;
+} td_align_octave;
 
 typedef struct
 {
@@ -59,7 +74,12 @@ typedef struct
     float   med_avg[2][3];         // bass, mids, treble, more damping, for each channel (long-term average is 1)
     float   long_avg[2][3];        // bass, mids, treble, heavy damping, for each channel (long-term average is 1)
     float   fWaveform[2][576];             // Not all 576 are valid! - only NUM_WAVEFORM_SAMPLES samples are valid for each channel (note: NUM_WAVEFORM_SAMPLES is declared in shell_defines.h)
-    float   fSpectrum[2][NUM_FREQUENCIES]; // NUM_FREQUENCIES samples for each channel (note: NUM_FREQUENCIES is declared in shell_defines.h)
+    float  *fSpectrum[2];                  // nFrequencies samples for each channel
+    int     nFrequencies;                  // m_fft_size/2 (NUM_FREQUENCIES by default; note: NUM_FREQUENCIES is declared in shell_defines.h)
+    float   beat;                          // 1 on the frame a beat falls on, 0 otherwise
+    float   beat_phase;                    // 0..1, from one beat to the next
+    float   bpm;                           // current tempo estimate
+    float   beat_confidence;               // 0..1: how steady the beat is (below ~0.25 there isn't really one)
 } td_soundinfo;                    // ...range is 0 Hz to 22050 Hz, evenly spaced.
 
 #pragma pack(push, 1)
@@ -71,6 +91,8 @@ public:
     int       GetFrame() const;    // returns current frame # (starts at zero)
     float     GetTime() const;     // returns current animation time (in seconds) (starts at zero) (updated once per frame)
     float     GetFps() const;      // returns current estimate of framerate (frames per second)
+    bool      GetFramePercentiles(int stat, float window_secs, td_frame_percentiles *p) const;  // frame time percentiles (FRAME_STAT_*) over the last 'window_secs' seconds, or the whole session if <= 0
+    float     GetFrameBudget() const;  // seconds per frame that the fps limit allows, or 0 if it's unlimited
     eScrMode  GetScreenMode() const;     // returns WINDOWED, FULLSCREEN, FAKE_FULLSCREEN, DESKTOP, or NOT_YET_KNOWN (if called before or during OverrideDefaults()).
     HWND      GetWinampWindow();   // returns handle to Winamp main window
     HINSTANCE GetInstance();       // returns handle to the plugin DLL module; used for things like loading resources (dialogs, bitmaps, icons...) that are built into the plugin.
@@ -107,6 +129,9 @@ protected:
     // MISC
     // ------------------------------------------------------------
     td_soundinfo m_sound;                   // a structure always containing the most recent sound analysis information; defined in pluginshell.h.
+    int          GetFFTWindowLen() const;   // # of samples each spectrum is computed from (576 unless m_fft_overlap is set)
+    const float* GetRecentSamples(int ch) const { return m_recent[ch] + m_recent_len - GetFFTWindowLen(); }; // the last GetFFTWindowLen() raw samples of channel ch
+    float        GetFFTGain(const FFT &fft) const; // scales the spectrum of 'fft' to the levels of the original 576-sample analysis
     void         SuggestHowToFreeSomeMem(); // gives the user a 'smart' messagebox that suggests how they can free up some video memory.
 
     // CONFIG PANEL SETTINGS
@@ -137,6 +162,12 @@ protected:
     int          m_skin;                    // 0 or 1
 #endif
     int          m_fix_slow_text;           // 0 or 1
+    int          m_fft_size;                // 256-8192, a power of 2: the spectrum has half this many frequencies
+    int          m_fft_window;              // FFT_WINDOW_HANN, FFT_WINDOW_BLACKMAN_HARRIS or FFT_WINDOW_KAISER
+    int          m_fft_overlap;             // 0-90: % of each frame's analysis window made of older samples
+    int          m_frame_pacing;            // FRAME_PACING_AUTO, FRAME_PACING_TIMER or FRAME_PACING_HYBRID
+    int          m_show_frame_stats;        // 0 or 1: frame time percentiles overlay
+    int          m_frame_stats_dump;        // 0 or 1: write the session's frame times to milkdrop2_frame_stats.csv/.json on exit
     td_fontinfo  m_fontinfo[NUM_BASIC_FONTS + NUM_EXTRA_FONTS];
     D3DDISPLAYMODE m_disp_mode_fs;          // a D3DDISPLAYMODE struct that specifies the width, height, refresh rate, and color format to use when the plugin goes fullscreen.
 
@@ -250,14 +281,31 @@ private:
     double m_last_raw_time;
     LARGE_INTEGER m_high_perf_timer_freq;  // 0 if high-precision timer not available
    private:
+    FramePacer m_pacer;                    // for EnforceMaxFPS
+    FrameStats m_frame_stats;
+    LARGE_INTEGER m_frame_start;           // 0 if the last frame was skipped
+    float  m_frame_present_ms;             // of the last frame
     float  m_time_hist[TIME_HIST_SLOTS];		// cumulative
     int    m_time_hist_pos;
 
     // PRIVATE AUDIO PROCESSING DATA
     FFT   m_fftobj;
-    float m_oldwave[2][576];        // for wave alignment
-    int   m_prev_align_offset[2];   // for wave alignment
-    int   m_align_weights_ready;
+    BeatTracker m_beattracker;
+    float *m_recent[2];             // the last m_recent_len samples, oldest first
+    int   m_recent_len;
+    float *m_fft_in;                // GetFFTWindowLen() samples
+    float m_fft_gain;
+    PCMRingBuffer m_pcm;            // PushAudio -> AnalyzeAudioStream
+    int   m_stream_rate;
+    __int64 m_stream_pos;           // # of samples analysed from m_pcm
+    double m_stream_t0;             // PushAudio time of the first hop analysed (-1 before that)
+    double m_hop_time;              //  and of the last one, relative to m_stream_t0
+    float m_hop_rate;               // hops per second, as the timestamps have it
+    int   m_align_octaves;          // for wave alignment: 0 if it's off
+    td_align_octave m_align_oct[ALIGN_MAX_OCTAVES];
+    float m_align_weight[ALIGN_PYRAMID_SIZE];
+    float m_align_pyr_old[2][ALIGN_PYRAMID_SIZE];   // last frame's aligned waves
+    float m_align_pyr_new[ALIGN_PYRAMID_SIZE];
 
 public:
     CPluginShell();
@@ -266,9 +314,17 @@ public:
     // called by vis.cpp, on behalf of Winamp:
     int  PluginPreInitialize(HWND hWinampWnd, HINSTANCE hWinampInstance);    
     int  PluginInitialize();                                                
-    int  PluginRender(unsigned char *pWaveL, unsigned char *pWaveR);
+    int  PluginRender();
     void PluginQuit();
 
+    // the audio to analyse: push it (from any one thread, in pieces of any size, between
+    //  PluginInitialize and PluginQuit) and PluginRender analyses it in hops of 576, each at
+    //  its own time, so it sees every sample however fast or slow the rendering is.
+    //  'time' is when pLeft[0] plays, in seconds on any steady clock; -1 if it directly
+    //  follows the previous push.
+    void PluginSetAudioStreamRate(int sample_rate);     // default 44100
+    int  PushAudio(const float *pLeft, const float *pRight, int frames, double time = -1);  // -1..1; pRight can be NULL; returns # of frames taken
+
     void ToggleHelp();
     void TogglePlaylist();
 
@@ -298,7 +354,11 @@ private:
     void ReadConfig();
     void WriteConfig();
     void DoTime();
-    void AnalyzeNewSound(unsigned char *pWaveL, unsigned char *pWaveR);
+    void AnalyzeAudioStream();
+    void AnalyzeWaveform(float time, float rate);
+    void InitAlignWaves();
+    void BuildAlignPyramid(float* pyr, const float* wave, int nValid);
+    void ShiftAlignPyramid(float* dest, const float* pyr, int offset);
     void AlignWaves();
     int  InitDirectX();
     void CleanUpDirectX();
@@ -327,6 +387,14 @@ protected:
     void RenderPlaylist();
     void StuffParams(DXCONTEXT_PARAMS *pParams);
     void EnforceMaxFPS();
+    void UpdateFramePacerDisplay();
+    void RecordFrameStart();
+    void RecordFramePresented();
+    void RenderFrameStats();
+    void DumpFrameStats();
+#ifdef ZONE_PROFILER
+    void DumpZoneProfile();
+#endif
 
     // DESKTOP MODE FUNCTIONS (found in desktop_mode.cpp)
     int  InitDesktopMode() const;
@@ -344,7 +412,6 @@ protected:
 
 	LPDIRECT3D9 m_vjd3d9;
 	LPDIRECT3DDEVICE9 m_vjd3d9_device;
-	LARGE_INTEGER m_prev_end_of_frame;
 protected:
 	HWND	m_hTextWnd;
 private:
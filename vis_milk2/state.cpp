@@ -224,6 +224,9 @@ CState::CState()
 	// it is a SUBSET of the per-vertex calculation variable list.
 	m_pf_codehandle = NULL;
 	m_pp_codehandle = NULL;
+	memset(m_pp_batch_clones, 0, sizeof(m_pp_batch_clones));
+	m_pp_class = PP_CODE_EMPTY;
+	m_nExtraVars = m_nExtraVarsWave = 0;
 	m_pf_eel = NSEEL_VM_alloc();
 	m_pv_eel = NSEEL_VM_alloc();
     for (int i=0; i<MAX_CUSTOM_WAVES; i++)
@@ -260,6 +263,37 @@ CState::~CState()
 
 //--------------------------------------------------------------------------------
 
+static void RegisterBandVars(NSEEL_VMCTX vm, double **band, double **band_att, int nExtraVars)
+{
+    // band1..bandN, band1_att..bandN_att: the log-spaced spectrum bands (see CPlugin::DoCustomSoundAnalysis).
+    //  the ones past g_plugin.m_nSpectrumBands - or all of them, if the preset didn't ask for
+    //  EXTRA_VARS_BANDS - aren't registered, and stay NULL.
+    int nBands = (nExtraVars & EXTRA_VARS_BANDS) ? g_plugin.m_nSpectrumBands : 0;
+    for (int vi=0; vi<MAX_SPECTRUM_BANDS; vi++)
+    {
+        band[vi] = band_att[vi] = NULL;
+        if (vi >= nBands)
+            continue;
+        char buf[16] = {0};
+        _snprintf(buf, ARRAYSIZE(buf), "band%d", vi+1);
+        band[vi] = NSEEL_VM_regvar(vm, buf);
+        _snprintf(buf, ARRAYSIZE(buf), "band%d_att", vi+1);
+        band_att[vi] = NSEEL_VM_regvar(vm, buf);
+    }
+}
+
+static void RegisterBeatVars(NSEEL_VMCTX vm, double **beat, double **beat_phase, double **bpm, int nExtraVars)
+{
+    // beat, beat_phase, bpm: the beat tracker's output (see CPlugin::DoCustomSoundAnalysis).
+    //  NULL unless the preset asked for EXTRA_VARS_BEAT.
+    *beat = *beat_phase = *bpm = NULL;
+    if (!(nExtraVars & EXTRA_VARS_BEAT))
+        return;
+    *beat       = NSEEL_VM_regvar(vm, "beat");
+    *beat_phase = NSEEL_VM_regvar(vm, "beat_phase");
+    *bpm        = NSEEL_VM_regvar(vm, "bpm");
+}
+
 void CState::RegisterBuiltInVariables(int flags)
 {
     if (flags & RECOMPILE_PRESET_CODE)
@@ -283,6 +317,8 @@ void CState::RegisterBuiltInVariables(int flags)
 	    var_pf_bass_att	= NSEEL_VM_regvar(m_pf_eel, "bass_att");	// i
 	    var_pf_mid_att	= NSEEL_VM_regvar(m_pf_eel, "mid_att");	// i
 	    var_pf_treb_att	= NSEEL_VM_regvar(m_pf_eel, "treb_att");	// i
+        RegisterBandVars(m_pf_eel, var_pf_band, var_pf_band_att, m_nExtraVars);	// i
+	    RegisterBeatVars(m_pf_eel, &var_pf_beat, &var_pf_beat_phase, &var_pf_bpm, m_nExtraVars);	// i
 	    var_pf_frame    = NSEEL_VM_regvar(m_pf_eel, "frame");
 	    var_pf_decay	= NSEEL_VM_regvar(m_pf_eel, "decay");
 	    var_pf_wave_a	= NSEEL_VM_regvar(m_pf_eel, "wave_a");
@@ -371,6 +407,8 @@ void CState::RegisterBuiltInVariables(int flags)
 	    var_pv_bass_att	= NSEEL_VM_regvar(m_pv_eel, "bass_att");	// i
 	    var_pv_mid_att	= NSEEL_VM_regvar(m_pv_eel, "mid_att");	// i
 	    var_pv_treb_att	= NSEEL_VM_regvar(m_pv_eel, "treb_att");	// i
+        RegisterBandVars(m_pv_eel, var_pv_band, var_pv_band_att, m_nExtraVars);	// i
+	    RegisterBeatVars(m_pv_eel, &var_pv_beat, &var_pv_beat_phase, &var_pv_bpm, m_nExtraVars);	// i
 	    var_pv_frame    = NSEEL_VM_regvar(m_pv_eel, "frame");
 	    var_pv_x		= NSEEL_VM_regvar(m_pv_eel, "x");			// i
 	    var_pv_y		= NSEEL_VM_regvar(m_pv_eel, "y");			// i
@@ -389,6 +427,47 @@ void CState::RegisterBuiltInVariables(int flags)
         var_pv_pixelsy  = NSEEL_VM_regvar(m_pv_eel, "pixelsy");
         var_pv_aspectx  = NSEEL_VM_regvar(m_pv_eel, "aspectx");
         var_pv_aspecty  = NSEEL_VM_regvar(m_pv_eel, "aspecty");
+
+        // these are the same for every vertex of a frame (the i/o ones are reset at the start of
+        //  each vertex), so per-vertex code that only depends on them is run once per frame
+        //  (see NSEEL_code_execute_prologue() in ComputeGridAlphaValues).
+        {
+            EEL_F *uniforms[] = {
+                var_pv_zoom, var_pv_zoomexp, var_pv_rot, var_pv_warp, var_pv_cx, var_pv_cy,
+                var_pv_dx, var_pv_dy, var_pv_sx, var_pv_sy,
+                var_pv_time, var_pv_fps, var_pv_frame, var_pv_progress,
+                var_pv_bass, var_pv_mid, var_pv_treb, var_pv_bass_att, var_pv_mid_att, var_pv_treb_att,
+                var_pv_meshx, var_pv_meshy, var_pv_pixelsx, var_pv_pixelsy, var_pv_aspectx, var_pv_aspecty,
+            };
+            EEL_F *all_uniforms[ARRAYSIZE(uniforms) + NUM_Q_VAR + MAX_SPECTRUM_BANDS*2 + 3];
+            int nUniforms = ARRAYSIZE(uniforms) + NUM_Q_VAR;
+            memcpy(all_uniforms, uniforms, sizeof(uniforms));
+            memcpy(all_uniforms + ARRAYSIZE(uniforms), var_pv_q, sizeof(EEL_F *)*NUM_Q_VAR);
+            for (int vi=0; vi<g_plugin.m_nSpectrumBands && var_pv_band[vi]; vi++)
+            {
+                all_uniforms[nUniforms++] = var_pv_band[vi];
+                all_uniforms[nUniforms++] = var_pv_band_att[vi];
+            }
+            if (var_pv_beat)
+            {
+                all_uniforms[nUniforms++] = var_pv_beat;
+                all_uniforms[nUniforms++] = var_pv_beat_phase;
+                all_uniforms[nUniforms++] = var_pv_bpm;
+            }
+            NSEEL_VM_SetUniformVars(m_pv_eel, all_uniforms, nUniforms);
+        }
+
+        // the vars that differ per vertex; code that only talks to the rest of the preset through
+        //  these (and the uniforms) can be run a row of vertices at a time (NSEEL_code_execute_batch),
+        //  which is how the mesh is split across the worker threads.
+        {
+            EEL_F *batch[NUM_PV_BATCH_VARS] = {
+                var_pv_x, var_pv_y, var_pv_rad, var_pv_ang,
+                var_pv_zoom, var_pv_zoomexp, var_pv_rot, var_pv_warp, var_pv_cx, var_pv_cy,
+                var_pv_dx, var_pv_dy, var_pv_sx, var_pv_sy,
+            };
+            NSEEL_VM_SetBatchVars(m_pv_eel, batch, NUM_PV_BATCH_VARS);
+        }
     }
 
     if (flags & RECOMPILE_WAVE_CODE)
@@ -418,6 +497,8 @@ void CState::RegisterBuiltInVariables(int flags)
 	        m_wave[i].var_pf_bass_att	= NSEEL_VM_regvar(m_wave[i].m_pf_eel, "bass_att");	// i
 	        m_wave[i].var_pf_mid_att	= NSEEL_VM_regvar(m_wave[i].m_pf_eel, "mid_att");	// i
 	        m_wave[i].var_pf_treb_att	= NSEEL_VM_regvar(m_wave[i].m_pf_eel, "treb_att");	// i
+            RegisterBandVars(m_wave[i].m_pf_eel, m_wave[i].var_pf_band, m_wave[i].var_pf_band_att, m_nExtraVarsWave);	// i
+	        RegisterBeatVars(m_wave[i].m_pf_eel, &m_wave[i].var_pf_beat, &m_wave[i].var_pf_beat_phase, &m_wave[i].var_pf_bpm, m_nExtraVarsWave);	// i
 	        m_wave[i].var_pf_r          = NSEEL_VM_regvar(m_wave[i].m_pf_eel, "r");         // i/o
 	        m_wave[i].var_pf_g          = NSEEL_VM_regvar(m_wave[i].m_pf_eel, "g");         // i/o
 	        m_wave[i].var_pf_b          = NSEEL_VM_regvar(m_wave[i].m_pf_eel, "b");         // i/o
@@ -447,6 +528,8 @@ void CState::RegisterBuiltInVariables(int flags)
 	        m_wave[i].var_pp_bass_att	= NSEEL_VM_regvar(m_wave[i].m_pp_eel, "bass_att");	// i
 	        m_wave[i].var_pp_mid_att	= NSEEL_VM_regvar(m_wave[i].m_pp_eel, "mid_att");	// i
 	        m_wave[i].var_pp_treb_att	= NSEEL_VM_regvar(m_wave[i].m_pp_eel, "treb_att");	// i
+            RegisterBandVars(m_wave[i].m_pp_eel, m_wave[i].var_pp_band, m_wave[i].var_pp_band_att, m_nExtraVarsWave);	// i
+	        RegisterBeatVars(m_wave[i].m_pp_eel, &m_wave[i].var_pp_beat, &m_wave[i].var_pp_beat_phase, &m_wave[i].var_pp_bpm, m_nExtraVarsWave);	// i
             m_wave[i].var_pp_sample     = NSEEL_VM_regvar(m_wave[i].m_pp_eel, "sample");    // i
             m_wave[i].var_pp_value1     = NSEEL_VM_regvar(m_wave[i].m_pp_eel, "value1");    // i
             m_wave[i].var_pp_value2     = NSEEL_VM_regvar(m_wave[i].m_pp_eel, "value2");    // i
@@ -486,6 +569,8 @@ void CState::RegisterBuiltInVariables(int flags)
 	        m_shape[i].var_pf_bass_att	= NSEEL_VM_regvar(m_shape[i].m_pf_eel, "bass_att");	// i
 	        m_shape[i].var_pf_mid_att	= NSEEL_VM_regvar(m_shape[i].m_pf_eel, "mid_att");	// i
 	        m_shape[i].var_pf_treb_att	= NSEEL_VM_regvar(m_shape[i].m_pf_eel, "treb_att");	// i
+            RegisterBandVars(m_shape[i].m_pf_eel, m_shape[i].var_pf_band, m_shape[i].var_pf_band_att, m_nExtraVarsWave);	// i
+	        RegisterBeatVars(m_shape[i].m_pf_eel, &m_shape[i].var_pf_beat, &m_shape[i].var_pf_beat_phase, &m_shape[i].var_pf_bpm, m_nExtraVarsWave);	// i
 	        m_shape[i].var_pf_x          = NSEEL_VM_regvar(m_shape[i].m_pf_eel, "x");         // i/o
 	        m_shape[i].var_pf_y          = NSEEL_VM_regvar(m_shape[i].m_pf_eel, "y");         // i/o
 	        m_shape[i].var_pf_rad        = NSEEL_VM_regvar(m_shape[i].m_pf_eel, "rad");         // i/o
@@ -535,6 +620,7 @@ void CState::Default(DWORD ApplyFlags)
     if (ApplyFlags & STATE_GENERAL)
     {
         m_fRating				= 3.0f;
+        m_bExpensive			= false;
 	    m_fDecay				= 0.98f;	// 1.0 = none, 0.95 = heavy decay
 	    m_fGammaAdj				= 2.0f;		// 1.0 = reg; +2.0 = double, +3.0 = triple...
 	    m_fVideoEchoZoom		= 2.0f;
@@ -561,6 +647,7 @@ void CState::Default(DWORD ApplyFlags)
     // wave:
     if (ApplyFlags & STATE_WAVE)
     {
+	    m_nExtraVarsWave		= 0;
 	    m_nWaveMode				= 0;
 	     m_nOldWaveMode			= -1;
 	    m_bAdditiveWaves		= false;
@@ -676,6 +763,7 @@ void CState::Default(DWORD ApplyFlags)
         m_szPerFrameInit[0] = 0;
         m_szPerFrameExpr[0] = 0;
         m_szPerPixelExpr[0] = 0;
+        m_nExtraVars        = 0;
     }
 
 	// DON'T FORGET TO ADD NEW VARIABLES TO BLEND FUNCTION, IMPORT, and EXPORT AS WELL!!!!!!!!
@@ -890,6 +978,10 @@ bool CState::Export(const wchar_t *szIniFile)
 	fprintf(fOut, "[preset00]\n");    
 
 	fprintf(fOut, "%s=%.3f\n", "fRating",                m_fRating);         
+	if (m_bExpensive)   // (only written when set; it's rare)
+		fprintf(fOut, "%s=%d\n", "bExpensive",           m_bExpensive);
+	if (m_nExtraVars | m_nExtraVarsWave)   // (only when asked for, as older presets may use the names)
+		fprintf(fOut, "%s=%d\n", "nExtraVars",           m_nExtraVars | m_nExtraVarsWave);
 	fprintf(fOut, "%s=%.3f\n", "fGammaAdj",              m_fGammaAdj.eval(-1));         
 	fprintf(fOut, "%s=%.3f\n", "fDecay",                 m_fDecay.eval(-1));            
 	fprintf(fOut, "%s=%.3f\n", "fVideoEchoZoom",         m_fVideoEchoZoom.eval(-1));    
@@ -1326,6 +1418,7 @@ bool CState::Import(const wchar_t *szIniFile, float fTime, CState* pOldState, DW
     if (ApplyFlags & STATE_GENERAL)
     {
         m_fRating				= GetFastFloat("fRating",m_fRating,f);
+        m_bExpensive			= (GetFastInt ("bExpensive",m_bExpensive,f) != 0);
 	    m_fDecay                = GetFastFloat("fDecay",m_fDecay.eval(-1),f);
 	    m_fGammaAdj             = GetFastFloat("fGammaAdj" ,m_fGammaAdj.eval(-1),f);
 	    m_fVideoEchoZoom        = GetFastFloat("fVideoEchoZoom",m_fVideoEchoZoom.eval(-1),f);
@@ -1349,6 +1442,7 @@ bool CState::Import(const wchar_t *szIniFile, float fTime, CState* pOldState, DW
     // wave:
     if (ApplyFlags & STATE_WAVE)
     {
+	    m_nExtraVarsWave        = GetFastInt  ("nExtraVars",m_nExtraVarsWave,f);
 	    m_nWaveMode             = GetFastInt  ("nWaveMode",m_nWaveMode,f);
 	    m_bAdditiveWaves		= (GetFastInt ("bAdditiveWaves",m_bAdditiveWaves,f) != 0);
 	    m_bWaveDots		        = (GetFastInt ("bWaveDots",m_bWaveDots,f) != 0);
@@ -1419,6 +1513,7 @@ bool CState::Import(const wchar_t *szIniFile, float fTime, CState* pOldState, DW
         ReadCode(f, m_szPerFrameInit, "per_frame_init_");
         ReadCode(f, m_szPerFrameExpr, "per_frame_");
         ReadCode(f, m_szPerPixelExpr, "per_pixel_");
+        m_nExtraVars = GetFastInt("nExtraVars",m_nExtraVars,f);
     }
     
     // warp shader
@@ -1481,12 +1576,22 @@ void CState::FreeVarsAndCode(bool bFree)
 		    NSEEL_code_free(m_pf_codehandle);
 		m_pf_codehandle = NULL;
 	}
+	for (int i=0; i<MAX_WARP_THREADS-1; i++)
+	{
+		if (m_pp_batch_clones[i])
+		{
+			if (bFree)
+				NSEEL_code_free(m_pp_batch_clones[i]);
+			m_pp_batch_clones[i] = NULL;
+		}
+	}
 	if (m_pp_codehandle)
 	{
         if (bFree)
     		NSEEL_code_free(m_pp_codehandle);
 		m_pp_codehandle = NULL;
 	}
+	m_pp_class = PP_CODE_EMPTY;
 
     for (int i=0; i<MAX_CUSTOM_WAVES; i++)
     {
@@ -1554,6 +1659,16 @@ void CState::StripLinefeedCharsAndComments(char *src, char *dest)
 	dest[i2] = 0;
 }
 
+// names compiled code in the profiler's output (see CPlugin::DumpCodeProfile)
+static void SetCodeLabel(NSEEL_CODEHANDLE h, const wchar_t *szPreset, const char *szWhat, int i=-1)
+{
+    char szPart[64] = {0};
+    char buf[128] = {0};
+    _snprintf(szPart, ARRAYSIZE(szPart)-1, szWhat, i);
+    _snprintf(buf, ARRAYSIZE(buf)-1, "%ls: %s", szPreset, szPart);
+    NSEEL_code_setlabel(h, buf);
+}
+
 void CState::RecompileExpressions(int flags, int bReInit)
 {
     // before we get started, if we redo the init code for the preset, we have to redo
@@ -1572,11 +1687,20 @@ void CState::RecompileExpressions(int flags, int bReInit)
 		    NSEEL_code_free(m_pf_codehandle);
 		    m_pf_codehandle = NULL;
 	    }
+	    for (int i=0; i<MAX_WARP_THREADS-1; i++)
+	    {
+		    if (m_pp_batch_clones[i])
+		    {
+			    NSEEL_code_free(m_pp_batch_clones[i]);
+			    m_pp_batch_clones[i] = NULL;
+		    }
+	    }
 	    if (m_pp_codehandle)
 	    {
 		    NSEEL_code_free(m_pp_codehandle);
 		    m_pp_codehandle = NULL;
 	    }
+	    m_pp_class = PP_CODE_EMPTY;
     }
     if (flags & RECOMPILE_WAVE_CODE)
     {
@@ -1709,6 +1833,8 @@ void CState::RecompileExpressions(int flags, int bReInit)
 				    _snwprintf(buffer, ARRAYSIZE(buffer), WASABI_API_LNGSTRINGW(IDS_WARNING_PRESET_X_ERROR_IN_PER_FRAME_CODE), m_szDesc);
                     g_plugin.AddError(buffer, 6.0f, ERR_PRESET, true);
 			    }
+			    else
+				    SetCodeLabel(m_pf_codehandle, m_szDesc, "per-frame");
 	        }
 
             // 3. compile preset per-pixel code
@@ -1721,6 +1847,23 @@ void CState::RecompileExpressions(int flags, int bReInit)
 				    _snwprintf(buffer, ARRAYSIZE(buffer), WASABI_API_LNGSTRINGW(IDS_WARNING_PRESET_X_ERROR_IN_PER_VERTEX_CODE), m_szDesc);
                     g_plugin.AddError(buffer, 6.0f, ERR_PRESET, true);
 			    }
+			    else
+			    {
+				    SetCodeLabel(m_pp_codehandle, m_szDesc, "per-pixel");
+
+				    // if it can't see which vertex it's running for, every vertex gets the same results.
+				    int reads = NSEEL_code_getbatchreads(m_pp_codehandle);
+				    int per_vertex = (1<<PV_BATCH_X) | (1<<PV_BATCH_Y) | (1<<PV_BATCH_RAD) | (1<<PV_BATCH_ANG);
+				    m_pp_class = (reads >= 0 && !(reads & per_vertex)) ? PP_CODE_UNIFORM : PP_CODE_VARYING;
+
+				    // private copies for the worker threads computing the mesh (see ComputeGridRows)
+				    for (int i=0; m_pp_class == PP_CODE_VARYING && i<g_plugin.m_nWarpThreads-1; i++)
+				    {
+					    m_pp_batch_clones[i] = NSEEL_code_clone_batch(m_pp_codehandle);
+					    if (m_pp_batch_clones[i])
+						    SetCodeLabel(m_pp_batch_clones[i], m_szDesc, "per-pixel (thread %d)", i+1);
+				    }
+			    }
 	        }
 	        
             //resetVars(NULL);
@@ -1780,6 +1923,8 @@ void CState::RecompileExpressions(int flags, int bReInit)
 				            _snwprintf(buffer, ARRAYSIZE(buffer), WASABI_API_LNGSTRINGW(IDS_WARNING_PRESET_X_ERROR_IN_WAVE_X_PER_FRAME_CODE), m_szDesc, i);
                             g_plugin.AddError(buffer, 6.0f, ERR_PRESET, true);
 			            }
+			            else
+				            SetCodeLabel(m_wave[i].m_pf_codehandle, m_szDesc, "wave %d per-frame", i);
                     #endif
                 }
 
@@ -1793,6 +1938,8 @@ void CState::RecompileExpressions(int flags, int bReInit)
 				        _snwprintf(buffer, ARRAYSIZE(buffer), WASABI_API_LNGSTRINGW(IDS_WARNING_PRESET_X_ERROR_IN_WAVE_X_PER_POINT_CODE), m_szDesc, i);
                         g_plugin.AddError(buffer, 6.0f, ERR_PRESET, true);
 			        }
+			        else
+				        SetCodeLabel(m_wave[i].m_pp_codehandle, m_szDesc, "wave %d per-point", i);
                 }
             }
         }
@@ -1851,6 +1998,8 @@ void CState::RecompileExpressions(int flags, int bReInit)
 				            _snwprintf(buffer, ARRAYSIZE(buffer), WASABI_API_LNGSTRINGW(IDS_WARNING_PRESET_X_ERROR_IN_SHAPE_X_PER_FRAME_CODE), m_szDesc, i);
                             g_plugin.AddError(buffer, 6.0f, ERR_PRESET, true);
 			            }
+			            else
+				            SetCodeLabel(m_shape[i].m_pf_codehandle, m_szDesc, "shape %d per-frame", i);
 		            #endif
                 }
 
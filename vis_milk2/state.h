@@ -48,6 +48,29 @@ OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #define NUM_Q_VAR 32
 #define NUM_T_VAR 8
+#define MAX_SPECTRUM_BANDS 64   // band1..bandN and band1_att..bandN_att, N = CPlugin::m_nSpectrumBands
+
+// opt-in sets of built-in variables, for the 'nExtraVars' preset key (the sum of the ones it wants).
+//  older presets are free to use these names for their own variables, so they're only registered on request.
+#define EXTRA_VARS_BANDS   1    // band1..bandN, band1_att..bandN_att
+#define EXTRA_VARS_BEAT    2    // beat, beat_phase, bpm
+
+// order of the per-vertex arrays given to NSEEL_code_execute_batch() (see CState::RecompileExpressions)
+enum
+{
+    PV_BATCH_X, PV_BATCH_Y, PV_BATCH_RAD, PV_BATCH_ANG,
+    PV_BATCH_ZOOM, PV_BATCH_ZOOMEXP, PV_BATCH_ROT, PV_BATCH_WARP, PV_BATCH_CX, PV_BATCH_CY,
+    PV_BATCH_DX, PV_BATCH_DY, PV_BATCH_SX, PV_BATCH_SY,
+    NUM_PV_BATCH_VARS
+};
+
+// how the results of the per-pixel code vary over the mesh (see CState::m_pp_class)
+enum
+{
+    PP_CODE_EMPTY,      // no per-pixel code; the per-frame values apply everywhere
+    PP_CODE_UNIFORM,    // doesn't read x, y, rad or ang (or carry state between vertices), so it's run once per frame
+    PP_CODE_VARYING,    // has to be run for every vertex
+};
 
 #define MAX_BIGSTRING_LEN    32768
 
@@ -129,6 +152,8 @@ public:
     double* var_pf_q[NUM_Q_VAR];
     double* var_pf_t[NUM_T_VAR];
 	double *var_pf_bass, *var_pf_mid, *var_pf_treb, *var_pf_bass_att, *var_pf_mid_att, *var_pf_treb_att;
+    double *var_pf_band[MAX_SPECTRUM_BANDS], *var_pf_band_att[MAX_SPECTRUM_BANDS];
+    double *var_pf_beat, *var_pf_beat_phase, *var_pf_bpm;
 	double *var_pf_r, *var_pf_g, *var_pf_b, *var_pf_a;
 	double *var_pf_r2, *var_pf_g2, *var_pf_b2, *var_pf_a2;
 	double *var_pf_border_r, *var_pf_border_g, *var_pf_border_b, *var_pf_border_a;
@@ -187,6 +212,8 @@ public:
     double* var_pf_q[NUM_Q_VAR];
     double* var_pf_t[NUM_T_VAR];
 	double *var_pf_bass, *var_pf_mid, *var_pf_treb, *var_pf_bass_att, *var_pf_mid_att, *var_pf_treb_att;
+    double *var_pf_band[MAX_SPECTRUM_BANDS], *var_pf_band_att[MAX_SPECTRUM_BANDS];
+    double *var_pf_beat, *var_pf_beat_phase, *var_pf_bpm;
 	double *var_pf_r, *var_pf_g, *var_pf_b, *var_pf_a;
     double *var_pf_samples;
 
@@ -200,6 +227,8 @@ public:
     double* var_pp_q[NUM_Q_VAR];
     double* var_pp_t[NUM_T_VAR];
 	double *var_pp_bass, *var_pp_mid, *var_pp_treb, *var_pp_bass_att, *var_pp_mid_att, *var_pp_treb_att;
+    double *var_pp_band[MAX_SPECTRUM_BANDS], *var_pp_band_att[MAX_SPECTRUM_BANDS];
+    double *var_pp_beat, *var_pp_beat_phase, *var_pp_bpm;
     double *var_pp_sample, *var_pp_value1, *var_pp_value2;
 	double *var_pp_x, *var_pp_y, *var_pp_r, *var_pp_g, *var_pp_b, *var_pp_a;
 
@@ -260,6 +289,9 @@ public:
 	int                 m_nWarpPSVersion;  // 0 = milkdrop 1 era (no PS), 2 = ps_2_0, 3 = ps_3_0
 	int                 m_nCompPSVersion;  // 0 = milkdrop 1 era (no PS), 2 = ps_2_0, 3 = ps_3_0
 	float				m_fRating;		// 0..5
+	bool				m_bExpensive;	// 'bExpensive=1' in the file: its per-vertex work is heavy, so the adaptive mesh drops right away
+	int					m_nExtraVars;		// EXTRA_VARS_* for the per-frame & per-vertex code ('nExtraVars', read along w/ that code)
+	int					m_nExtraVarsWave;	// EXTRA_VARS_* for the custom waves & shapes (the same key, read along w/ theirs)
 	// post-processing:
 	CBlendableFloat		m_fGammaAdj;	// +0 -> +1.0 (double), +2.0 (triple)...
 	CBlendableFloat		m_fVideoEchoZoom;
@@ -370,6 +402,8 @@ public:
 	// for arbitrary function evaluation:
     NSEEL_CODEHANDLE				m_pf_codehandle;			
     NSEEL_CODEHANDLE				m_pp_codehandle;	
+    NSEEL_CODEHANDLE				m_pp_batch_clones[MAX_WARP_THREADS-1];	// m_pp_codehandle for the worker threads (NULL if it can't be batched)
+    int								m_pp_class;		// PP_CODE_EMPTY/UNIFORM/VARYING, set when m_pp_codehandle is compiled
     char			m_szPerFrameInit[MAX_BIGSTRING_LEN];
     char			m_szPerFrameExpr[MAX_BIGSTRING_LEN];
     char			m_szPerPixelExpr[MAX_BIGSTRING_LEN];
@@ -389,6 +423,8 @@ public:
     double *var_pf_zoom, *var_pf_zoomexp, *var_pf_rot, *var_pf_warp, *var_pf_cx, *var_pf_cy, *var_pf_dx, *var_pf_dy, *var_pf_sx, *var_pf_sy;
 	double *var_pf_time, *var_pf_fps;
 	double *var_pf_bass, *var_pf_mid, *var_pf_treb, *var_pf_bass_att, *var_pf_mid_att, *var_pf_treb_att;
+    double *var_pf_band[MAX_SPECTRUM_BANDS], *var_pf_band_att[MAX_SPECTRUM_BANDS];
+    double *var_pf_beat, *var_pf_beat_phase, *var_pf_bpm;
 	double *var_pf_wave_a, *var_pf_wave_r, *var_pf_wave_g, *var_pf_wave_b, *var_pf_wave_x, *var_pf_wave_y, *var_pf_wave_mystery, *var_pf_wave_mode;
 	double *var_pf_decay;
 	double *var_pf_frame;
@@ -428,6 +464,8 @@ public:
     double *var_pv_zoom, *var_pv_zoomexp, *var_pv_rot, *var_pv_warp, *var_pv_cx, *var_pv_cy, *var_pv_dx, *var_pv_dy, *var_pv_sx, *var_pv_sy;
 	double *var_pv_time, *var_pv_fps;
 	double *var_pv_bass, *var_pv_mid, *var_pv_treb, *var_pv_bass_att, *var_pv_mid_att, *var_pv_treb_att;
+    double *var_pv_band[MAX_SPECTRUM_BANDS], *var_pv_band_att[MAX_SPECTRUM_BANDS];
+    double *var_pv_beat, *var_pv_beat_phase, *var_pv_bpm;
 	double *var_pv_x, *var_pv_y, *var_pv_rad, *var_pv_ang;
 	double *var_pv_frame;
 	//double *var_pv_q1, *var_pv_q2, *var_pv_q3, *var_pv_q4, *var_pv_q5, *var_pv_q6, *var_pv_q7, *var_pv_q8;
@@ -38,6 +38,7 @@ OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #define SafeRelease(x) { if (x) {x->Release(); x=NULL;} } 
 #define SafeDelete(x) { if (x) {delete x; x=NULL;} }
+#define SafeDeleteArray(x) { if (x) {delete [] x; x=NULL;} }
 #define IsNullGuid(lpGUID) ( ((int*)lpGUID)[0]==0 && ((int*)lpGUID)[1]==0 && ((int*)lpGUID)[2]==0 && ((int*)lpGUID)[3]==0 )
 #define DlgItemIsChecked(hDlg, nIDDlgItem) ((SendDlgItemMessage(hDlg, nIDDlgItem, BM_GETCHECK, (WPARAM) 0, (LPARAM) 0) == BST_CHECKED) ? true : false)
 #define CosineInterp(x) (0.5f - 0.5f*cosf((x) * 3.1415926535898f))
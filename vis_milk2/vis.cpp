@@ -262,8 +262,21 @@ int init(struct winampVisModule *this_mod)
 // render function for oscilloscope. Returns 0 if successful, 1 if visualization should end.
 int render1(struct winampVisModule *this_mod)
 {
-	return !g_plugin.PluginRender(this_mod->waveformData[0],
-								  this_mod->waveformData[1]);
+	// winamp only gives us a 576-sample snapshot of whatever is playing right now, so
+	// push it as a hop of its own, timestamped with now.
+	static LARGE_INTEGER freq;
+	if (!freq.QuadPart)
+		QueryPerformanceFrequency(&freq);
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+
+	float wave[2][576];
+	for (int ch=0; ch<2; ch++)
+		for (int i=0; i<576; i++)
+			wave[ch][i] = ((this_mod->waveformData[ch][i] ^ 128) - 128) / 128.0f;
+	g_plugin.PushAudio(wave[0], wave[1], 576, (double)now.QuadPart/freq.QuadPart);
+
+	return !g_plugin.PluginRender();
 }
 
 // cleanup (opposite of init()). Should destroy the window, unregister the window class, etc.
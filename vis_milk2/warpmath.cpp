@@ -0,0 +1,376 @@
+/*
+  LICENSE
+  -------
+Copyright 2005-2013 Nullsoft, Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, 
+are permitted provided that the following conditions are met:
+
+  * Redistributions of source code must retain the above copyright notice,
+    this list of conditions and the following disclaimer. 
+
+  * Redistributions in binary form must reproduce the above copyright notice,
+    this list of conditions and the following disclaimer in the documentation
+    and/or other materials provided with the distribution. 
+
+  * Neither the name of Nullsoft nor the names of its contributors may be used to 
+    endorse or promote products derived from this software without specific prior written permission. 
+ 
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR 
+IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND 
+FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR 
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT 
+OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "warpmath.h"
+#include <math.h>
+#include <string.h>
+
+// a 'vector' here is 4 floats with SSE2 or NEON, or just 1 float otherwise;
+//  the math below is written once, against these few wrappers.
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE2__)
+    #include <emmintrin.h>
+    #define VW 4
+    typedef __m128  vf;
+    typedef __m128i vi;
+    typedef __m128  vm;
+    static inline vf v_set(float a)          { return _mm_set1_ps(a); }
+    static inline vf v_load(const float* p)  { return _mm_loadu_ps(p); }
+    static inline void v_store(float* p, vf a) { _mm_storeu_ps(p, a); }
+    static inline vf v_add(vf a, vf b)       { return _mm_add_ps(a, b); }
+    static inline vf v_sub(vf a, vf b)       { return _mm_sub_ps(a, b); }
+    static inline vf v_mul(vf a, vf b)       { return _mm_mul_ps(a, b); }
+    static inline vf v_div(vf a, vf b)       { return _mm_div_ps(a, b); }
+    static inline vf v_min(vf a, vf b)       { return _mm_min_ps(a, b); }
+    static inline vf v_max(vf a, vf b)       { return _mm_max_ps(a, b); }
+    static inline vm v_gt(vf a, vf b)        { return _mm_cmpgt_ps(a, b); }
+    static inline vf v_select(vm m, vf a, vf b) { return _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b)); }
+    static inline vi v_rint(vf a)            { return _mm_cvtps_epi32(a); }   // (MXCSR is round-to-nearest)
+    static inline vf v_i2f(vi a)             { return _mm_cvtepi32_ps(a); }
+    static inline vi v_asint(vf a)           { return _mm_castps_si128(a); }
+    static inline vf v_asfloat(vi a)         { return _mm_castsi128_ps(a); }
+    static inline vi i_set(int a)            { return _mm_set1_epi32(a); }
+    static inline vi i_add(vi a, vi b)       { return _mm_add_epi32(a, b); }
+    static inline vi i_and(vi a, vi b)       { return _mm_and_si128(a, b); }
+    static inline vi i_or (vi a, vi b)       { return _mm_or_si128(a, b); }
+    static inline vi i_mask(vm m)            { return _mm_castps_si128(m); }
+    #define i_srl(a,n) _mm_srli_epi32(a, n)
+    #define i_sll(a,n) _mm_slli_epi32(a, n)
+#elif defined(_M_ARM64) || defined(__aarch64__)
+    #include <arm_neon.h>
+    #define VW 4
+    typedef float32x4_t vf;
+    typedef int32x4_t   vi;
+    typedef uint32x4_t  vm;
+    static inline vf v_set(float a)          { return vdupq_n_f32(a); }
+    static inline vf v_load(const float* p)  { return vld1q_f32(p); }
+    static inline void v_store(float* p, vf a) { vst1q_f32(p, a); }
+    static inline vf v_add(vf a, vf b)       { return vaddq_f32(a, b); }
+    static inline vf v_sub(vf a, vf b)       { return vsubq_f32(a, b); }
+    static inline vf v_mul(vf a, vf b)       { return vmulq_f32(a, b); }
+    static inline vf v_div(vf a, vf b)       { return vdivq_f32(a, b); }
+    static inline vf v_min(vf a, vf b)       { return vminq_f32(a, b); }
+    static inline vf v_max(vf a, vf b)       { return vmaxq_f32(a, b); }
+    static inline vm v_gt(vf a, vf b)        { return vcgtq_f32(a, b); }
+    static inline vf v_select(vm m, vf a, vf b) { return vbslq_f32(m, a, b); }
+    static inline vi v_rint(vf a)            { return vcvtnq_s32_f32(a); }
+    static inline vf v_i2f(vi a)             { return vcvtq_f32_s32(a); }
+    static inline vi v_asint(vf a)           { return vreinterpretq_s32_f32(a); }
+    static inline vf v_asfloat(vi a)         { return vreinterpretq_f32_s32(a); }
+    static inline vi i_set(int a)            { return vdupq_n_s32(a); }
+    static inline vi i_add(vi a, vi b)       { return vaddq_s32(a, b); }
+    static inline vi i_and(vi a, vi b)       { return vandq_s32(a, b); }
+    static inline vi i_or (vi a, vi b)       { return vorrq_s32(a, b); }
+    static inline vi i_mask(vm m)            { return vreinterpretq_s32_u32(m); }
+    #define i_srl(a,n) vreinterpretq_s32_u32(vshrq_n_u32(vreinterpretq_u32_s32(a), n))
+    #define i_sll(a,n) vshlq_n_s32(a, n)
+#else
+    #define VW 1
+    typedef float vf;
+    typedef int   vi;
+    typedef int   vm;
+    static inline vf v_set(float a)          { return a; }
+    static inline vf v_load(const float* p)  { return *p; }
+    static inline void v_store(float* p, vf a) { *p = a; }
+    static inline vf v_add(vf a, vf b)       { return a + b; }
+    static inline vf v_sub(vf a, vf b)       { return a - b; }
+    static inline vf v_mul(vf a, vf b)       { return a * b; }
+    static inline vf v_div(vf a, vf b)       { return a / b; }
+    static inline vf v_min(vf a, vf b)       { return (a < b) ? a : b; }
+    static inline vf v_max(vf a, vf b)       { return (a > b) ? a : b; }
+    static inline vm v_gt(vf a, vf b)        { return (a > b) ? -1 : 0; }
+    static inline vf v_select(vm m, vf a, vf b) { return m ? a : b; }
+    static inline vi v_rint(vf a)            { return (int)floorf(a + 0.5f); }
+    static inline vf v_i2f(vi a)             { return (float)a; }
+    static inline vi v_asint(vf a)           { vi i; memcpy(&i, &a, 4); return i; }
+    static inline vf v_asfloat(vi a)         { vf f; memcpy(&f, &a, 4); return f; }
+    static inline vi i_set(int a)            { return a; }
+    static inline vi i_add(vi a, vi b)       { return a + b; }
+    static inline vi i_and(vi a, vi b)       { return a & b; }
+    static inline vi i_or (vi a, vi b)       { return a | b; }
+    static inline vi i_mask(vm m)            { return m; }
+    #define i_srl(a,n) ((int)((unsigned int)(a) >> (n)))
+    #define i_sll(a,n) ((int)((unsigned int)(a) << (n)))
+#endif
+
+#define WARP_PI         3.14159265358979f
+#define WARP_TWO_PI_HI  6.28125f                // 2*pi, split so that k*hi is exact
+#define WARP_TWO_PI_LO  0.00193530717958647692f
+#define WARP_INV_TWO_PI 0.159154943091895336f
+#define WARP_LN2        0.693147180559945309f
+#define WARP_INV_LN2    1.44269504088896341f
+
+// sin(x): reduced to [-pi..pi], folded into [-pi/2..pi/2], then a degree-11 polynomial.
+//  |error| < 2e-7 for |x| < 1e4.
+static inline vf v_sin(vf x)
+{
+    vf k = v_i2f(v_rint(v_mul(x, v_set(WARP_INV_TWO_PI))));
+    vf r = v_sub(v_sub(x, v_mul(k, v_set(WARP_TWO_PI_HI))), v_mul(k, v_set(WARP_TWO_PI_LO)));
+    r = v_min(r, v_sub(v_set( WARP_PI), r));    // sin(r) == sin( pi-r)
+    r = v_max(r, v_sub(v_set(-WARP_PI), r));    // sin(r) == sin(-pi-r)
+    vf r2 = v_mul(r, r);
+    vf p = v_set(-2.50521084e-8f);
+    p = v_add(v_mul(p, r2), v_set( 2.75573192e-6f));
+    p = v_add(v_mul(p, r2), v_set(-1.98412698e-4f));
+    p = v_add(v_mul(p, r2), v_set( 8.33333333e-3f));
+    p = v_add(v_mul(p, r2), v_set(-1.66666667e-1f));
+    p = v_add(v_mul(p, r2), v_set( 1.0f));
+    return v_mul(p, r);
+}
+
+static inline vf v_cos(vf x)
+{
+    return v_sin(v_add(x, v_set(WARP_PI*0.5f)));
+}
+
+// log2(x), for normal x > 0: exponent + 2*atanh((m-1)/(m+1))/ln2, w/mantissa m in [sqrt(.5)..sqrt(2)).
+//  |error| < 1e-7.
+static inline vf v_log2(vf x)
+{
+    vi bits = v_asint(x);
+    vi e    = i_add(i_and(i_srl(bits, 23), i_set(0xFF)), i_set(-127));
+    vf m    = v_asfloat(i_or(i_and(bits, i_set(0x007FFFFF)), i_set(0x3F800000)));
+    vm big  = v_gt(m, v_set(1.41421356f));
+    m = v_select(big, v_mul(m, v_set(0.5f)), m);
+    e = i_add(e, i_and(i_mask(big), i_set(1)));
+    vf t  = v_div(v_sub(m, v_set(1.0f)), v_add(m, v_set(1.0f)));
+    vf t2 = v_mul(t, t);
+    vf p = v_set(2.0f/9);
+    p = v_add(v_mul(p, t2), v_set(2.0f/7));
+    p = v_add(v_mul(p, t2), v_set(2.0f/5));
+    p = v_add(v_mul(p, t2), v_set(2.0f/3));
+    p = v_add(v_mul(p, t2), v_set(2.0f));
+    return v_add(v_mul(v_mul(p, t), v_set(WARP_INV_LN2)), v_i2f(e));
+}
+
+// 2^x: 2^round(x) from the exponent bits, times a degree-7 polynomial for e^(frac*ln2).
+//  relative error < 2e-7; x is clamped to [-126..126].
+static inline vf v_exp2(vf x)
+{
+    x = v_min(v_max(x, v_set(-126.0f)), v_set(126.0f));
+    vi i = v_rint(x);
+    vf g = v_mul(v_sub(x, v_i2f(i)), v_set(WARP_LN2));
+    vf p = v_set(1.0f/5040);
+    p = v_add(v_mul(p, g), v_set(1.0f/720));
+    p = v_add(v_mul(p, g), v_set(1.0f/120));
+    p = v_add(v_mul(p, g), v_set(1.0f/24));
+    p = v_add(v_mul(p, g), v_set(1.0f/6));
+    p = v_add(v_mul(p, g), v_set(0.5f));
+    p = v_add(v_mul(p, g), v_set(1.0f));
+    p = v_add(v_mul(p, g), v_set(1.0f));
+    return v_mul(p, v_asfloat(i_sll(i_add(i, i_set(127)), 23)));
+}
+
+void InitWarpConsts(td_warpconsts* k, float fWarpTime, float fWarpScaleInv, const float f[4],
+                    float aspect_x, float aspect_y, float texel_offset_x, float texel_offset_y)
+{
+    k->aspect_x = aspect_x;
+    k->aspect_y = aspect_y;
+    k->inv_aspect_x = 1.0f/aspect_x;
+    k->inv_aspect_y = 1.0f/aspect_y;
+    k->texel_offset_x = texel_offset_x;
+    k->texel_offset_y = texel_offset_y;
+
+    // u += w*sin(t*0.333 + s*(x*f0 - y*f3)) + w*cos(t*0.753 - s*(x*f1 - y*f2))
+    // v += w*cos(t*0.375 - s*(x*f2 + y*f1)) + w*sin(t*0.825 + s*(x*f0 + y*f3))
+    // the time part grows without bound, so it's reduced here, in double precision.
+    const double PI = 3.14159265358979323846;
+    double t[4] = { fWarpTime*0.333f, fWarpTime*0.375f + PI/2, fWarpTime*0.753f + PI/2, fWarpTime*0.825f };
+    float s = fWarpScaleInv;
+    float bx[4] = {  s*f[0], -s*f[2], -s*f[1],  s*f[0] };
+    float by[4] = { -s*f[3], -s*f[1],  s*f[2],  s*f[3] };
+    for (int i=0; i<4; i++)
+    {
+        k->warp_t[i]  = (float)(t[i] - 2*PI*floor(t[i]/(2*PI) + 0.5));
+        k->warp_bx[i] = bx[i];
+        k->warp_by[i] = by[i];
+    }
+}
+
+// the per-lane inputs of WarpLanes(); for uniform params these are just computed once.
+typedef struct
+{
+    vf neg_log2_zoom, log2_zoomexp;
+    vf warp;        // warp*0.0035
+    vf cx, cy, dx, dy, inv_sx, inv_sy;
+    vf cos_rot, sin_rot;
+} td_warplanes;
+
+static inline void WarpLanes(const td_warpconsts* k, const td_warplanes& L, bool bConstZoom, vf zoom_inv,
+                             vf x, vf y, vf rad, vf* pu, vf* pv)
+{
+    // zoom2 = zoom^(zoomexp^(rad*2-1)), so 1/zoom2 = 2^(-log2(zoom) * 2^((rad*2-1)*log2(zoomexp)))
+    if (!bConstZoom)
+    {
+        vf e = v_exp2(v_mul(v_sub(v_add(rad, rad), v_set(1.0f)), L.log2_zoomexp));
+        zoom_inv = v_exp2(v_mul(L.neg_log2_zoom, e));
+    }
+
+    // initial texcoords, w/built-in zoom factor
+    vf u = v_add(v_mul(v_mul(x, v_set( 0.5f*k->aspect_x)), zoom_inv), v_set(0.5f));
+    vf v = v_add(v_mul(v_mul(y, v_set(-0.5f*k->aspect_y)), zoom_inv), v_set(0.5f));
+
+    // stretch on X, Y:
+    u = v_add(v_mul(v_sub(u, L.cx), L.inv_sx), L.cx);
+    v = v_add(v_mul(v_sub(v, L.cy), L.inv_sy), L.cy);
+
+    // warping:
+    vf w[4];
+    for (int i=0; i<4; i++)
+        w[i] = v_sin(v_add(v_add(v_set(k->warp_t[i]), v_mul(x, v_set(k->warp_bx[i]))), v_mul(y, v_set(k->warp_by[i]))));
+    u = v_add(u, v_mul(L.warp, v_add(w[0], w[2])));
+    v = v_add(v, v_mul(L.warp, v_add(w[1], w[3])));
+
+    // rotation:
+    vf u2 = v_sub(u, L.cx);
+    vf v2 = v_sub(v, L.cy);
+    u = v_add(v_sub(v_mul(u2, L.cos_rot), v_mul(v2, L.sin_rot)), L.cx);
+    v = v_add(v_add(v_mul(u2, L.sin_rot), v_mul(v2, L.cos_rot)), L.cy);
+
+    // translation:
+    u = v_sub(u, L.dx);
+    v = v_sub(v, L.dy);
+
+    // undo aspect ratio fix, and the final half-texel-offset translation:
+    *pu = v_add(v_mul(v_sub(u, v_set(0.5f)), v_set(k->inv_aspect_x)), v_set(0.5f + k->texel_offset_x));
+    *pv = v_add(v_mul(v_sub(v, v_set(0.5f)), v_set(k->inv_aspect_y)), v_set(0.5f + k->texel_offset_y));
+}
+
+bool WarpVerts_Uniform(const td_warpconsts* k, const td_warpparams* p, const float* x, const float* y, const float* rad,
+                       float* u, float* v, int count)
+{
+    if (!(p->zoom > 0 && p->zoomexp > 0))
+        return false;
+
+    // everything but x, y, rad is per-frame; hoist it.
+    td_warplanes L;
+    L.neg_log2_zoom = v_set(-logf(p->zoom)*WARP_INV_LN2);
+    L.log2_zoomexp  = v_set( logf(p->zoomexp)*WARP_INV_LN2);
+    L.warp    = v_set(p->warp*0.0035f);
+    L.cx      = v_set(p->cx);
+    L.cy      = v_set(p->cy);
+    L.dx      = v_set(p->dx);
+    L.dy      = v_set(p->dy);
+    L.inv_sx  = v_set(1.0f/p->sx);
+    L.inv_sy  = v_set(1.0f/p->sy);
+    L.cos_rot = v_set(cosf(p->rot));
+    L.sin_rot = v_set(sinf(p->rot));
+    bool bConstZoom = (p->zoomexp == 1.0f);     // (the default) -> zoom2 == zoom, everywhere
+    vf zoom_inv = v_set(1.0f/p->zoom);
+
+    int i = 0;
+    for ( ; i+VW <= count; i += VW)
+    {
+        vf uu, vv;
+        WarpLanes(k, L, bConstZoom, zoom_inv, v_load(&x[i]), v_load(&y[i]), v_load(&rad[i]), &uu, &vv);
+        v_store(&u[i], uu);
+        v_store(&v[i], vv);
+    }
+    if (i < count)
+    {
+        // the last partial vector goes through padded copies
+        float xt[VW], yt[VW], rt[VW], ut[VW], vt[VW];
+        int n = count - i;
+        for (int j=0; j<VW; j++)
+        {
+            int src = i + ((j < n) ? j : n-1);
+            xt[j] = x[src];
+            yt[j] = y[src];
+            rt[j] = rad[src];
+        }
+        vf uu, vv;
+        WarpLanes(k, L, bConstZoom, zoom_inv, v_load(xt), v_load(yt), v_load(rt), &uu, &vv);
+        v_store(ut, uu);
+        v_store(vt, vv);
+        memcpy(&u[i], ut, n*sizeof(float));
+        memcpy(&v[i], vt, n*sizeof(float));
+    }
+    return true;
+}
+
+static inline void LoadLanes(const float* const p[NUM_WARP_PARAMS], int i, td_warplanes* L)
+{
+    L->neg_log2_zoom = v_sub(v_set(0), v_log2(v_load(&p[WARP_PARAM_ZOOM][i])));
+    L->log2_zoomexp  = v_log2(v_load(&p[WARP_PARAM_ZOOMEXP][i]));
+    L->warp   = v_mul(v_load(&p[WARP_PARAM_WARP][i]), v_set(0.0035f));
+    L->cx     = v_load(&p[WARP_PARAM_CX][i]);
+    L->cy     = v_load(&p[WARP_PARAM_CY][i]);
+    L->dx     = v_load(&p[WARP_PARAM_DX][i]);
+    L->dy     = v_load(&p[WARP_PARAM_DY][i]);
+    L->inv_sx = v_div(v_set(1.0f), v_load(&p[WARP_PARAM_SX][i]));
+    L->inv_sy = v_div(v_set(1.0f), v_load(&p[WARP_PARAM_SY][i]));
+    vf rot = v_load(&p[WARP_PARAM_ROT][i]);
+    L->cos_rot = v_cos(rot);
+    L->sin_rot = v_sin(rot);
+}
+
+bool WarpVerts_Varying(const td_warpconsts* k, const float* const p[NUM_WARP_PARAMS], const float* x, const float* y, const float* rad,
+                       float* u, float* v, int count)
+{
+    // v_log2() needs normal, positive inputs
+    for (int i=0; i<count; i++)
+        if (!(p[WARP_PARAM_ZOOM][i] >= 1e-30f && p[WARP_PARAM_ZOOMEXP][i] >= 1e-30f))
+            return false;
+
+    td_warplanes L;
+    vf zoom_inv = v_set(1.0f);
+    int i = 0;
+    for ( ; i+VW <= count; i += VW)
+    {
+        vf uu, vv;
+        LoadLanes(p, i, &L);
+        WarpLanes(k, L, false, zoom_inv, v_load(&x[i]), v_load(&y[i]), v_load(&rad[i]), &uu, &vv);
+        v_store(&u[i], uu);
+        v_store(&v[i], vv);
+    }
+    if (i < count)
+    {
+        float pt[NUM_WARP_PARAMS][VW], xt[VW], yt[VW], rt[VW], ut[VW], vt[VW];
+        const float* pp[NUM_WARP_PARAMS];
+        int n = count - i;
+        for (int j=0; j<VW; j++)
+        {
+            int src = i + ((j < n) ? j : n-1);
+            xt[j] = x[src];
+            yt[j] = y[src];
+            rt[j] = rad[src];
+            for (int q=0; q<NUM_WARP_PARAMS; q++)
+                pt[q][j] = p[q][src];
+        }
+        for (int q=0; q<NUM_WARP_PARAMS; q++)
+            pp[q] = pt[q];
+        vf uu, vv;
+        LoadLanes(pp, 0, &L);
+        WarpLanes(k, L, false, zoom_inv, v_load(xt), v_load(yt), v_load(rt), &uu, &vv);
+        v_store(ut, uu);
+        v_store(vt, vv);
+        memcpy(&u[i], ut, n*sizeof(float));
+        memcpy(&v[i], vt, n*sizeof(float));
+    }
+    return true;
+}
@@ -0,0 +1,81 @@
+/*
+  LICENSE
+  -------
+Copyright 2005-2013 Nullsoft, Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, 
+are permitted provided that the following conditions are met:
+
+  * Redistributions of source code must retain the above copyright notice,
+    this list of conditions and the following disclaimer. 
+
+  * Redistributions in binary form must reproduce the above copyright notice,
+    this list of conditions and the following disclaimer in the documentation
+    and/or other materials provided with the distribution. 
+
+  * Neither the name of Nullsoft nor the names of its contributors may be used to 
+    endorse or promote products derived from this software without specific prior written permission. 
+ 
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR 
+IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND 
+FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR 
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT 
+OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef __NULLSOFT_DX9_EXAMPLE_PLUGIN_WARPMATH_H__
+#define __NULLSOFT_DX9_EXAMPLE_PLUGIN_WARPMATH_H__ 1
+
+// Vectorised version of the built-in per-vertex warp (zoom, zoomexp, rot, warp,
+//  cx/cy, dx/dy, sx/sy) that CPlugin::ComputeGridRows() applies to each mesh vertex.
+// sin/cos/log2/exp2 are polynomial approximations; over the ranges the warp uses,
+//  the resulting UVs stay within ~2e-6 of the powf/sinf/cosf version.
+
+typedef struct
+{
+    float zoom, zoomexp, rot, warp, cx, cy, dx, dy, sx, sy;
+} td_warpparams;    // the built-in per-vertex vars, as floats
+
+enum
+{
+    WARP_PARAM_ZOOM = 0,
+    WARP_PARAM_ZOOMEXP,
+    WARP_PARAM_ROT,
+    WARP_PARAM_WARP,
+    WARP_PARAM_CX,
+    WARP_PARAM_CY,
+    WARP_PARAM_DX,
+    WARP_PARAM_DY,
+    WARP_PARAM_SX,
+    WARP_PARAM_SY,
+    NUM_WARP_PARAMS
+};  // same order as td_warpparams
+
+typedef struct
+{
+    float aspect_x, aspect_y;           // m_fAspectX, m_fAspectY
+    float inv_aspect_x, inv_aspect_y;
+    float texel_offset_x, texel_offset_y;
+    // each of the 4 warp terms is sin(t + bx*x + by*y), with the time part reduced to [-pi..pi]
+    //  (the two cos() terms have their +pi/2 folded into t).
+    float warp_t[4], warp_bx[4], warp_by[4];
+} td_warpconsts;    // per-frame inputs; see InitWarpConsts()
+
+void InitWarpConsts(td_warpconsts* k, float fWarpTime, float fWarpScaleInv, const float f[4],
+                    float aspect_x, float aspect_y, float texel_offset_x, float texel_offset_y);
+
+// computes the warped UVs of 'count' verts at (x[i], y[i]), radius rad[i].
+// WarpVerts_Uniform() is for when the params are the same for every vert (no per-vertex code);
+//  WarpVerts_Varying() takes one array per param (indexed by WARP_PARAM_*).
+// Both return false (and write nothing) if zoom or zoomexp is <= 0 somewhere; powf() has
+//  to handle those, so the caller should fall back to the scalar code.
+bool WarpVerts_Uniform(const td_warpconsts* k, const td_warpparams* p, const float* x, const float* y, const float* rad,
+                       float* u, float* v, int count);
+bool WarpVerts_Varying(const td_warpconsts* k, const float* const p[NUM_WARP_PARAMS], const float* x, const float* y, const float* rad,
+                       float* u, float* v, int count);
+
+#endif
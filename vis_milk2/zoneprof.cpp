@@ -0,0 +1,290 @@
+/*
+  LICENSE
+  -------
+Copyright 2005-2013 Nullsoft, Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, 
+are permitted provided that the following conditions are met:
+
+  * Redistributions of source code must retain the above copyright notice,
+    this list of conditions and the following disclaimer. 
+
+  * Redistributions in binary form must reproduce the above copyright notice,
+    this list of conditions and the following disclaimer in the documentation
+    and/or other materials provided with the distribution. 
+
+  * Neither the name of Nullsoft nor the names of its contributors may be used to 
+    endorse or promote products derived from this software without specific prior written permission. 
+ 
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR 
+IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND 
+FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR 
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT 
+OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include "zoneprof.h"
+
+#ifdef ZONE_PROFILER
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+ZoneProfiler g_zoneprof;
+
+/*****************************************************************************/
+
+ZoneProfiler::ZoneProfiler()
+{
+    m_num_zones = 0;
+    m_frames = new td_frame[ZONEPROF_FRAMES];
+    m_labels = new td_label[ZONEPROF_MAX_LABELS];
+    Reset();
+}
+
+/*****************************************************************************/
+
+void ZoneProfiler::Reset()
+{
+    // (zone ids stay valid; they're cached in statics at each PROFILE_ZONE)
+    m_num_frames = 0;
+    m_cur = NULL;
+    m_depth = 0;
+    m_num_labels = 0;
+    m_cur_label = -1;
+    m_cur_label_w[0] = 0;
+    m_first_start = 0;
+}
+
+/*****************************************************************************/
+
+double ZoneProfiler::Now()
+{
+#ifdef _WIN32
+    static double scale;
+    LARGE_INTEGER t;
+    if (!scale)
+    {
+        LARGE_INTEGER f;
+        QueryPerformanceFrequency(&f);
+        scale = 1.0/(double)f.QuadPart;
+    }
+    QueryPerformanceCounter(&t);
+    return (double)t.QuadPart*scale;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + ts.tv_nsec*0.000000001;
+#endif
+}
+
+/*****************************************************************************/
+
+int ZoneProfiler::GetZoneId(const char *name)
+{
+    for (int i=0; i<m_num_zones; i++)
+        if (!strcmp(m_zone_name[i], name))
+            return i;
+    if (m_num_zones >= ZONEPROF_MAX_ZONES)
+        return -1;
+    m_zone_name[m_num_zones] = name;
+    return m_num_zones++;
+}
+
+/*****************************************************************************/
+
+void ZoneProfiler::BeginFrame()
+{
+    m_cur = &m_frames[m_num_frames % ZONEPROF_FRAMES];
+    m_cur->frame = m_num_frames;
+    m_cur->label = -1;
+    m_cur->start = Now();
+    m_cur->dur = 0;
+    m_cur->num_events = 0;
+    if (m_num_frames == 0)
+        m_first_start = m_cur->start;
+    m_depth = 0;
+}
+
+/*****************************************************************************/
+
+void ZoneProfiler::SetLabel(const wchar_t *label)
+{
+    if (!m_cur)
+        return;
+
+    // the label rarely changes, so only look it up (or add it) when it does
+    if (m_cur_label < 0 || wcsncmp(label, m_cur_label_w, ZONEPROF_LABEL_LEN-1))
+    {
+        wcsncpy(m_cur_label_w, label, ZONEPROF_LABEL_LEN-1);
+        m_cur_label_w[ZONEPROF_LABEL_LEN-1] = 0;
+
+        char name[ZONEPROF_LABEL_LEN] = {0};
+#ifdef _WIN32
+        WideCharToMultiByte(CP_UTF8, 0, m_cur_label_w, -1, name, ZONEPROF_LABEL_LEN-1, NULL, NULL);
+#else
+        wcstombs(name, m_cur_label_w, ZONEPROF_LABEL_LEN-1);
+#endif
+        m_cur_label = -1;
+        for (int i=0; i<m_num_labels; i++)
+            if (!strcmp(m_labels[i].name, name))
+                m_cur_label = i;
+        if (m_cur_label < 0 && m_num_labels < ZONEPROF_MAX_LABELS)
+        {
+            m_cur_label = m_num_labels++;
+            memset(&m_labels[m_cur_label], 0, sizeof(td_label));
+            strcpy(m_labels[m_cur_label].name, name);
+        }
+    }
+    m_cur->label = m_cur_label;
+}
+
+/*****************************************************************************/
+
+void ZoneProfiler::EndFrame()
+{
+    if (!m_cur)
+        return;
+    m_cur->dur = (float)(Now() - m_cur->start);
+
+    if (m_cur->label >= 0)
+    {
+        float frame_time[ZONEPROF_MAX_ZONES] = {0};
+        td_label* l = &m_labels[m_cur->label];
+        l->frames++;
+        l->frame_time += m_cur->dur;
+        for (int i=0; i<m_cur->num_events; i++)
+        {
+            const td_event* e = &m_cur->event[i];
+            l->calls[e->zone]++;
+            l->time[e->zone] += e->dur;
+            frame_time[e->zone] += e->dur;
+        }
+        for (int z=0; z<m_num_zones; z++)
+            if (frame_time[z] > l->worst[z])
+                l->worst[z] = frame_time[z];
+    }
+
+    m_num_frames++;
+    m_cur = NULL;
+}
+
+/*****************************************************************************/
+
+void ZoneProfiler::BeginZone()
+{
+    if (m_depth < (int)(sizeof(m_zone_start)/sizeof(m_zone_start[0])))
+        m_zone_start[m_depth] = Now();
+    m_depth++;
+}
+
+void ZoneProfiler::EndZone(int zone)
+{
+    m_depth--;
+    if (!m_cur || zone < 0 || m_depth >= (int)(sizeof(m_zone_start)/sizeof(m_zone_start[0])) ||
+        m_cur->num_events >= ZONEPROF_MAX_EVENTS)
+        return;
+    td_event* e = &m_cur->event[m_cur->num_events++];
+    e->start = m_zone_start[m_depth];
+    e->dur = (float)(Now() - e->start);
+    e->zone = (short)zone;
+    e->depth = (short)m_depth;
+}
+
+/*****************************************************************************/
+
+static void WriteJSONString(FILE* f, const char* s)
+{
+    fputc('"', f);
+    for (; *s; s++)
+    {
+        if (*s == '"' || *s == '\\')
+            fputc('\\', f);
+        if ((unsigned char)*s >= 32)
+            fputc(*s, f);
+    }
+    fputc('"', f);
+}
+
+bool ZoneProfiler::WriteTrace(const wchar_t *szFile) const
+{
+    FILE* f = _wfopen(szFile, L"w");
+    if (!f)
+        return false;
+
+    // one complete ("X") event per frame, and one per zone inside it; times in microseconds.
+    fprintf(f, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    fprintf(f, "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 1, \"args\": {\"name\": \"render\"}}");
+    int first = (m_num_frames > ZONEPROF_FRAMES) ? m_num_frames - ZONEPROF_FRAMES : 0;
+    for (int n=first; n<m_num_frames; n++)
+    {
+        const td_frame* fr = &m_frames[n % ZONEPROF_FRAMES];
+        fprintf(f, ",\n{\"name\": \"frame %d\", \"cat\": \"frame\", \"ph\": \"X\", \"pid\": 1, \"tid\": 1, \"ts\": %.1f, \"dur\": %.1f, \"args\": {\"preset\": ",
+                fr->frame, (fr->start - m_first_start)*1e6, fr->dur*1e6);
+        WriteJSONString(f, (fr->label >= 0) ? m_labels[fr->label].name : "");
+        fprintf(f, "}}");
+        for (int i=0; i<fr->num_events; i++)
+        {
+            const td_event* e = &fr->event[i];
+            fprintf(f, ",\n{\"name\": ");
+            WriteJSONString(f, m_zone_name[e->zone]);
+            fprintf(f, ", \"cat\": \"zone\", \"ph\": \"X\", \"pid\": 1, \"tid\": 1, \"ts\": %.1f, \"dur\": %.1f}",
+                    (e->start - m_first_start)*1e6, e->dur*1e6);
+        }
+    }
+    fprintf(f, "\n]}\n");
+
+    fclose(f);
+    return true;
+}
+
+/*****************************************************************************/
+
+bool ZoneProfiler::WriteByLabel(const wchar_t *szFile) const
+{
+    FILE* f = _wfopen(szFile, L"w");
+    if (!f)
+        return false;
+
+    // csv: one row per (label, zone), with the whole frame as zone "(frame)"
+    fprintf(f, "preset,zone,frames,calls,avg_ms_per_frame,worst_ms_per_frame\n");
+    for (int i=0; i<m_num_labels; i++)
+    {
+        const td_label* l = &m_labels[i];
+        if (l->frames == 0)
+            continue;
+
+        char name[ZONEPROF_LABEL_LEN*2+2] = {0};
+        int len = 0;
+        name[len++] = '"';
+        for (const char* s = l->name; *s; s++)
+        {
+            if (*s == '"')
+                name[len++] = '"';
+            name[len++] = *s;
+        }
+        name[len++] = '"';
+
+        fprintf(f, "%s,(frame),%d,%d,%.4f,\n", name, l->frames, l->frames, l->frame_time*1000.0/l->frames);
+        for (int z=0; z<m_num_zones; z++)
+            if (l->calls[z] > 0)
+                fprintf(f, "%s,%s,%d,%d,%.4f,%.4f\n", name, m_zone_name[z], l->frames, l->calls[z],
+                        l->time[z]*1000.0/l->frames, l->worst[z]*1000.0);
+    }
+
+    fclose(f);
+    return true;
+}
+
+#endif
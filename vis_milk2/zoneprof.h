@@ -0,0 +1,146 @@
+/*
+  LICENSE
+  -------
+Copyright 2005-2013 Nullsoft, Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, 
+are permitted provided that the following conditions are met:
+
+  * Redistributions of source code must retain the above copyright notice,
+    this list of conditions and the following disclaimer. 
+
+  * Redistributions in binary form must reproduce the above copyright notice,
+    this list of conditions and the following disclaimer in the documentation
+    and/or other materials provided with the distribution. 
+
+  * Neither the name of Nullsoft nor the names of its contributors may be used to 
+    endorse or promote products derived from this software without specific prior written permission. 
+ 
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR 
+IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND 
+FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR 
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT 
+OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#ifndef __NULLSOFT_DX9_PLUGIN_SHELL_ZONEPROF_H__
+#define __NULLSOFT_DX9_PLUGIN_SHELL_ZONEPROF_H__ 1
+
+// a scoped-zone cpu profiler for the render thread.  it's only compiled in when
+// ZONE_PROFILER is defined (in the project's preprocessor definitions, like
+// LEGACY_DESKTOP_MODE); otherwise the macros below compile to nothing.
+//
+//   PROFILE_FRAME_BEGIN();            // start of a frame
+//   PROFILE_FRAME_LABEL(szPreset);    // what the frame's stats are grouped by (the preset)
+//   { PROFILE_ZONE("DrawWave"); ... } // times the rest of the enclosing scope
+//   PROFILE_FRAME_END();
+//
+// the last ZONEPROF_FRAMES frames are kept for WriteTrace() (chrome://tracing or
+// Perfetto 'trace event' json), and every frame is added to per-label totals for WriteByLabel().
+
+#ifdef ZONE_PROFILER
+
+#include <wchar.h>
+
+#define ZONEPROF_MAX_ZONES    48
+#define ZONEPROF_MAX_EVENTS   128   // per frame
+#define ZONEPROF_FRAMES       600
+#define ZONEPROF_MAX_LABELS   256
+#define ZONEPROF_LABEL_LEN    128   // utf-8 bytes
+
+class ZoneProfiler
+{
+public:
+    ZoneProfiler();
+    void Reset();
+
+    int  GetZoneId(const char *name);       // name must be a string literal (it isn't copied)
+    void BeginFrame();
+    void SetLabel(const wchar_t *label);
+    void EndFrame();
+    void BeginZone();
+    void EndZone(int zone);
+
+    bool WriteTrace(const wchar_t *szFile) const;
+    bool WriteByLabel(const wchar_t *szFile) const;
+
+private:
+    typedef struct
+    {
+        double start;                       // seconds
+        float  dur;
+        short  zone;
+        short  depth;
+    } td_event;
+
+    typedef struct
+    {
+        int      frame;
+        int      label;
+        double   start;
+        float    dur;
+        int      num_events;
+        td_event event[ZONEPROF_MAX_EVENTS];
+    } td_frame;
+
+    typedef struct
+    {
+        char   name[ZONEPROF_LABEL_LEN];
+        int    frames;
+        double frame_time;
+        int    calls[ZONEPROF_MAX_ZONES];
+        double time[ZONEPROF_MAX_ZONES];
+        float  worst[ZONEPROF_MAX_ZONES];   // in a single frame
+    } td_label;
+
+    static double Now();
+
+    const char* m_zone_name[ZONEPROF_MAX_ZONES];
+    int         m_num_zones;
+    td_frame*   m_frames;                   // ring of ZONEPROF_FRAMES
+    int         m_num_frames;               // # recorded so far
+    td_frame*   m_cur;                      // NULL between frames
+    double      m_zone_start[16];           // stack of open zones
+    int         m_depth;
+    td_label*   m_labels;
+    int         m_num_labels;
+    int         m_cur_label;                // -1 if none
+    wchar_t     m_cur_label_w[ZONEPROF_LABEL_LEN];
+    double      m_first_start;
+};
+
+extern ZoneProfiler g_zoneprof;
+
+class ZoneScope
+{
+public:
+    ZoneScope(int zone) : m_zone(zone) { g_zoneprof.BeginZone(); }
+    ~ZoneScope() { g_zoneprof.EndZone(m_zone); }
+private:
+    int m_zone;
+};
+
+#define PROFILE_ZONE_CAT2(a,b) a##b
+#define PROFILE_ZONE_CAT(a,b)  PROFILE_ZONE_CAT2(a,b)
+#define PROFILE_ZONE(name) \
+    static const int PROFILE_ZONE_CAT(_zone_id_,__LINE__) = g_zoneprof.GetZoneId(name); \
+    ZoneScope PROFILE_ZONE_CAT(_zone_,__LINE__)(PROFILE_ZONE_CAT(_zone_id_,__LINE__))
+#define PROFILE_FRAME_BEGIN()       g_zoneprof.BeginFrame()
+#define PROFILE_FRAME_LABEL(label)  g_zoneprof.SetLabel(label)
+#define PROFILE_FRAME_END()         g_zoneprof.EndFrame()
+
+#else
+
+#define PROFILE_ZONE(name)
+#define PROFILE_FRAME_BEGIN()
+#define PROFILE_FRAME_LABEL(label)
+#define PROFILE_FRAME_END()
+
+#endif
+
+#endif